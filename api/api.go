@@ -1,16 +1,43 @@
 package api
 
 /*
-#cgo LDFLAGS: -lavformat -lavcodec -lswscale -lavutil -pthread
+#cgo LDFLAGS: -lavformat -lavcodec -lswscale -lswresample -lavutil -pthread
 #include <string.h>
 #include "./stream/cgompeg.h"
+#include "./../core/report.c"
+#include "./../core/probe.c"
+#include "./../core/mapped.c"
+#include "./../core/executor.c"
+#include "./stream/read_pipe.c"
+#include "./stream/ingest.c"
+#include "./stream/sink.c"
+#include "./stream/uring.c"
 #include "./stream/cgompeg.c"
+#include "./stream/plan.c"
+#include "./stream/thumbs.c"
+#include "./stream/abr.c"
+#include "./stream/gop.c"
+#include "./stream/llhls.c"
+#include "./stream/live.c"
+
+extern int goHlsSink(uintptr_t handle, char *name, uint8_t *data, int size);
+extern void goJobProgress(uintptr_t handle, int64_t position, int64_t duration);
+extern void goSegmentLatency(uintptr_t handle, int64_t latency);
+extern void goJobLog(uintptr_t handle, int level, char *line);
 */
 import "C"
 import (
+	"crypto/rand"
+	"encoding/hex"
 	"io"
 	"net/http"
 	"os"
+	"path/filepath"
+	"runtime"
+	"runtime/cgo"
+	"strconv"
+	"time"
+	"unsafe"
 
 	"github.com/labstack/echo/v4"
 	"github.com/labstack/echo/v4/middleware"
@@ -27,10 +54,128 @@ type Metadata struct {
 	Resolution [32]byte  // Video resolution string
 }
 
+// conversions bounds the number of C conversions running at once
+var conversions *WorkerPool
+
+// newJobID returns a random identifier used to name the job directories
+func newJobID() (string, error) {
+	b := make([]byte, 8)
+	if _, err := rand.Read(b); err != nil {
+		return "", err
+	}
+	return hex.EncodeToString(b), nil
+}
+
+// copyCString copies s into a fixed size C char array, always NUL terminating it
+func copyCString(dst []C.char, s string) {
+	n := copy(unsafe.Slice((*byte)(unsafe.Pointer(&dst[0])), len(dst)-1), s)
+	dst[n] = 0
+}
+
+// probeCacheDir keeps the probe results of every source seen so far,
+// shared by all jobs
+const probeCacheDir = "cache/probe"
+
+// newJobConfig gives the job its own working and output directories and
+// its probe budget, zero values keep the FFmpeg defaults
+func newJobConfig(jobID string, segments C.int, probeSize, analyzeDuration int64) C.JobConfig {
+	var cfg C.JobConfig
+	{
+		copyCString(cfg.JobID[:], jobID)
+		copyCString(cfg.WorkDir[:], filepath.Join("tmp", jobID))
+		copyCString(cfg.OutputDir[:], filepath.Join("outputs", jobID))
+		copyCString(cfg.Probe.CacheDir[:], probeCacheDir)
+
+		cfg.SegmentFormat = segments
+
+		cfg.Probe.ProbeSize = C.int64_t(probeSize)
+		cfg.Probe.AnalyzeDuration = C.int64_t(analyzeDuration)
+	}
+	return cfg
+}
+
+// segmentFormats maps the segments query parameter to the C SegmentFormat
+var segmentFormats = map[string]C.int{
+	"ts":    C.SEGMENT_TS,
+	"fmp4":  C.SEGMENT_FMP4,
+	"llhls": C.SEGMENT_LL_HLS,
+}
+
+// ioBackends maps the io query parameter to the C IoBackend
+var ioBackends = map[string]C.int{
+	"posix": C.IO_BACKEND_POSIX,
+	"uring": C.IO_BACKEND_URING,
+	"mmap":  C.IO_BACKEND_MMAP,
+}
+
+// queryInt64 returns the non negative integer query parameter name, 0 when it is missing or invalid
+func queryInt64(c echo.Context, name string) int64 {
+	v, err := strconv.ParseInt(c.QueryParam(name), 10, 64)
+	if err != nil || v < 0 {
+		return 0
+	}
+	return v
+}
+
+// newJobStats copies the report the C job filled in
+func newJobStats(report C.JobReport, mode string, result int) jobStats {
+	stats := jobStats{
+		Mode:         mode,
+		Result:       "success",
+		CacheHit:     report.CacheHit != 0,
+		FirstSegment: time.Duration(report.FirstSegmentMicros) * time.Microsecond,
+		BytesIn:      int64(report.BytesIn),
+		BytesOut:     int64(report.BytesOut),
+		Packets:      int64(report.Packets),
+		Segments:     int64(report.Segments),
+	}
+
+	if result != 0 {
+		stats.Result = "error"
+	}
+
+	for i := range stats.Stages {
+		stats.Stages[i] = stageTime{
+			Wall: time.Duration(report.Stages[i].WallMicros) * time.Microsecond,
+			CPU:  time.Duration(report.Stages[i].CpuMicros) * time.Microsecond,
+		}
+	}
+
+	return stats
+}
+
+// startupFields reports how long the job took to produce output, in milliseconds
+func startupFields(stats jobStats) map[string]string {
+	fields := map[string]string{
+		"probe_ms":    strconv.FormatFloat(float64(stats.Stages[C.JOB_STAGE_PROBE].Wall.Microseconds())/1000, 'f', 1, 64),
+		"probe_cache": "miss",
+	}
+
+	if stats.CacheHit {
+		fields["probe_cache"] = "hit"
+	}
+
+	if stats.FirstSegment >= 0 {
+		fields["time_to_first_segment_ms"] = strconv.FormatFloat(float64(stats.FirstSegment.Microseconds())/1000, 'f', 1, 64)
+	}
+
+	return fields
+}
+
 // NewServer creates and configures the Echo server
 func NewServer() *echo.Echo {
 	e := echo.New()
 
+	// One native thread per core, with a queue of the same size in front of them
+	if conversions == nil {
+		pool, err := NewWorkerPool(runtime.NumCPU(), runtime.NumCPU())
+		if err != nil {
+			panic(err)
+		}
+
+		conversions = pool
+	}
+
 	// Middleware
 	e.Use(middleware.Logger())
 	e.Use(middleware.Recover())
@@ -38,23 +183,269 @@ func NewServer() *echo.Echo {
 
 	// Routes
 	e.POST("/upload", handleUpload)
+	e.OPTIONS("/uploads", handleUploadOptions)
+	e.POST("/uploads", handleCreateUpload)
+	e.HEAD("/uploads/:id", handleUploadOffset)
+	e.PATCH("/uploads/:id", handleUploadChunk)
+	e.DELETE("/uploads/:id", handleDeleteUpload)
+	e.POST("/live", handleStartLive)
+	e.POST("/live/:id/stream", handleLivePush)
+	e.DELETE("/live/:id", handleStopLive)
+	e.GET("/jobs/:id", handleJob)
+	e.GET("/jobs/:id/events", handleJobEvents)
+	e.GET("/hls/:job/:file", handleMemoryOutput)
+	e.GET("/metrics", handleMetrics)
 	e.GET("/swagger/*", echoSwagger.WrapHandler)
 
 	return e
 }
 
-// handleUpload handles the file upload and HLS conversion
+// conversion holds the options of a conversion, read from the query of
+// /upload and /uploads
+type conversion struct {
+	mode            string // copy, abr or transcode
+	spool           bool
+	memory          bool
+	segments        C.int
+	probeSize       int64
+	analyzeDuration int64
+	playlist        string
+	dedupe          bool  // the job id is the content address of the upload, see dedupe.go
+	io              C.int // IoBackend of the job
+	thumbnails      int   // seconds between scrub thumbnails, none when zero
+}
+
+// parseConversion reads the conversion options of the request, the
+// message is set when they are invalid
+func parseConversion(c echo.Context) (conversion, string) {
+	cv := conversion{
+		mode:            c.QueryParam("mode"),
+		spool:           c.QueryParam("ingest") == "spool",
+		memory:          c.QueryParam("output") == "memory",
+		probeSize:       queryInt64(c, "probesize"),
+		analyzeDuration: queryInt64(c, "analyzeduration"),
+		thumbnails:      int(queryInt64(c, "thumbnails")),
+		playlist:        "output.m3u8",
+	}
+
+	if cv.mode != "abr" && cv.mode != "transcode" {
+		cv.mode = "copy"
+	}
+
+	if cv.mode == "abr" {
+		cv.playlist = "master.m3u8"
+	}
+
+	segments, ok := segmentFormats[c.QueryParam("segments")]
+	{
+		if !ok && c.QueryParam("segments") != "" {
+			return cv, "Unknown segments format"
+		}
+
+		cv.segments = segments
+	}
+
+	// local input files are mapped unless the upload asks for another backend
+	backend := c.QueryParam("io")
+	if backend == "" {
+		backend = "mmap"
+	}
+
+	io, ok := ioBackends[backend]
+	{
+		if !ok {
+			return cv, "Unknown io backend"
+		}
+
+		cv.io = io
+	}
+
+	if cv.memory && (cv.mode != "copy" || cv.segments == C.SEGMENT_LL_HLS) {
+		return cv, "In-memory output needs copy mode with ts or fmp4 segments"
+	}
+
+	if cv.thumbnails > 0 && (cv.mode != "copy" || cv.memory || cv.segments == C.SEGMENT_LL_HLS) {
+		return cv, "Thumbnails need copy mode with ts or fmp4 segments written to disk"
+	}
+
+	return cv, ""
+}
+
+// start queues the conversion of job, a registered queued job, from what
+// is written into the pipe rPipe reads from and closes rPipe once the
+// conversion is over. incomplete, when not nil, is asked afterwards whether
+// the input was cut short, the job fails with its error then. it returns
+// the ErrQueueFull of Submit when every worker is busy and the queue is full
+func (cv conversion) start(job *Job, rPipe *os.File, incomplete func() error) error {
+
+	fd := C.int(rPipe.Fd())
+	jobID := job.ID()
+
+	// the C job reports its progress and, in memory mode, hands its files over through these
+	progress := cgo.NewHandle(job)
+
+	var sink cgo.Handle
+	if cv.memory {
+		sink = cgo.NewHandle(memoryOutputs.Sink(jobID))
+	}
+
+	release := func() {
+		rPipe.Close()
+		progress.Delete()
+
+		if cv.memory {
+			sink.Delete()
+		}
+	}
+
+	// the C thread keeps using the task after Submit returned, so it lives in C memory
+	task := (*C.UploadTask)(C.calloc(1, C.sizeof_UploadTask))
+	{
+		task.Task.Func = C.TaskFunc(C.run_upload_task)
+		task.Fd = fd
+		task.Job = newJobConfig(jobID, cv.segments, cv.probeSize, cv.analyzeDuration)
+
+		switch {
+		case cv.mode == "abr":
+			task.Kind = C.UPLOAD_ABR
+		case cv.mode == "transcode":
+			task.Kind = C.UPLOAD_TRANSCODE
+		case cv.spool:
+			task.Kind = C.UPLOAD_SPOOL
+		default:
+			task.Kind = C.UPLOAD_STREAM
+		}
+
+		cfg := &task.Job
+
+		cfg.IoBackend = cv.io
+		cfg.Thumbnails = C.int(cv.thumbnails)
+		cfg.Report.Progress = C.ProgressFunc(C.goJobProgress)
+		cfg.Report.ProgressHandle = C.uintptr_t(progress)
+		cfg.Log.Func = C.LogFunc(C.goJobLog)
+		cfg.Log.Handle = C.uintptr_t(progress)
+
+		if cv.memory {
+			cfg.Sink.Func = C.HlsSinkFunc(C.goHlsSink)
+			cfg.Sink.Handle = C.uintptr_t(sink)
+		}
+	}
+
+	// Process the data in C on one of the pool threads
+	done, err := conversions.Submit(unsafe.Pointer(task), job.start)
+	{
+		if err != nil {
+			C.free(unsafe.Pointer(task))
+			release()
+
+			// uploads that joined it see the failure, the next one claims the id again
+			job.fail("Conversion queue is full")
+			jobs.Remove(jobID)
+			metrics.RecordRejected(cv.mode)
+			return err
+		}
+	}
+
+	// the request does not wait for the conversion, the job keeps its result
+	go func() {
+		result := <-done
+		report := task.Job.Report
+
+		C.free(unsafe.Pointer(task))
+		release()
+
+		stats := newJobStats(report, cv.mode, result)
+		metrics.Record(stats)
+
+		failure := "Failed to process video"
+		if incomplete != nil {
+			if err := incomplete(); err != nil {
+				result, failure = 1, err.Error()
+			}
+		}
+
+		if result != 0 {
+			if cv.memory {
+				memoryOutputs.Drop(jobID)
+			}
+
+			job.fail(failure)
+			return
+		}
+
+		response := startupFields(stats)
+		{
+			response["playlist"] = filepath.Join("outputs", jobID, cv.playlist)
+
+			if cv.memory {
+				response["playlist"] = "/hls/" + jobID + "/" + cv.playlist
+			}
+		}
+
+		if cv.dedupe && !cv.memory {
+			markConverted(jobID)
+		}
+
+		job.finish(response)
+	}()
+
+	return nil
+}
+
+// queueFull answers 503 when a conversion could not be queued
+func queueFull(c echo.Context) error {
+	c.Response().Header().Set("Retry-After", "5")
+	return c.JSON(http.StatusServiceUnavailable, map[string]string{
+		"error": "Conversion queue is full, try again later",
+	})
+}
+
+// queuedResponse is the body of a queued conversion, it tells where to follow the job
+func queuedResponse(jobID string) map[string]string {
+	return map[string]string{
+		"status":     jobQueued,
+		"job_id":     jobID,
+		"status_url": "/jobs/" + jobID,
+		"events_url": "/jobs/" + jobID + "/events",
+	}
+}
+
+// handleUpload starts the HLS conversion of an uploaded file
 // @Summary Upload video file for HLS conversion
-// @Description Upload a video file to convert it to HLS format
+// @Description Upload a video file to convert it to HLS format. The conversion runs in the background: the response carries the job id, poll /jobs/{job_id} or follow /jobs/{job_id}/events for progress and the result
 // @Accept multipart/form-data
 // @Produce json
 // @Param file formData file true "Video file to convert"
-// @Success 200 {object} map[string]string "Successfully converted to HLS"
+// @Param mode query string false "Conversion mode: copy (default) keeps the source bitrate, abr encodes a 1080p/720p/480p/360p ladder with master.m3u8, transcode re-encodes to H.264 with keyframe chunks spread over all cores"
+// @Param ingest query string false "Ingest mode: stream (default) demuxes from the pipe, spool writes tmp/temp.mp4 first"
+// @Param segments query string false "Segment container: ts (default), fmp4 (CMAF with init.mp4) or llhls (fmp4 with parts: partial segments as byte ranges, polled without blocking reloads, copy mode only)"
+// @Param probesize query int false "Bytes read while probing the input, FFmpeg default when missing"
+// @Param analyzeduration query int false "Microseconds of media analyzed while probing, FFmpeg default when missing"
+// @Param output query string false "Output: disk (default) writes outputs/{job_id}, memory keeps the playlist and segments in memory and serves them from /hls/{job_id}/{file} (copy mode with ts or fmp4 segments only)"
+// @Param io query string false "I/O backend of the spooled input and copy mode files: mmap (default, the input is read from a memory mapping), posix or uring (io_uring read-ahead and queued segment writes, posix where the kernel has no io_uring)"
+// @Param thumbnails query int false "Seconds between scrub thumbnails: the keyframes are decoded during the copy into thumbs_N.jpg sprite sheets listed by thumbnails.vtt next to the playlist (copy mode with ts or fmp4 segments on disk only), none when missing"
+// @Param wait query bool false "Wait for the conversion and answer with its result, like before jobs were asynchronous"
+// @Param dedupe query bool false "Reuse the output of an identical upload converted with the same options, or join its running conversion (default true)"
+// @Success 200 {object} map[string]string "Successfully converted to HLS (wait=true, or an identical upload was already converted)"
+// @Success 202 {object} map[string]string "Conversion queued"
 // @Failure 400 {object} map[string]string "Bad request"
 // @Failure 500 {object} map[string]string "Internal server error"
+// @Failure 503 {object} map[string]string "Conversion queue is full"
 // @Router /upload [post]
 func handleUpload(c echo.Context) error {
 
+	cv, invalid := parseConversion(c)
+	{
+		if invalid != "" {
+			return c.JSON(http.StatusBadRequest, map[string]string{
+				"error": invalid,
+			})
+		}
+	}
+
+	wait, _ := strconv.ParseBool(c.QueryParam("wait"))
+	cv.dedupe = c.QueryParam("dedupe") != "false"
+
 	file, err := c.FormFile("file")
 	{
 		if err != nil {
@@ -64,7 +455,7 @@ func handleUpload(c echo.Context) error {
 		}
 	}
 
-	// Open the uploaded file
+	// Open the uploaded file, it is read after this handler returned
 	src, err := file.Open()
 	{
 		if err != nil {
@@ -72,62 +463,103 @@ func handleUpload(c echo.Context) error {
 				"error": "Failed to open uploaded file",
 			})
 		}
+	}
 
-		defer src.Close()
+	var job *Job
+	{
+		if cv.dedupe {
+			var created bool
+			job, created, err = claimUpload(src, cv)
+
+			// an identical upload was converted or is being converted, this one joins it
+			if err == nil && !created {
+				src.Close()
+				metrics.RecordDeduplicated(cv.mode)
+				return respondJob(c, job, wait, true)
+			}
+		} else {
+			var jobID string
+			if jobID, err = newJobID(); err == nil {
+				job = jobs.Add(jobID, cv.mode)
+			}
+		}
+
+		if err != nil {
+			src.Close()
+			return c.JSON(http.StatusInternalServerError, map[string]string{
+				"error": "Failed to create job",
+			})
+		}
 	}
 
 	// Create pipe for communication with C code
 	rPipe, wPipe, err := os.Pipe()
 	{
 		if err != nil {
+			src.Close()
+			jobs.Remove(job.ID())
 			return c.JSON(http.StatusInternalServerError, map[string]string{
 				"error": "Failed to create pipe",
 			})
 		}
 	}
 
-	// var metadata Metadata
-	// {
-	// 	metadata.FileSize = file.Size
-	// 	copy(metadata.MimeType[:], file.Header.Get("Content-Type"))
-	// 	copy(metadata.Extension[:], filepath.Ext(file.Filename))
-	// 	copy(metadata.Resolution[:], file.Header.Get("Content-Resolution"))
-	// }
-
-	// cMetadata := C.MetaData{}
-	// {
-	// 	// Replace the direct copy with unsafe pointer copy
-	// 	C.memcpy(unsafe.Pointer(&cMetadata.FileSize), unsafe.Pointer(&metadata.FileSize), 8)
-	// 	C.memcpy(unsafe.Pointer(&cMetadata.MimeType[0]), unsafe.Pointer(&metadata.MimeType[0]), 128)
-	// 	C.memcpy(unsafe.Pointer(&cMetadata.Extension[0]), unsafe.Pointer(&metadata.Extension[0]), 16)
-	// 	C.memcpy(unsafe.Pointer(&cMetadata.Resolution[0]), unsafe.Pointer(&metadata.Resolution[0]), 32)
-	// }
-
 	go func() {
+		// Closing the write end signals EOF to the demuxer; if C bails out
+		// early closing rPipe unblocks this copy with EPIPE.
+		defer wPipe.Close()
+		defer src.Close()
 
 		if _, err := io.Copy(wPipe, src); err != nil {
 			return
 		}
-		wPipe.Close()
 	}()
 
-	// Process the data in C
-	result := C.read_pipe(C.int(rPipe.Fd()), &C.MetaData{})
-	{
-		if int(result) != 0 {
-			return c.JSON(http.StatusInternalServerError, map[string]string{
-				"error": "Failed to process video",
-			})
+	if err := cv.start(job, rPipe, nil); err != nil {
+		return queueFull(c)
+	}
+
+	return respondJob(c, job, wait, false)
+}
+
+// respondJob answers an upload with its job: the result once it is
+// finished when wait is set or it already is, the queued response
+// otherwise. deduplicated marks a job another upload started
+func respondJob(c echo.Context, job *Job, wait, deduplicated bool) error {
+
+	if !wait && !job.Status().finished() {
+		response := queuedResponse(job.ID())
+		if deduplicated {
+			response["deduplicated"] = "true"
 		}
+
+		return c.JSON(http.StatusAccepted, response)
 	}
 
-	// Close read pipe after successful processing
-	defer rPipe.Close()
+	<-job.Done()
+
+	status := job.Status()
+	if status.State == jobFailed {
+		return c.JSON(http.StatusInternalServerError, map[string]string{
+			"error":  status.Error,
+			"job_id": job.ID(),
+		})
+	}
 
-	return c.JSON(http.StatusOK, map[string]string{
+	response := map[string]string{
 		"message": "Video successfully converted to HLS",
 		"status":  "success",
-	})
+		"job_id":  job.ID(),
+	}
+	for k, v := range status.Result {
+		response[k] = v
+	}
+
+	if deduplicated {
+		response["deduplicated"] = "true"
+	}
+
+	return c.JSON(http.StatusOK, response)
 }
 
 // StartServer starts the HTTP server
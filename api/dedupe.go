@@ -0,0 +1,86 @@
+package api
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+)
+
+// convertedMarker is written next to the playlist of a content addressed
+// job once it succeeded, so the output is reused after a restart too. the
+// playlist alone does not tell, it is rewritten while the job runs
+const convertedMarker = ".converted"
+
+// uploadKey returns the content address of an upload converted with cv:
+// the sha256 of its bytes and of the options that shape the output,
+// src is rewound afterwards
+func uploadKey(src io.ReadSeeker, cv conversion) (string, error) {
+	h := sha256.New()
+
+	if _, err := io.Copy(h, src); err != nil {
+		return "", err
+	}
+
+	if _, err := src.Seek(0, io.SeekStart); err != nil {
+		return "", err
+	}
+
+	// ingest=spool only changes how the bytes reach the demuxer, not the output
+	fmt.Fprintf(h, "\x00%s/%d/%t/%d/%d/%d", cv.mode, cv.segments, cv.memory, cv.probeSize, cv.analyzeDuration, cv.thumbnails)
+
+	return hex.EncodeToString(h.Sum(nil)[:16]), nil
+}
+
+// claimUpload returns the job of the upload in src: the job of an identical
+// upload when one is running or its output is still there, a new queued
+// job under the content address otherwise. created tells which.
+// the upload was already buffered by the multipart parser, so hashing it
+// first costs one read of a local file and saves the whole conversion
+func claimUpload(src io.ReadSeeker, cv conversion) (job *Job, created bool, err error) {
+	key, err := uploadKey(src, cv)
+	if err != nil {
+		return nil, false, err
+	}
+
+	job, created = jobs.Claim(key, cv.mode, func(job *Job) bool {
+		status := job.Status()
+
+		switch {
+		case status.State == jobFailed:
+			return false
+		case status.State == jobDone && cv.memory:
+			_, ok := memoryOutputs.Get(key, cv.playlist)
+			return ok
+		default:
+			return true
+		}
+	})
+
+	// finished before the job was forgotten or the server restarted
+	if created && !cv.memory && converted(key, cv.playlist) {
+		job.finish(map[string]string{
+			"playlist": filepath.Join("outputs", key, cv.playlist),
+		})
+		return job, false, nil
+	}
+
+	return job, created, nil
+}
+
+// converted tells whether outputs/jobID holds the finished output of a content addressed job
+func converted(jobID, playlist string) bool {
+	for _, name := range []string{convertedMarker, playlist} {
+		if _, err := os.Stat(filepath.Join("outputs", jobID, name)); err != nil {
+			return false
+		}
+	}
+	return true
+}
+
+// markConverted records that outputs/jobID is complete, see convertedMarker
+func markConverted(jobID string) {
+	os.WriteFile(filepath.Join("outputs", jobID, convertedMarker), nil, 0644)
+}
@@ -0,0 +1,328 @@
+package api
+
+import (
+	"encoding/json"
+	"fmt"
+	"net/http"
+	"sync"
+	"time"
+
+	"github.com/labstack/echo/v4"
+)
+
+// states of a conversion as reported by /jobs
+const (
+	jobQueued  = "queued"
+	jobRunning = "running"
+	jobDone    = "done"
+	jobFailed  = "failed"
+)
+
+// jobRetention is how long a finished job stays queryable
+const jobRetention = time.Hour
+
+// JobStatus is the state of a conversion as served by /jobs
+type JobStatus struct {
+	ID         string            `json:"job_id"`
+	Mode       string            `json:"mode"`
+	State      string            `json:"state"`
+	Progress   float64           `json:"progress"`              // 0 to 1, -1 while the input duration is unknown
+	PositionMs int64             `json:"position_ms"`           // media converted so far
+	DurationMs int64             `json:"duration_ms,omitempty"` // input duration, 0 when unknown
+	LatencyMs  int64             `json:"latency_ms,omitempty"`  // live jobs: ingest to playlist latency of the last segment
+	Result     map[string]string `json:"result,omitempty"`      // the conversion response once done
+	Error      string            `json:"error,omitempty"`
+	LastLog    string            `json:"last_log,omitempty"` // last error FFmpeg logged for the job
+}
+
+// finished tells whether the job reached a final state
+func (s JobStatus) finished() bool {
+	return s.State == jobDone || s.State == jobFailed
+}
+
+// Job tracks one conversion from upload to result
+type Job struct {
+	mu          sync.Mutex
+	status      JobStatus
+	finishedAt  time.Time
+	done        chan struct{}
+	subscribers map[chan JobStatus]struct{}
+}
+
+// ID returns the job id, it never changes
+func (j *Job) ID() string {
+	return j.status.ID
+}
+
+// Status returns a snapshot of the job
+func (j *Job) Status() JobStatus {
+	j.mu.Lock()
+	defer j.mu.Unlock()
+
+	return j.status
+}
+
+// Done is closed once the job is done or failed
+func (j *Job) Done() <-chan struct{} {
+	return j.done
+}
+
+// Subscribe returns a channel that receives the current status and then
+// every change, intermediate updates are dropped for slow readers
+func (j *Job) Subscribe() (<-chan JobStatus, func()) {
+	updates := make(chan JobStatus, 1)
+
+	j.mu.Lock()
+	updates <- j.status
+	j.subscribers[updates] = struct{}{}
+	j.mu.Unlock()
+
+	cancel := func() {
+		j.mu.Lock()
+		delete(j.subscribers, updates)
+		j.mu.Unlock()
+	}
+
+	return updates, cancel
+}
+
+// update changes the status under the lock and publishes the new one
+func (j *Job) update(change func(status *JobStatus)) {
+	j.mu.Lock()
+	defer j.mu.Unlock()
+
+	if j.status.finished() {
+		return
+	}
+
+	change(&j.status)
+
+	// replace the update a subscriber has not read yet
+	for updates := range j.subscribers {
+		select {
+		case <-updates:
+		default:
+		}
+
+		select {
+		case updates <- j.status:
+		default:
+		}
+	}
+
+	if j.status.finished() {
+		j.finishedAt = time.Now()
+		close(j.done)
+	}
+}
+
+// start marks the job as picked up by a worker
+func (j *Job) start() {
+	j.update(func(status *JobStatus) {
+		status.State = jobRunning
+	})
+}
+
+// setProgress is called from the C job through goJobProgress
+func (j *Job) setProgress(position, duration time.Duration) {
+	j.update(func(status *JobStatus) {
+		status.PositionMs = position.Milliseconds()
+		status.Progress = -1
+
+		if duration > 0 {
+			status.DurationMs = duration.Milliseconds()
+			status.Progress = min(float64(position)/float64(duration), 1)
+		}
+	})
+}
+
+// setLatency is called from a live job through goSegmentLatency
+func (j *Job) setLatency(latency time.Duration) {
+	j.update(func(status *JobStatus) {
+		status.LatencyMs = latency.Milliseconds()
+	})
+}
+
+// setLog is called from the C job through goJobLog
+func (j *Job) setLog(line string) {
+	j.update(func(status *JobStatus) {
+		status.LastLog = line
+	})
+}
+
+// finish stores the response of a successful conversion
+func (j *Job) finish(result map[string]string) {
+	j.update(func(status *JobStatus) {
+		status.State = jobDone
+		status.Progress = 1
+		status.Result = result
+	})
+}
+
+// fail stores why the conversion failed
+func (j *Job) fail(err string) {
+	j.update(func(status *JobStatus) {
+		status.State = jobFailed
+		status.Error = err
+	})
+}
+
+// JobRegistry holds the queued, running and recently finished jobs
+type JobRegistry struct {
+	mu   sync.Mutex
+	jobs map[string]*Job
+}
+
+// NewJobRegistry returns an empty registry
+func NewJobRegistry() *JobRegistry {
+	return &JobRegistry{
+		jobs: make(map[string]*Job),
+	}
+}
+
+// jobs are the conversions started by /upload
+var jobs = NewJobRegistry()
+
+func newJob(id, mode string) *Job {
+	return &Job{
+		status:      JobStatus{ID: id, Mode: mode, State: jobQueued},
+		done:        make(chan struct{}),
+		subscribers: make(map[chan JobStatus]struct{}),
+	}
+}
+
+// Add registers a queued job, jobs finished longer than jobRetention ago are forgotten
+func (r *JobRegistry) Add(id, mode string) *Job {
+	job := newJob(id, mode)
+
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	r.expire()
+	r.jobs[id] = job
+
+	return job
+}
+
+// Claim returns the job id when reuse accepts it, otherwise it registers a
+// new queued job under id; created tells which. Concurrent claims of the
+// same id get the same job, that is how duplicate uploads coalesce
+func (r *JobRegistry) Claim(id, mode string, reuse func(*Job) bool) (job *Job, created bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	if job, ok := r.jobs[id]; ok && reuse(job) {
+		return job, false
+	}
+
+	job = newJob(id, mode)
+
+	r.expire()
+	r.jobs[id] = job
+
+	return job, true
+}
+
+// expire forgets the jobs finished longer than jobRetention ago, r.mu is held
+func (r *JobRegistry) expire() {
+	for jobID, old := range r.jobs {
+		old.mu.Lock()
+		expired := old.status.finished() && time.Since(old.finishedAt) > jobRetention
+		old.mu.Unlock()
+
+		if expired {
+			delete(r.jobs, jobID)
+		}
+	}
+}
+
+// Remove forgets a job that never made it into the queue
+func (r *JobRegistry) Remove(id string) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	delete(r.jobs, id)
+}
+
+// Get returns the job id
+func (r *JobRegistry) Get(id string) (*Job, bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	job, ok := r.jobs[id]
+	return job, ok
+}
+
+// handleJob returns the state of a conversion
+// @Summary Conversion status
+// @Description State, progress and, once done, the result of a conversion started by /upload
+// @Produce json
+// @Param id path string true "Job ID returned by /upload"
+// @Success 200 {object} JobStatus "Job status"
+// @Failure 404 {object} map[string]string "No such job"
+// @Router /jobs/{id} [get]
+func handleJob(c echo.Context) error {
+	job, ok := jobs.Get(c.Param("id"))
+	if !ok {
+		return c.JSON(http.StatusNotFound, map[string]string{
+			"error": "No such job",
+		})
+	}
+
+	return c.JSON(http.StatusOK, job.Status())
+}
+
+// handleJobEvents streams the state of a conversion as server-sent events
+// @Summary Conversion progress events
+// @Description Server-sent events with the job status: a progress event on every change (about 4 per second while running), then one done or failed event that ends the stream
+// @Produce text/event-stream
+// @Param id path string true "Job ID returned by /upload"
+// @Success 200 {object} JobStatus "Stream of job status events"
+// @Failure 404 {object} map[string]string "No such job"
+// @Router /jobs/{id}/events [get]
+func handleJobEvents(c echo.Context) error {
+	job, ok := jobs.Get(c.Param("id"))
+	if !ok {
+		return c.JSON(http.StatusNotFound, map[string]string{
+			"error": "No such job",
+		})
+	}
+
+	updates, cancel := job.Subscribe()
+	defer cancel()
+
+	res := c.Response()
+	{
+		res.Header().Set("Content-Type", "text/event-stream")
+		res.Header().Set("Cache-Control", "no-cache")
+		res.Header().Set("Connection", "keep-alive")
+		res.WriteHeader(http.StatusOK)
+	}
+
+	for {
+		select {
+		case <-c.Request().Context().Done():
+			return nil
+
+		case status := <-updates:
+			data, err := json.Marshal(status)
+			if err != nil {
+				return err
+			}
+
+			event := "progress"
+			if status.finished() {
+				event = status.State
+			}
+
+			if _, err := fmt.Fprintf(res, "event: %s\ndata: %s\n\n", event, data); err != nil {
+				return nil
+			}
+			res.Flush()
+
+			if status.finished() {
+				return nil
+			}
+		}
+	}
+}
@@ -0,0 +1,446 @@
+package api
+
+/*
+#include <stdlib.h>
+#include "./stream/cgompeg.h"
+#include "./stream/remux.h"
+
+extern void goJobProgress(uintptr_t handle, int64_t position, int64_t duration);
+extern void goSegmentLatency(uintptr_t handle, int64_t latency);
+extern void goJobLog(uintptr_t handle, int level, char *line);
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"io"
+	"net"
+	"net/http"
+	"net/url"
+	"os"
+	"path/filepath"
+	"runtime/cgo"
+	"strings"
+	"sync"
+	"unsafe"
+
+	"github.com/labstack/echo/v4"
+)
+
+// maxLiveStreams bounds the live jobs running at once, they run next to
+// the conversion pool instead of on it because they last until their
+// source ends
+const maxLiveStreams = 8
+
+// maxLiveWindow bounds the window query parameter of /live
+const maxLiveWindow = 100
+
+// liveSocketDir holds the unix sockets /live may read from, a unix: source
+// elsewhere is refused
+const liveSocketDir = "sockets"
+
+// liveFormats are the demuxers a live source can be read with
+var liveFormats = map[string]bool{"mpegts": true, "flv": true}
+
+// LiveStream is a running live job
+type LiveStream struct {
+	ID      string
+	push    *os.File   // write end of the pipe a pushed stream is read from, nil when the job pulls its source
+	pushing sync.Mutex // held by the request pushing the stream
+
+	mu    sync.Mutex
+	cfg   *C.JobConfig // C memory shared with live_ingest, freed once it returned
+	ended bool
+}
+
+// stop ends the live job at its next read and ends a pushed stream
+func (s *LiveStream) stop() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if s.ended {
+		return
+	}
+
+	C.live_stop(s.cfg)
+
+	if s.push != nil {
+		s.push.Close()
+	}
+}
+
+// endPush closes the write end of a pushed stream, the job demuxes what
+// is still in the pipe and ends at its EOF
+func (s *LiveStream) endPush() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if s.ended {
+		return
+	}
+
+	s.push.Close()
+}
+
+// LiveRegistry holds the running live jobs
+type LiveRegistry struct {
+	mu      sync.Mutex
+	streams map[string]*LiveStream
+	slots   chan struct{}
+}
+
+// NewLiveRegistry returns an empty registry running up to max live jobs
+func NewLiveRegistry(max int) *LiveRegistry {
+	return &LiveRegistry{
+		streams: make(map[string]*LiveStream),
+		slots:   make(chan struct{}, max),
+	}
+}
+
+// liveStreams are the live jobs started by /live
+var liveStreams = NewLiveRegistry(maxLiveStreams)
+
+// Get returns the running live job id
+func (r *LiveRegistry) Get(id string) (*LiveStream, bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	stream, ok := r.streams[id]
+	return stream, ok
+}
+
+// liveParam returns the live job of the :id path parameter
+func liveParam(c echo.Context) (*LiveStream, error) {
+	stream, ok := liveStreams.Get(c.Param("id"))
+	if !ok {
+		return nil, c.JSON(http.StatusNotFound, map[string]string{
+			"error": "No such live stream",
+		})
+	}
+	return stream, nil
+}
+
+// handleStartLive starts a live job
+// @Summary Start a live stream
+// @Description Remuxes a continuous MPEG-TS or FLV stream into a sliding window HLS playlist at outputs/{job_id}/output.m3u8 until the source ends, stays silent for 30s or DELETE /live/{job_id} is called. Without source the stream is pushed with POST /live/{job_id}/stream. Old segments are deleted, so the disk use stays at about window segments. Ingest to playlist latency is exported as cgompeg_live_segment_latency_seconds
+// @Produce json
+// @Param source query string false "Source to pull, on this host only: tcp:// to a loopback address or with ?listen=1 on a local address, udp:// on a loopback or local address, unix: inside sockets/; empty to push the stream"
+// @Param format query string false "Demuxer: mpegts (default) or flv"
+// @Param window query int false "Segments listed by the playlist, 6 when missing"
+// @Param segments query string false "Segment container: ts (default) or fmp4"
+// @Param probesize query int false "Bytes read while probing the input, FFmpeg default when missing"
+// @Param analyzeduration query int false "Microseconds of media analyzed while probing, FFmpeg default when missing"
+// @Success 201 {object} map[string]string "Live stream started"
+// @Failure 400 {object} map[string]string "Bad request"
+// @Failure 500 {object} map[string]string "Internal server error"
+// @Failure 503 {object} map[string]string "Too many live streams"
+// @Router /live [post]
+func handleStartLive(c echo.Context) error {
+
+	source := c.QueryParam("source")
+	format := c.QueryParam("format")
+	window := queryInt64(c, "window")
+
+	if format == "" {
+		format = "mpegts"
+	}
+
+	segments, ok := segmentFormats[c.QueryParam("segments")]
+
+	var invalid string
+	{
+		switch {
+		case !liveFormats[format]:
+			invalid = "Unknown live format"
+		case !ok && c.QueryParam("segments") != "" || segments == C.SEGMENT_LL_HLS:
+			invalid = "Live segments are ts or fmp4"
+		case window > maxLiveWindow:
+			invalid = fmt.Sprintf("Window is at most %d segments", maxLiveWindow)
+		case source != "":
+			var err error
+			if source, err = liveSource(source); err != nil {
+				invalid = err.Error()
+			}
+		}
+
+		if invalid != "" {
+			return c.JSON(http.StatusBadRequest, map[string]string{
+				"error": invalid,
+			})
+		}
+	}
+
+	select {
+	case liveStreams.slots <- struct{}{}:
+	default:
+		return c.JSON(http.StatusServiceUnavailable, map[string]string{
+			"error": "Too many live streams",
+		})
+	}
+
+	jobID, err := newJobID()
+	{
+		if err != nil {
+			<-liveStreams.slots
+			return c.JSON(http.StatusInternalServerError, map[string]string{
+				"error": "Failed to create job",
+			})
+		}
+	}
+
+	stream := &LiveStream{ID: jobID}
+
+	// a pushed stream is demuxed from a pipe, the push request writes into it
+	var rPipe *os.File
+	if source == "" {
+		rPipe, stream.push, err = os.Pipe()
+		if err != nil {
+			<-liveStreams.slots
+			return c.JSON(http.StatusInternalServerError, map[string]string{
+				"error": "Failed to create pipe",
+			})
+		}
+
+		source = fmt.Sprintf("pipe:%d", rPipe.Fd())
+	}
+
+	job := jobs.Add(jobID, "live")
+	handle := cgo.NewHandle(job)
+
+	// stop() may use the config from other goroutines while the job runs, so it lives in C memory
+	stream.cfg = (*C.JobConfig)(C.calloc(1, C.sizeof_JobConfig))
+	{
+		*stream.cfg = newJobConfig(jobID, segments, queryInt64(c, "probesize"), queryInt64(c, "analyzeduration"))
+
+		stream.cfg.LiveWindow = C.int(window)
+		stream.cfg.Report.Progress = C.ProgressFunc(C.goJobProgress)
+		stream.cfg.Report.Latency = C.LatencyFunc(C.goSegmentLatency)
+		stream.cfg.Report.ProgressHandle = C.uintptr_t(handle)
+		stream.cfg.Log.Func = C.LogFunc(C.goJobLog)
+		stream.cfg.Log.Handle = C.uintptr_t(handle)
+	}
+
+	liveStreams.mu.Lock()
+	liveStreams.streams[jobID] = stream
+	liveStreams.mu.Unlock()
+
+	cSource := C.CString(source)
+	cFormat := C.CString(format)
+
+	go func() {
+		job.start()
+
+		result := int(C.live_ingest(cSource, cFormat, stream.cfg))
+
+		stream.mu.Lock()
+		stream.ended = true
+		stream.mu.Unlock()
+
+		liveStreams.mu.Lock()
+		delete(liveStreams.streams, jobID)
+		liveStreams.mu.Unlock()
+
+		if rPipe != nil {
+			rPipe.Close()
+		}
+
+		stats := newJobStats(stream.cfg.Report, "live", result)
+		metrics.Record(stats)
+
+		C.free(unsafe.Pointer(cSource))
+		C.free(unsafe.Pointer(cFormat))
+		C.free(unsafe.Pointer(stream.cfg))
+		handle.Delete()
+		<-liveStreams.slots
+
+		if result != 0 {
+			job.fail("Live stream failed")
+			return
+		}
+
+		job.finish(map[string]string{
+			"playlist": filepath.Join("outputs", jobID, "output.m3u8"),
+		})
+	}()
+
+	response := queuedResponse(jobID)
+	{
+		response["status"] = jobRunning
+		response["playlist"] = filepath.Join("outputs", jobID, "output.m3u8")
+		response["stop_url"] = "/live/" + jobID
+
+		if stream.push != nil {
+			response["push_url"] = "/live/" + jobID + "/stream"
+		}
+	}
+
+	return c.JSON(http.StatusCreated, response)
+}
+
+// liveSource checks a pulled source and returns the url handed to FFmpeg.
+// it only reaches this host so /live can not be pointed at other machines:
+// tcp:// connects to a loopback address or listens (?listen=1) on one of
+// the addresses of this host, udp:// always binds and takes the same
+// addresses. host names are refused, a DNS answer could point them
+// anywhere. unix: sockets have to be inside liveSocketDir
+func liveSource(source string) (string, error) {
+
+	if path, ok := strings.CutPrefix(source, "unix:"); ok {
+		return liveSocket(path)
+	}
+
+	u, err := url.Parse(source)
+	if err != nil || (u.Scheme != "tcp" && u.Scheme != "udp") || u.Opaque != "" {
+		return "", errors.New("Live sources are udp://, tcp:// or unix: urls")
+	}
+
+	host := u.Hostname()
+	if host == "" && u.Scheme == "tcp" && !isListener(u) {
+		return "", errors.New("A tcp:// source needs a host, or ?listen=1")
+	}
+
+	var ip net.IP
+	if host != "" {
+		if ip = net.ParseIP(host); ip == nil {
+			return "", errors.New("Live source hosts are IP addresses")
+		}
+	}
+
+	switch {
+	case ip != nil && ip.IsLoopback():
+	case u.Scheme == "tcp" && !isListener(u):
+		return "", errors.New("A tcp:// source connects to a loopback address only, listen with ?listen=1")
+	case ip != nil && !ip.IsUnspecified() && !isLocalAddress(ip):
+		return "", errors.New("A live listener binds to an address of this host")
+	}
+
+	return source, nil
+}
+
+// liveSocket returns the unix: url of path, which has to be inside
+// liveSocketDir once symlinks and .. are resolved
+func liveSocket(path string) (string, error) {
+
+	outside := fmt.Errorf("unix: sockets have to be inside %s/", liveSocketDir)
+
+	dir, err := filepath.Abs(liveSocketDir)
+	if err != nil {
+		return "", outside
+	}
+
+	if dir, err = filepath.EvalSymlinks(dir); err != nil {
+		return "", outside
+	}
+
+	abs, err := filepath.Abs(path)
+	if err != nil {
+		return "", outside
+	}
+
+	// the socket may not exist yet when the job listens on it, its directory does
+	parent, err := filepath.EvalSymlinks(filepath.Dir(abs))
+	if err != nil {
+		return "", outside
+	}
+
+	socket := filepath.Join(parent, filepath.Base(abs))
+
+	if rel, err := filepath.Rel(dir, socket); err != nil || rel == "." || strings.HasPrefix(rel, "..") {
+		return "", outside
+	}
+
+	return "unix:" + socket, nil
+}
+
+// isListener tells whether a tcp:// url makes FFmpeg accept a sender
+func isListener(u *url.URL) bool {
+	listen := u.Query().Get("listen")
+	return listen == "1" || listen == "2"
+}
+
+// isLocalAddress tells whether ip belongs to an interface of this host
+func isLocalAddress(ip net.IP) bool {
+
+	addrs, err := net.InterfaceAddrs()
+	if err != nil {
+		return false
+	}
+
+	for _, addr := range addrs {
+		if prefix, ok := addr.(*net.IPNet); ok && prefix.IP.Equal(ip) {
+			return true
+		}
+	}
+
+	return false
+}
+
+// handleLivePush feeds a live job the stream in the request body
+// @Summary Push a live stream
+// @Description The chunked request body is the MPEG-TS or FLV stream of a live job started without source. The live job ends with the request
+// @Accept application/octet-stream
+// @Param id path string true "Job ID returned by POST /live"
+// @Success 204 "Stream ended"
+// @Failure 400 {object} map[string]string "The live job pulls its source"
+// @Failure 404 {object} map[string]string "No such live stream"
+// @Failure 410 {object} map[string]string "The live job stopped reading"
+// @Failure 423 {object} map[string]string "The stream is already pushed"
+// @Router /live/{id}/stream [post]
+func handleLivePush(c echo.Context) error {
+
+	stream, err := liveParam(c)
+	if stream == nil {
+		return err
+	}
+
+	if stream.push == nil {
+		return c.JSON(http.StatusBadRequest, map[string]string{
+			"error": "This live stream pulls its source",
+		})
+	}
+
+	if !stream.pushing.TryLock() {
+		return c.JSON(http.StatusLocked, map[string]string{
+			"error": "The stream is already pushed",
+		})
+	}
+	defer stream.pushing.Unlock()
+
+	// a dropped push, or a job that stopped reading, stops the live stream at once
+	_, err = io.Copy(stream.push, c.Request().Body)
+	if err != nil {
+		stream.stop()
+
+		if pipeErr, ok := err.(*os.PathError); ok {
+			return c.JSON(http.StatusGone, map[string]string{
+				"error": "Live stream stopped reading: " + pipeErr.Err.Error(),
+			})
+		}
+
+		return err
+	}
+
+	// the end of the body ends the live stream once the pipe is drained
+	stream.endPush()
+
+	return c.NoContent(http.StatusNoContent)
+}
+
+// handleStopLive ends a live job
+// @Summary Stop a live stream
+// @Description Ends the live job, the playlist is closed with #EXT-X-ENDLIST and the job is done
+// @Param id path string true "Job ID returned by POST /live"
+// @Success 202 "Stopping, follow /jobs/{id} for the end"
+// @Failure 404 {object} map[string]string "No such live stream"
+// @Router /live/{id} [delete]
+func handleStopLive(c echo.Context) error {
+
+	stream, err := liveParam(c)
+	if stream == nil {
+		return err
+	}
+
+	stream.stop()
+
+	return c.NoContent(http.StatusAccepted)
+}
@@ -0,0 +1,262 @@
+package api
+
+import (
+	"bytes"
+	"fmt"
+	"net/http"
+	"sort"
+	"strconv"
+	"sync"
+	"time"
+
+	"github.com/labstack/echo/v4"
+)
+
+// stageNames are the JobStage values of core/report.h, in order
+var stageNames = [...]string{"spool", "probe", "header", "packets", "trailer"}
+
+// stageBuckets covers a probe of a few milliseconds up to a long transcode
+var stageBuckets = []float64{0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300, 600}
+
+// firstSegmentBuckets covers low latency parts up to a transcode that is spooled first
+var firstSegmentBuckets = []float64{0.05, 0.1, 0.25, 0.5, 1, 2, 4, 8, 15, 30, 60}
+
+// liveLatencyBuckets covers one second segments published right away up to a stalled live source
+var liveLatencyBuckets = []float64{0.5, 1, 1.5, 2, 3, 4, 6, 8, 10, 15, 20, 30}
+
+// stageTime is the time a job spent in one stage
+type stageTime struct {
+	Wall time.Duration
+	CPU  time.Duration // job threads only, the codec's own worker threads are not included
+}
+
+// jobStats is the Go copy of the C JobReport of a finished job
+type jobStats struct {
+	Mode         string
+	Result       string // success or error
+	CacheHit     bool
+	Stages       [len(stageNames)]stageTime
+	FirstSegment time.Duration // negative when no segment was written
+	BytesIn      int64
+	BytesOut     int64
+	Packets      int64
+	Segments     int64
+}
+
+// histogram is a cumulative Prometheus histogram
+type histogram struct {
+	buckets []float64
+	counts  []uint64 // one per bucket, the +Inf bucket is count
+	sum     float64
+	count   uint64
+}
+
+func newHistogram(buckets []float64) *histogram {
+	return &histogram{
+		buckets: buckets,
+		counts:  make([]uint64, len(buckets)),
+	}
+}
+
+func (h *histogram) observe(v float64) {
+	for i, bound := range h.buckets {
+		if v <= bound {
+			h.counts[i]++
+		}
+	}
+
+	h.sum += v
+	h.count++
+}
+
+// write prints the histogram series of name with labels, labels may be empty
+func (h *histogram) write(buf *bytes.Buffer, name, labels string) {
+	sep := ""
+	if labels != "" {
+		sep = ","
+	}
+
+	for i, bound := range h.buckets {
+		fmt.Fprintf(buf, "%s_bucket{%s%sle=\"%s\"} %d\n", name, labels, sep, strconv.FormatFloat(bound, 'g', -1, 64), h.counts[i])
+	}
+
+	fmt.Fprintf(buf, "%s_bucket{%s%sle=\"+Inf\"} %d\n", name, labels, sep, h.count)
+
+	if labels != "" {
+		labels = "{" + labels + "}"
+	}
+
+	fmt.Fprintf(buf, "%s_sum%s %s\n", name, labels, strconv.FormatFloat(h.sum, 'g', -1, 64))
+	fmt.Fprintf(buf, "%s_count%s %d\n", name, labels, h.count)
+}
+
+// Metrics aggregates the reports of every finished job for /metrics
+type Metrics struct {
+	mu sync.Mutex
+
+	stages       map[string]*histogram // keyed by stage labels
+	firstSegment *histogram
+	liveLatency  *histogram
+
+	jobs     map[string]uint64 // keyed by mode and result labels
+	cache    map[string]uint64 // probe cache hits and misses
+	bytesIn  uint64
+	bytesOut uint64
+	packets  uint64
+	segments uint64
+}
+
+// NewMetrics returns an empty registry
+func NewMetrics() *Metrics {
+	return &Metrics{
+		stages:       make(map[string]*histogram),
+		firstSegment: newHistogram(firstSegmentBuckets),
+		liveLatency:  newHistogram(liveLatencyBuckets),
+		jobs:         make(map[string]uint64),
+		cache:        make(map[string]uint64),
+	}
+}
+
+// metrics collects the reports of the conversions run by the server
+var metrics = NewMetrics()
+
+// Record adds the report of a finished job
+func (m *Metrics) Record(stats jobStats) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	m.jobs[fmt.Sprintf("mode=%q,result=%q", stats.Mode, stats.Result)]++
+
+	if stats.CacheHit {
+		m.cache["hit"]++
+	} else {
+		m.cache["miss"]++
+	}
+
+	for i, stage := range stats.Stages {
+
+		// stages the job did not go through are not observed
+		if stage.Wall == 0 && stage.CPU == 0 {
+			continue
+		}
+
+		m.stage(stageNames[i], "wall").observe(stage.Wall.Seconds())
+		m.stage(stageNames[i], "cpu").observe(stage.CPU.Seconds())
+	}
+
+	if stats.FirstSegment >= 0 {
+		m.firstSegment.observe(stats.FirstSegment.Seconds())
+	}
+
+	m.bytesIn += uint64(stats.BytesIn)
+	m.bytesOut += uint64(stats.BytesOut)
+	m.packets += uint64(stats.Packets)
+	m.segments += uint64(stats.Segments)
+}
+
+// ObserveLiveLatency adds the ingest to playlist latency of a segment a
+// live job published, it is recorded while the job runs
+func (m *Metrics) ObserveLiveLatency(latency time.Duration) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	m.liveLatency.observe(latency.Seconds())
+}
+
+// RecordRejected counts a job turned away because the queue was full
+func (m *Metrics) RecordRejected(mode string) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	m.jobs[fmt.Sprintf("mode=%q,result=%q", mode, "rejected")]++
+}
+
+// RecordDeduplicated counts an upload answered by the job of an identical one
+func (m *Metrics) RecordDeduplicated(mode string) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	m.jobs[fmt.Sprintf("mode=%q,result=%q", mode, "deduplicated")]++
+}
+
+func (m *Metrics) stage(name, kind string) *histogram {
+	key := fmt.Sprintf("stage=%q,kind=%q", name, kind)
+
+	h, ok := m.stages[key]
+	if !ok {
+		h = newHistogram(stageBuckets)
+		m.stages[key] = h
+	}
+
+	return h
+}
+
+// WriteTo writes every metric in the Prometheus text exposition format
+func (m *Metrics) WriteTo(buf *bytes.Buffer) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	buf.WriteString("# HELP cgompeg_stage_seconds Time jobs spent in each stage, wall clock and cpu of the job threads.\n")
+	buf.WriteString("# TYPE cgompeg_stage_seconds histogram\n")
+	for _, key := range sortedKeys(m.stages) {
+		m.stages[key].write(buf, "cgompeg_stage_seconds", key)
+	}
+
+	buf.WriteString("# HELP cgompeg_time_to_first_segment_seconds Time from job start until the first segment was written.\n")
+	buf.WriteString("# TYPE cgompeg_time_to_first_segment_seconds histogram\n")
+	m.firstSegment.write(buf, "cgompeg_time_to_first_segment_seconds", "")
+
+	buf.WriteString("# HELP cgompeg_live_segment_latency_seconds Time from reading about the oldest packet of a live segment until the playlist listed it.\n")
+	buf.WriteString("# TYPE cgompeg_live_segment_latency_seconds histogram\n")
+	m.liveLatency.write(buf, "cgompeg_live_segment_latency_seconds", "")
+
+	buf.WriteString("# HELP cgompeg_jobs_total Finished, rejected and deduplicated jobs.\n")
+	buf.WriteString("# TYPE cgompeg_jobs_total counter\n")
+	for _, key := range sortedKeys(m.jobs) {
+		fmt.Fprintf(buf, "cgompeg_jobs_total{%s} %d\n", key, m.jobs[key])
+	}
+
+	buf.WriteString("# HELP cgompeg_probe_cache_total Probes answered by the probe cache or not.\n")
+	buf.WriteString("# TYPE cgompeg_probe_cache_total counter\n")
+	for _, key := range sortedKeys(m.cache) {
+		fmt.Fprintf(buf, "cgompeg_probe_cache_total{result=%q} %d\n", key, m.cache[key])
+	}
+
+	counters := []struct {
+		name, help string
+		value      uint64
+	}{
+		{"cgompeg_input_bytes_total", "Packet payload read from the inputs.", m.bytesIn},
+		{"cgompeg_output_bytes_total", "Bytes written to the outputs, playlists included.", m.bytesOut},
+		{"cgompeg_packets_total", "Packets read from the inputs.", m.packets},
+		{"cgompeg_segments_total", "Media segments written.", m.segments},
+	}
+
+	for _, c := range counters {
+		fmt.Fprintf(buf, "# HELP %s %s\n# TYPE %s counter\n%s %d\n", c.name, c.help, c.name, c.name, c.value)
+	}
+}
+
+func sortedKeys[V any](m map[string]V) []string {
+	keys := make([]string, 0, len(m))
+	for key := range m {
+		keys = append(keys, key)
+	}
+
+	sort.Strings(keys)
+
+	return keys
+}
+
+// handleMetrics exposes the job metrics to Prometheus
+// @Summary Job metrics
+// @Description Per-stage timings, time to first segment, bytes, packets and segments of the finished jobs in the Prometheus text format
+// @Produce plain
+// @Success 200 {string} string "Prometheus metrics"
+// @Router /metrics [get]
+func handleMetrics(c echo.Context) error {
+	var buf bytes.Buffer
+	metrics.WriteTo(&buf)
+
+	return c.Blob(http.StatusOK, "text/plain; version=0.0.4; charset=utf-8", buf.Bytes())
+}
@@ -0,0 +1,135 @@
+package api
+
+import (
+	"errors"
+	"net/http"
+	"path"
+	"sync"
+
+	"github.com/labstack/echo/v4"
+)
+
+// memoryOutputBytes bounds the files kept by in-memory conversions, the
+// oldest jobs are dropped past it
+const memoryOutputBytes = 1 << 30
+
+// errOutputTooLarge is returned by a sink when a single job outgrows the store
+var errOutputTooLarge = errors.New("in-memory output is larger than the store")
+
+// OutputStore keeps the playlists and segments of in-memory conversions
+// so they can be served without ever touching the disk
+type OutputStore struct {
+	mu       sync.RWMutex
+	jobs     map[string]map[string][]byte
+	order    []string // job ids, oldest first
+	size     int64
+	maxBytes int64
+}
+
+// NewOutputStore returns an empty store holding up to maxBytes
+func NewOutputStore(maxBytes int64) *OutputStore {
+	return &OutputStore{
+		jobs:     make(map[string]map[string][]byte),
+		maxBytes: maxBytes,
+	}
+}
+
+// memoryOutputs holds the outputs of the conversions run with output=memory
+var memoryOutputs = NewOutputStore(memoryOutputBytes)
+
+// Sink returns the HlsSink that stores the files of jobID, a file that is
+// handed over again (the playlist) replaces the previous one
+func (s *OutputStore) Sink(jobID string) HlsSink {
+	return func(name string, data []byte) error {
+		s.mu.Lock()
+		defer s.mu.Unlock()
+
+		files, ok := s.jobs[jobID]
+		if !ok {
+			files = make(map[string][]byte)
+			s.jobs[jobID] = files
+			s.order = append(s.order, jobID)
+		}
+
+		s.size += int64(len(data)) - int64(len(files[name]))
+		files[name] = data
+
+		// make room by dropping the oldest jobs, never this one
+		for s.size > s.maxBytes && len(s.order) > 0 && s.order[0] != jobID {
+			s.drop(s.order[0])
+		}
+
+		if s.size > s.maxBytes {
+			return errOutputTooLarge
+		}
+
+		return nil
+	}
+}
+
+// Get returns the file name of jobID
+func (s *OutputStore) Get(jobID, name string) ([]byte, bool) {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+
+	data, ok := s.jobs[jobID][name]
+	return data, ok
+}
+
+// Drop removes every file of jobID, used when its conversion failed
+func (s *OutputStore) Drop(jobID string) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	s.drop(jobID)
+}
+
+func (s *OutputStore) drop(jobID string) {
+	for _, data := range s.jobs[jobID] {
+		s.size -= int64(len(data))
+	}
+
+	delete(s.jobs, jobID)
+
+	for i, id := range s.order {
+		if id == jobID {
+			s.order = append(s.order[:i], s.order[i+1:]...)
+			break
+		}
+	}
+}
+
+// outputTypes are the content types of the files an hls output is made of
+var outputTypes = map[string]string{
+	".m3u8": "application/vnd.apple.mpegurl",
+	".ts":   "video/mp2t",
+	".m4s":  "video/iso.segment",
+	".mp4":  "video/mp4",
+}
+
+// handleMemoryOutput serves a playlist or segment of an in-memory conversion
+// @Summary In-memory HLS output
+// @Description Playlist, init segment or segment of a conversion uploaded with output=memory
+// @Produce octet-stream
+// @Param job path string true "Job ID returned by /upload"
+// @Param file path string true "File name, e.g. output.m3u8 or segment000.ts"
+// @Success 200 {file} file "The file"
+// @Failure 404 {object} map[string]string "No such job or file"
+// @Router /hls/{job}/{file} [get]
+func handleMemoryOutput(c echo.Context) error {
+	name := c.Param("file")
+
+	data, ok := memoryOutputs.Get(c.Param("job"), name)
+	if !ok {
+		return c.JSON(http.StatusNotFound, map[string]string{
+			"error": "No such output",
+		})
+	}
+
+	contentType, ok := outputTypes[path.Ext(name)]
+	if !ok {
+		contentType = "application/octet-stream"
+	}
+
+	return c.Blob(http.StatusOK, contentType, data)
+}
@@ -0,0 +1,142 @@
+package api
+
+/*
+#include "./../core/executor.h"
+*/
+import "C"
+import (
+	"errors"
+	"os"
+	"runtime/cgo"
+	"syscall"
+	"unsafe"
+)
+
+// ErrQueueFull is returned by Submit when every worker is busy and the
+// queue has no free slot left.
+var ErrQueueFull = errors.New("conversion queue is full")
+
+// pooledRun is the Go side of a submitted task
+type pooledRun struct {
+	started func()
+	done    chan int
+}
+
+// WorkerPool runs C tasks on a fixed number of native threads fed by a
+// bounded queue (core/executor.c), so a burst of uploads can not start
+// more C conversions than there are cores. a conversion waits on a channel
+// instead of holding a Go OS thread in a cgo call for its whole duration
+type WorkerPool struct {
+	executor *C.Executor
+	events   *os.File
+}
+
+// NewWorkerPool starts workers native threads behind a queue of size queueSize
+func NewWorkerPool(workers, queueSize int) (*WorkerPool, error) {
+	executor := C.executor_open(C.int(workers), C.int(queueSize))
+	if executor == nil {
+		return nil, errors.New("could not start the conversion threads")
+	}
+
+	// the executor closes its descriptor, the os.File closes this one
+	fd, err := syscall.Dup(int(C.executor_fd(executor)))
+	if err != nil {
+		C.executor_close(&executor)
+		return nil, err
+	}
+
+	syscall.CloseOnExec(fd)
+
+	p := &WorkerPool{
+		executor: executor,
+		events:   os.NewFile(uintptr(fd), "executor"),
+	}
+
+	go p.poll()
+
+	return p, nil
+}
+
+// poll waits on the event descriptor in the netpoller, so no thread is
+// parked on it, and hands the events of the tasks to their submitters
+func (p *WorkerPool) poll() {
+	conn, err := p.events.SyscallConn()
+	if err != nil {
+		panic(err)
+	}
+
+	events := make([]C.TaskEvent, C.EXECUTOR_POLL_MAX)
+
+	for {
+		n := 0
+
+		// called again each time the descriptor becomes readable while it returns false
+		err := conn.Read(func(uintptr) bool {
+			n = int(C.executor_poll(p.executor, &events[0], C.int(len(events))))
+			return n > 0
+		})
+		if err != nil {
+			return
+		}
+
+		deliver(events[:n])
+	}
+}
+
+// deliver hands polled events to the submitters of their tasks
+func deliver(events []C.TaskEvent) {
+	for _, event := range events {
+		handle := cgo.Handle(event.Task.Handle)
+		run := handle.Value().(*pooledRun)
+
+		switch event.State {
+		case C.TASK_STARTED:
+			if run.started != nil {
+				run.started()
+			}
+		case C.TASK_DONE:
+			run.done <- int(event.Task.Result)
+			handle.Delete()
+		}
+	}
+}
+
+// Submit queues task without blocking, started is called once a worker
+// picked it up and the returned channel receives its result. task is C
+// memory that has to stay valid until the result was received
+func (p *WorkerPool) Submit(task unsafe.Pointer, started func()) (<-chan int, error) {
+	run := &pooledRun{
+		started: started,
+		done:    make(chan int, 1),
+	}
+
+	handle := cgo.NewHandle(run)
+	(*C.Task)(task).Handle = C.uintptr_t(handle)
+
+	if C.executor_submit(p.executor, (*C.Task)(task)) < 0 {
+		handle.Delete()
+		return nil, ErrQueueFull
+	}
+
+	return run.done, nil
+}
+
+// Close stops accepting jobs and waits for the queued ones to finish
+func (p *WorkerPool) Close() {
+	// waits for a poll in progress, the poll goroutine returns after it
+	p.events.Close()
+
+	C.executor_stop(p.executor)
+
+	events := make([]C.TaskEvent, C.EXECUTOR_POLL_MAX)
+	for {
+		n := int(C.executor_poll(p.executor, &events[0], C.int(len(events))))
+		if n == 0 {
+			break
+		}
+
+		deliver(events[:n])
+	}
+
+	C.executor_close(&p.executor)
+}
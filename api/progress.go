@@ -0,0 +1,43 @@
+package api
+
+/*
+#include <stdint.h>
+*/
+import "C"
+import (
+	"runtime/cgo"
+	"strings"
+	"time"
+)
+
+// goJobProgress is the C ProgressFunc of every /upload job, handle is the
+// cgo.Handle of its *Job
+//
+//export goJobProgress
+func goJobProgress(handle C.uintptr_t, position, duration C.int64_t) {
+	job := cgo.Handle(handle).Value().(*Job)
+
+	job.setProgress(time.Duration(position)*time.Microsecond, time.Duration(duration)*time.Microsecond)
+}
+
+// goJobLog is the C LogFunc of every /upload and /live job, handle is the
+// cgo.Handle of its *Job. only errors are passed, the last one is kept
+//
+//export goJobLog
+func goJobLog(handle C.uintptr_t, level C.int, line *C.char) {
+	job := cgo.Handle(handle).Value().(*Job)
+
+	job.setLog(strings.TrimSpace(C.GoString(line)))
+}
+
+// goSegmentLatency is the C LatencyFunc of every /live job, handle is the
+// cgo.Handle of its *Job
+//
+//export goSegmentLatency
+func goSegmentLatency(handle C.uintptr_t, latency C.int64_t) {
+	job := cgo.Handle(handle).Value().(*Job)
+	d := time.Duration(latency) * time.Microsecond
+
+	job.setLatency(d)
+	metrics.ObserveLiveLatency(d)
+}
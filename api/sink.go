@@ -0,0 +1,28 @@
+package api
+
+/*
+#include <stdint.h>
+*/
+import "C"
+import (
+	"runtime/cgo"
+	"unsafe"
+)
+
+// HlsSink receives the files of an in-memory conversion, name is relative
+// to the job's output directory and data is owned by the sink
+type HlsSink func(name string, data []byte) error
+
+// goHlsSink is the C HlsSinkFunc of every in-memory job, handle is the
+// cgo.Handle of the job's HlsSink
+//
+//export goHlsSink
+func goHlsSink(handle C.uintptr_t, name *C.char, data *C.uint8_t, size C.int) C.int {
+	sink := cgo.Handle(handle).Value().(HlsSink)
+
+	if err := sink(C.GoString(name), C.GoBytes(unsafe.Pointer(data), size)); err != nil {
+		return -1
+	}
+
+	return 0
+}
@@ -0,0 +1,811 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "abr.h"
+#include "remux.h"
+#include "plan.h"
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+#include "libavutil/cpu.h"
+#include "libavutil/error.h"
+
+const Rendition default_ladder[] = {
+    { "1080p", 1080, 5000000 },
+    { "720p",  720,  2800000 },
+    { "480p",  480,  1400000 },
+    { "360p",  360,  800000 },
+};
+
+const int default_ladder_size = sizeof(default_ladder) / sizeof(default_ladder[0]);
+
+typedef struct {
+    AVFrame *frame;   // decoded video frame, shared by reference with every branch
+    AVPacket *packet; // audio packet, carried into every variant by its audio plan
+} LadderItem;
+
+// bounded single producer / single consumer queue between the decoder and a branch
+typedef struct {
+    LadderItem items[LADDER_QUEUE_SIZE];
+    int head;
+    int count;
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} LadderQueue;
+
+// one rendition: its own scaler, encoder and hls muxer, run on its own thread
+typedef struct {
+    Rendition rendition;
+    int width;
+    int height;
+    char output_dir[1024];
+
+    AVFormatContext *output_ctx;
+    AVCodecContext *encoder_ctx;
+    struct SwsContext *sws_ctx;
+    AVFrame *scaled;
+    AVPacket *packet;
+
+    AVFormatContext *input_ctx; // the time bases of the audio packets
+    RemuxPlan audio;            // the audio stream alone, see plan_audio(); no streams without audio
+    int audio_index;            // output stream of the audio, -1 without audio
+
+    char codecs[16]; // avc1.PPCCLL of the encoded video, read from its SPS, empty until then
+
+    LadderQueue queue;
+    pthread_t thread;
+    int started;
+    int result;
+
+    JobReport *report; // shared by the branches, the counters are atomic
+    const JobLog *log; // of the job thread, the branch thread logs to it too
+} LadderBranch;
+
+static void queue_init(LadderQueue *queue) {
+
+    memset(queue, 0, sizeof(*queue));
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+/*
+this function blocks while the queue is full, so the decoder never runs
+more than LADDER_QUEUE_SIZE frames ahead of the slowest encoder
+*/
+static void queue_push(LadderQueue *queue, LadderItem item) {
+
+    pthread_mutex_lock(&queue->lock);
+    {
+        while (queue->count == LADDER_QUEUE_SIZE) {
+            pthread_cond_wait(&queue->not_full, &queue->lock);
+        }
+
+        queue->items[(queue->head + queue->count) % LADDER_QUEUE_SIZE] = item;
+        queue->count++;
+
+        pthread_cond_signal(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// returns 0 once the queue is finished and drained
+static int queue_pop(LadderQueue *queue, LadderItem *item) {
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0 && !queue->finished) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % LADDER_QUEUE_SIZE;
+    queue->count--;
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 1;
+}
+
+static void queue_finish(LadderQueue *queue) {
+
+    pthread_mutex_lock(&queue->lock);
+    {
+        queue->finished = 1;
+        pthread_cond_broadcast(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void queue_destroy(LadderQueue *queue) {
+
+    LadderItem item;
+
+    queue->finished = 1;
+    while (queue_pop(queue, &item)) {
+        av_frame_free(&item.frame);
+        av_packet_free(&item.packet);
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+const AVCodec* find_h264_encoder(void) {
+
+    const AVCodec *encoder = avcodec_find_encoder_by_name("libx264");
+    {
+        if (encoder == NULL) {
+            encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+        }
+    }
+
+    return encoder;
+}
+
+/*
+this function fills branch->codecs from the first SPS found in data, either
+an avcC record (fmp4 extradata) or annex b NAL units (packets, mpeg-ts
+extradata): profile_idc, the constraint flags and level_idc follow the
+NAL header
+*/
+static void read_avc_codec(LadderBranch *branch, const uint8_t *data, int size) {
+
+    if (branch->codecs[0] != '\0' || data == NULL || size < 4) {
+        return;
+    }
+
+    if (data[0] == 1) {
+        snprintf(branch->codecs, sizeof(branch->codecs), "avc1.%02x%02x%02x", data[1], data[2], data[3]);
+        return;
+    }
+
+    for (int i = 0; i + 6 < size; i++) {
+
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 7) {
+            snprintf(branch->codecs, sizeof(branch->codecs), "avc1.%02x%02x%02x", data[i + 4], data[i + 5], data[i + 6]);
+            return;
+        }
+    }
+}
+
+// RFC 6381 name of the copied audio for CODECS, NULL when there is none for it
+static const char* audio_codec(const AVCodecParameters *codecpar) {
+
+    switch (codecpar->codec_id) {
+        // the aac profiles are the mpeg-4 audio object types minus one
+        case AV_CODEC_ID_AAC:
+            switch (codecpar->profile) {
+                case 4: return "mp4a.40.5";   // HE-AAC
+                case 28: return "mp4a.40.29"; // HE-AACv2
+                default: return "mp4a.40.2";  // LC, also when unknown
+            }
+        case AV_CODEC_ID_MP3: return "mp4a.40.34";
+        case AV_CODEC_ID_AC3: return "ac-3";
+        case AV_CODEC_ID_EAC3: return "ec-3";
+        default: return NULL;
+    }
+}
+
+/*
+this function opens the scaler target, the h264 encoder and the hls muxer
+of a branch. the audio stream (if any) is carried into every variant the
+way the copy mode carries it: copied when the segments can hold it,
+encoded to aac when they can not (opus, vorbis, flac, pcm), see plan.c
+*/
+static int open_branch(LadderBranch *branch, AVFormatContext *input_ctx, AVStream *video_stream, AVStream *audio_stream, int threads, SegmentFormat format, JobReport *report) {
+
+    const AVCodec *encoder = find_h264_encoder();
+    {
+        if (encoder == NULL) {
+            fprintf(stderr, "Error: Could not find H.264 encoder.\n");
+            return AVERROR_ENCODER_NOT_FOUND;
+        }
+    }
+
+    branch->output_ctx = alloc_hls_output(branch->output_dir, "index.m3u8");
+    {
+        if (branch->output_ctx == NULL) {
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    AVRational frame_rate = av_guess_frame_rate(input_ctx, video_stream, NULL);
+
+    branch->encoder_ctx = avcodec_alloc_context3(encoder);
+    {
+        if (branch->encoder_ctx == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        AVCodecContext *encoder_ctx = branch->encoder_ctx;
+
+        encoder_ctx->width = branch->width;
+        encoder_ctx->height = branch->height;
+        encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        encoder_ctx->sample_aspect_ratio = video_stream->codecpar->sample_aspect_ratio;
+        encoder_ctx->time_base = video_stream->time_base;
+        encoder_ctx->framerate = frame_rate;
+        encoder_ctx->bit_rate = branch->rendition.VideoBitrate;
+        encoder_ctx->rc_max_rate = branch->rendition.VideoBitrate * 11 / 10;
+        encoder_ctx->rc_buffer_size = branch->rendition.VideoBitrate * 2;
+        encoder_ctx->gop_size = frame_rate.num > 0 ? (int)(av_q2d(frame_rate) * LADDER_KEYFRAME_SECONDS + 0.5) : 250;
+        encoder_ctx->thread_count = threads;
+
+        if (branch->output_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+            encoder_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+    }
+
+    AVDictionary *encoder_options = NULL;
+    {
+        av_dict_set(&encoder_options, "preset", "veryfast", 0);
+        av_dict_set(&encoder_options, "forced-idr", "1", 0); // forced I frames become IDR
+
+        // a scene cut IDR in one rendition only would move its segment boundaries off the others
+        av_dict_set(&encoder_options, "sc_threshold", "0", 0);
+    }
+
+    int result = avcodec_open2(branch->encoder_ctx, encoder, &encoder_options);
+    {
+        av_dict_free(&encoder_options);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open encoder for %s: %s\n", branch->rendition.Name, av_err2str(result));
+            return result;
+        }
+
+        // fmp4 outputs have the SPS in the extradata, mpeg-ts ones only in the first packet
+        read_avc_codec(branch, branch->encoder_ctx->extradata, branch->encoder_ctx->extradata_size);
+    }
+
+    AVStream *out_video = avformat_new_stream(branch->output_ctx, NULL);
+    {
+        if (out_video == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        result = avcodec_parameters_from_context(out_video->codecpar, branch->encoder_ctx);
+        if (result < 0) {
+            return result;
+        }
+
+        out_video->time_base = branch->encoder_ctx->time_base;
+    }
+
+    branch->audio_index = -1;
+    branch->input_ctx = input_ctx;
+
+    if (audio_stream) {
+
+        result = plan_audio(&branch->audio, input_ctx, audio_stream->index, branch->output_ctx, format);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not plan the audio of %s: %s\n", branch->rendition.Name, av_err2str(result));
+                return result;
+            }
+        }
+
+        branch->audio_index = branch->audio.streams[audio_stream->index].output_index;
+    }
+
+    branch->report = report;
+    branch->log = job_log_current();
+
+    if (write_hls_header(branch->output_ctx, branch->output_dir, format, 0, NULL, NULL, report) < 0) {
+        return AVERROR(EIO);
+    }
+
+    branch->scaled = av_frame_alloc();
+    branch->packet = av_packet_alloc();
+    {
+        if (branch->scaled == NULL || branch->packet == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        branch->scaled->format = AV_PIX_FMT_YUV420P;
+        branch->scaled->width = branch->width;
+        branch->scaled->height = branch->height;
+
+        result = av_frame_get_buffer(branch->scaled, 0);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static void close_branch(LadderBranch *branch) {
+
+    avcodec_free_context(&branch->encoder_ctx);
+    sws_freeContext(branch->sws_ctx);
+    av_frame_free(&branch->scaled);
+    av_packet_free(&branch->packet);
+    free_plan(&branch->audio);
+
+    if (branch->output_ctx) {
+        avformat_free_context(branch->output_ctx);
+        branch->output_ctx = NULL;
+    }
+
+    queue_destroy(&branch->queue);
+}
+
+/*
+this function drains the encoder into the branch muxer
+*/
+static int write_encoded(LadderBranch *branch) {
+
+    while (1) {
+
+        int result = avcodec_receive_packet(branch->encoder_ctx, branch->packet);
+        {
+            if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+                return 0;
+            }
+
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        read_avc_codec(branch, branch->packet->data, branch->packet->size);
+
+        AVStream *out_stream = branch->output_ctx->streams[0];
+        {
+            av_packet_rescale_ts(branch->packet, branch->encoder_ctx->time_base, out_stream->time_base);
+            branch->packet->stream_index = 0;
+        }
+
+        result = av_interleaved_write_frame(branch->output_ctx, branch->packet);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+}
+
+/*
+this function scales a shared decoded frame into the branch geometry and
+encodes it. the decoded frame is only read, so every branch can use the
+same buffers without copying them
+*/
+static int encode_frame(LadderBranch *branch, const AVFrame *frame) {
+
+    branch->sws_ctx = sws_getCachedContext(branch->sws_ctx,
+        frame->width, frame->height, frame->format,
+        branch->width, branch->height, AV_PIX_FMT_YUV420P,
+        SWS_BICUBIC, NULL, NULL, NULL);
+    {
+        if (branch->sws_ctx == NULL) {
+            fprintf(stderr, "Error: Could not create scaling context for %s.\n", branch->rendition.Name);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    // the encoder may still hold a reference to the previous picture
+    int result = av_frame_make_writable(branch->scaled);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    sws_scale(branch->sws_ctx, (const uint8_t* const*)frame->data, frame->linesize, 0, frame->height, branch->scaled->data, branch->scaled->linesize);
+
+    branch->scaled->pts = frame->pts;
+    branch->scaled->pict_type = frame->pict_type;
+
+    result = avcodec_send_frame(branch->encoder_ctx, branch->scaled);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return write_encoded(branch);
+}
+
+// the packet is unreferenced by plan_write_packet() in every case
+static int write_audio(LadderBranch *branch, AVPacket *packet) {
+
+    if (branch->audio_index < 0) {
+        av_packet_unref(packet);
+        return 0;
+    }
+
+    return plan_write_packet(&branch->audio, branch->input_ctx, branch->output_ctx, packet);
+}
+
+/*
+this function is the body of a branch thread
+after an error it keeps draining its queue so the decoder never blocks
+on a branch that gave up
+*/
+static void* branch_thread(void *arg) {
+
+    LadderBranch *branch = (LadderBranch*)arg;
+    LadderItem item;
+
+    job_log_attach(branch->log);
+
+    int64_t cpu = thread_cpu_micros();
+
+    while (queue_pop(&branch->queue, &item)) {
+
+        if (branch->result >= 0) {
+            if (item.frame) {
+                branch->result = encode_frame(branch, item.frame);
+            } else {
+                branch->result = write_audio(branch, item.packet);
+            }
+
+            if (branch->result < 0) {
+                fprintf(stderr, "Error: Rendition %s failed: %s\n", branch->rendition.Name, av_err2str(branch->result));
+            }
+        }
+
+        av_frame_free(&item.frame);
+        av_packet_free(&item.packet);
+    }
+
+    stage_add_cpu(branch->report, JOB_STAGE_PACKETS, thread_cpu_micros() - cpu);
+    cpu = thread_cpu_micros();
+
+    if (branch->result >= 0) {
+
+        branch->result = avcodec_send_frame(branch->encoder_ctx, NULL);
+
+        if (branch->result >= 0) {
+            branch->result = write_encoded(branch);
+        }
+
+        // the audio filter or aac encoder holds the last packets
+        if (branch->result >= 0) {
+            branch->result = plan_flush(&branch->audio, branch->output_ctx);
+        }
+
+        if (branch->result >= 0) {
+            branch->result = av_write_trailer(branch->output_ctx);
+        }
+    }
+
+    stage_add_cpu(branch->report, JOB_STAGE_TRAILER, thread_cpu_micros() - cpu);
+
+    return NULL;
+}
+
+/*
+this function receives every pending frame from the decoder and hands a
+reference of it to each branch. keyframes are forced at the same
+timestamps in every rendition so the variants stay segment aligned
+*/
+static int fan_out_frames(AVCodecContext *decoder_ctx, AVFrame *frame, LadderBranch *branches, int nb_branches, int64_t *next_keyframe, int64_t keyframe_interval) {
+
+    while (1) {
+
+        int result = avcodec_receive_frame(decoder_ctx, frame);
+        {
+            if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+                return 0;
+            }
+
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        frame->pts = frame->best_effort_timestamp;
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+        if (frame->pts != AV_NOPTS_VALUE && (*next_keyframe == AV_NOPTS_VALUE || frame->pts >= *next_keyframe)) {
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            *next_keyframe = frame->pts + keyframe_interval;
+        }
+
+        for (int i = 0; i < nb_branches; i++) {
+
+            AVFrame *ref = av_frame_clone(frame);
+            {
+                if (ref == NULL) {
+                    av_frame_unref(frame);
+                    return AVERROR(ENOMEM);
+                }
+            }
+
+            queue_push(&branches[i].queue, (LadderItem){ ref, NULL });
+        }
+
+        av_frame_unref(frame);
+    }
+}
+
+/*
+this function writes master.m3u8, fmp4 variants map an init segment
+(EXT-X-MAP), which needs version 7. the audio is described by the stream
+of the variants, encoded to aac when the source audio was not carried
+*/
+static int write_master_playlist(const char *output_dir, const LadderBranch *branches, int nb_branches, SegmentFormat format) {
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/master.m3u8", output_dir);
+
+    FILE *file = fopen(path, "w");
+    {
+        if (!file) {
+            perror("Error: Could not open master playlist");
+            return AVERROR(errno);
+        }
+    }
+
+    // every variant carries the same audio
+    const AVCodecParameters *audio_par = branches[0].audio_index >= 0 ? branches[0].output_ctx->streams[branches[0].audio_index]->codecpar : NULL;
+
+    int64_t audio_bitrate = 0;
+    {
+        if (audio_par) {
+            audio_bitrate = audio_par->bit_rate > 0 ? audio_par->bit_rate : 128000;
+        }
+    }
+
+    // players pick a variant they can decode without fetching it first
+    const char *audio = audio_par ? audio_codec(audio_par) : NULL;
+
+    fprintf(file, "#EXTM3U\n#EXT-X-VERSION:%d\n#EXT-X-INDEPENDENT-SEGMENTS\n", format == SEGMENT_TS ? 3 : 7);
+
+    for (int i = 0; i < nb_branches; i++) {
+
+        int64_t average = branches[i].rendition.VideoBitrate + audio_bitrate;
+        int64_t peak = branches[i].encoder_ctx->rc_max_rate + audio_bitrate;
+
+        fprintf(file, "#EXT-X-STREAM-INF:BANDWIDTH=%" PRId64 ",AVERAGE-BANDWIDTH=%" PRId64 ",RESOLUTION=%dx%d",
+            peak, average, branches[i].width, branches[i].height);
+
+        // CODECS has to list every codec of the variant, it is left out when one is unknown
+        if (branches[i].codecs[0] != '\0' && (audio_par == NULL || audio)) {
+            fprintf(file, ",CODECS=\"%s%s%s\"", branches[i].codecs, audio ? "," : "", audio ? audio : "");
+        }
+
+        fprintf(file, "\n%s/index.m3u8\n", branches[i].rendition.Name);
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/*
+this function builds an adaptive bitrate ladder from the input
+the video is decoded once, every decoded frame is fanned out to one
+scaler+encoder branch per rendition, each running on its own thread and
+writing <output_dir>/<name>/index.m3u8. master.m3u8 lists the variants
+*/
+int abr_ladder(AVFormatContext *input_ctx, const char *output_dir, const Rendition *renditions, int nb_renditions, SegmentFormat format, JobReport *report) {
+
+    int video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    {
+        if (video_index < 0) {
+            fprintf(stderr, "Error: Could not find video stream.\n");
+            return 1;
+        }
+    }
+
+    int audio_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_AUDIO, -1, video_index, NULL, 0);
+
+    AVStream *video_stream = input_ctx->streams[video_index];
+    AVStream *audio_stream = audio_index >= 0 ? input_ctx->streams[audio_index] : NULL;
+
+    const AVCodec *decoder = avcodec_find_decoder(video_stream->codecpar->codec_id);
+    {
+        if (decoder == NULL) {
+            fprintf(stderr, "Error: Could not find video decoder.\n");
+            return 1;
+        }
+    }
+
+    AVCodecContext *decoder_ctx = avcodec_alloc_context3(decoder);
+    {
+        if (decoder_ctx == NULL) {
+            return 1;
+        }
+
+        int result = avcodec_parameters_to_context(decoder_ctx, video_stream->codecpar);
+        {
+            if (result < 0) {
+                avcodec_free_context(&decoder_ctx);
+                return 1;
+            }
+        }
+
+        decoder_ctx->pkt_timebase = video_stream->time_base;
+        decoder_ctx->thread_count = 0; // one decode for all renditions, let it use every core
+
+        result = avcodec_open2(decoder_ctx, decoder, NULL);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not open video decoder.\n");
+                avcodec_free_context(&decoder_ctx);
+                return 1;
+            }
+        }
+    }
+
+    if (nb_renditions > LADDER_MAX_RENDITIONS) {
+        nb_renditions = LADDER_MAX_RENDITIONS;
+    }
+
+    /*
+    this block picks the renditions, upscaling is pointless so renditions
+    taller than the source are skipped. if none is left the source height
+    is used with the bitrate of the smallest rendition
+    */
+    LadderBranch branches[LADDER_MAX_RENDITIONS];
+    int nb_branches = 0;
+    {
+        memset(branches, 0, sizeof(branches));
+
+        for (int i = 0; i < nb_renditions; i++) {
+            if (renditions[i].Height <= decoder_ctx->height) {
+                branches[nb_branches++].rendition = renditions[i];
+            }
+        }
+
+        if (nb_branches == 0 && nb_renditions > 0) {
+            branches[0].rendition = renditions[nb_renditions - 1];
+            branches[0].rendition.Height = decoder_ctx->height;
+            nb_branches = 1;
+        }
+
+        for (int i = 0; i < nb_branches; i++) {
+
+            LadderBranch *branch = &branches[i];
+
+            branch->height = branch->rendition.Height & ~1;
+            branch->width = (int)av_rescale(decoder_ctx->width, branch->height, decoder_ctx->height) & ~1;
+            snprintf(branch->output_dir, sizeof(branch->output_dir), "%s/%s", output_dir, branch->rendition.Name);
+
+            queue_init(&branch->queue);
+        }
+    }
+
+    int threads = FFMAX(1, av_cpu_count() / FFMAX(1, nb_branches));
+    int result = 0;
+
+    for (int i = 0; i < nb_branches && result >= 0; i++) {
+        result = open_branch(&branches[i], input_ctx, video_stream, audio_stream, threads, format, report);
+    }
+
+    for (int i = 0; i < nb_branches && result >= 0; i++) {
+        if (pthread_create(&branches[i].thread, NULL, branch_thread, &branches[i]) != 0) {
+            fprintf(stderr, "Error: Could not start rendition thread.\n");
+            result = AVERROR(EAGAIN);
+            break;
+        }
+
+        branches[i].started = 1;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    {
+        if (packet == NULL || frame == NULL) {
+            result = AVERROR(ENOMEM);
+        }
+    }
+
+    int64_t keyframe_interval = av_rescale_q(LADDER_KEYFRAME_SECONDS, (AVRational){1, 1}, video_stream->time_base);
+    int64_t next_keyframe = AV_NOPTS_VALUE;
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    /*
+    this block is the single decode pass
+    video packets are decoded and the frames fanned out, audio packets are
+    handed to every branch as they are, everything else is dropped
+    */
+    while (result >= 0 && (result = av_read_frame(input_ctx, packet)) >= 0) {
+
+        report_packet(report, packet);
+        report_progress(report, packet->dts, input_ctx->streams[packet->stream_index]->time_base);
+
+        if (packet->stream_index == video_index) {
+
+            result = avcodec_send_packet(decoder_ctx, packet);
+            av_packet_unref(packet);
+
+            // a corrupt packet should not abort the whole ladder
+            if (result == AVERROR_INVALIDDATA) {
+                result = 0;
+                continue;
+            }
+
+            if (result >= 0) {
+                result = fan_out_frames(decoder_ctx, frame, branches, nb_branches, &next_keyframe, keyframe_interval);
+            }
+
+        } else if (packet->stream_index == audio_index) {
+
+            for (int i = 0; i < nb_branches && result >= 0; i++) {
+
+                AVPacket *ref = av_packet_clone(packet);
+                {
+                    if (ref == NULL) {
+                        result = AVERROR(ENOMEM);
+                        break;
+                    }
+                }
+
+                queue_push(&branches[i].queue, (LadderItem){ NULL, ref });
+            }
+
+            av_packet_unref(packet);
+
+        } else {
+            av_packet_unref(packet);
+        }
+    }
+
+    if (result == AVERROR_EOF) {
+
+        // flush the frames the decoder is still holding
+        result = avcodec_send_packet(decoder_ctx, NULL);
+
+        if (result >= 0) {
+            result = fan_out_frames(decoder_ctx, frame, branches, nb_branches, &next_keyframe, keyframe_interval);
+        }
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "Error: ABR decode failed: %s\n", av_err2str(result));
+    }
+
+    // the branches drain their queues and write their trailers while they are joined
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
+    for (int i = 0; i < nb_branches; i++) {
+
+        queue_finish(&branches[i].queue);
+
+        if (branches[i].started) {
+            pthread_join(branches[i].thread, NULL);
+        }
+
+        if (branches[i].result < 0 && result >= 0) {
+            result = branches[i].result;
+        }
+    }
+
+    stage_end(report, JOB_STAGE_TRAILER, &clock);
+
+    if (result >= 0) {
+        result = write_master_playlist(output_dir, branches, nb_branches, format);
+    }
+
+    for (int i = 0; i < nb_branches; i++) {
+        close_branch(&branches[i]);
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&decoder_ctx);
+
+    return result < 0 ? 1 : 0;
+}
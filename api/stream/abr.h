@@ -0,0 +1,35 @@
+#ifndef ABR_H
+#define ABR_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "../../core/probe.h"
+#include "remux.h"
+
+// frames buffered per branch before the decoder waits for the slowest encoder
+#define LADDER_QUEUE_SIZE 8
+
+// forced keyframe interval, the same for every rendition so players can
+// switch between variants on any segment boundary
+#define LADDER_KEYFRAME_SECONDS 2
+
+#define LADDER_MAX_RENDITIONS 8
+
+typedef struct {
+    char Name[16];        // directory of the variant, e.g. "720p"
+    int Height;           // width follows the source aspect ratio
+    int64_t VideoBitrate; // bits per second
+} Rendition;
+
+// 1080p/720p/480p/360p, renditions taller than the source are skipped
+extern const Rendition default_ladder[];
+extern const int default_ladder_size;
+
+// libx264 when available, otherwise any H.264 encoder
+const AVCodec* find_h264_encoder(void);
+
+int abr_ladder(AVFormatContext *input_ctx, const char *output_dir, const Rendition *renditions, int nb_renditions, SegmentFormat format, JobReport *report);
+
+#endif
@@ -5,11 +5,25 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include "cgompeg.h"
-
-#define TEMP_FILE "tmp/temp.mp4"
+#include "ingest.h"
+#include "remux.h"
+#include "plan.h"
+#include "abr.h"
+#include "gop.h"
+#include "llhls.h"
+#include "live.h"
+#include "read_pipe.h"
+#include "../../core/mapped.h"
+
+// file names inside the per-job directories (see JobConfig)
+#define TEMP_FILE "temp.mp4"
+#define SPILL_FILE "spill.mp4"
+#define PLAYLIST_FILE "output.m3u8"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #include "libavformat/avformat.h"
@@ -20,26 +34,89 @@
  
 #ifdef _WIN32
     #include <direct.h>  // For _mkdir on Windows
+    #define make_dir(path) _mkdir(path)
+#else
+    #define make_dir(path) mkdir(path, 0777)
 #endif
 
-static int custom_read(void *opaque, uint8_t *buf, int buf_size) {
-    
-    FILE *file = (FILE*)opaque;
-    
-    size_t bytes_read = fread(buf, 1, buf_size, file);
-    {
-        if (bytes_read == 0) {
-            return AVERROR_EOF;
+// used when a caller passes no JobConfig, matches the old fixed layout
+static const JobConfig default_job = { .JobID = "", .WorkDir = "tmp", .OutputDir = "outputs", .IoBackend = IO_BACKEND_MMAP };
+
+/*
+this function creates a directory and all of its missing parents (mkdir -p)
+it is fine if the directory already exists
+*/
+int make_dirs(const char *path) {
+
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+
+    for (char *p = buffer + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            make_dir(buffer);
+            *p = '/';
         }
     }
 
-    return bytes_read;
+    if (make_dir(buffer) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    return 0;
 }
 
-// int custom_read(void *opaque, uint8_t *buf, int buf_size) {
-//     FILE *file = (FILE*)opaque;
-//     return fread(buf, 1, buf_size, file);
-// }
+// the sink of a job that keeps its outputs in memory, NULL when they go to OutputDir
+static HlsSink* job_sink(JobConfig *job) {
+    return job->Sink.Func ? &job->Sink : NULL;
+}
+
+/*
+this function creates the working and output directories of a job
+every job gets its own pair so concurrent conversions never share
+a temp file, a segment or a playlist. jobs with a sink write no outputs
+*/
+static int setup_job_dirs(JobConfig *job) {
+
+    if (make_dirs(job->WorkDir) < 0) {
+        fprintf(stderr, "Error: Could not create work directory '%s'.\n", job->WorkDir);
+        return -1;
+    }
+
+    if (job_sink(job) == NULL && make_dirs(job->OutputDir) < 0) {
+        fprintf(stderr, "Error: Could not create output directory '%s'.\n", job->OutputDir);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+this function returns the config a job runs with, starts its report and
+routes the FFmpeg messages of the calling thread to job->Log until
+end_job(). callers without a JobConfig get a copy of default_job in
+fallback, the job writes its JobReport into it
+*/
+static JobConfig* start_job(JobConfig *job, JobConfig *fallback) {
+
+    if (job == NULL) {
+        *fallback = default_job;
+        job = fallback;
+    }
+
+    job_report_init(&job->Report);
+    job_log_attach(&job->Log);
+
+    return job;
+}
+
+// the config may be gone once the entry point returned, so is its JobLog
+static int end_job(int result) {
+
+    job_log_attach(NULL);
+
+    return result;
+}
 
 /* 
 this function opens the input file and returns the context
@@ -75,22 +152,12 @@ AVFormatContext* open_input_file(const char *input_file) {
 }
 
 /*
-this function sets up the output file for hls
-it also copies the streams from the input to the output
-it also sets the hls options
+this function allocates the hls output context for output_dir/output_file
+without touching the disk, in-memory outputs never create output_dir
 */
-AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *input_ctx) {
-    
-    char m3u8_path[1024];
-    char output_dir[] = "outputs";
-    {   
-        #ifdef _WIN32
-            _mkdir(output_dir);
-        #else
-            mkdir(output_dir, 0777);
-        #endif
-    }
+static AVFormatContext* new_hls_output(const char *output_dir, const char *output_file) {
 
+    char m3u8_path[1024];
     snprintf(m3u8_path, sizeof(m3u8_path), "%s/%s", output_dir, output_file);
     AVFormatContext *output_ctx = NULL;
 
@@ -107,67 +174,94 @@ AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *inpu
         }
     }
 
-    /*
-    this block copies the streams from the input to the output
-    it also sets the codec parameters
-    */
-    for (int i = 0; i < input_ctx->nb_streams; i++) {
-        
-        AVStream *in_stream = input_ctx->streams[i];
-        
-        /*
-        this function allocates a new stream
-        it also sets the codec parameters as the same as the input stream. 
-        Example: video, audio, etc.
-        */
-        AVStream *out_stream = avformat_new_stream(output_ctx, NULL); 
-        {   
-            if (out_stream == NULL) {
-                fprintf(stderr, "Error: Failed to allocate output stream.\n");
-                return NULL;
-            }
-        }
+    return output_ctx;
+}
 
-        /*
-        this function copies the codec parameters from the input stream to the output stream
-        */
-        int result = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar);
-        {
-            if (result < 0) {
-                fprintf(stderr, "Error: Failed to copy codec parameters.\n");
-                return NULL;
-            }
-        }
+/*
+this function allocates the hls output context inside output_dir
+the caller adds the streams and then calls write_hls_header()
+*/
+AVFormatContext* alloc_hls_output(const char *output_dir, const char *output_file) {
 
-        out_stream->codecpar->codec_tag = 0;
+    if (make_dirs(output_dir) < 0) {
+        fprintf(stderr, "Error: Could not create output directory '%s'.\n", output_dir);
+        return NULL;
     }
 
+    return new_hls_output(output_dir, output_file);
+}
+
+/*
+this function sets the hls options and writes the header
+segments are written next to the playlist in output_dir
+the hls muxer has no partial segments, SEGMENT_LL_HLS is written as fmp4
+here; remux_to_hls() hands low latency remuxes to remux_to_llhls()
+the segments and bytes the muxer writes from here on are counted in report
+with a sink the files are handed to it instead of written to output_dir,
+with uring they are written to output_dir through io_uring
+a window above 0 makes a live playlist: only the last window segments are
+listed and the muxer deletes the ones that fell out, 0 lists them all
+*/
+int write_hls_header(AVFormatContext *output_ctx, const char *output_dir, SegmentFormat format, int window, HlsSink *sink, UringOutput *uring, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    if (sink) {
+        sink_hls_output(output_ctx, sink, report);
+    } else if (uring) {
+        uring_hls_output(output_ctx, uring, report);
+    } else {
+        watch_hls_output(output_ctx, report);
+    }
+
+    int fmp4 = format == SEGMENT_FMP4 || format == SEGMENT_LL_HLS;
+
     /*
     this block sets the hls options
     hls_time: the duration of each segment in seconds
     hls_list_size: the number of segments to keep in the playlist
     hls_segment_filename: the filename format for the segments
+    hls_segment_type: mpegts or fmp4, fmp4 also writes hls_fmp4_init_filename
+    next to the playlist
     */
     char segment_path[1024];
-    snprintf(segment_path, sizeof(segment_path), "%s/segment%%03d.ts", output_dir);
+    snprintf(segment_path, sizeof(segment_path), fmp4 ? "%s/segment%%03d.m4s" : "%s/segment%%03d.ts", output_dir);
    
     AVDictionary *options = NULL;
     { 
         av_dict_set(&options, "hls_time", "1", 0); // Segment duration
-        av_dict_set(&options, "hls_list_size", "0", 0); // Unlimited playlist size
+        av_dict_set_int(&options, "hls_list_size", window, 0); // 0 is an unlimited playlist size
         av_dict_set(&options, "hls_segment_filename", segment_path, 0);
         // av_dict_set(&options, "video_bitrate", "1000000", 0);
         // av_dict_set(&options, "audio_bitrate", "128000", 0);
-        // av_dict_set(&options, "hls_flags", "delete_segments", 0);
+
+        // sliding window, the disk use of a live job stays at about window segments
+        if (window > 0) {
+            av_dict_set(&options, "hls_flags", "delete_segments+program_date_time", 0);
+        }
+
+        if (fmp4) {
+            av_dict_set(&options, "hls_segment_type", "fmp4", 0);
+            av_dict_set(&options, "hls_fmp4_init_filename", LLHLS_INIT_FILE, 0);
+        }
+
+        // an event playlist is written to <playlist>.tmp and renamed on disk,
+        // a sink would only ever get the .tmp. a vod playlist is written once,
+        // under its own name, when the muxer finishes
+        if (sink) {
+            av_dict_set(&options, "hls_playlist_type", "vod", 0);
+        }
     }
     
     if (!(output_ctx->oformat->flags & AVFMT_NOFILE)) {
 
-        int result = avio_open(&output_ctx->pb, output_file, AVIO_FLAG_WRITE);
+        int result = avio_open(&output_ctx->pb, output_ctx->url, AVIO_FLAG_WRITE);
         {
             if (result < 0) {
-                fprintf(stderr, "Error: Could not open output file '%s'.\n", output_file);
-                return NULL;
+                fprintf(stderr, "Error: Could not open output file '%s'.\n", output_ctx->url);
+                av_dict_free(&options);
+                return -1;
             }
         }
     }
@@ -176,57 +270,128 @@ AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *inpu
     this block writes the header to the output file. Ex: in xxxxx.m3u8
     it also sets the hls options. Example: hls_time, hls_list_size, hls_segment_filename
     */
-    result = avformat_write_header(output_ctx, &options);
+    int result = avformat_write_header(output_ctx, &options);
     {
         if (result < 0) {
             fprintf(stderr, "Error: Could not write header to output file.\n");
-            return NULL;
+            av_dict_free(&options);
+            return -1;
         }
     }
 
     av_dict_free(&options);
+
+    stage_end(report, JOB_STAGE_HEADER, &clock);
     
-    return output_ctx;
+    return 0;
 }
 
 /*
-this function copies the packets from the input to the output
-it also sets the pts, dts, duration, and pos for the output packet
-it also unreferences the input packet
+this function sets up the output file for hls
+it also adds the output streams the way plan_streams() planned them, see plan.c
+it also sets the hls options
+on failure the plan is freed with the output
 */
-int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx) {
-    
-    AVPacket pkt;
+AVFormatContext* setup_hls_output(const char *output_dir, const char *output_file, AVFormatContext *input_ctx, SegmentFormat format, int window, RemuxPlan *plan, HlsSink *sink, UringOutput *uring, JobReport *report) {
     
-    /*
-    this block reads the packets from the input
-    it also sets the pts, dts, duration, and pos for the output packet
-    it also unreferences the input packet
-    */
-    while (av_read_frame(input_ctx, &pkt) >= 0) {
-        
-        AVStream *in_stream = input_ctx->streams[pkt.stream_index];
-        AVStream *out_stream = output_ctx->streams[pkt.stream_index];
-        {
-            pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.dts = av_rescale_q_rnd(pkt.dts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.duration = av_rescale_q(pkt.duration, in_stream->time_base, out_stream->time_base);
-            pkt.pos = -1;
+    AVFormatContext *output_ctx = sink ? new_hls_output(output_dir, output_file) : alloc_hls_output(output_dir, output_file);
+    {
+        if (output_ctx == NULL) {
+            return NULL;
         }
+    }
 
-        int result = av_interleaved_write_frame(output_ctx, &pkt);
+    // ts segments may be upgraded to fmp4 for video only fmp4 carries
+    int result = plan_streams(plan, input_ctx, output_ctx, &format);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not plan the output streams.\n");
+            free_plan(plan);
+            avformat_free_context(output_ctx);
+            return NULL;
+        }
+    }
+
+    result = write_hls_header(output_ctx, output_dir, format, window, sink, uring, report);
+    {
+        if (result < 0) {
+            free_plan(plan);
+            avformat_free_context(output_ctx);
+            return NULL;
+        }
+    }
+    
+    return output_ctx;
+}
+
+/*
+this function reads the next input packet into plan->input and writes it
+the way the plan of its stream says: copied, filtered, transcoded or dropped
+the packet is the same for the whole job and blank again on return, so
+the loop itself allocates nothing, what the demuxer and the muxer allocate
+per packet is measured by bench/alloc_bench.c
+it returns 1 for a packet, 0 at the end of the input, < 0 when writing failed
+*/
+int remux_packet(AVFormatContext *input_ctx, AVFormatContext *output_ctx, RemuxPlan *plan, JobReport *report) {
+
+    AVPacket *packet = plan->input;
+
+    // read errors end the input like the end of the file does
+    if (av_read_frame(input_ctx, packet) < 0) {
+        return 0;
+    }
+
+    report_packet(report, packet);
+    report_progress(report, packet->dts, input_ctx->streams[packet->stream_index]->time_base);
+
+    // keyframes are decoded from the same packet, before the copy consumes it
+    if (plan->thumbs) {
+
+        int result = thumbs_packet(plan->thumbs, packet);
         {
             if (result < 0) {
-                fprintf(stderr, "Error: Failed to write frame to output file.\n");
-                av_packet_unref(&pkt);
-                return -1;
+                av_packet_unref(packet);
+                return result;
             }
         }
+    }
+
+    // the packet is unreferenced by plan_write_packet() in every case
+    int result = plan_write_packet(plan, input_ctx, output_ctx, packet);
+
+    return result < 0 ? result : 1;
+}
+
+/*
+this function copies the packets from the input to the output with
+remux_packet(), the filters and encoders are flushed before the trailer
+*/
+int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx, RemuxPlan *plan, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    int result;
+
+    while ((result = remux_packet(input_ctx, output_ctx, plan, report)) > 0);
 
-        av_packet_unref(&pkt);
+    if (result < 0) {
+        fprintf(stderr, "Error: Failed to write frame to output file.\n");
+        return -1;
     }
 
-    int result = av_write_trailer(output_ctx);
+    result = plan_flush(plan, output_ctx);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Failed to flush the output streams.\n");
+            return -1;
+        }
+    }
+
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
+    result = av_write_trailer(output_ctx);
     {
         if (result < 0) {
             fprintf(stderr, "Error: Failed to write trailer to output file.\n");
@@ -234,43 +399,141 @@ int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx) {
         }
     }
 
+    stage_end(report, JOB_STAGE_TRAILER, &clock);
+
     return 0;
 }
 
-int cmd(const char *input_file, const char *output_file) {
-    
-    av_log_set_level(AV_LOG_QUIET);
+/*
+this function remuxes an already opened input into hls
+it is shared by cmd(), which opens the input by path, and stream_pipe(),
+which demuxes straight from the upload pipe
+with a sink nothing is written to output_dir, see sink.c
+IO_BACKEND_URING writes the files through io_uring when the kernel has it
+thumbnails > 0 adds scrub thumbnails that many seconds apart, see thumbs.c
+*/
+int remux_to_hls(AVFormatContext *input_ctx, const char *output_dir, const char *output_file, SegmentFormat format, HlsSink *sink, IoBackend io, int thumbnails, JobReport *report) {
 
-    AVFormatContext *input_ctx = open_input_file(input_file);
-    { 
-        if (input_ctx == NULL) { 
-            fprintf(stderr, "Error: Could not open input file.\n");
+    if (format == SEGMENT_LL_HLS) {
+
+        // the partial segments are written by llhls.c itself, not by the hls muxer
+        if (sink) {
+            fprintf(stderr, "Error: LL-HLS outputs can not be kept in memory.\n");
             return 1;
-        };
+        }
+
+        return remux_to_llhls(input_ctx, output_dir, output_file, report) < 0 ? 1 : 0;
     }
 
-    AVFormatContext *output_ctx = setup_hls_output(output_file, input_ctx);
+    RemuxPlan plan;
+
+    UringOutput uring_output;
+    UringOutput *uring = !sink && io == IO_BACKEND_URING && uring_available() ? &uring_output : NULL;
+
+    AVFormatContext *output_ctx = setup_hls_output(output_dir, output_file, input_ctx, format, 0, &plan, sink, uring, report);
     {
         if (output_ctx == NULL) {
             fprintf(stderr, "Error: Could not setup HLS output.\n");
-            avformat_close_input(&input_ctx);
-            avformat_free_context(output_ctx);
+
+            if (sink) {
+                sink_release(sink);
+            }
             return 1;
         }
     }
 
-    int result = copy_packets(input_ctx, output_ctx);
-    {   
-        if (result < 0) {
-            avformat_close_input(&input_ctx);
-            avformat_free_context(output_ctx);
-            return 1;
+    // the sheets are written to output_dir, in memory outputs go without them
+    if (thumbnails > 0 && !sink) {
+        plan.thumbs = thumbs_open(input_ctx, output_dir, thumbnails);
+    }
+
+    int result = copy_packets(input_ctx, output_ctx, &plan, report);
+
+    if (plan.thumbs) {
+
+        if (result == 0 && thumbs_finish(plan.thumbs) < 0) {
+            fprintf(stderr, "Error: Could not write the thumbnails.\n");
+            result = -1;
         }
+
+        thumbs_free(&plan.thumbs);
     }
-    
+
+    free_plan(&plan);
+    avformat_free_context(output_ctx);
+
+    if (sink) {
+        sink_release(sink);
+    }
+
+    if (result < 0) {
+        return 1;
+    }
+
+    // the muxer does not check io_close2, a file the sink rejected or a failed write shows up here
+    if ((sink && sink->failed) || (uring && uring->failed)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+this function returns the reader of a job's input file for io, NULL when
+libavformat opens the file by path: IO_BACKEND_POSIX, or a file that
+could not be mapped. mapped is filled in for IO_BACKEND_MMAP
+*/
+static AVIOContext* open_input_io(const char *input_file, IoBackend io, MappedInput *mapped) {
+
+    mapped->data = NULL;
+    mapped->size = 0;
+
+    switch (io) {
+        case IO_BACKEND_URING: return uring_open_read(input_file);
+        case IO_BACKEND_MMAP: return map_input(mapped, input_file, 1) == 0 ? mapped_io(mapped) : NULL;
+        default: return NULL;
+    }
+}
+
+// after avformat_close_input
+static void close_input_io(AVIOContext **pb, IoBackend io, MappedInput *mapped) {
+
+    if (io == IO_BACKEND_URING) {
+        uring_close_read(pb);
+    } else {
+        free_mapped_io(pb);
+    }
+
+    unmap_input(mapped);
+}
+
+/*
+this function converts a file on disk into hls inside job->OutputDir
+IO_BACKEND_URING jobs read the file through a ring with read-ahead,
+IO_BACKEND_MMAP jobs straight from the page cache
+*/
+static int convert_file(const char *input_file, const char *output_file, JobConfig *job) {
+
+    MappedInput mapped;
+    AVIOContext *pb = open_input_io(input_file, job->IoBackend, &mapped);
+
+    AVFormatContext *input_ctx = open_input_probed_io(input_file, pb, &job->Probe, &job->Report);
+    { 
+        if (input_ctx == NULL) { 
+            fprintf(stderr, "Error: Could not open input file.\n");
+            close_input_io(&pb, job->IoBackend, &mapped);
+            return 1;
+        };
+    }
+
+    int result = remux_to_hls(input_ctx, job->OutputDir, output_file, job->SegmentFormat, job_sink(job), job->IoBackend, job->Thumbnails, &job->Report);
     {
         avformat_close_input(&input_ctx);
-        avformat_free_context(output_ctx);
+        close_input_io(&pb, job->IoBackend, &mapped);
+
+        if (result != 0) {
+            return 1;
+        }
     }
 
     printf("HLS conversion completed successfully.\n");
@@ -278,49 +541,278 @@ int cmd(const char *input_file, const char *output_file) {
     return 0;
 }
 
+int cmd(const char *input_file, const char *output_file) {
+
+    JobConfig fallback;
+    return end_job(convert_file(input_file, output_file, start_job(NULL, &fallback)));
+}
+
+
+/*
+this function copies everything from the pipe into path with drain_pipe()
+*/
+static int spool_pipe(int fd, const char *path, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
 
-int read_pipe(int fd, MetaData *metadata) {
-    // Create tmp directory if it doesn't exist
-    #ifdef _WIN32
-        _mkdir("tmp");
-    #else
-        mkdir("tmp", 0777);
-    #endif
+    // create .mp4 file
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        perror("Error: Could not open file descriptor as a file");
+        return -1;
+    }
 
-    // debug hls
+    int64_t spooled = drain_pipe(fd, file);
+
+    close(file);  // Close file before passing to cmd
+
+    if (spooled < 0) {
+        perror("Error: Could not read the upload from the pipe");
+        return -1;
+    }
 
-    av_log_set_level(AV_LOG_DEBUG);
+    stage_end(report, JOB_STAGE_SPOOL, &clock);
+
+    return 0;
+}
+
+/*
+this function spools the upload to TEMP_FILE and converts it like cmd()
+*/
+static int spool_and_convert(int fd, JobConfig *job) {
+
+    // Create the job directories if they don't exist
+    if (setup_job_dirs(job) < 0) {
+        return 1;
+    }
 
     // printf("file size: %" PRId64 "\n", metadata->FileSize);
     // printf("extension: %s\n", metadata->Extension);
     // printf("mime type: %s\n", metadata->MimeType);
     // printf("resolution: %s\n", metadata->Resolution);
 
-    // create .mp4 file
-    FILE *file = fopen(TEMP_FILE, "wb");
-    if (!file) {
-        perror("Error: Could not open file descriptor as a file");
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s/%s", job->WorkDir, TEMP_FILE);
+
+    if (spool_pipe(fd, temp_path, &job->Report) < 0) {
         return 1;
     }
 
-    // read from pipe
-    char buffer[1024];
-    ssize_t bytes_read;
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        fwrite(buffer, 1, bytes_read, file);
+    // Process the video
+    int result = convert_file(temp_path, PLAYLIST_FILE, job);
+
+    // Clean up temp file and the (now empty) work directory
+    remove(temp_path);
+    remove(job->WorkDir);
+
+    return result;
+}
+
+int read_pipe(int fd, MetaData *metadata, JobConfig *job) {
+
+    (void)metadata;
+
+    JobConfig fallback;
+    job = start_job(job, &fallback);
+
+    return end_job(spool_and_convert(fd, job));
+}
+
+typedef enum {
+    PIPE_JOB_REMUX = 0, // stream copy into a single playlist
+    PIPE_JOB_ABR   = 1, // decode once, encode the default ladder
+} PipeJobKind;
+
+/*
+this function demuxes the upload straight from the pipe
+unlike read_pipe() it does not wait for the whole upload to land in
+TEMP_FILE, so segments are written while the upload is still arriving.
+mp4 files with the moov box at the end can not be demuxed without seeking,
+those are spilled to memory (or to SPILL_FILE past INGEST_SPILL_MAX) first
+*/
+static int run_pipe_job(int fd, JobConfig *job, PipeJobKind kind) {
+
+    // the ladder writes its master playlist and renditions itself
+    if (kind == PIPE_JOB_ABR && job_sink(job)) {
+        fprintf(stderr, "Error: ABR outputs can not be kept in memory.\n");
+        return 1;
+    }
+
+    // Create the job directories, the work dir holds the spill file
+    if (setup_job_dirs(job) < 0) {
+        return 1;
     }
 
-    fclose(file);  // Close file before passing to cmd
+    char spill_path[1024];
+    snprintf(spill_path, sizeof(spill_path), "%s/%s", job->WorkDir, SPILL_FILE);
 
-    // Process the video
-    int result = cmd(TEMP_FILE, "output.m3u8");
+    IngestSource source;
+
+    AVFormatContext *input_ctx = open_input_pipe(&source, fd, spill_path, &job->Probe, &job->Report);
+    {
+        if (input_ctx == NULL) {
+            fprintf(stderr, "Error: Could not open input pipe.\n");
+            return 1;
+        }
+    }
+
+    int result;
+    {
+        if (kind == PIPE_JOB_ABR) {
+            result = abr_ladder(input_ctx, job->OutputDir, default_ladder, default_ladder_size, job->SegmentFormat, &job->Report);
+        } else {
+            result = remux_to_hls(input_ctx, job->OutputDir, PLAYLIST_FILE, job->SegmentFormat, job_sink(job), job->IoBackend, job->Thumbnails, &job->Report);
+        }
+
+        close_input_pipe(&input_ctx, &source);
+        remove(job->WorkDir);
+
+        if (result != 0) {
+            return 1;
+        }
+    }
+
+    printf("HLS conversion completed successfully.\n");
+
+    return 0;
+}
+
+int stream_pipe(int fd, MetaData *metadata, JobConfig *job) {
+
+    (void)metadata;
+
+    JobConfig fallback;
+    job = start_job(job, &fallback);
+
+    return end_job(run_pipe_job(fd, job, PIPE_JOB_REMUX));
+}
+
+/*
+this function is stream_pipe() with an adaptive bitrate ladder instead of
+a stream copy, it writes master.m3u8 plus one variant per rendition
+*/
+int abr_pipe(int fd, MetaData *metadata, JobConfig *job) {
+
+    (void)metadata;
+
+    JobConfig fallback;
+    job = start_job(job, &fallback);
+
+    return end_job(run_pipe_job(fd, job, PIPE_JOB_ABR));
+}
+
+/*
+this function transcodes the upload to h264 with gop_transcode()
+the chunk workers seek into the input, so the upload is spooled to
+TEMP_FILE first like read_pipe() does
+*/
+static int spool_and_transcode(int fd, JobConfig *job) {
+
+    if (job_sink(job)) {
+        fprintf(stderr, "Error: Transcoded outputs can not be kept in memory.\n");
+        return 1;
+    }
+
+    if (setup_job_dirs(job) < 0) {
+        return 1;
+    }
+
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s/%s", job->WorkDir, TEMP_FILE);
+
+    if (spool_pipe(fd, temp_path, &job->Report) < 0) {
+        return 1;
+    }
 
-    // Clean up temp file
-    remove(TEMP_FILE);
+    int result = gop_transcode(temp_path, job->OutputDir, PLAYLIST_FILE, job->Threads, job->SegmentFormat, job->IoBackend, &job->Probe, &job->Report);
+
+    remove(temp_path);
+    remove(job->WorkDir);
 
     return result;
 }
 
+int transcode_pipe(int fd, MetaData *metadata, JobConfig *job) {
+
+    (void)metadata;
+
+    JobConfig fallback;
+    job = start_job(job, &fallback);
+
+    return end_job(spool_and_transcode(fd, job));
+}
+
+/*
+this function is the TaskFunc of an UploadTask, it runs the entry point of
+the task's Kind on an executor thread
+*/
+int run_upload_task(Task *task) {
+
+    UploadTask *upload = (UploadTask*)task;
+    MetaData metadata = { 0 };
+
+    switch (upload->Kind) {
+        case UPLOAD_SPOOL: return read_pipe(upload->Fd, &metadata, &upload->Job);
+        case UPLOAD_ABR: return abr_pipe(upload->Fd, &metadata, &upload->Job);
+        case UPLOAD_TRANSCODE: return transcode_pipe(upload->Fd, &metadata, &upload->Job);
+        default: return stream_pipe(upload->Fd, &metadata, &upload->Job);
+    }
+}
+
+/*
+this function remuxes a continuous mpeg-ts or flv stream from url into a
+sliding window playlist inside job->OutputDir until the source ends, goes
+silent or live_stop() is called; it returns 0 for all three
+format is the demuxer name ("mpegts", "flv"), empty to probe it
+*/
+static int ingest_live(const char *url, const char *format, JobConfig *job) {
+
+    // the muxer deletes the segments that leave the window, that needs files
+    if (job_sink(job) || job->SegmentFormat == SEGMENT_LL_HLS) {
+        fprintf(stderr, "Error: Live jobs write ts or fmp4 segments to disk.\n");
+        return 1;
+    }
+
+    if (make_dirs(job->OutputDir) < 0) {
+        fprintf(stderr, "Error: Could not create output directory '%s'.\n", job->OutputDir);
+        return 1;
+    }
+
+    LiveInput live = { .stop = &job->Stop };
+
+    AVFormatContext *input_ctx = open_live_input(url, format, &job->Probe, &live, &job->Report);
+    {
+        if (input_ctx == NULL) {
+            return 1;
+        }
+    }
+
+    int window = job->LiveWindow > 0 ? job->LiveWindow : LIVE_DEFAULT_WINDOW;
+
+    int result = remux_live(input_ctx, &live, job->OutputDir, PLAYLIST_FILE, job->SegmentFormat, window, &job->Report);
+
+    avformat_close_input(&input_ctx);
+
+    return result < 0 ? 1 : 0;
+}
+
+int live_ingest(const char *url, const char *format, JobConfig *job) {
+
+    JobConfig fallback;
+    job = start_job(job, &fallback);
+
+    return end_job(ingest_live(url, format, job));
+}
+
+/*
+this function ends a running live_ingest() of job at its next read, it
+may be called from any thread
+*/
+void live_stop(JobConfig *job) {
+    __atomic_store_n(&job->Stop, 1, __ATOMIC_RELAXED);
+}
+
 // // Define thread argument struct
 // struct ThreadArgs {
 //     int fd;
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+#include "../../core/probe.h"
+#include "../../core/executor.h"
+#include "sink.h"
+#include "uring.h"
+
 // Define the struct first
 typedef struct {
     int64_t FileSize;
@@ -11,7 +16,48 @@ typedef struct {
     char Resolution[32];
 } MetaData;
 
-// Then declare the function
-int read_pipe(int fd, MetaData *metadata);
+// Per-job directories, every conversion works in its own pair so
+// concurrent uploads never overwrite each other's files
+typedef struct {
+    char JobID[64];
+    char WorkDir[512];   // temp and spill files, removed after the job
+    char OutputDir[512]; // playlist and segments
+    int SegmentFormat;   // SegmentFormat of remux.h, SEGMENT_TS when zero
+    ProbeOptions Probe;  // probe budget and probe cache of the job
+    HlsSink Sink;        // keeps the outputs in memory when Sink.Func is set, copy mode only
+    int LiveWindow;      // segments listed by a live playlist, LIVE_DEFAULT_WINDOW when zero
+    int Stop;            // set by live_stop(), ends a live job
+    int IoBackend;       // IoBackend of uring.h, IO_BACKEND_POSIX when zero
+    int Threads;         // GOP workers of a transcode job, one per core when zero
+    int Thumbnails;      // seconds between scrub thumbnails of a copy job, none when zero
+    JobLog Log;          // FFmpeg messages of the job, dropped when Log.Func is NULL
+    JobReport Report; // filled in by the job
+} JobConfig;
+
+// Entry point an UploadTask runs
+typedef enum {
+    UPLOAD_STREAM    = 0, // stream_pipe()
+    UPLOAD_SPOOL     = 1, // read_pipe()
+    UPLOAD_ABR       = 2, // abr_pipe()
+    UPLOAD_TRANSCODE = 3, // transcode_pipe()
+} UploadKind;
+
+// A conversion of an upload pipe for an Executor, allocated in C memory by
+// the caller since it outlives the submitting call
+typedef struct {
+    Task Task;     // first, run_upload_task() is its Func
+    int Kind;      // UploadKind
+    int Fd;        // read end of the upload pipe
+    JobConfig Job; // Job.Report is read once the task is done
+} UploadTask;
+
+// Then declare the functions
+int run_upload_task(Task *task);
+int read_pipe(int fd, MetaData *metadata, JobConfig *job);
+int stream_pipe(int fd, MetaData *metadata, JobConfig *job);
+int abr_pipe(int fd, MetaData *metadata, JobConfig *job);
+int transcode_pipe(int fd, MetaData *metadata, JobConfig *job);
+int live_ingest(const char *url, const char *format, JobConfig *job);
+void live_stop(JobConfig *job);
 
 #endif
\ No newline at end of file
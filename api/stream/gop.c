@@ -0,0 +1,1005 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "gop.h"
+#include "abr.h"
+#include "remux.h"
+#include "../../core/mapped.h"
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+#include "libavutil/cpu.h"
+#include "libavutil/error.h"
+
+// one independent range of the video, decoded and encoded by a single worker
+typedef struct {
+    int64_t start; // pts of the keyframe the chunk starts on, video time base
+    int64_t end;   // pts of the next chunk's keyframe, INT64_MAX for the last chunk
+
+    AVPacket **packets; // encoded packets, in the video time base
+    int nb_packets;
+    int capacity;
+
+    int done;
+    int result;
+} GopChunk;
+
+typedef struct {
+    const char *input_file;
+    MappedInput mapped; // the input when the job maps it, shared by every reader below
+
+    int video_index;
+    AVRational time_base; // video stream time base, also used by the encoders
+    AVRational frame_rate;
+    AVRational sample_aspect_ratio;
+    int width;
+    int height;
+    int global_header;
+
+    GopChunk *chunks;
+    int nb_chunks;
+
+    int next_chunk; // next chunk handed to a worker
+    int next_write; // next chunk the muxer is waiting for
+    int max_ahead;
+    int aborted;
+
+    int codec_threads; // of every decoder and encoder: 1 next to other workers, 0 (their own threads) for a single one
+
+    JobReport *report; // shared by the workers, the counters are atomic
+    const JobLog *log; // of the job thread, the workers log to it too
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} GopJob;
+
+typedef struct {
+    GopJob *job;
+    pthread_t thread;
+    int started;
+
+    AVFormatContext *input_ctx;
+    AVIOContext *pb; // reader of job->mapped, NULL when the input is opened by path
+    AVCodecContext *decoder_ctx;
+    struct SwsContext *sws_ctx;
+    AVFrame *frame;
+    AVFrame *converted;
+    AVPacket *packet;
+} GopWorker;
+
+static int add_chunk(GopJob *job, int64_t start) {
+
+    GopChunk *chunks = av_realloc_array(job->chunks, job->nb_chunks + 1, sizeof(*chunks));
+    {
+        if (chunks == NULL) {
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    job->chunks = chunks;
+
+    if (job->nb_chunks > 0) {
+        job->chunks[job->nb_chunks - 1].end = start;
+    }
+
+    memset(&job->chunks[job->nb_chunks], 0, sizeof(GopChunk));
+    job->chunks[job->nb_chunks].start = start;
+    job->chunks[job->nb_chunks].end = INT64_MAX;
+    job->nb_chunks++;
+
+    return 0;
+}
+
+/*
+this function merges the keyframes into chunks of about GOP_CHUNK_SECONDS
+every chunk starts on a keyframe so the chunks can be decoded and encoded
+independently of each other
+*/
+static int build_chunks(GopJob *job, const int64_t *keyframes, int nb_keyframes) {
+
+    int64_t chunk_length = av_rescale_q(GOP_CHUNK_SECONDS, (AVRational){1, 1}, job->time_base);
+    int64_t last_start = AV_NOPTS_VALUE;
+
+    for (int i = 0; i < nb_keyframes; i++) {
+
+        if (last_start == AV_NOPTS_VALUE || keyframes[i] - last_start >= chunk_length) {
+
+            int result = add_chunk(job, keyframes[i]);
+            {
+                if (result < 0) {
+                    return result;
+                }
+            }
+
+            last_start = keyframes[i];
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function collects the keyframe pts of the video stream
+it only demuxes (no decoding)
+*/
+static int scan_keyframes(AVFormatContext *input_ctx, int video_index, int64_t **keyframes, int *nb_keyframes) {
+
+    int capacity = 0;
+
+    AVPacket *packet = av_packet_alloc();
+    int result = packet ? 0 : AVERROR(ENOMEM);
+
+    while (result >= 0 && (result = av_read_frame(input_ctx, packet)) >= 0) {
+
+        int64_t pts = packet->pts;
+
+        // keyframes come in presentation order, anything else is a broken timestamp
+        if (packet->stream_index == video_index && (packet->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE &&
+            (*nb_keyframes == 0 || pts > (*keyframes)[*nb_keyframes - 1])) {
+
+            if (*nb_keyframes == capacity) {
+
+                capacity = FFMAX(256, capacity * 2);
+
+                int64_t *grown = av_realloc_array(*keyframes, capacity, sizeof(int64_t));
+                if (grown == NULL) {
+                    result = AVERROR(ENOMEM);
+                    av_packet_unref(packet);
+                    break;
+                }
+
+                *keyframes = grown;
+            }
+
+            (*keyframes)[(*nb_keyframes)++] = pts;
+        }
+
+        av_packet_unref(packet);
+    }
+
+    av_packet_free(&packet);
+
+    return result == AVERROR_EOF ? 0 : result;
+}
+
+/*
+this function opens a reader of the job input: through a reader of its own
+on the job's mapping when the input is mapped, by path otherwise. *pb is
+freed with free_mapped_io() after avformat_close_input
+*/
+static AVFormatContext* open_job_input(const GopJob *job, AVIOContext **pb, const ProbeOptions *probe, JobReport *report) {
+
+    *pb = mapped_io(&job->mapped);
+
+    AVFormatContext *input_ctx = open_input_probed_io(job->input_file, *pb, probe, report);
+    {
+        if (input_ctx == NULL) {
+            free_mapped_io(pb);
+        }
+    }
+
+    return input_ctx;
+}
+
+/*
+this function probes the input and splits the video into chunks
+the keyframe index comes from the probe cache when the same content was
+transcoded before, otherwise the input is demuxed once and the index is
+stored for the next time
+*/
+static int index_keyframes(GopJob *job, const ProbeOptions *probe, JobReport *report) {
+
+    AVIOContext *pb;
+    AVFormatContext *input_ctx = open_job_input(job, &pb, probe, report);
+    {
+        if (input_ctx == NULL) {
+            return AVERROR(ENOENT);
+        }
+    }
+
+    job->video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    {
+        if (job->video_index < 0) {
+            fprintf(stderr, "Error: Could not find video stream.\n");
+            avformat_close_input(&input_ctx);
+            free_mapped_io(&pb);
+            return job->video_index;
+        }
+    }
+
+    AVStream *video_stream = input_ctx->streams[job->video_index];
+    {
+        job->time_base = video_stream->time_base;
+        job->frame_rate = av_guess_frame_rate(input_ctx, video_stream, NULL);
+        job->sample_aspect_ratio = video_stream->codecpar->sample_aspect_ratio;
+        job->width = video_stream->codecpar->width;
+        job->height = video_stream->codecpar->height;
+
+        for (int i = 0; i < input_ctx->nb_streams; i++) {
+            input_ctx->streams[i]->discard = i == job->video_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+    }
+
+    int64_t *keyframes = NULL;
+    int nb_keyframes = 0;
+    int result = 0;
+
+    if (probe_cache_keyframes(probe, job->input_file, &keyframes, &nb_keyframes) < 0) {
+
+        result = scan_keyframes(input_ctx, job->video_index, &keyframes, &nb_keyframes);
+
+        if (result >= 0 && nb_keyframes > 0) {
+            probe_cache_store_keyframes(probe, job->input_file, keyframes, nb_keyframes);
+        }
+    }
+
+    avformat_close_input(&input_ctx);
+    free_mapped_io(&pb);
+
+    if (result >= 0) {
+        result = build_chunks(job, keyframes, nb_keyframes);
+    }
+
+    av_freep(&keyframes);
+
+    return result;
+}
+
+/*
+this function opens a fresh encoder for a chunk, so every chunk starts
+with an IDR frame and carries no state over from the previous one.
+parallelism comes from the chunks, so with several workers each encoder
+is single threaded; a single worker keeps the encoder's own threads
+*/
+static int open_chunk_encoder(const GopJob *job, AVCodecContext **encoder_ctx) {
+
+    const AVCodec *encoder = find_h264_encoder();
+    {
+        if (encoder == NULL) {
+            fprintf(stderr, "Error: Could not find H.264 encoder.\n");
+            return AVERROR_ENCODER_NOT_FOUND;
+        }
+    }
+
+    AVCodecContext *ctx = avcodec_alloc_context3(encoder);
+    {
+        if (ctx == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        ctx->width = job->width;
+        ctx->height = job->height;
+        ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        ctx->sample_aspect_ratio = job->sample_aspect_ratio;
+        ctx->time_base = job->time_base;
+        ctx->framerate = job->frame_rate;
+        ctx->gop_size = job->frame_rate.num > 0 ? (int)(av_q2d(job->frame_rate) * 2 + 0.5) : 250;
+        ctx->thread_count = job->codec_threads;
+        ctx->bit_rate = 4000000; // only used by encoders without crf
+
+        if (job->global_header) {
+            ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+    }
+
+    AVDictionary *options = NULL;
+    {
+        // constant quality keeps the chunks consistent without a shared rate control
+        av_dict_set(&options, "preset", "veryfast", 0);
+        av_dict_set(&options, "crf", "23", 0);
+    }
+
+    int result = avcodec_open2(ctx, encoder, &options);
+    {
+        av_dict_free(&options);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open chunk encoder: %s\n", av_err2str(result));
+            avcodec_free_context(&ctx);
+            return result;
+        }
+    }
+
+    *encoder_ctx = ctx;
+
+    return 0;
+}
+
+static int append_packet(GopChunk *chunk, AVPacket *packet) {
+
+    if (chunk->nb_packets == chunk->capacity) {
+
+        int capacity = FFMAX(64, chunk->capacity * 2);
+
+        AVPacket **packets = av_realloc_array(chunk->packets, capacity, sizeof(*packets));
+        {
+            if (packets == NULL) {
+                return AVERROR(ENOMEM);
+            }
+        }
+
+        chunk->packets = packets;
+        chunk->capacity = capacity;
+    }
+
+    AVPacket *stored = av_packet_alloc();
+    {
+        if (stored == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        av_packet_move_ref(stored, packet);
+    }
+
+    chunk->packets[chunk->nb_packets++] = stored;
+
+    return 0;
+}
+
+static void free_chunk_packets(GopChunk *chunk) {
+
+    for (int i = 0; i < chunk->nb_packets; i++) {
+        av_packet_free(&chunk->packets[i]);
+    }
+
+    av_freep(&chunk->packets);
+    chunk->nb_packets = 0;
+    chunk->capacity = 0;
+}
+
+static int encode_into_chunk(AVCodecContext *encoder_ctx, const AVFrame *frame, GopChunk *chunk, AVPacket *packet) {
+
+    int result = avcodec_send_frame(encoder_ctx, frame);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    while (1) {
+
+        result = avcodec_receive_packet(encoder_ctx, packet);
+        {
+            if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+                return 0;
+            }
+
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        result = append_packet(chunk, packet);
+        {
+            if (result < 0) {
+                av_packet_unref(packet);
+                return result;
+            }
+        }
+    }
+}
+
+/*
+this function takes every frame the decoder has ready, keeps the ones
+inside [chunk->start, chunk->end) and encodes them
+*/
+static int drain_decoder(GopWorker *worker, GopChunk *chunk, AVCodecContext *encoder_ctx) {
+
+    GopJob *job = worker->job;
+
+    while (1) {
+
+        int result = avcodec_receive_frame(worker->decoder_ctx, worker->frame);
+        {
+            if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+                return 0;
+            }
+
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        int64_t pts = worker->frame->best_effort_timestamp;
+        {
+            if (pts == AV_NOPTS_VALUE || pts < chunk->start || pts >= chunk->end) {
+                av_frame_unref(worker->frame);
+                continue;
+            }
+        }
+
+        AVFrame *input = worker->frame;
+
+        if (input->format != AV_PIX_FMT_YUV420P || input->width != job->width || input->height != job->height) {
+
+            worker->sws_ctx = sws_getCachedContext(worker->sws_ctx,
+                input->width, input->height, input->format,
+                job->width, job->height, AV_PIX_FMT_YUV420P,
+                SWS_BICUBIC, NULL, NULL, NULL);
+            {
+                if (worker->sws_ctx == NULL) {
+                    av_frame_unref(worker->frame);
+                    return AVERROR(EINVAL);
+                }
+            }
+
+            result = av_frame_make_writable(worker->converted);
+            {
+                if (result < 0) {
+                    av_frame_unref(worker->frame);
+                    return result;
+                }
+            }
+
+            sws_scale(worker->sws_ctx, (const uint8_t* const*)input->data, input->linesize, 0, input->height, worker->converted->data, worker->converted->linesize);
+            input = worker->converted;
+        }
+
+        // the decoder's picture type would otherwise force keyframes in the encoder
+        input->pts = pts;
+        input->pict_type = AV_PICTURE_TYPE_NONE;
+
+        result = encode_into_chunk(encoder_ctx, input, chunk, worker->packet);
+        av_frame_unref(worker->frame);
+
+        if (result < 0) {
+            return result;
+        }
+    }
+}
+
+/*
+this function decodes and encodes one chunk
+the worker seeks to the chunk's keyframe and decodes until the first
+picture after the next chunk's keyframe, so leading pictures of an open
+gop that belong to this chunk are still decoded here
+*/
+static int transcode_chunk(GopWorker *worker, GopChunk *chunk) {
+
+    GopJob *job = worker->job;
+    AVCodecContext *encoder_ctx = NULL;
+
+    int result = open_chunk_encoder(job, &encoder_ctx);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    avcodec_flush_buffers(worker->decoder_ctx);
+
+    result = av_seek_frame(worker->input_ctx, job->video_index, chunk->start, AVSEEK_FLAG_BACKWARD);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not seek to chunk start: %s\n", av_err2str(result));
+            avcodec_free_context(&encoder_ctx);
+            return result;
+        }
+    }
+
+    int reached_next = 0;
+
+    while ((result = av_read_frame(worker->input_ctx, worker->packet)) >= 0) {
+
+        AVPacket *packet = worker->packet;
+
+        if (packet->stream_index != job->video_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+        if (chunk->end != INT64_MAX && pts != AV_NOPTS_VALUE) {
+
+            if (reached_next && pts > chunk->end) {
+                av_packet_unref(packet);
+                break;
+            }
+
+            if ((packet->flags & AV_PKT_FLAG_KEY) && pts >= chunk->end) {
+                reached_next = 1;
+            }
+        }
+
+        report_packet(job->report, packet);
+
+        result = avcodec_send_packet(worker->decoder_ctx, packet);
+        av_packet_unref(packet);
+
+        if (result < 0 && result != AVERROR_INVALIDDATA) {
+            break;
+        }
+
+        result = drain_decoder(worker, chunk, encoder_ctx);
+        if (result < 0) {
+            break;
+        }
+    }
+
+    if (result >= 0 || result == AVERROR_EOF) {
+
+        // flush the decoder, then the encoder
+        result = avcodec_send_packet(worker->decoder_ctx, NULL);
+
+        if (result >= 0) {
+            result = drain_decoder(worker, chunk, encoder_ctx);
+        }
+
+        if (result >= 0) {
+            result = encode_into_chunk(encoder_ctx, NULL, chunk, worker->packet);
+        }
+    }
+
+    avcodec_free_context(&encoder_ctx);
+
+    return result;
+}
+
+static int open_worker(GopWorker *worker) {
+
+    GopJob *job = worker->job;
+
+    worker->input_ctx = open_job_input(job, &worker->pb, NULL, NULL);
+    {
+        if (worker->input_ctx == NULL) {
+            return AVERROR(ENOENT);
+        }
+
+        for (int i = 0; i < worker->input_ctx->nb_streams; i++) {
+            worker->input_ctx->streams[i]->discard = i == job->video_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+    }
+
+    AVStream *video_stream = worker->input_ctx->streams[job->video_index];
+
+    const AVCodec *decoder = avcodec_find_decoder(video_stream->codecpar->codec_id);
+    {
+        if (decoder == NULL) {
+            fprintf(stderr, "Error: Could not find video decoder.\n");
+            return AVERROR_DECODER_NOT_FOUND;
+        }
+    }
+
+    worker->decoder_ctx = avcodec_alloc_context3(decoder);
+    {
+        if (worker->decoder_ctx == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        int result = avcodec_parameters_to_context(worker->decoder_ctx, video_stream->codecpar);
+        if (result < 0) {
+            return result;
+        }
+
+        worker->decoder_ctx->pkt_timebase = video_stream->time_base;
+        worker->decoder_ctx->thread_count = job->codec_threads;
+
+        result = avcodec_open2(worker->decoder_ctx, decoder, NULL);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    worker->frame = av_frame_alloc();
+    worker->converted = av_frame_alloc();
+    worker->packet = av_packet_alloc();
+    {
+        if (worker->frame == NULL || worker->converted == NULL || worker->packet == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        worker->converted->format = AV_PIX_FMT_YUV420P;
+        worker->converted->width = job->width;
+        worker->converted->height = job->height;
+    }
+
+    return av_frame_get_buffer(worker->converted, 0);
+}
+
+static void close_worker(GopWorker *worker) {
+
+    avformat_close_input(&worker->input_ctx);
+    free_mapped_io(&worker->pb);
+    avcodec_free_context(&worker->decoder_ctx);
+    sws_freeContext(worker->sws_ctx);
+    av_frame_free(&worker->frame);
+    av_frame_free(&worker->converted);
+    av_packet_free(&worker->packet);
+}
+
+/*
+this function hands out the next chunk, it waits while the worker would
+get more than max_ahead chunks ahead of the muxer
+returns -1 when there is nothing left to do
+*/
+static int claim_chunk(GopJob *job) {
+
+    pthread_mutex_lock(&job->lock);
+
+    while (!job->aborted && job->next_chunk < job->nb_chunks && job->next_chunk >= job->next_write + job->max_ahead) {
+        pthread_cond_wait(&job->cond, &job->lock);
+    }
+
+    int index = -1;
+    {
+        if (!job->aborted && job->next_chunk < job->nb_chunks) {
+            index = job->next_chunk++;
+        }
+    }
+
+    pthread_mutex_unlock(&job->lock);
+
+    return index;
+}
+
+static void finish_chunk(GopJob *job, GopChunk *chunk, int result) {
+
+    pthread_mutex_lock(&job->lock);
+    {
+        chunk->done = 1;
+        chunk->result = result;
+
+        if (result < 0) {
+            job->aborted = 1;
+        }
+
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void abort_job(GopJob *job) {
+
+    pthread_mutex_lock(&job->lock);
+    {
+        job->aborted = 1;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void* gop_worker(void *arg) {
+
+    GopWorker *worker = (GopWorker*)arg;
+    GopJob *job = worker->job;
+
+    job_log_attach(job->log);
+
+    int64_t cpu = thread_cpu_micros();
+
+    int result = open_worker(worker);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not start chunk worker: %s\n", av_err2str(result));
+            abort_job(job);
+            return NULL;
+        }
+    }
+
+    int index;
+    while ((index = claim_chunk(job)) >= 0) {
+
+        GopChunk *chunk = &job->chunks[index];
+
+        result = transcode_chunk(worker, chunk);
+        finish_chunk(job, chunk, result);
+
+        if (result < 0) {
+            break;
+        }
+    }
+
+    stage_add_cpu(job->report, JOB_STAGE_PACKETS, thread_cpu_micros() - cpu);
+
+    return NULL;
+}
+
+/*
+this function writes the encoded packets of a finished chunk
+the chunk encoders share settings, so their dts continue across chunk
+boundaries; the check below only guards against a broken source
+*/
+static int write_chunk(AVFormatContext *output_ctx, GopChunk *chunk, AVRational time_base, int64_t *last_dts) {
+
+    AVStream *out_stream = output_ctx->streams[0];
+
+    for (int i = 0; i < chunk->nb_packets; i++) {
+
+        AVPacket *packet = chunk->packets[i];
+
+        if (packet->dts != AV_NOPTS_VALUE && *last_dts != AV_NOPTS_VALUE && packet->dts <= *last_dts) {
+
+            packet->dts = *last_dts + 1;
+
+            if (packet->pts != AV_NOPTS_VALUE && packet->pts < packet->dts) {
+                packet->pts = packet->dts;
+            }
+        }
+
+        if (packet->dts != AV_NOPTS_VALUE) {
+            *last_dts = packet->dts;
+        }
+
+        av_packet_rescale_ts(packet, time_base, out_stream->time_base);
+        packet->stream_index = 0;
+
+        int result = av_interleaved_write_frame(output_ctx, packet);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Failed to write frame to output file.\n");
+                return result;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function transcodes the input to h264 hls using workers threads
+the video is split at keyframes into chunks which are decoded and encoded
+on separate threads, each with its own decoder and encoder. the muxer
+stitches the chunks back in order and interleaves the audio, which is
+stream copied from a separate sequential read of the input
+workers <= 0 uses one worker per core, workers == 1 is the serial path:
+one decoder and one encoder, each with its own frame/slice threads
+with IO_BACKEND_MMAP the input is mapped once and the index, the workers
+and the audio reader all read the same pages; any other io opens it by
+path per reader. probe and report may be NULL
+*/
+int gop_transcode(const char *input_file, const char *output_dir, const char *output_file, int workers, SegmentFormat format, IoBackend io, const ProbeOptions *probe, JobReport *report) {
+
+    GopJob job;
+    {
+        memset(&job, 0, sizeof(job));
+        job.input_file = input_file;
+        job.report = report;
+        job.log = job_log_current();
+
+        // the workers and the audio reader read the mapping at once, so even
+        // the serial path has two readers
+        if (io == IO_BACKEND_MMAP) {
+            map_input(&job.mapped, input_file, FFMAX(workers, 1) + 1);
+        }
+
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.cond, NULL);
+    }
+
+    AVFormatContext *audio_ctx = NULL;
+    AVIOContext *audio_pb = NULL;
+    AVFormatContext *output_ctx = NULL;
+    AVCodecContext *template_ctx = NULL;
+    AVPacket *audio_packet = NULL;
+    GopWorker *pool = NULL;
+
+    int audio_index = -1;
+    int result = index_keyframes(&job, probe, report);
+    {
+        if (result >= 0 && job.nb_chunks == 0) {
+            fprintf(stderr, "Error: No keyframes found in input.\n");
+            result = AVERROR_INVALIDDATA;
+        }
+    }
+
+    if (workers <= 0) {
+        workers = av_cpu_count();
+    }
+
+    workers = FFMAX(1, FFMIN(workers, job.nb_chunks));
+    job.max_ahead = workers * GOP_CHUNKS_AHEAD;
+    job.codec_threads = workers == 1 ? 0 : 1;
+
+    /*
+    this block opens the muxer side: a sequential reader for the audio copy
+    and the hls output. a template encoder with the chunk settings gives
+    the output stream its codec parameters before any chunk is done
+    */
+    if (result >= 0) {
+
+        audio_ctx = open_job_input(&job, &audio_pb, NULL, NULL);
+        output_ctx = alloc_hls_output(output_dir, output_file);
+        audio_packet = av_packet_alloc();
+
+        if (audio_ctx == NULL || output_ctx == NULL || audio_packet == NULL) {
+            result = AVERROR(EIO);
+        }
+    }
+
+    if (result >= 0) {
+
+        audio_index = av_find_best_stream(audio_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+
+        for (int i = 0; i < audio_ctx->nb_streams; i++) {
+            audio_ctx->streams[i]->discard = i == audio_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+
+        job.global_header = output_ctx->oformat->flags & AVFMT_GLOBALHEADER;
+        result = open_chunk_encoder(&job, &template_ctx);
+    }
+
+    if (result >= 0) {
+
+        AVStream *out_video = avformat_new_stream(output_ctx, NULL);
+        AVStream *out_audio = audio_index >= 0 ? avformat_new_stream(output_ctx, NULL) : NULL;
+
+        if (out_video == NULL || (audio_index >= 0 && out_audio == NULL)) {
+            result = AVERROR(ENOMEM);
+        } else {
+            result = avcodec_parameters_from_context(out_video->codecpar, template_ctx);
+            out_video->time_base = job.time_base;
+
+            if (result >= 0 && out_audio) {
+                result = avcodec_parameters_copy(out_audio->codecpar, audio_ctx->streams[audio_index]->codecpar);
+                out_audio->codecpar->codec_tag = 0;
+            }
+        }
+
+        if (result >= 0 && write_hls_header(output_ctx, output_dir, format, 0, NULL, NULL, report) < 0) {
+            result = AVERROR(EIO);
+        }
+    }
+
+    avcodec_free_context(&template_ctx);
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    if (result >= 0) {
+
+        pool = av_calloc(workers, sizeof(*pool));
+        {
+            if (pool == NULL) {
+                result = AVERROR(ENOMEM);
+            }
+        }
+
+        for (int i = 0; result >= 0 && i < workers; i++) {
+
+            pool[i].job = &job;
+
+            if (pthread_create(&pool[i].thread, NULL, gop_worker, &pool[i]) != 0) {
+                fprintf(stderr, "Error: Could not start chunk worker thread.\n");
+                result = AVERROR(EAGAIN);
+                break;
+            }
+
+            pool[i].started = 1;
+        }
+    }
+
+    /*
+    this block is the stitcher
+    chunks are written strictly in order; after each chunk the audio is
+    copied up to the chunk end so both streams advance together
+    */
+    int64_t last_dts = AV_NOPTS_VALUE;
+    int audio_pending = 0;
+    int audio_eof = audio_index < 0;
+
+    for (int i = 0; result >= 0 && i < job.nb_chunks; i++) {
+
+        GopChunk *chunk = &job.chunks[i];
+
+        pthread_mutex_lock(&job.lock);
+        {
+            while (!chunk->done && !job.aborted) {
+                pthread_cond_wait(&job.cond, &job.lock);
+            }
+
+            if (!chunk->done) {
+                result = AVERROR_EXIT;
+            } else {
+                result = chunk->result;
+            }
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        if (result < 0) {
+            break;
+        }
+
+        result = write_chunk(output_ctx, chunk, job.time_base, &last_dts);
+        report_progress(report, last_dts, job.time_base);
+
+        while (result >= 0 && !audio_eof) {
+
+            if (!audio_pending) {
+
+                int read = av_read_frame(audio_ctx, audio_packet);
+                {
+                    if (read == AVERROR_EOF) {
+                        audio_eof = 1;
+                        break;
+                    }
+
+                    if (read < 0) {
+                        result = read;
+                        break;
+                    }
+
+                    if (audio_packet->stream_index != audio_index) {
+                        av_packet_unref(audio_packet);
+                        continue;
+                    }
+                }
+
+                report_packet(report, audio_packet);
+
+                audio_pending = 1;
+            }
+
+            AVStream *in_audio = audio_ctx->streams[audio_index];
+            AVStream *out_audio = output_ctx->streams[1];
+
+            if (audio_packet->pts != AV_NOPTS_VALUE && chunk->end != INT64_MAX &&
+                av_rescale_q(audio_packet->pts, in_audio->time_base, job.time_base) >= chunk->end) {
+                break;
+            }
+
+            av_packet_rescale_ts(audio_packet, in_audio->time_base, out_audio->time_base);
+            audio_packet->stream_index = 1;
+            audio_packet->pos = -1;
+
+            result = av_interleaved_write_frame(output_ctx, audio_packet);
+            audio_pending = 0;
+        }
+
+        free_chunk_packets(chunk);
+
+        pthread_mutex_lock(&job.lock);
+        {
+            job.next_write = i + 1;
+            pthread_cond_broadcast(&job.cond);
+        }
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "Error: GOP parallel transcode failed: %s\n", av_err2str(result));
+        abort_job(&job);
+    }
+
+    for (int i = 0; pool && i < workers; i++) {
+        if (pool[i].started) {
+            pthread_join(pool[i].thread, NULL);
+        }
+
+        close_worker(&pool[i]);
+    }
+
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
+    if (result >= 0) {
+        result = av_write_trailer(output_ctx);
+    }
+
+    stage_end(report, JOB_STAGE_TRAILER, &clock);
+
+    for (int i = 0; i < job.nb_chunks; i++) {
+        free_chunk_packets(&job.chunks[i]);
+    }
+
+    av_freep(&job.chunks);
+    av_freep(&pool);
+    av_packet_free(&audio_packet);
+    avformat_close_input(&audio_ctx);
+    free_mapped_io(&audio_pb);
+
+    if (output_ctx) {
+        avformat_free_context(output_ctx);
+    }
+
+    unmap_input(&job.mapped);
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+
+    return result < 0 ? 1 : 0;
+}
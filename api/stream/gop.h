@@ -0,0 +1,16 @@
+#ifndef GOP_H
+#define GOP_H
+
+#include "../../core/probe.h"
+#include "remux.h"
+
+// target duration of a chunk, chunks are cut on the first keyframe after it
+#define GOP_CHUNK_SECONDS 10
+
+// chunks a worker may finish ahead of the muxer, per worker; bounds the
+// encoded packets held in memory while waiting for a slower chunk
+#define GOP_CHUNKS_AHEAD 2
+
+int gop_transcode(const char *input_file, const char *output_dir, const char *output_file, int workers, SegmentFormat format, IoBackend io, const ProbeOptions *probe, JobReport *report);
+
+#endif
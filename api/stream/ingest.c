@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ingest.h"
+#include "read_pipe.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+#include "libavutil/error.h"
+
+static uint32_t read_be32(const uint8_t *data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+/*
+this function reads from the pipe until the buffer is full or the writer
+closed its end. a single read() on a pipe returns at most what is buffered
+in the kernel, so it has to loop
+*/
+static ssize_t read_full(int fd, uint8_t *buf, size_t size) {
+
+    size_t total = 0;
+
+    while (total < size) {
+
+        ssize_t bytes_read = read(fd, buf + total, size - total);
+        {
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (bytes_read < 0) {
+                return -1;
+            }
+
+            if (bytes_read == 0) {
+                break;
+            }
+        }
+
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+/*
+this function walks the top level boxes of an iso bmff (mp4/mov) file
+an mp4 with the moov box after mdat can not be demuxed without seeking
+back, so it has to be spilled before probing. any other container (ts,
+mkv, webm, flv, fragmented or faststart mp4) can be read from the pipe
+*/
+static int needs_random_access(const uint8_t *data, int size) {
+
+    static const char *bmff_boxes[] = { "ftyp", "moov", "mdat", "wide", "free", "skip", "pnot" };
+
+    int is_bmff = 0;
+    {
+        for (int i = 0; size >= 8 && i < (int)(sizeof(bmff_boxes) / sizeof(bmff_boxes[0])); i++) {
+            if (memcmp(data + 4, bmff_boxes[i], 4) == 0) {
+                is_bmff = 1;
+            }
+        }
+
+        if (!is_bmff) {
+            return 0;
+        }
+    }
+
+    int64_t offset = 0;
+
+    while (offset + 8 <= size) {
+
+        uint64_t box_size = read_be32(data + offset);
+        const uint8_t *box_type = data + offset + 4;
+
+        if (memcmp(box_type, "moov", 4) == 0) {
+            return 0;
+        }
+
+        if (memcmp(box_type, "mdat", 4) == 0) {
+            return 1;
+        }
+
+        uint64_t header_size = 8;
+
+        // 64 bit box size follows the type
+        if (box_size == 1) {
+            if (offset + 16 > size) {
+                break;
+            }
+
+            box_size = ((uint64_t)read_be32(data + offset + 8) << 32) | read_be32(data + offset + 12);
+            header_size = 16;
+        }
+
+        // a box that runs to the end of the file or a broken size
+        if (box_size < header_size) {
+            return 1;
+        }
+
+        // the next box starts past the peek window, checked before adding so a huge size can not wrap the offset
+        if (box_size > (uint64_t)(size - offset)) {
+            break;
+        }
+
+        offset += box_size;
+    }
+
+    // moov was not found inside the peek window, play it safe
+    return 1;
+}
+
+/*
+this function is the AVIOContext read callback for the pipe
+it first hands out the bytes that were read ahead while sniffing
+the container and then reads straight from the pipe
+*/
+static int custom_read(void *opaque, uint8_t *buf, int buf_size) {
+
+    IngestSource *source = (IngestSource*)opaque;
+
+    if (source->peek_pos < source->peek_size) {
+
+        int size = FFMIN(buf_size, source->peek_size - source->peek_pos);
+        memcpy(buf, source->peek + source->peek_pos, size);
+        source->peek_pos += size;
+
+        return size;
+    }
+
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(source->fd, buf, buf_size);
+    } while (bytes_read < 0 && errno == EINTR);
+    {
+        if (bytes_read == 0) {
+            return AVERROR_EOF;
+        }
+
+        if (bytes_read < 0) {
+            return AVERROR(errno);
+        }
+    }
+
+    source->bytes_read += bytes_read;
+
+    return bytes_read;
+}
+
+static int memory_read(void *opaque, uint8_t *buf, int buf_size) {
+
+    IngestSource *source = (IngestSource*)opaque;
+
+    int64_t left = source->spill_size - source->spill_pos;
+    {
+        if (left <= 0) {
+            return AVERROR_EOF;
+        }
+    }
+
+    int size = (int)FFMIN((int64_t)buf_size, left);
+    memcpy(buf, source->spill + source->spill_pos, size);
+    source->spill_pos += size;
+
+    return size;
+}
+
+static int64_t memory_seek(void *opaque, int64_t offset, int whence) {
+
+    IngestSource *source = (IngestSource*)opaque;
+
+    if (whence & AVSEEK_SIZE) {
+        return source->spill_size;
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: position = offset; break;
+        case SEEK_CUR: position = source->spill_pos + offset; break;
+        case SEEK_END: position = source->spill_size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+
+    if (position < 0 || position > source->spill_size) {
+        return AVERROR(EINVAL);
+    }
+
+    source->spill_pos = position;
+
+    return position;
+}
+
+/*
+this function drains the rest of the pipe for containers that need seeking
+the upload is kept in memory up to INGEST_SPILL_MAX, past that the buffer
+is flushed into spill_path and the rest of the pipe is appended to it
+*/
+static int spill_input(IngestSource *source, const char *spill_path) {
+
+    source->spill_capacity = FFMAX(source->peek_size, 1 << 20);
+    source->spill = av_malloc(source->spill_capacity);
+    {
+        if (source->spill == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        memcpy(source->spill, source->peek, source->peek_size);
+        source->spill_size = source->peek_size;
+        av_freep(&source->peek);
+        source->peek_size = 0;
+    }
+
+    while (1) {
+
+        if (source->spill_size == source->spill_capacity) {
+
+            if (source->spill_capacity >= INGEST_SPILL_MAX) {
+                break;
+            }
+
+            int64_t capacity = FFMIN(source->spill_capacity * 2, (int64_t)INGEST_SPILL_MAX);
+
+            uint8_t *spill = av_realloc(source->spill, capacity);
+            {
+                if (spill == NULL) {
+                    return AVERROR(ENOMEM);
+                }
+            }
+
+            source->spill = spill;
+            source->spill_capacity = capacity;
+        }
+
+        ssize_t bytes_read = read_full(source->fd, source->spill + source->spill_size, source->spill_capacity - source->spill_size);
+        {
+            if (bytes_read < 0) {
+                return AVERROR(errno);
+            }
+
+            if (bytes_read == 0) {
+                source->mode = INGEST_MODE_MEMORY;
+                return 0;
+            }
+        }
+
+        source->spill_size += bytes_read;
+        source->bytes_read += bytes_read;
+    }
+
+    // the upload is bigger than the spill buffer, move it to disk
+    FILE *file = fopen(spill_path, "wb");
+    {
+        if (!file) {
+            perror("Error: Could not open spill file");
+            return AVERROR(errno);
+        }
+
+        source->spill_path = spill_path;
+    }
+
+    int written = fwrite(source->spill, 1, source->spill_size, file) == (size_t)source->spill_size && fflush(file) == 0;
+    av_freep(&source->spill);
+    source->spill_size = 0;
+
+    // the rest of the upload goes from the pipe to the file without passing through here
+    int64_t drained = written ? drain_pipe(source->fd, fileno(file)) : -1;
+    {
+        if (drained > 0) {
+            source->bytes_read += drained;
+        }
+    }
+
+    fclose(file);
+
+    source->mode = INGEST_MODE_FILE;
+
+    return drained < 0 ? AVERROR(EIO) : 0;
+}
+
+/*
+this function opens the upload pipe as an input context
+the pipe is handed to avformat_open_input through a custom AVIOContext so
+packets can be demuxed while the upload is still arriving. if the container
+needs random access the upload is spilled first (see spill_input)
+*/
+AVFormatContext* open_input_pipe(IngestSource *source, int fd, const char *spill_path, const ProbeOptions *probe, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    memset(source, 0, sizeof(*source));
+    source->fd = fd;
+
+    source->peek = av_malloc(INGEST_PEEK_SIZE);
+    {
+        if (source->peek == NULL) {
+            fprintf(stderr, "Error: Could not allocate ingest buffer.\n");
+            return NULL;
+        }
+    }
+
+    ssize_t peek_size = read_full(fd, source->peek, INGEST_PEEK_SIZE);
+    {
+        if (peek_size <= 0) {
+            fprintf(stderr, "Error: Could not read from pipe.\n");
+            close_input_pipe(NULL, source);
+            return NULL;
+        }
+
+        source->peek_size = peek_size;
+        source->bytes_read = peek_size;
+    }
+
+    if (needs_random_access(source->peek, source->peek_size)) {
+
+        int result = spill_input(source, spill_path);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not spill input: %s\n", av_err2str(result));
+                close_input_pipe(NULL, source);
+                return NULL;
+            }
+        }
+    }
+
+    AVFormatContext *input_ctx = NULL;
+
+    if (source->mode != INGEST_MODE_FILE) {
+
+        input_ctx = avformat_alloc_context();
+        {
+            if (input_ctx == NULL) {
+                fprintf(stderr, "Error: Could not allocate input context.\n");
+                close_input_pipe(NULL, source);
+                return NULL;
+            }
+        }
+
+        uint8_t *io_buffer = av_malloc(INGEST_IO_BUFFER_SIZE);
+        {
+            if (io_buffer == NULL) {
+                avformat_free_context(input_ctx);
+                close_input_pipe(NULL, source);
+                return NULL;
+            }
+        }
+
+        if (source->mode == INGEST_MODE_STREAM) {
+            input_ctx->pb = avio_alloc_context(io_buffer, INGEST_IO_BUFFER_SIZE, 0, source, custom_read, NULL, NULL);
+        } else {
+            input_ctx->pb = avio_alloc_context(io_buffer, INGEST_IO_BUFFER_SIZE, 0, source, memory_read, NULL, memory_seek);
+        }
+
+        if (input_ctx->pb == NULL) {
+            av_free(io_buffer);
+            avformat_free_context(input_ctx);
+            close_input_pipe(NULL, source);
+            return NULL;
+        }
+
+        input_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    AVIOContext *pb = input_ctx ? input_ctx->pb : NULL;
+
+    AVDictionary *format_options = NULL;
+    apply_probe_budget(&format_options, probe);
+
+    int result = avformat_open_input(&input_ctx, source->mode == INGEST_MODE_FILE ? spill_path : NULL, NULL, &format_options);
+    {
+        av_dict_free(&format_options);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open input pipe: %s\n", av_err2str(result));
+
+            // avformat_open_input does not free a custom pb on failure
+            if (pb) {
+                av_freep(&pb->buffer);
+                avio_context_free(&pb);
+            }
+
+            close_input_pipe(NULL, source);
+            return NULL;
+        }
+    }
+
+    result = avformat_find_stream_info(input_ctx, NULL);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not find stream info in input pipe.\n");
+            close_input_pipe(&input_ctx, source);
+            return NULL;
+        }
+    }
+
+    // the upload is not on disk yet, so there is no content hash to look up
+    report_input(report, input_ctx);
+    stage_end(report, JOB_STAGE_PROBE, &clock);
+
+    return input_ctx;
+}
+
+/*
+this function closes the input context opened by open_input_pipe
+it also frees the custom AVIOContext, the ingest buffers and removes
+the spill file if one was written
+*/
+void close_input_pipe(AVFormatContext **input_ctx, IngestSource *source) {
+
+    if (input_ctx && *input_ctx) {
+
+        AVIOContext *pb = source->mode != INGEST_MODE_FILE ? (*input_ctx)->pb : NULL;
+
+        avformat_close_input(input_ctx);
+
+        if (pb) {
+            av_freep(&pb->buffer);
+            avio_context_free(&pb);
+        }
+    }
+
+    av_freep(&source->peek);
+    av_freep(&source->spill);
+
+    if (source->spill_path) {
+        remove(source->spill_path);
+        source->spill_path = NULL;
+    }
+}
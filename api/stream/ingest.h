@@ -0,0 +1,47 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libavformat/avformat.h"
+#include "../../core/probe.h"
+
+// size of the AVIOContext buffer used when demuxing straight from the pipe
+#define INGEST_IO_BUFFER_SIZE (64 * 1024)
+
+// how many bytes are read ahead to decide if the container can be streamed
+#define INGEST_PEEK_SIZE (64 * 1024)
+
+// upper bound of the in-memory spill buffer before it is moved to disk
+#define INGEST_SPILL_MAX (256 * 1024 * 1024)
+
+typedef enum {
+    INGEST_MODE_STREAM = 0, // demux directly from the pipe, no seeking
+    INGEST_MODE_MEMORY = 1, // whole upload spilled to memory, seekable
+    INGEST_MODE_FILE   = 2, // spill buffer overflowed, demux from spill file
+} IngestMode;
+
+typedef struct {
+    int fd;
+    IngestMode mode;
+
+    // bytes read ahead from the pipe while sniffing the container
+    uint8_t *peek;
+    int peek_size;
+    int peek_pos;
+
+    // spill buffer for containers that need random access (moov at the end)
+    uint8_t *spill;
+    int64_t spill_size;
+    int64_t spill_capacity;
+    int64_t spill_pos;
+    const char *spill_path;
+
+    int64_t bytes_read;
+} IngestSource;
+
+AVFormatContext* open_input_pipe(IngestSource *source, int fd, const char *spill_path, const ProbeOptions *probe, JobReport *report);
+void close_input_pipe(AVFormatContext **input_ctx, IngestSource *source);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "live.h"
+#include "plan.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/error.h"
+#include "libavutil/time.h"
+
+/*
+this function is the interrupt callback of a live input, the blocking
+reads of the network protocols poll it, so a stopped job or a silent
+source ends av_read_frame() with AVERROR_EXIT
+*/
+static int live_interrupt(void *opaque) {
+
+    LiveInput *live = opaque;
+
+    if (__atomic_load_n(live->stop, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+
+    return av_gettime_relative() - live->last_packet > LIVE_INPUT_TIMEOUT;
+}
+
+/*
+this function opens a continuous mpeg-ts or flv input: a udp or tcp
+listener, a unix socket or pipe:<fd> for a chunked http push
+format forces the demuxer, so the stream is not probed to guess it
+live->stop has to be set by the caller, it is read until the input closes
+*/
+AVFormatContext* open_live_input(const char *url, const char *format, const ProbeOptions *probe, LiveInput *live, JobReport *report) {
+
+    const AVInputFormat *input_format = NULL;
+    {
+        if (format && format[0] && (input_format = av_find_input_format(format)) == NULL) {
+            fprintf(stderr, "Error: Unknown live input format '%s'.\n", format);
+            return NULL;
+        }
+    }
+
+    AVFormatContext *input_ctx = avformat_alloc_context();
+    {
+        if (input_ctx == NULL) {
+            return NULL;
+        }
+
+        live->last_packet = av_gettime_relative();
+
+        input_ctx->interrupt_callback.callback = live_interrupt;
+        input_ctx->interrupt_callback.opaque = live;
+    }
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    AVDictionary *options = NULL;
+    {
+        apply_probe_budget(&options, probe);
+
+        // udp: a larger socket buffer, and a burst the demuxer can not keep up with drops packets instead of the job
+        av_dict_set(&options, "fifo_size", "1000000", 0);
+        av_dict_set(&options, "overrun_nonfatal", "1", 0);
+    }
+
+    int result = avformat_open_input(&input_ctx, url, input_format, &options);
+    {
+        av_dict_free(&options);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open live input '%s'.\n", url);
+            return NULL;
+        }
+    }
+
+    result = avformat_find_stream_info(input_ctx, NULL);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not find stream info in live input.\n");
+            avformat_close_input(&input_ctx);
+            return NULL;
+        }
+    }
+
+    stage_end(report, JOB_STAGE_PROBE, &clock);
+    report_input(report, input_ctx);
+
+    return input_ctx;
+}
+
+/*
+this function remuxes a live input into a sliding window playlist until the
+source ends, goes silent for LIVE_INPUT_TIMEOUT or the job is stopped
+nothing grows with the running time: the playlist lists window segments,
+the muxer deletes older ones and every packet is released once written
+a packet the muxer refuses (timestamps going back after the source
+restarted) is dropped instead of ending a job that may run for days
+the loop reuses one packet, see remux_packet()
+*/
+int remux_live(AVFormatContext *input_ctx, LiveInput *live, const char *output_dir, const char *output_file, SegmentFormat format, int window, JobReport *report) {
+
+    RemuxPlan plan;
+
+    AVFormatContext *output_ctx = setup_hls_output(output_dir, output_file, input_ctx, format, window, &plan, NULL, NULL, report);
+    {
+        if (output_ctx == NULL) {
+            fprintf(stderr, "Error: Could not setup HLS output.\n");
+            return -1;
+        }
+    }
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    int result;
+    int64_t dropped = 0;
+
+    while ((result = remux_packet(input_ctx, output_ctx, &plan, report)) != 0) {
+
+        live->last_packet = av_gettime_relative();
+
+        if (result == AVERROR(EINVAL)) {
+            dropped++;
+            continue;
+        }
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Failed to write live packet.\n");
+            break;
+        }
+    }
+
+    if (dropped > 0) {
+        printf("Dropped %" PRId64 " live packets the muxer refused.\n", dropped);
+    }
+
+    if (result >= 0) {
+        result = plan_flush(&plan, output_ctx);
+    }
+
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
+    // the trailer closes the playlist with #EXT-X-ENDLIST
+    if (av_write_trailer(output_ctx) < 0 && result >= 0) {
+        fprintf(stderr, "Error: Failed to write trailer to output file.\n");
+        result = -1;
+    }
+
+    stage_end(report, JOB_STAGE_TRAILER, &clock);
+
+    free_plan(&plan);
+    avformat_free_context(output_ctx);
+
+    return result;
+}
@@ -0,0 +1,25 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+#include "../../core/probe.h"
+#include "remux.h"
+
+// segments listed in a live playlist when the job does not say
+#define LIVE_DEFAULT_WINDOW 6
+
+// a live input that delivers no packet for this many microseconds is over
+#define LIVE_INPUT_TIMEOUT (30 * 1000000LL)
+
+// State of a live input, checked by the interrupt callback of the demuxer
+typedef struct {
+    const int *stop;     // set to 1 to end the job, see live_stop()
+    int64_t last_packet; // av_gettime_relative() of the last packet read
+} LiveInput;
+
+AVFormatContext* open_live_input(const char *url, const char *format, const ProbeOptions *probe, LiveInput *live, JobReport *report);
+int remux_live(AVFormatContext *input_ctx, LiveInput *live, const char *output_dir, const char *output_file, SegmentFormat format, int window, JobReport *report);
+
+#endif
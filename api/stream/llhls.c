@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include "llhls.h"
+#include "remux.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+#include "libavutil/error.h"
+#include "libavutil/time.h"
+
+#define LLHLS_IO_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    int64_t offset; // byte offset inside the segment file
+    int64_t size;
+    double duration;
+    int independent; // starts with a keyframe
+} LlPart;
+
+typedef struct {
+    int index;
+    double duration;
+    LlPart parts[LLHLS_MAX_PARTS];
+    int nb_parts;
+} LlSegment;
+
+typedef struct {
+    const char *output_dir;
+    const char *output_file;
+    JobReport *report;
+
+    FILE *file;     // init segment while writing the header, then the current segment
+    int64_t bytes;  // bytes written into file
+
+    LlSegment *segments; // finished segments
+    int nb_segments;
+    int capacity;
+
+    LlSegment current;
+
+    int reference_index;  // stream the parts are timed on, the video if there is one
+    AVRational time_base; // of the reference stream in the output
+    int64_t part_start;   // pts of the current part
+    int64_t last_end;     // pts + duration of the last reference packet
+    int part_independent;
+    int max_target;       // EXT-X-TARGETDURATION so far
+} LlHlsWriter;
+
+/*
+the mp4 muxer writes into this callback instead of a file, so the bytes
+of every fragment land in the current segment at a known offset
+*/
+static int ll_write(void *opaque, const uint8_t *buf, int buf_size) {
+
+    LlHlsWriter *writer = (LlHlsWriter*)opaque;
+
+    if (writer->file == NULL || fwrite(buf, 1, buf_size, writer->file) != (size_t)buf_size) {
+        return AVERROR(EIO);
+    }
+
+    writer->bytes += buf_size;
+    report_output(writer->report, buf_size, 0);
+
+    return buf_size;
+}
+
+static int open_segment(LlHlsWriter *writer) {
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/segment%03d.m4s", writer->output_dir, writer->current.index);
+
+    writer->file = fopen(path, "wb");
+    {
+        if (writer->file == NULL) {
+            fprintf(stderr, "Error: Could not open segment '%s'.\n", path);
+            return AVERROR(errno);
+        }
+    }
+
+    writer->bytes = 0;
+
+    return 0;
+}
+
+/*
+this function rewrites the media playlist, to a temporary file first so a
+player polling it never reads half a playlist
+finished segments are listed with their parts for the last
+LLHLS_PART_SEGMENTS segments, the parts of the segment being written follow
+there is no preload hint: nothing serves blocking reloads or the bytes of
+a part that is still being written, so the playlist only announces parts
+that are complete on disk and players poll it (no CAN-BLOCK-RELOAD)
+*/
+static int write_playlist(LlHlsWriter *writer, int final) {
+
+    char path[1024];
+    char temp_path[1100];
+    {
+        snprintf(path, sizeof(path), "%s/%s", writer->output_dir, writer->output_file);
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    }
+
+    FILE *file = fopen(temp_path, "w");
+    {
+        if (file == NULL) {
+            return AVERROR(errno);
+        }
+    }
+
+    fprintf(file, "#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-INDEPENDENT-SEGMENTS\n");
+    fprintf(file, "#EXT-X-TARGETDURATION:%d\n", writer->max_target);
+    fprintf(file, "#EXT-X-PART-INF:PART-TARGET=%.3f\n", LLHLS_PART_SECONDS);
+    fprintf(file, "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=%.3f\n", LLHLS_PART_SECONDS * 3);
+    fprintf(file, "#EXT-X-PLAYLIST-TYPE:EVENT\n#EXT-X-MEDIA-SEQUENCE:0\n");
+    fprintf(file, "#EXT-X-MAP:URI=\"%s\"\n", LLHLS_INIT_FILE);
+
+    for (int i = 0; i < writer->nb_segments; i++) {
+
+        const LlSegment *segment = &writer->segments[i];
+
+        if (!final && i >= writer->nb_segments - LLHLS_PART_SEGMENTS) {
+            for (int j = 0; j < segment->nb_parts; j++) {
+                const LlPart *part = &segment->parts[j];
+                fprintf(file, "#EXT-X-PART:DURATION=%.5f,URI=\"segment%03d.m4s\",BYTERANGE=\"%" PRId64 "@%" PRId64 "\"%s\n",
+                    part->duration, segment->index, part->size, part->offset, part->independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+
+        fprintf(file, "#EXTINF:%.5f,\nsegment%03d.m4s\n", segment->duration, segment->index);
+    }
+
+    if (final) {
+        fprintf(file, "#EXT-X-ENDLIST\n");
+    } else {
+
+        const LlSegment *segment = &writer->current;
+
+        for (int j = 0; j < segment->nb_parts; j++) {
+            const LlPart *part = &segment->parts[j];
+            fprintf(file, "#EXT-X-PART:DURATION=%.5f,URI=\"segment%03d.m4s\",BYTERANGE=\"%" PRId64 "@%" PRId64 "\"%s\n",
+                part->duration, segment->index, part->size, part->offset, part->independent ? ",INDEPENDENT=YES" : "");
+        }
+    }
+
+    long size = ftell(file);
+
+    if (fclose(file) != 0 || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return AVERROR(EIO);
+    }
+
+    report_output(writer->report, FFMAX(size, 0), 0);
+
+    // the first part is what a low latency player can start on
+    if (writer->report && writer->report->FirstSegmentMicros < 0 && writer->nb_segments + writer->current.nb_parts > 0) {
+        writer->report->FirstSegmentMicros = av_gettime_relative() - writer->report->StartedAt;
+    }
+
+    return 0;
+}
+
+/*
+this function closes the current part at end_pts
+the queued packets and the open fragment are flushed so the part is one
+complete moof+mdat on disk before the playlist announces it
+*/
+static int finish_part(LlHlsWriter *writer, AVFormatContext *output_ctx, int64_t end_pts) {
+
+    // the mp4 muxer holds the fragment in memory until it is flushed
+    int64_t offset = writer->bytes;
+
+    int result = av_interleaved_write_frame(output_ctx, NULL);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    result = av_write_frame(output_ctx, NULL);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    avio_flush(output_ctx->pb);
+    fflush(writer->file);
+
+    if (writer->bytes == offset) {
+        return 0;
+    }
+
+    LlPart *part = &writer->current.parts[writer->current.nb_parts++];
+    {
+        part->offset = offset;
+        part->size = writer->bytes - offset;
+        part->duration = (end_pts - writer->part_start) * av_q2d(writer->time_base);
+        part->independent = writer->part_independent;
+    }
+
+    writer->current.duration += part->duration;
+    writer->part_start = end_pts;
+    writer->part_independent = 0;
+
+    return write_playlist(writer, 0);
+}
+
+static int finish_segment(LlHlsWriter *writer) {
+
+    if (writer->file) {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+
+    if (writer->current.nb_parts == 0) {
+        return 0;
+    }
+
+    if (writer->nb_segments == writer->capacity) {
+
+        int capacity = FFMAX(16, writer->capacity * 2);
+
+        LlSegment *segments = av_realloc_array(writer->segments, capacity, sizeof(*segments));
+        {
+            if (segments == NULL) {
+                return AVERROR(ENOMEM);
+            }
+        }
+
+        writer->segments = segments;
+        writer->capacity = capacity;
+    }
+
+    writer->max_target = FFMAX(writer->max_target, (int)ceil(writer->current.duration));
+    writer->segments[writer->nb_segments++] = writer->current;
+    report_output(writer->report, 0, 1);
+
+    int index = writer->current.index + 1;
+    {
+        memset(&writer->current, 0, sizeof(writer->current));
+        writer->current.index = index;
+    }
+
+    return 0;
+}
+
+/*
+this function decides where the packet goes before it is written
+parts are cut every LLHLS_PART_SECONDS on the reference stream, segments
+on the first keyframe after LLHLS_SEGMENT_SECONDS
+*/
+static int cut_before(LlHlsWriter *writer, AVFormatContext *output_ctx, const AVPacket *packet) {
+
+    if (packet->stream_index != writer->reference_index || packet->pts == AV_NOPTS_VALUE) {
+        return 0;
+    }
+
+    int key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+    if (writer->part_start == AV_NOPTS_VALUE) {
+        writer->part_start = packet->pts;
+        writer->part_independent = key;
+        return 0;
+    }
+
+    double part_elapsed = (packet->pts - writer->part_start) * av_q2d(writer->time_base);
+    double segment_elapsed = writer->current.duration + part_elapsed;
+
+    int new_segment = (key && segment_elapsed >= LLHLS_SEGMENT_SECONDS) || writer->current.nb_parts == LLHLS_MAX_PARTS - 1;
+    int new_part = new_segment || part_elapsed >= LLHLS_PART_SECONDS;
+
+    if (new_part) {
+
+        int result = finish_part(writer, output_ctx, packet->pts);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        writer->part_independent = key;
+    }
+
+    if (new_segment) {
+
+        int result = finish_segment(writer);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        result = open_segment(writer);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function writes the init segment, the mp4 muxer runs as a
+fragmented cmaf muxer where every av_write_frame(NULL) closes a fragment
+*/
+static AVFormatContext* open_ll_output(LlHlsWriter *writer, AVFormatContext *input_ctx) {
+
+    AVFormatContext *output_ctx = NULL;
+
+    int result = avformat_alloc_output_context2(&output_ctx, NULL, "mp4", NULL);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not create output context.\n");
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < input_ctx->nb_streams; i++) {
+
+        AVStream *out_stream = avformat_new_stream(output_ctx, NULL);
+        {
+            if (out_stream == NULL || avcodec_parameters_copy(out_stream->codecpar, input_ctx->streams[i]->codecpar) < 0) {
+                fprintf(stderr, "Error: Failed to allocate output stream.\n");
+                avformat_free_context(output_ctx);
+                return NULL;
+            }
+        }
+
+        out_stream->codecpar->codec_tag = 0;
+    }
+
+    uint8_t *io_buffer = av_malloc(LLHLS_IO_BUFFER_SIZE);
+    {
+        if (io_buffer == NULL) {
+            avformat_free_context(output_ctx);
+            return NULL;
+        }
+    }
+
+    output_ctx->pb = avio_alloc_context(io_buffer, LLHLS_IO_BUFFER_SIZE, 1, writer, NULL, ll_write, NULL);
+    {
+        if (output_ctx->pb == NULL) {
+            av_free(io_buffer);
+            avformat_free_context(output_ctx);
+            return NULL;
+        }
+
+        output_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    char init_path[1024];
+    snprintf(init_path, sizeof(init_path), "%s/%s", writer->output_dir, LLHLS_INIT_FILE);
+
+    writer->file = fopen(init_path, "wb");
+
+    AVDictionary *options = NULL;
+    {
+        av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof+cmaf+skip_trailer", 0);
+    }
+
+    result = writer->file ? avformat_write_header(output_ctx, &options) : AVERROR(EIO);
+    {
+        av_dict_free(&options);
+
+        if (result >= 0) {
+            avio_flush(output_ctx->pb);
+        }
+
+        if (writer->file) {
+            fclose(writer->file);
+            writer->file = NULL;
+        }
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not write init segment: %s\n", av_err2str(result));
+            av_freep(&output_ctx->pb->buffer);
+            avio_context_free(&output_ctx->pb);
+            avformat_free_context(output_ctx);
+            return NULL;
+        }
+    }
+
+    return output_ctx;
+}
+
+static void close_ll_output(AVFormatContext *output_ctx) {
+
+    if (output_ctx) {
+        av_freep(&output_ctx->pb->buffer);
+        avio_context_free(&output_ctx->pb);
+        avformat_free_context(output_ctx);
+    }
+}
+
+/*
+this function remuxes into low latency hls
+the hls muxer of FFmpeg has no partial segments, so the segmenting is done
+here on top of the fragmented mp4 muxer: every part is one cmaf fragment
+appended to the segment file and listed as a byte range of it, which keeps
+the segments identical to the SEGMENT_FMP4 ones for regular and dash players
+*/
+int remux_to_llhls(AVFormatContext *input_ctx, const char *output_dir, const char *output_file, JobReport *report) {
+
+    if (make_dirs(output_dir) < 0) {
+        fprintf(stderr, "Error: Could not create output directory '%s'.\n", output_dir);
+        return -1;
+    }
+
+    LlHlsWriter writer;
+    {
+        memset(&writer, 0, sizeof(writer));
+        writer.output_dir = output_dir;
+        writer.output_file = output_file;
+        writer.report = report;
+        writer.part_start = AV_NOPTS_VALUE;
+        writer.last_end = AV_NOPTS_VALUE;
+        writer.max_target = (int)ceil(LLHLS_SEGMENT_SECONDS);
+
+        writer.reference_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+        if (writer.reference_index < 0) {
+            writer.reference_index = 0;
+        }
+    }
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    AVFormatContext *output_ctx = open_ll_output(&writer, input_ctx);
+    {
+        if (output_ctx == NULL) {
+            return -1;
+        }
+
+        writer.time_base = output_ctx->streams[writer.reference_index]->time_base;
+    }
+
+    stage_end(report, JOB_STAGE_HEADER, &clock);
+    stage_begin(&clock);
+
+    int result = open_segment(&writer);
+
+    AVPacket *packet = av_packet_alloc();
+    {
+        if (packet == NULL) {
+            result = AVERROR(ENOMEM);
+        }
+    }
+
+    while (result >= 0 && (result = av_read_frame(input_ctx, packet)) >= 0) {
+
+        report_packet(report, packet);
+
+        AVStream *in_stream = input_ctx->streams[packet->stream_index];
+        AVStream *out_stream = output_ctx->streams[packet->stream_index];
+        {
+            av_packet_rescale_ts(packet, in_stream->time_base, out_stream->time_base);
+            packet->pos = -1;
+        }
+
+        report_progress(report, packet->dts, out_stream->time_base);
+
+        result = cut_before(&writer, output_ctx, packet);
+        {
+            if (result < 0) {
+                av_packet_unref(packet);
+                break;
+            }
+        }
+
+        if (packet->stream_index == writer.reference_index && packet->pts != AV_NOPTS_VALUE) {
+            writer.last_end = FFMAX(writer.last_end, packet->pts + packet->duration);
+        }
+
+        result = av_interleaved_write_frame(output_ctx, packet);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Failed to write frame to output file.\n");
+                break;
+            }
+        }
+    }
+
+    av_packet_free(&packet);
+
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
+    if (result == AVERROR_EOF) {
+
+        result = writer.last_end != AV_NOPTS_VALUE ? finish_part(&writer, output_ctx, writer.last_end) : 0;
+
+        if (result >= 0) {
+            result = av_write_trailer(output_ctx);
+        }
+
+        if (result >= 0) {
+            result = finish_segment(&writer);
+        }
+
+        if (result >= 0) {
+            result = write_playlist(&writer, 1);
+        }
+
+        stage_end(report, JOB_STAGE_TRAILER, &clock);
+    }
+
+    if (writer.file) {
+        fclose(writer.file);
+    }
+
+    close_ll_output(output_ctx);
+    av_freep(&writer.segments);
+
+    if (result < 0) {
+        fprintf(stderr, "Error: Low latency HLS failed: %s\n", av_err2str(result));
+        return result;
+    }
+
+    printf("HLS conversion completed successfully.\n");
+
+    return 0;
+}
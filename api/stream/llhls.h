@@ -0,0 +1,24 @@
+#ifndef LLHLS_H
+#define LLHLS_H
+
+#include "libavformat/avformat.h"
+#include "../../core/probe.h"
+
+// init segment of fmp4 outputs, next to the playlist
+#define LLHLS_INIT_FILE "init.mp4"
+
+// segments are cut on the first keyframe after LLHLS_SEGMENT_SECONDS,
+// partial segments every LLHLS_PART_SECONDS
+#define LLHLS_SEGMENT_SECONDS 2.0
+#define LLHLS_PART_SECONDS 0.5
+
+// only the last segments of the playlist list their parts
+#define LLHLS_PART_SEGMENTS 3
+
+// upper bound of parts in one segment, a source with longer keyframe
+// intervals gets its segments cut without a keyframe
+#define LLHLS_MAX_PARTS 64
+
+int remux_to_llhls(AVFormatContext *input_ctx, const char *output_dir, const char *output_file, JobReport *report);
+
+#endif
@@ -0,0 +1,725 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "plan.h"
+
+#include "libavutil/channel_layout.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+
+// bitrate of the aac encode per channel
+#define PLAN_AAC_BITRATE_PER_CHANNEL 64000
+
+// codecs hls players play from the segments as they are, per container
+static const enum AVCodecID ts_video[] = { AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_NONE };
+static const enum AVCodecID fmp4_video[] = { AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_VP9, AV_CODEC_ID_AV1, AV_CODEC_ID_NONE };
+static const enum AVCodecID hls_audio[] = { AV_CODEC_ID_AAC, AV_CODEC_ID_MP3, AV_CODEC_ID_AC3, AV_CODEC_ID_EAC3, AV_CODEC_ID_NONE };
+
+static int carries(const enum AVCodecID *codecs, enum AVCodecID codec_id) {
+
+    for (int i = 0; codecs[i] != AV_CODEC_ID_NONE; i++) {
+        if (codecs[i] == codec_id) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function returns the bitstream filter a copied stream needs in the
+segment container, NULL when its packets fit as they are
+mpeg-ts wants annex b video, fmp4 wants aac without adts headers
+*/
+static const char* stream_filter(const AVCodecParameters *par, int fmp4) {
+
+    // avcC and hvcC extradata start with their version, 1, annex b with a start code
+    int length_prefixed = par->extradata_size > 0 && par->extradata[0] == 1;
+
+    if (!fmp4 && par->codec_id == AV_CODEC_ID_H264 && length_prefixed) {
+        return "h264_mp4toannexb";
+    }
+
+    if (!fmp4 && par->codec_id == AV_CODEC_ID_HEVC && length_prefixed) {
+        return "hevc_mp4toannexb";
+    }
+
+    if (fmp4 && par->codec_id == AV_CODEC_ID_AAC && par->extradata_size == 0) {
+        return "aac_adtstoasc";
+    }
+
+    return NULL;
+}
+
+// this function returns sample_rate when aac has it, 48kHz otherwise
+static int aac_sample_rate(int sample_rate) {
+
+    static const int rates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+    for (int i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        if (rates[i] == sample_rate) {
+            return sample_rate;
+        }
+    }
+
+    return 48000;
+}
+
+static int open_filter(StreamPlan *stream, const AVStream *in_stream, AVStream *out_stream, const char *name) {
+
+    const AVBitStreamFilter *filter = av_bsf_get_by_name(name);
+    {
+        if (filter == NULL) {
+            fprintf(stderr, "Error: Could not find the %s bitstream filter.\n", name);
+            return AVERROR_BSF_NOT_FOUND;
+        }
+    }
+
+    int result = av_bsf_alloc(filter, &stream->bsf_ctx);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    result = avcodec_parameters_copy(stream->bsf_ctx->par_in, in_stream->codecpar);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    stream->bsf_ctx->time_base_in = in_stream->time_base;
+
+    result = av_bsf_init(stream->bsf_ctx);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open the %s bitstream filter.\n", name);
+            return result;
+        }
+    }
+
+    return avcodec_parameters_copy(out_stream->codecpar, stream->bsf_ctx->par_out);
+}
+
+/*
+this function opens the decoder of in_stream and an aac encoder for
+out_stream, mono stays mono and everything else is mixed down to stereo
+*/
+static int open_transcoder(StreamPlan *stream, const AVStream *in_stream, AVStream *out_stream) {
+
+    const AVCodecParameters *par = in_stream->codecpar;
+
+    const AVCodec *decoder = avcodec_find_decoder(par->codec_id);
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    {
+        if (decoder == NULL || encoder == NULL) {
+            fprintf(stderr, "Error: Could not find a %s decoder and an aac encoder.\n", avcodec_get_name(par->codec_id));
+            return AVERROR_DECODER_NOT_FOUND;
+        }
+    }
+
+    StreamTranscoder *transcoder = av_mallocz(sizeof(*transcoder));
+    {
+        if (transcoder == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        stream->transcoder = transcoder;
+        transcoder->next_pts = AV_NOPTS_VALUE;
+
+        transcoder->decoder_ctx = avcodec_alloc_context3(decoder);
+        transcoder->encoder_ctx = avcodec_alloc_context3(encoder);
+        transcoder->decoded = av_frame_alloc();
+        transcoder->resampled = av_frame_alloc();
+        transcoder->frame = av_frame_alloc();
+
+        if (!transcoder->decoder_ctx || !transcoder->encoder_ctx || !transcoder->decoded || !transcoder->resampled || !transcoder->frame) {
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    AVCodecContext *decoder_ctx = transcoder->decoder_ctx;
+    {
+        int result = avcodec_parameters_to_context(decoder_ctx, par);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        decoder_ctx->pkt_timebase = in_stream->time_base;
+
+        result = avcodec_open2(decoder_ctx, decoder, NULL);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not open the %s decoder.\n", avcodec_get_name(par->codec_id));
+                return result;
+            }
+        }
+    }
+
+    AVCodecContext *encoder_ctx = transcoder->encoder_ctx;
+    {
+        av_channel_layout_default(&encoder_ctx->ch_layout, par->ch_layout.nb_channels == 1 ? 1 : 2);
+
+        encoder_ctx->sample_rate = aac_sample_rate(par->sample_rate);
+        encoder_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+        encoder_ctx->bit_rate = PLAN_AAC_BITRATE_PER_CHANNEL * encoder_ctx->ch_layout.nb_channels;
+        encoder_ctx->time_base = (AVRational){ 1, encoder_ctx->sample_rate };
+
+        // the audio specific config goes into extradata, mpeg-ts builds its adts headers from it
+        encoder_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        int result = avcodec_open2(encoder_ctx, encoder, NULL);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not open the aac encoder.\n");
+                return result;
+            }
+        }
+
+        result = avcodec_parameters_from_context(out_stream->codecpar, encoder_ctx);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        out_stream->time_base = encoder_ctx->time_base;
+    }
+
+    transcoder->fifo = av_audio_fifo_alloc(encoder_ctx->sample_fmt, encoder_ctx->ch_layout.nb_channels, encoder_ctx->frame_size);
+    {
+        if (transcoder->fifo == NULL) {
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    AVFrame *frame = transcoder->frame;
+    {
+        frame->format = encoder_ctx->sample_fmt;
+        frame->sample_rate = encoder_ctx->sample_rate;
+        frame->nb_samples = encoder_ctx->frame_size;
+
+        int result = av_channel_layout_copy(&frame->ch_layout, &encoder_ctx->ch_layout);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        return av_frame_get_buffer(frame, 0);
+    }
+}
+
+static void free_transcoder(StreamTranscoder **transcoder) {
+
+    StreamTranscoder *t = *transcoder;
+    if (t == NULL) {
+        return;
+    }
+
+    avcodec_free_context(&t->decoder_ctx);
+    avcodec_free_context(&t->encoder_ctx);
+    swr_free(&t->swr_ctx);
+    av_audio_fifo_free(t->fifo);
+    av_frame_free(&t->decoded);
+    av_frame_free(&t->resampled);
+    av_frame_free(&t->frame);
+
+    av_freep(transcoder);
+}
+
+/*
+this function allocates the stream plans and packets of a plan, every
+stream starts as STREAM_DROP
+*/
+static int alloc_plan(RemuxPlan *plan, const AVFormatContext *input_ctx) {
+
+    memset(plan, 0, sizeof(*plan));
+
+    plan->streams = av_calloc(input_ctx->nb_streams, sizeof(*plan->streams));
+    plan->input = av_packet_alloc();
+    plan->packet = av_packet_alloc();
+    {
+        if (plan->streams == NULL || plan->input == NULL || plan->packet == NULL) {
+            return AVERROR(ENOMEM);
+        }
+
+        plan->nb_streams = input_ctx->nb_streams;
+    }
+
+    for (int i = 0; i < plan->nb_streams; i++) {
+        plan->streams[i].action = STREAM_DROP;
+        plan->streams[i].output_index = -1;
+    }
+
+    return 0;
+}
+
+/*
+this function adds the output stream of a kept input stream and opens its
+filter or encoder for stream->action
+*/
+static int open_stream(StreamPlan *stream, AVStream *in_stream, AVFormatContext *output_ctx, int fmp4) {
+
+    AVStream *out_stream = avformat_new_stream(output_ctx, NULL);
+    {
+        if (out_stream == NULL) {
+            fprintf(stderr, "Error: Failed to allocate output stream.\n");
+            return AVERROR(ENOMEM);
+        }
+
+        stream->output_index = out_stream->index;
+    }
+
+    int result;
+    {
+        switch (stream->action) {
+            case STREAM_BSF:       result = open_filter(stream, in_stream, out_stream, stream_filter(in_stream->codecpar, fmp4)); break;
+            case STREAM_TRANSCODE: result = open_transcoder(stream, in_stream, out_stream); break;
+            default:               result = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar); break;
+        }
+
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    out_stream->codecpar->codec_tag = 0;
+
+    return 0;
+}
+
+/*
+this function picks the cheapest way to carry every input stream and adds
+the output streams for the kept ones:
+- the main video is copied, through an annex b filter for mpeg-ts; video
+  only fmp4 can carry (vp9, av1) switches *format from ts to fmp4, other
+  video (mpeg-4 part 2, mpeg-2) is copied as it always was, the muxer
+  takes it but players may not (mode=transcode re-encodes it)
+- audio hls plays is copied, the main audio track is encoded to aac when
+  it is not (opus, vorbis, flac, pcm), other audio tracks are dropped then
+- data, subtitle and attachment streams, cover art and extra video tracks
+  are dropped
+on failure the caller frees the plan with free_plan()
+*/
+int plan_streams(RemuxPlan *plan, AVFormatContext *input_ctx, AVFormatContext *output_ctx, SegmentFormat *format) {
+
+    int result = alloc_plan(plan, input_ctx);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    int video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    int audio_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_AUDIO, -1, video_index, NULL, 0);
+
+    // cover art is a video stream holding a single picture
+    if (video_index >= 0 && (input_ctx->streams[video_index]->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+        video_index = -1;
+    }
+
+    if (video_index >= 0) {
+
+        enum AVCodecID codec_id = input_ctx->streams[video_index]->codecpar->codec_id;
+
+        if (*format == SEGMENT_TS && !carries(ts_video, codec_id) && carries(fmp4_video, codec_id)) {
+            printf("%s video can not go into mpeg-ts, writing fmp4 segments.\n", avcodec_get_name(codec_id));
+            *format = SEGMENT_FMP4;
+        }
+
+        if (!carries(*format == SEGMENT_TS ? ts_video : fmp4_video, codec_id)) {
+            printf("Warning: %s video is copied as it is, hls players may not play it.\n", avcodec_get_name(codec_id));
+        }
+    }
+
+    int fmp4 = *format != SEGMENT_TS;
+
+    for (int i = 0; i < input_ctx->nb_streams; i++) {
+
+        AVStream *in_stream = input_ctx->streams[i];
+        const AVCodecParameters *par = in_stream->codecpar;
+
+        StreamPlan *stream = &plan->streams[i];
+        {
+            if (i == video_index || (par->codec_type == AVMEDIA_TYPE_AUDIO && carries(hls_audio, par->codec_id))) {
+                stream->action = stream_filter(par, fmp4) ? STREAM_BSF : STREAM_COPY;
+            } else if (i == audio_index) {
+                stream->action = STREAM_TRANSCODE;
+            }
+
+            if (stream->action == STREAM_DROP) {
+                printf("Dropping stream %d (%s %s).\n", i, av_get_media_type_string(par->codec_type), avcodec_get_name(par->codec_id));
+                continue;
+            }
+        }
+
+        result = open_stream(stream, in_stream, output_ctx, fmp4);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    if (output_ctx->nb_streams == 0) {
+        fprintf(stderr, "Error: The input has no stream hls can carry.\n");
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    return 0;
+}
+
+/*
+this function plans the audio stream audio_index alone, for outputs that
+encode their own video (the renditions of the abr ladder): it is copied,
+filtered or encoded to aac the way plan_streams() carries the main audio
+track into segments of format, every other input stream is dropped
+on failure the caller frees the plan with free_plan()
+*/
+int plan_audio(RemuxPlan *plan, AVFormatContext *input_ctx, int audio_index, AVFormatContext *output_ctx, SegmentFormat format) {
+
+    int result = alloc_plan(plan, input_ctx);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    AVStream *in_stream = input_ctx->streams[audio_index];
+    const AVCodecParameters *par = in_stream->codecpar;
+
+    int fmp4 = format != SEGMENT_TS;
+
+    StreamPlan *stream = &plan->streams[audio_index];
+    {
+        if (carries(hls_audio, par->codec_id)) {
+            stream->action = stream_filter(par, fmp4) ? STREAM_BSF : STREAM_COPY;
+        } else {
+            stream->action = STREAM_TRANSCODE;
+        }
+    }
+
+    return open_stream(stream, in_stream, output_ctx, fmp4);
+}
+
+/*
+this function writes a copied or filtered packet, time_base is the one
+its timestamps are in
+*/
+static int write_copied(const StreamPlan *stream, AVFormatContext *output_ctx, AVPacket *packet, AVRational time_base) {
+
+    AVStream *out_stream = output_ctx->streams[stream->output_index];
+    {
+        packet->pts = av_rescale_q_rnd(packet->pts, time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+        packet->dts = av_rescale_q_rnd(packet->dts, time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+        packet->duration = av_rescale_q(packet->duration, time_base, out_stream->time_base);
+        packet->pos = -1;
+        packet->stream_index = stream->output_index;
+    }
+
+    return av_interleaved_write_frame(output_ctx, packet);
+}
+
+static int drain_filter(const StreamPlan *stream, AVFormatContext *output_ctx, AVPacket *packet) {
+
+    int result;
+
+    while ((result = av_bsf_receive_packet(stream->bsf_ctx, packet)) >= 0) {
+
+        result = write_copied(stream, output_ctx, packet, stream->bsf_ctx->time_base_out);
+        {
+            if (result < 0) {
+                av_packet_unref(packet);
+                return result;
+            }
+        }
+    }
+
+    return result == AVERROR(EAGAIN) || result == AVERROR_EOF ? 0 : result;
+}
+
+static int drain_encoder(const StreamPlan *stream, AVFormatContext *output_ctx, AVPacket *packet) {
+
+    AVCodecContext *encoder_ctx = stream->transcoder->encoder_ctx;
+    AVStream *out_stream = output_ctx->streams[stream->output_index];
+
+    int result;
+
+    while ((result = avcodec_receive_packet(encoder_ctx, packet)) >= 0) {
+
+        av_packet_rescale_ts(packet, encoder_ctx->time_base, out_stream->time_base);
+        packet->stream_index = stream->output_index;
+
+        result = av_interleaved_write_frame(output_ctx, packet);
+        {
+            if (result < 0) {
+                av_packet_unref(packet);
+                return result;
+            }
+        }
+    }
+
+    return result == AVERROR(EAGAIN) || result == AVERROR_EOF ? 0 : result;
+}
+
+/*
+this function encodes the samples in the fifo in frames of frame_size,
+flush also encodes the short frame left at the end of the stream
+*/
+static int encode_fifo(const StreamPlan *stream, AVFormatContext *output_ctx, AVPacket *packet, int flush) {
+
+    StreamTranscoder *t = stream->transcoder;
+    int frame_size = t->encoder_ctx->frame_size;
+
+    while (av_audio_fifo_size(t->fifo) >= frame_size || (flush && av_audio_fifo_size(t->fifo) > 0)) {
+
+        // the encoder may still hold the last frame
+        t->frame->nb_samples = frame_size;
+
+        int result = av_frame_make_writable(t->frame);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        int nb_samples = av_audio_fifo_read(t->fifo, (void**)t->frame->data, frame_size);
+        {
+            if (nb_samples < 0) {
+                return nb_samples;
+            }
+        }
+
+        t->frame->nb_samples = nb_samples;
+        t->frame->pts = t->next_pts;
+        t->next_pts += nb_samples;
+
+        result = avcodec_send_frame(t->encoder_ctx, t->frame);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        result = drain_encoder(stream, output_ctx, packet);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function converts a decoded frame to the encoder's format and queues
+it in the fifo, a NULL frame drains the resampler at the end
+the first frame places the aac track on the input timeline, from there
+its timestamps follow from the sample count
+*/
+static int resample_frame(StreamTranscoder *t, const AVFrame *decoded) {
+
+    AVCodecContext *encoder_ctx = t->encoder_ctx;
+
+    if (t->swr_ctx == NULL) {
+
+        if (decoded == NULL) {
+            return 0;
+        }
+
+        int result = swr_alloc_set_opts2(&t->swr_ctx, &encoder_ctx->ch_layout, encoder_ctx->sample_fmt, encoder_ctx->sample_rate,
+                                         &decoded->ch_layout, decoded->format, decoded->sample_rate, 0, NULL);
+        if (result >= 0) {
+            result = swr_init(t->swr_ctx);
+        }
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not set up the audio resampler.\n");
+            return result;
+        }
+
+        int64_t pts = decoded->best_effort_timestamp != AV_NOPTS_VALUE ? decoded->best_effort_timestamp : 0;
+        t->next_pts = av_rescale_q(pts, t->decoder_ctx->pkt_timebase, encoder_ctx->time_base);
+    }
+
+    int nb_samples = swr_get_out_samples(t->swr_ctx, decoded ? decoded->nb_samples : 0);
+    {
+        if (nb_samples <= 0) {
+            return nb_samples;
+        }
+    }
+
+    // the buffers are only replaced when a frame needs more samples than they hold
+    AVFrame *resampled = t->resampled;
+    {
+        if (nb_samples > t->resampled_capacity) {
+
+            av_frame_unref(resampled);
+
+            resampled->format = encoder_ctx->sample_fmt;
+            resampled->sample_rate = encoder_ctx->sample_rate;
+            resampled->nb_samples = nb_samples;
+
+            int result = av_channel_layout_copy(&resampled->ch_layout, &encoder_ctx->ch_layout);
+            if (result >= 0) {
+                result = av_frame_get_buffer(resampled, 0);
+            }
+
+            if (result < 0) {
+                t->resampled_capacity = 0;
+                return result;
+            }
+
+            t->resampled_capacity = nb_samples;
+        }
+    }
+
+    int converted = swr_convert(t->swr_ctx, resampled->data, t->resampled_capacity,
+                                decoded ? (const uint8_t**)decoded->extended_data : NULL, decoded ? decoded->nb_samples : 0);
+    {
+        if (converted < 0) {
+            return converted;
+        }
+    }
+
+    int written = av_audio_fifo_write(t->fifo, (void**)resampled->data, converted);
+
+    return written < 0 ? written : 0;
+}
+
+static int decode_frames(const StreamPlan *stream, AVFormatContext *output_ctx, AVPacket *packet) {
+
+    StreamTranscoder *t = stream->transcoder;
+
+    int result;
+
+    while ((result = avcodec_receive_frame(t->decoder_ctx, t->decoded)) >= 0) {
+
+        result = resample_frame(t, t->decoded);
+        av_frame_unref(t->decoded);
+
+        if (result >= 0) {
+            result = encode_fifo(stream, output_ctx, packet, 0);
+        }
+
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return result == AVERROR(EAGAIN) || result == AVERROR_EOF ? 0 : result;
+}
+
+/*
+this function copies, filters or transcodes one input packet the way its
+stream was planned, the packet is unreferenced in every case
+*/
+int plan_write_packet(RemuxPlan *plan, AVFormatContext *input_ctx, AVFormatContext *output_ctx, AVPacket *packet) {
+
+    // streams that showed up after probing were never planned
+    StreamPlan *stream = packet->stream_index < plan->nb_streams ? &plan->streams[packet->stream_index] : NULL;
+    {
+        if (stream == NULL || stream->action == STREAM_DROP) {
+            av_packet_unref(packet);
+            return 0;
+        }
+    }
+
+    int result;
+
+    switch (stream->action) {
+
+        case STREAM_BSF:
+            result = av_bsf_send_packet(stream->bsf_ctx, packet);
+            if (result >= 0) {
+                result = drain_filter(stream, output_ctx, plan->packet);
+            }
+            break;
+
+        case STREAM_TRANSCODE:
+            result = avcodec_send_packet(stream->transcoder->decoder_ctx, packet);
+
+            // a corrupt audio packet should not abort the remux
+            if (result == AVERROR_INVALIDDATA) {
+                result = 0;
+            } else if (result >= 0) {
+                result = decode_frames(stream, output_ctx, plan->packet);
+            }
+            break;
+
+        default:
+            result = write_copied(stream, output_ctx, packet, input_ctx->streams[packet->stream_index]->time_base);
+            break;
+    }
+
+    av_packet_unref(packet);
+
+    return result;
+}
+
+/*
+this function drains the bitstream filters, decoders, resamplers and
+encoders once the input is exhausted, before the trailer is written
+*/
+int plan_flush(RemuxPlan *plan, AVFormatContext *output_ctx) {
+
+    for (int i = 0; i < plan->nb_streams; i++) {
+
+        StreamPlan *stream = &plan->streams[i];
+        int result = 0;
+
+        if (stream->action == STREAM_BSF) {
+
+            result = av_bsf_send_packet(stream->bsf_ctx, NULL);
+            if (result >= 0) {
+                result = drain_filter(stream, output_ctx, plan->packet);
+            }
+
+        } else if (stream->action == STREAM_TRANSCODE) {
+
+            StreamTranscoder *t = stream->transcoder;
+
+            result = avcodec_send_packet(t->decoder_ctx, NULL);
+            if (result >= 0) {
+                result = decode_frames(stream, output_ctx, plan->packet);
+            }
+            if (result >= 0) {
+                result = resample_frame(t, NULL);
+            }
+            if (result >= 0) {
+                result = encode_fifo(stream, output_ctx, plan->packet, 1);
+            }
+            if (result >= 0) {
+                result = avcodec_send_frame(t->encoder_ctx, NULL);
+            }
+            if (result >= 0) {
+                result = drain_encoder(stream, output_ctx, plan->packet);
+            }
+        }
+
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+void free_plan(RemuxPlan *plan) {
+
+    for (int i = 0; i < plan->nb_streams; i++) {
+        av_bsf_free(&plan->streams[i].bsf_ctx);
+        free_transcoder(&plan->streams[i].transcoder);
+    }
+
+    av_freep(&plan->streams);
+    av_packet_free(&plan->input);
+    av_packet_free(&plan->packet);
+
+    plan->nb_streams = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libavcodec/bsf.h"
+#include "libavutil/audio_fifo.h"
+#include "libswresample/swresample.h"
+
+#include "remux.h"
+#include "thumbs.h"
+
+// What the remux does with one input stream, cheapest first
+typedef enum {
+    STREAM_DROP      = 0, // not carried: data, subtitles, cover art, extra video, audio that would need a second encode
+    STREAM_COPY      = 1, // packets are copied as they are
+    STREAM_BSF       = 2, // packets are copied through a bitstream filter (h264_mp4toannexb, aac_adtstoasc, ...)
+    STREAM_TRANSCODE = 3, // audio decoded and encoded to aac, the segments can not carry the source codec
+} StreamAction;
+
+// the aac encode of a STREAM_TRANSCODE stream
+typedef struct {
+    AVCodecContext *decoder_ctx;
+    AVCodecContext *encoder_ctx;
+    struct SwrContext *swr_ctx; // created from the first decoded frame
+    AVAudioFifo *fifo;          // resampled samples waiting for a full encoder frame
+    AVFrame *decoded;
+    AVFrame *resampled;         // its buffers are kept and reused while they are large enough
+    int resampled_capacity;     // samples the buffers of resampled hold
+    AVFrame *frame;             // frame_size samples handed to the encoder
+    int64_t next_pts;           // in encoder time base, AV_NOPTS_VALUE until the first frame
+} StreamTranscoder;
+
+typedef struct {
+    StreamAction action;
+    int output_index; // -1 when dropped
+
+    AVBSFContext *bsf_ctx;          // STREAM_BSF
+    StreamTranscoder *transcoder;   // STREAM_TRANSCODE
+} StreamPlan;
+
+// per stream actions of a remux, filled in by plan_streams()
+struct RemuxPlan {
+    StreamPlan *streams; // one per input stream
+    int nb_streams;
+    AVPacket *input;     // every input packet is read into this one, see remux_packet()
+    AVPacket *packet;    // output of the filters and encoders
+    ThumbSheet *thumbs;  // sees every input packet before it is written, NULL without thumbnails
+};
+
+int plan_streams(RemuxPlan *plan, AVFormatContext *input_ctx, AVFormatContext *output_ctx, SegmentFormat *format);
+int plan_audio(RemuxPlan *plan, AVFormatContext *input_ctx, int audio_index, AVFormatContext *output_ctx, SegmentFormat format);
+int plan_write_packet(RemuxPlan *plan, AVFormatContext *input_ctx, AVFormatContext *output_ctx, AVPacket *packet);
+int plan_flush(RemuxPlan *plan, AVFormatContext *output_ctx);
+void free_plan(RemuxPlan *plan);
+
+#endif
@@ -1,31 +1,144 @@
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "read_pipe.h"
 
-int read_file_from_pipe(int fd) {
+#if defined(__linux__)
+    #include <sys/syscall.h>
+    #define PIPE_HAVE_SPLICE
+#endif
 
+#ifndef SPLICE_F_MOVE
+    #define SPLICE_F_MOVE 1
+#endif
 
-    printf("C received: %d", fd);
-    
-    FILE *output = fopen("output.mp4", "w");
-    if (!output) {
-        perror("Failed to open output file");
-        return 1;
+/*
+this function writes the whole buffer, a write() to a file may stop short
+*/
+static int write_full(int fd, const uint8_t *buf, size_t size) {
+
+    while (size > 0) {
+
+        ssize_t written = write(fd, buf, size);
+        {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written < 0) {
+                return -1;
+            }
+        }
+
+        buf += written;
+        size -= written;
     }
 
-    char buffer[1024];
+    return 0;
+}
+
+/*
+this function copies the pipe into out_fd through one PIPE_COPY_BUFFER_SIZE
+buffer, for kernels or descriptors splice() does not take
+*/
+static int64_t copy_pipe(int fd, int out_fd) {
+
+    void *buffer;
+    {
+        if (posix_memalign(&buffer, PIPE_COPY_ALIGN, PIPE_COPY_BUFFER_SIZE) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    int64_t total = 0;
     ssize_t bytes_read;
 
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        fwrite(buffer, 1, bytes_read, output); // Write data to file
-        //printf("C received: %s", buffer);
+    while ((bytes_read = read(fd, buffer, PIPE_COPY_BUFFER_SIZE)) != 0) {
+
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes_read < 0 || write_full(out_fd, buffer, bytes_read) < 0) {
+            total = -1;
+            break;
+        }
+
+        total += bytes_read;
+    }
+
+    free(buffer);
+
+    return total;
+}
+
+/*
+this function moves everything from the pipe fd into out_fd until the
+writer closes its end, and returns the number of bytes moved (-1 and errno
+on failure). on linux the data goes from the pipe to the file with
+splice(), the kernel moves the pipe pages without a copy through user
+space and with one syscall per PIPE_SPLICE_SIZE instead of one read() and
+one write() per buffer. when splice() is refused on the first call (fd is
+not a pipe, out_fd is opened for appending, an old kernel) it falls back
+to copy_pipe()
+*/
+int64_t drain_pipe(int fd, int out_fd) {
+
+    int64_t total = 0;
+
+#ifdef PIPE_HAVE_SPLICE
+    for (;;) {
+
+        ssize_t moved = syscall(SYS_splice, fd, NULL, out_fd, NULL, PIPE_SPLICE_SIZE, SPLICE_F_MOVE);
+        {
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (moved < 0 && total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                break;
+            }
+
+            if (moved < 0) {
+                return -1;
+            }
+
+            if (moved == 0) {
+                return total;
+            }
+        }
+
+        total += moved;
+    }
+#endif
+
+    return copy_pipe(fd, out_fd);
+}
+
+/*
+this function drains the pipe into output.mp4
+*/
+int read_file_from_pipe(int fd) {
+
+
+    printf("C received: %d", fd);
+
+    int output = open("output.mp4", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        perror("Failed to open output file");
+        return 1;
     }
 
-    if (bytes_read < 0) {
+    if (drain_pipe(fd, output) < 0) {
         perror("Error reading from pipe");
+        close(output);
         return 1;
     }
 
-    fclose(output);
+    close(output);
 
     return 0;
-}
\ No newline at end of file
+}
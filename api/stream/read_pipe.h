@@ -2,8 +2,17 @@
 #define READ_PIPE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 
+// bytes asked from one splice() call, the kernel moves what the pipe holds
+#define PIPE_SPLICE_SIZE (1024 * 1024)
+
+// buffer of the read()/write() fallback, page aligned
+#define PIPE_COPY_BUFFER_SIZE (1024 * 1024)
+#define PIPE_COPY_ALIGN 4096
+
+int64_t drain_pipe(int fd, int out_fd);
 int read_file_from_pipe(int fd);
 
 #endif
\ No newline at end of file
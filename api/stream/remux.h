@@ -0,0 +1,33 @@
+#ifndef REMUX_H
+#define REMUX_H
+
+#include "libavformat/avformat.h"
+#include "../../core/probe.h"
+#include "sink.h"
+#include "uring.h"
+
+// Segment container of the hls outputs
+typedef enum {
+    SEGMENT_TS     = 0, // mpeg-ts segments
+    SEGMENT_FMP4   = 1, // cmaf/fmp4 segments with an init.mp4, playable by dash players too
+    SEGMENT_LL_HLS = 2, // fmp4 with parts: partial segments listed as byte ranges (see llhls.c)
+} SegmentFormat;
+
+// per stream copy, filter, transcode or drop decisions, see plan.h
+typedef struct RemuxPlan RemuxPlan;
+
+// Shared building blocks of the hls pipeline in cgompeg.c, used by the
+// other conversion modes (abr.c, ...) so they write the same layout
+int make_dirs(const char *path);
+
+AVFormatContext* open_input_file(const char *input_file);
+
+AVFormatContext* alloc_hls_output(const char *output_dir, const char *output_file);
+int write_hls_header(AVFormatContext *output_ctx, const char *output_dir, SegmentFormat format, int window, HlsSink *sink, UringOutput *uring, JobReport *report);
+AVFormatContext* setup_hls_output(const char *output_dir, const char *output_file, AVFormatContext *input_ctx, SegmentFormat format, int window, RemuxPlan *plan, HlsSink *sink, UringOutput *uring, JobReport *report);
+
+int remux_packet(AVFormatContext *input_ctx, AVFormatContext *output_ctx, RemuxPlan *plan, JobReport *report);
+int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx, RemuxPlan *plan, JobReport *report);
+int remux_to_hls(AVFormatContext *input_ctx, const char *output_dir, const char *output_file, SegmentFormat format, HlsSink *sink, IoBackend io, int thumbnails, JobReport *report);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "sink.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+
+#define SINK_IO_BUFFER_SIZE 32768
+
+// one file of an in-memory output, the opaque of its AVIOContext
+typedef struct {
+    char name[1024];
+    uint8_t *data;
+    int64_t size;
+    int64_t capacity;
+    int64_t pos;
+} SinkFile;
+
+static int sink_write(void *opaque, const uint8_t *buf, int buf_size) {
+
+    SinkFile *file = (SinkFile*)opaque;
+
+    int64_t end = file->pos + buf_size;
+
+    if (end > file->capacity) {
+
+        int64_t capacity = FFMAX(end, file->capacity * 2);
+
+        uint8_t *data = av_realloc(file->data, capacity);
+        {
+            if (data == NULL) {
+                return AVERROR(ENOMEM);
+            }
+        }
+
+        file->data = data;
+        file->capacity = capacity;
+    }
+
+    // a seek past the end leaves a hole, files on disk read it as zeros
+    if (file->pos > file->size) {
+        memset(file->data + file->size, 0, file->pos - file->size);
+    }
+
+    memcpy(file->data + file->pos, buf, buf_size);
+    file->pos = end;
+    file->size = FFMAX(file->size, end);
+
+    return buf_size;
+}
+
+static int64_t sink_seek(void *opaque, int64_t offset, int whence) {
+
+    SinkFile *file = (SinkFile*)opaque;
+
+    if (whence & AVSEEK_SIZE) {
+        return file->size;
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: position = offset; break;
+        case SEEK_CUR: position = file->pos + offset; break;
+        case SEEK_END: position = file->size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    file->pos = position;
+
+    return position;
+}
+
+/*
+this function gives every file the muxer opens a growing buffer instead
+of a file descriptor, nothing is read back so reads are refused
+*/
+static int sink_io_open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options) {
+
+    (void)options;
+
+    HlsSink *sink = (HlsSink*)s->opaque;
+
+    if (!(flags & AVIO_FLAG_WRITE)) {
+        return AVERROR(ENOSYS);
+    }
+
+    report_hls_open(sink->report, url);
+
+    SinkFile *file = av_mallocz(sizeof(*file));
+    uint8_t *io_buffer = av_malloc(SINK_IO_BUFFER_SIZE);
+    {
+        if (file == NULL || io_buffer == NULL) {
+            av_free(file);
+            av_free(io_buffer);
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    // the outputs are flat, the playlist names the segments relative to itself
+    av_strlcpy(file->name, av_basename(url), sizeof(file->name));
+
+    file->data = sink->spare;
+    file->capacity = sink->spare_capacity;
+    sink->spare = NULL;
+    sink->spare_capacity = 0;
+
+    *pb = avio_alloc_context(io_buffer, SINK_IO_BUFFER_SIZE, 1, file, NULL, sink_write, sink_seek);
+    {
+        if (*pb == NULL) {
+            av_free(file->data);
+            av_free(file);
+            av_free(io_buffer);
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function hands the finished file to the sink and frees it, its data
+buffer is kept as the spare of the sink when it is the larger one
+*/
+static int sink_io_close2(AVFormatContext *s, AVIOContext *pb) {
+
+    HlsSink *sink = (HlsSink*)s->opaque;
+
+    if (pb == NULL) {
+        return 0;
+    }
+
+    avio_flush(pb);
+
+    SinkFile *file = (SinkFile*)pb->opaque;
+    int result = pb->error;
+
+    report_output(sink->report, file->size, 0);
+
+    if (result == 0 && (file->size > INT_MAX || sink->Func(sink->Handle, file->name, file->data, (int)file->size) < 0)) {
+        fprintf(stderr, "Error: Could not hand over output file '%s'.\n", file->name);
+        result = AVERROR_EXTERNAL;
+    }
+
+    if (result < 0) {
+        sink->failed = 1;
+    }
+
+    if (file->capacity > sink->spare_capacity) {
+        FFSWAP(uint8_t*, file->data, sink->spare);
+        FFSWAP(int64_t, file->capacity, sink->spare_capacity);
+    }
+
+    av_free(file->data);
+    av_free(file);
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+
+    return result;
+}
+
+/*
+this function redirects every file of an hls output to sink, it has to
+be called before avformat_write_header. the segments and bytes are
+counted into report like watch_hls_output() does for files on disk
+*/
+void sink_hls_output(AVFormatContext *output_ctx, HlsSink *sink, JobReport *report) {
+
+    sink->report = report;
+    sink->failed = 0;
+
+    output_ctx->opaque = sink;
+    output_ctx->io_open = sink_io_open;
+    output_ctx->io_close2 = sink_io_close2;
+}
+
+/*
+this function frees the spare buffer once the output is closed
+*/
+void sink_release(HlsSink *sink) {
+
+    av_freep(&sink->spare);
+    sink->spare_capacity = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+#include "../../core/report.h"
+
+// receives a finished file of an in-memory output, name is relative to the
+// output dir and data is only valid during the call, < 0 fails the job
+typedef int (*HlsSinkFunc)(uintptr_t handle, char *name, uint8_t *data, int size);
+
+// In-memory output of a job: when Func is set the hls muxer writes nothing
+// to disk, every playlist, init segment and segment is handed to Func once
+// the muxer closes it. the playlist is a vod one, handed over once when the
+// muxer finishes, see write_hls_header()
+typedef struct {
+    HlsSinkFunc Func;
+    uintptr_t Handle; // passed back to Func, a cgo.Handle on the Go side
+
+    JobReport *report; // set by sink_hls_output()
+    int failed;        // set when a file could not be handed over
+
+    // buffer of the last file handed over, the next file is written into it
+    // so a job does not grow a new buffer for every segment
+    uint8_t *spare;
+    int64_t spare_capacity;
+} HlsSink;
+
+void sink_hls_output(AVFormatContext *output_ctx, HlsSink *sink, JobReport *report);
+void sink_release(HlsSink *sink);
+
+#endif
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "thumbs.h"
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+
+// mjpeg quantizer of the sheets, 2 (best) to 31
+#define THUMB_QSCALE 5
+
+#define THUMBS_PER_SHEET (THUMB_COLUMNS * THUMB_ROWS)
+
+struct ThumbSheet {
+    char output_dir[512];
+
+    int stream_index;
+    AVRational time_base; // of the video stream, every time below is in it
+    int64_t start;        // start time of the input, the cues count from it
+    int64_t interval;     // between two thumbnails at least
+    int64_t next;         // a keyframe before it is not decoded, AV_NOPTS_VALUE before the first
+    int64_t end;          // of the last video packet, where the last cue ends
+
+    AVCodecContext *decoder_ctx; // skips every frame that is not a keyframe
+    AVCodecContext *encoder_ctx; // mjpeg, the size of a whole sheet
+    struct SwsContext *sws_ctx;  // cached, follows size changes of the video
+    AVFrame *decoded;
+    AVFrame *sprite;             // the sheet being filled, YUVJ420P
+    AVPacket *encoded;
+
+    int width;  // of one thumbnail, even
+    int height;
+
+    int64_t *times; // of every thumbnail, in sheet order
+    int nb_thumbs;
+    int capacity;
+};
+
+// the sheet is black where no thumbnail was drawn yet
+static int blank_sprite(AVFrame *sprite) {
+
+    int result = av_frame_make_writable(sprite);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    ptrdiff_t linesize[4];
+    for (int i = 0; i < 4; i++) {
+        linesize[i] = sprite->linesize[i];
+    }
+
+    return av_image_fill_black(sprite->data, linesize, sprite->format, AVCOL_RANGE_JPEG, sprite->width, sprite->height);
+}
+
+static AVCodecContext* open_sheet_encoder(int width, int height) {
+
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    {
+        if (encoder == NULL) {
+            fprintf(stderr, "Error: Could not find the MJPEG encoder.\n");
+            return NULL;
+        }
+    }
+
+    AVCodecContext *encoder_ctx = avcodec_alloc_context3(encoder);
+    {
+        if (encoder_ctx == NULL) {
+            return NULL;
+        }
+
+        encoder_ctx->width = width;
+        encoder_ctx->height = height;
+        encoder_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        encoder_ctx->color_range = AVCOL_RANGE_JPEG;
+        encoder_ctx->time_base = (AVRational){1, 1};
+        encoder_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+        encoder_ctx->global_quality = FF_QP2LAMBDA * THUMB_QSCALE;
+        encoder_ctx->thread_count = 1; // a sheet is encoded every THUMBS_PER_SHEET thumbnails
+
+        if (avcodec_open2(encoder_ctx, encoder, NULL) < 0) {
+            fprintf(stderr, "Error: Could not open the MJPEG encoder.\n");
+            avcodec_free_context(&encoder_ctx);
+            return NULL;
+        }
+    }
+
+    return encoder_ctx;
+}
+
+/*
+this function opens a keyframe only decoder for the video stream of
+input_ctx and an empty sheet, the stream is picked like plan_streams()
+picks it. interval is in seconds, a keyframe closer than that to the last
+thumbnail is skipped before it reaches the decoder
+it returns NULL for inputs without a decodable video stream
+*/
+ThumbSheet* thumbs_open(AVFormatContext *input_ctx, const char *output_dir, int interval) {
+
+    int video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    {
+        if (video_index < 0 || (input_ctx->streams[video_index]->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            printf("No video stream, no thumbnails.\n");
+            return NULL;
+        }
+    }
+
+    AVStream *stream = input_ctx->streams[video_index];
+    AVCodecParameters *codecpar = stream->codecpar;
+
+    const AVCodec *decoder = avcodec_find_decoder(codecpar->codec_id);
+    {
+        if (decoder == NULL || codecpar->width <= 0 || codecpar->height <= 0) {
+            fprintf(stderr, "Error: Can not decode %s video for thumbnails.\n", avcodec_get_name(codecpar->codec_id));
+            return NULL;
+        }
+    }
+
+    ThumbSheet *sheet = av_mallocz(sizeof(*sheet));
+    {
+        if (sheet == NULL) {
+            return NULL;
+        }
+
+        snprintf(sheet->output_dir, sizeof(sheet->output_dir), "%s", output_dir);
+
+        sheet->stream_index = video_index;
+        sheet->time_base = stream->time_base;
+        sheet->start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        sheet->interval = FFMAX(1, av_rescale_q(FFMAX(interval, 1), (AVRational){1, 1}, stream->time_base));
+        sheet->next = AV_NOPTS_VALUE;
+        sheet->end = AV_NOPTS_VALUE;
+    }
+
+    // anamorphic video is shown with square pixels
+    AVRational sar = codecpar->sample_aspect_ratio;
+    {
+        if (sar.num <= 0 || sar.den <= 0) {
+            sar = (AVRational){1, 1};
+        }
+
+        sheet->width = THUMB_WIDTH;
+        sheet->height = FFMAX(2, av_rescale(THUMB_WIDTH, (int64_t)codecpar->height * sar.den, (int64_t)codecpar->width * sar.num) & ~1);
+    }
+
+    sheet->decoder_ctx = avcodec_alloc_context3(decoder);
+    {
+        if (sheet->decoder_ctx == NULL || avcodec_parameters_to_context(sheet->decoder_ctx, codecpar) < 0) {
+            fprintf(stderr, "Error: Could not allocate the thumbnail decoder.\n");
+            thumbs_free(&sheet);
+            return NULL;
+        }
+
+        sheet->decoder_ctx->pkt_timebase = stream->time_base;
+        sheet->decoder_ctx->skip_frame = AVDISCARD_NONKEY;
+
+        // frame threads would only add delay, one keyframe is decoded at a time
+        sheet->decoder_ctx->thread_count = 1;
+
+        if (avcodec_open2(sheet->decoder_ctx, decoder, NULL) < 0) {
+            fprintf(stderr, "Error: Could not open the thumbnail decoder.\n");
+            thumbs_free(&sheet);
+            return NULL;
+        }
+    }
+
+    sheet->encoder_ctx = open_sheet_encoder(sheet->width * THUMB_COLUMNS, sheet->height * THUMB_ROWS);
+    sheet->decoded = av_frame_alloc();
+    sheet->sprite = av_frame_alloc();
+    sheet->encoded = av_packet_alloc();
+    {
+        if (sheet->encoder_ctx == NULL || sheet->decoded == NULL || sheet->sprite == NULL || sheet->encoded == NULL) {
+            thumbs_free(&sheet);
+            return NULL;
+        }
+
+        sheet->sprite->width = sheet->encoder_ctx->width;
+        sheet->sprite->height = sheet->encoder_ctx->height;
+        sheet->sprite->format = AV_PIX_FMT_YUVJ420P;
+        sheet->sprite->color_range = AVCOL_RANGE_JPEG;
+
+        if (av_frame_get_buffer(sheet->sprite, 0) < 0 || blank_sprite(sheet->sprite) < 0) {
+            fprintf(stderr, "Error: Could not allocate the thumbnail sheet.\n");
+            thumbs_free(&sheet);
+            return NULL;
+        }
+    }
+
+    return sheet;
+}
+
+/*
+this function encodes the current sheet into THUMB_SPRITE_FILE number and
+blanks it for the next one. mjpeg has no delay, the encoder is never
+drained and the packet comes out right away
+*/
+static int write_sheet(ThumbSheet *sheet, int number) {
+
+    sheet->sprite->quality = sheet->encoder_ctx->global_quality;
+    sheet->sprite->pts = number;
+
+    int result = avcodec_send_frame(sheet->encoder_ctx, sheet->sprite);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not encode a thumbnail sheet.\n");
+            return result;
+        }
+    }
+
+    result = avcodec_receive_packet(sheet->encoder_ctx, sheet->encoded);
+    {
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not encode a thumbnail sheet.\n");
+            return result;
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), THUMB_SPRITE_FILE, number);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", sheet->output_dir, name);
+
+    FILE *file = fopen(path, "wb");
+    {
+        if (file == NULL) {
+            fprintf(stderr, "Error: Could not open %s.\n", path);
+            av_packet_unref(sheet->encoded);
+            return AVERROR(errno);
+        }
+    }
+
+    size_t written = fwrite(sheet->encoded->data, 1, sheet->encoded->size, file);
+
+    result = fclose(file) != 0 || written != (size_t)sheet->encoded->size ? AVERROR(EIO) : 0;
+
+    av_packet_unref(sheet->encoded);
+
+    if (result < 0) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        return result;
+    }
+
+    return blank_sprite(sheet->sprite);
+}
+
+/*
+this function scales a decoded keyframe into the next tile of the sheet
+and writes the sheet once its last tile is drawn. the tiles are even
+sized, so the chroma planes of YUVJ420P start at half the luma offset
+*/
+static int add_thumb(ThumbSheet *sheet, const AVFrame *frame) {
+
+    int64_t pts = frame->best_effort_timestamp;
+    {
+        // frames that come out of order would break the cue timeline
+        if (pts == AV_NOPTS_VALUE || (sheet->nb_thumbs > 0 && pts <= sheet->times[sheet->nb_thumbs - 1])) {
+            return 0;
+        }
+    }
+
+    if (sheet->nb_thumbs == sheet->capacity) {
+
+        int capacity = FFMAX(THUMBS_PER_SHEET, sheet->capacity * 2);
+        int64_t *times = av_realloc_array(sheet->times, capacity, sizeof(int64_t));
+        {
+            if (times == NULL) {
+                return AVERROR(ENOMEM);
+            }
+        }
+
+        sheet->times = times;
+        sheet->capacity = capacity;
+    }
+
+    sheet->sws_ctx = sws_getCachedContext(sheet->sws_ctx, frame->width, frame->height, frame->format, sheet->width, sheet->height, AV_PIX_FMT_YUVJ420P, SWS_BILINEAR, NULL, NULL, NULL);
+    {
+        if (sheet->sws_ctx == NULL) {
+            fprintf(stderr, "Error: Could not create the thumbnail scaler.\n");
+            return AVERROR(EINVAL);
+        }
+    }
+
+    int result = av_frame_make_writable(sheet->sprite);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    int tile = sheet->nb_thumbs % THUMBS_PER_SHEET;
+    int x = (tile % THUMB_COLUMNS) * sheet->width;
+    int y = (tile / THUMB_COLUMNS) * sheet->height;
+
+    AVFrame *sprite = sheet->sprite;
+
+    uint8_t *data[4] = {
+        sprite->data[0] + y * sprite->linesize[0] + x,
+        sprite->data[1] + (y / 2) * sprite->linesize[1] + x / 2,
+        sprite->data[2] + (y / 2) * sprite->linesize[2] + x / 2,
+        NULL,
+    };
+
+    sws_scale(sheet->sws_ctx, (const uint8_t* const*)frame->data, frame->linesize, 0, frame->height, data, sprite->linesize);
+
+    sheet->times[sheet->nb_thumbs++] = pts;
+
+    if (tile == THUMBS_PER_SHEET - 1) {
+        return write_sheet(sheet, (sheet->nb_thumbs - 1) / THUMBS_PER_SHEET);
+    }
+
+    return 0;
+}
+
+static int receive_thumbs(ThumbSheet *sheet) {
+
+    while (avcodec_receive_frame(sheet->decoder_ctx, sheet->decoded) >= 0) {
+
+        int result = add_thumb(sheet, sheet->decoded);
+
+        av_frame_unref(sheet->decoded);
+
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function looks at one input packet of the remux before it is
+written, the packet itself is left as it is. only keyframes of the video
+stream at least interval after the last thumbnail reach the decoder, so
+the cost is one picture decode per thumbnail; a keyframe the decoder
+rejects is skipped like the remux skips read errors
+it returns < 0 when a sheet could not be written
+*/
+int thumbs_packet(ThumbSheet *sheet, const AVPacket *packet) {
+
+    if (packet->stream_index != sheet->stream_index) {
+        return 0;
+    }
+
+    int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    {
+        if (ts == AV_NOPTS_VALUE) {
+            return 0;
+        }
+
+        if (sheet->end == AV_NOPTS_VALUE || ts + packet->duration > sheet->end) {
+            sheet->end = ts + packet->duration;
+        }
+    }
+
+    if (!(packet->flags & AV_PKT_FLAG_KEY) || (sheet->next != AV_NOPTS_VALUE && ts < sheet->next)) {
+        return 0;
+    }
+
+    if (avcodec_send_packet(sheet->decoder_ctx, packet) < 0) {
+        return 0;
+    }
+
+    sheet->next = ts + sheet->interval;
+
+    return receive_thumbs(sheet);
+}
+
+// writes t, relative to the start of the input, as hh:mm:ss.mmm
+static void write_cue_time(FILE *file, const ThumbSheet *sheet, int64_t t) {
+
+    int64_t ms = FFMAX(0, av_rescale_q(t - sheet->start, sheet->time_base, (AVRational){1, 1000}));
+
+    fprintf(file, "%02" PRId64 ":%02" PRId64 ":%02" PRId64 ".%03" PRId64, ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+}
+
+/*
+this function writes THUMB_TRACK_FILE: one cue per thumbnail, from its
+keyframe to the next thumbnail, pointing into its sheet with a media
+fragment (thumbs_0.jpg#xywh=x,y,w,h) the way players read scrub tracks
+*/
+static int write_track(const ThumbSheet *sheet) {
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", sheet->output_dir, THUMB_TRACK_FILE);
+
+    FILE *file = fopen(path, "w");
+    {
+        if (file == NULL) {
+            fprintf(stderr, "Error: Could not open %s.\n", path);
+            return AVERROR(errno);
+        }
+    }
+
+    fprintf(file, "WEBVTT\n");
+
+    for (int i = 0; i < sheet->nb_thumbs; i++) {
+
+        int64_t start = sheet->times[i];
+        int64_t end = i + 1 < sheet->nb_thumbs ? sheet->times[i + 1] : sheet->end;
+
+        // the last keyframe may be the last packet too
+        if (end <= start) {
+            end = start + sheet->interval;
+        }
+
+        int tile = i % THUMBS_PER_SHEET;
+
+        char name[64];
+        snprintf(name, sizeof(name), THUMB_SPRITE_FILE, i / THUMBS_PER_SHEET);
+
+        fprintf(file, "\n");
+        write_cue_time(file, sheet, start);
+        fprintf(file, " --> ");
+        write_cue_time(file, sheet, end);
+        fprintf(file, "\n%s#xywh=%d,%d,%d,%d\n", name, (tile % THUMB_COLUMNS) * sheet->width, (tile / THUMB_COLUMNS) * sheet->height, sheet->width, sheet->height);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        return AVERROR(EIO);
+    }
+
+    return 0;
+}
+
+/*
+this function drains the decoder, writes the last, partly filled sheet
+and the track. it is called once the remux read the whole input
+*/
+int thumbs_finish(ThumbSheet *sheet) {
+
+    int result = avcodec_send_packet(sheet->decoder_ctx, NULL);
+    {
+        if (result >= 0) {
+            result = receive_thumbs(sheet);
+        }
+
+        if (result < 0 && result != AVERROR_EOF) {
+            return result;
+        }
+    }
+
+    if (sheet->nb_thumbs % THUMBS_PER_SHEET != 0) {
+
+        result = write_sheet(sheet, sheet->nb_thumbs / THUMBS_PER_SHEET);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    return write_track(sheet);
+}
+
+void thumbs_free(ThumbSheet **sheet) {
+
+    ThumbSheet *s = *sheet;
+    {
+        if (s == NULL) {
+            return;
+        }
+    }
+
+    avcodec_free_context(&s->decoder_ctx);
+    avcodec_free_context(&s->encoder_ctx);
+    sws_freeContext(s->sws_ctx);
+    av_frame_free(&s->decoded);
+    av_frame_free(&s->sprite);
+    av_packet_free(&s->encoded);
+    av_freep(&s->times);
+    av_freep(sheet);
+}
@@ -0,0 +1,28 @@
+#ifndef THUMBS_H
+#define THUMBS_H
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+
+// width of a thumbnail, the height follows the aspect ratio of the video
+#define THUMB_WIDTH 160
+
+// thumbnails per sprite sheet, laid out in rows of THUMB_COLUMNS
+#define THUMB_COLUMNS 10
+#define THUMB_ROWS 10
+
+// files written next to the playlist, the sheets are numbered from 0
+#define THUMB_SPRITE_FILE "thumbs_%d.jpg"
+#define THUMB_TRACK_FILE "thumbnails.vtt"
+
+// Scrub thumbnails of a remux: the keyframes of the video are decoded on
+// the side of the packet copy, scaled into jpeg sprite sheets and listed
+// by a WebVTT track, see thumbs.c
+typedef struct ThumbSheet ThumbSheet;
+
+ThumbSheet* thumbs_open(AVFormatContext *input_ctx, const char *output_dir, int interval);
+int thumbs_packet(ThumbSheet *sheet, const AVPacket *packet);
+int thumbs_finish(ThumbSheet *sheet);
+void thumbs_free(ThumbSheet **sheet);
+
+#endif
@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "uring.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/uio.h>
+    #include <sys/syscall.h>
+    #include <linux/io_uring.h>
+    #define URING_HAVE_IO_URING
+#endif
+
+// AVIOContext buffer of an input read through a ring
+#define URING_READ_IO_BUFFER_SIZE 32768
+
+/*
+one io_uring instance with its URING_QUEUE_DEPTH registered buffers, slot i
+of a file is buffer i. a ring serves one file at a time and goes back to
+the pool when the file is closed, so a job never waits on another job's
+queue and the rings are set up once per process, not once per segment
+*/
+typedef struct UringRing {
+    int fd;
+
+    // submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    void *sqes;
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+
+    void *rings;
+    size_t rings_size;
+    size_t sqes_size;
+
+    uint8_t *buffers;
+
+    struct UringRing *next; // next idle ring of the pool
+} UringRing;
+
+typedef enum {
+    SLOT_IDLE      = 0,
+    SLOT_IN_FLIGHT = 1,
+    SLOT_DONE      = 2, // read finished, the data is in the buffer of the slot
+} SlotState;
+
+// a file read or written through a ring, the opaque of its AVIOContext
+typedef struct {
+    UringRing *ring;
+    int fd;
+    int64_t pos;
+    int64_t size;  // size of the input, or bytes written so far
+    int error;     // first failed completion, returned by the next call
+    int writing;
+
+    SlotState state[URING_QUEUE_DEPTH];
+    int64_t block[URING_QUEUE_DEPTH]; // reads: block of URING_BUFFER_SIZE bytes held by the slot
+    int length[URING_QUEUE_DEPTH];    // bytes asked for, then bytes read
+    int in_flight;
+} UringFile;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static UringRing *pool;
+static int pool_size;
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static int available;
+
+#ifdef URING_HAVE_IO_URING
+
+static void ring_destroy(UringRing *ring) {
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->rings) {
+        munmap(ring->rings, ring->rings_size);
+    }
+
+    close(ring->fd);
+    av_free(ring->buffers);
+    av_free(ring);
+}
+
+/*
+this function sets up a ring and registers its buffers, the kernel pins
+them once instead of mapping the pages of every read and write. kernels
+older than 5.4 (no single mmap) or without io_uring, and seccomp profiles
+that refuse it, get NULL
+*/
+static UringRing* ring_create(void) {
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    {
+        if (fd < 0) {
+            return NULL;
+        }
+
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            close(fd);
+            return NULL;
+        }
+    }
+
+    UringRing *ring = av_mallocz(sizeof(*ring));
+    {
+        if (ring == NULL) {
+            close(fd);
+            return NULL;
+        }
+
+        ring->fd = fd;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    ring->rings_size = FFMAX(sq_size, cq_size);
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    {
+        if (ring->rings == MAP_FAILED) {
+            ring->rings = NULL;
+            ring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    {
+        if (ring->sqes == MAP_FAILED) {
+            ring->sqes = NULL;
+            ring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    uint8_t *rings = ring->rings;
+    {
+        ring->sq_head = (unsigned*)(rings + params.sq_off.head);
+        ring->sq_tail = (unsigned*)(rings + params.sq_off.tail);
+        ring->sq_mask = (unsigned*)(rings + params.sq_off.ring_mask);
+        ring->sq_array = (unsigned*)(rings + params.sq_off.array);
+
+        ring->cq_head = (unsigned*)(rings + params.cq_off.head);
+        ring->cq_tail = (unsigned*)(rings + params.cq_off.tail);
+        ring->cq_mask = (unsigned*)(rings + params.cq_off.ring_mask);
+        ring->cqes = rings + params.cq_off.cqes;
+    }
+
+    ring->buffers = av_malloc(URING_QUEUE_DEPTH * URING_BUFFER_SIZE);
+    {
+        if (ring->buffers == NULL) {
+            ring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    struct iovec iov[URING_QUEUE_DEPTH];
+    {
+        for (int i = 0; i < URING_QUEUE_DEPTH; i++) {
+            iov[i].iov_base = ring->buffers + i * URING_BUFFER_SIZE;
+            iov[i].iov_len = URING_BUFFER_SIZE;
+        }
+    }
+
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, URING_QUEUE_DEPTH) < 0) {
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/*
+this function queues a fixed buffer read or write of slot, nothing is
+handed to the kernel before ring_submit()
+*/
+static void ring_push(UringRing *ring, int opcode, int fd, int slot, int length, int64_t offset) {
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe *sqe = (struct io_uring_sqe*)ring->sqes + index;
+    {
+        memset(sqe, 0, sizeof(*sqe));
+
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)(ring->buffers + slot * URING_BUFFER_SIZE);
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->buf_index = slot;
+        sqe->user_data = slot;
+    }
+
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int ring_submit(UringRing *ring, int count) {
+
+    while (count > 0) {
+
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, count, 0, 0, NULL, 0);
+        {
+            if (submitted < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (submitted < 0) {
+                return AVERROR(errno);
+            }
+        }
+
+        count -= submitted;
+    }
+
+    return 0;
+}
+
+/*
+this function waits for the next completion of the ring and returns the
+slot it belongs to, res is the byte count or a negative errno
+*/
+static int ring_wait(UringRing *ring, int *res) {
+
+    for (;;) {
+
+        unsigned head = *ring->cq_head;
+
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+
+            struct io_uring_cqe *cqe = (struct io_uring_cqe*)ring->cqes + (head & *ring->cq_mask);
+
+            int slot = (int)cqe->user_data;
+            *res = cqe->res;
+
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            return slot;
+        }
+
+        int result = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        {
+            if (result < 0 && errno != EINTR) {
+                return AVERROR(errno);
+            }
+        }
+    }
+}
+
+#else
+
+static void ring_destroy(UringRing *ring) {
+}
+
+static UringRing* ring_create(void) {
+    return NULL;
+}
+
+static void ring_push(UringRing *ring, int opcode, int fd, int slot, int length, int64_t offset) {
+}
+
+static int ring_submit(UringRing *ring, int count) {
+    return AVERROR(ENOSYS);
+}
+
+static int ring_wait(UringRing *ring, int *res) {
+    return AVERROR(ENOSYS);
+}
+
+#define IORING_OP_READ_FIXED 0
+#define IORING_OP_WRITE_FIXED 0
+
+#endif
+
+static UringRing* ring_acquire(void) {
+
+    pthread_mutex_lock(&pool_lock);
+
+    UringRing *ring = pool;
+    {
+        if (ring) {
+            pool = ring->next;
+            pool_size--;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return ring ? ring : ring_create();
+}
+
+// the ring has to be idle, every completion of its file reaped
+static void ring_release(UringRing *ring) {
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (pool_size < URING_POOL_MAX) {
+        ring->next = pool;
+        pool = ring;
+        pool_size++;
+        ring = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (ring) {
+        ring_destroy(ring);
+    }
+}
+
+static void probe_uring(void) {
+
+    UringRing *ring = ring_create();
+
+    if (ring) {
+        ring_release(ring);
+        available = 1;
+    }
+}
+
+/*
+this function tells whether io_uring works here, the first call sets up a
+ring to find out. IO_BACKEND_URING jobs use POSIX I/O when it does not
+*/
+int uring_available(void) {
+
+    pthread_once(&probe_once, probe_uring);
+
+    return available;
+}
+
+/*
+this function reaps one completion of the file, a failed or short one is
+kept in file->error
+*/
+static int reap_one(UringFile *file) {
+
+    int res;
+    int slot = ring_wait(file->ring, &res);
+    {
+        if (slot < 0) {
+            return slot;
+        }
+    }
+
+    file->in_flight--;
+
+    if (res < 0 || (file->writing && res != file->length[slot])) {
+        file->error = file->error < 0 ? file->error : res < 0 ? res : AVERROR(EIO);
+    }
+
+    file->state[slot] = file->writing || res < 0 ? SLOT_IDLE : SLOT_DONE;
+    file->length[slot] = FFMAX(res, 0);
+
+    return 0;
+}
+
+static int drain_file(UringFile *file) {
+
+    while (file->in_flight > 0) {
+
+        int result = reap_one(file);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static UringFile* open_file(const char *path, int flags) {
+
+    UringFile *file = av_mallocz(sizeof(*file));
+    {
+        if (file == NULL) {
+            return NULL;
+        }
+
+        for (int i = 0; i < URING_QUEUE_DEPTH; i++) {
+            file->block[i] = -1;
+        }
+
+        file->writing = (flags & O_ACCMODE) != O_RDONLY;
+    }
+
+    file->fd = open(path, flags, 0644);
+    {
+        if (file->fd < 0) {
+            av_free(file);
+            return NULL;
+        }
+    }
+
+    file->ring = ring_acquire();
+    {
+        if (file->ring == NULL) {
+            close(file->fd);
+            av_free(file);
+            return NULL;
+        }
+    }
+
+    return file;
+}
+
+// reaps what is still in flight before the ring serves another file
+static int close_file(UringFile *file) {
+
+    int result = drain_file(file);
+
+    if (result < 0) {
+        // the kernel may still write into the buffers, the ring can not be reused
+        ring_destroy(file->ring);
+    } else {
+        ring_release(file->ring);
+    }
+
+    if (close(file->fd) != 0 && result == 0) {
+        result = AVERROR(errno);
+    }
+
+    result = file->error < 0 ? file->error : result;
+
+    av_free(file);
+
+    return result;
+}
+
+/*
+this function queues the reads of block and of the URING_QUEUE_DEPTH - 1
+blocks after it that are not queued yet, block b goes to slot b % depth.
+while the demuxer takes a block the next ones are already on their way
+*/
+static int read_ahead(UringFile *file, int64_t block) {
+
+    int queued = 0;
+
+    for (int64_t b = block; b < block + URING_QUEUE_DEPTH && b * URING_BUFFER_SIZE < file->size; b++) {
+
+        int slot = b % URING_QUEUE_DEPTH;
+
+        if (file->block[slot] == b && file->state[slot] != SLOT_IDLE) {
+            continue;
+        }
+
+        // after a seek the slot may still be reading another block
+        while (file->state[slot] == SLOT_IN_FLIGHT) {
+
+            int result = reap_one(file);
+            {
+                if (result < 0) {
+                    return result;
+                }
+            }
+        }
+
+        int64_t offset = b * URING_BUFFER_SIZE;
+
+        file->block[slot] = b;
+        file->length[slot] = FFMIN(file->size - offset, URING_BUFFER_SIZE);
+        file->state[slot] = SLOT_IN_FLIGHT;
+        file->in_flight++;
+
+        ring_push(file->ring, IORING_OP_READ_FIXED, file->fd, slot, file->length[slot], offset);
+        queued++;
+    }
+
+    return ring_submit(file->ring, queued);
+}
+
+static int uring_read(void *opaque, uint8_t *buf, int buf_size) {
+
+    UringFile *file = (UringFile*)opaque;
+
+    if (file->pos >= file->size) {
+        return AVERROR_EOF;
+    }
+
+    int64_t block = file->pos / URING_BUFFER_SIZE;
+    int slot = block % URING_QUEUE_DEPTH;
+
+    int result = read_ahead(file, block);
+    {
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    while (file->state[slot] == SLOT_IN_FLIGHT) {
+
+        result = reap_one(file);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+    }
+
+    if (file->error < 0) {
+        return file->error;
+    }
+
+    int offset = file->pos - block * URING_BUFFER_SIZE;
+    int size = FFMIN(buf_size, file->length[slot] - offset);
+    {
+        // the file got shorter since it was opened
+        if (size <= 0) {
+            return AVERROR_EOF;
+        }
+    }
+
+    memcpy(buf, file->ring->buffers + slot * URING_BUFFER_SIZE + offset, size);
+    file->pos += size;
+
+    return size;
+}
+
+/*
+this function copies into a free slot and queues its write at the current
+position, it only waits when URING_QUEUE_DEPTH writes are in flight. the
+caller's buffer is reused as soon as this returns, hence the copy
+*/
+static int uring_write(void *opaque, const uint8_t *buf, int buf_size) {
+
+    UringFile *file = (UringFile*)opaque;
+
+    for (int written = 0; written < buf_size;) {
+
+        int slot = -1;
+
+        while (file->error == 0 && slot < 0) {
+
+            for (int i = 0; i < URING_QUEUE_DEPTH && slot < 0; i++) {
+                slot = file->state[i] == SLOT_IDLE ? i : -1;
+            }
+
+            if (slot < 0) {
+                int result = reap_one(file);
+                {
+                    if (result < 0) {
+                        return result;
+                    }
+                }
+            }
+        }
+
+        if (file->error < 0) {
+            return file->error;
+        }
+
+        int size = FFMIN(buf_size - written, URING_BUFFER_SIZE);
+
+        memcpy(file->ring->buffers + slot * URING_BUFFER_SIZE, buf + written, size);
+
+        file->length[slot] = size;
+        file->state[slot] = SLOT_IN_FLIGHT;
+        file->in_flight++;
+
+        ring_push(file->ring, IORING_OP_WRITE_FIXED, file->fd, slot, size, file->pos);
+
+        int result = ring_submit(file->ring, 1);
+        {
+            if (result < 0) {
+                return result;
+            }
+        }
+
+        file->pos += size;
+        file->size = FFMAX(file->size, file->pos);
+        written += size;
+    }
+
+    return buf_size;
+}
+
+/*
+this function moves the position of a read or written file. writes in
+flight are waited for first: the muxer seeks back to patch what it wrote,
+and two queued writes over the same bytes may land in any order
+*/
+static int64_t uring_seek(void *opaque, int64_t offset, int whence) {
+
+    UringFile *file = (UringFile*)opaque;
+
+    if (whence & AVSEEK_SIZE) {
+        return file->size;
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: position = offset; break;
+        case SEEK_CUR: position = file->pos + offset; break;
+        case SEEK_END: position = file->size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    if (file->writing) {
+
+        int result = drain_file(file);
+        {
+            if (result < 0 || file->error < 0) {
+                return result < 0 ? result : file->error;
+            }
+        }
+    }
+
+    file->pos = position;
+
+    return position;
+}
+
+/*
+this function opens path for reading through a ring with read-ahead, the
+AVIOContext goes to the input context before avformat_open_input.
+returns NULL when io_uring is not available, the caller then opens path
+the usual way
+*/
+AVIOContext* uring_open_read(const char *path) {
+
+    if (!uring_available()) {
+        return NULL;
+    }
+
+    UringFile *file = open_file(path, O_RDONLY);
+    {
+        if (file == NULL) {
+            return NULL;
+        }
+    }
+
+    struct stat st;
+    uint8_t *io_buffer = fstat(file->fd, &st) == 0 ? av_malloc(URING_READ_IO_BUFFER_SIZE) : NULL;
+    {
+        if (io_buffer == NULL) {
+            close_file(file);
+            return NULL;
+        }
+
+        file->size = st.st_size;
+    }
+
+    AVIOContext *pb = avio_alloc_context(io_buffer, URING_READ_IO_BUFFER_SIZE, 0, file, uring_read, NULL, uring_seek);
+    {
+        if (pb == NULL) {
+            av_free(io_buffer);
+            close_file(file);
+            return NULL;
+        }
+    }
+
+    return pb;
+}
+
+/*
+this function closes an input opened by uring_open_read(), after
+avformat_close_input since the input context does not own it
+*/
+void uring_close_read(AVIOContext **pb) {
+
+    if (*pb == NULL) {
+        return;
+    }
+
+    close_file((UringFile*)(*pb)->opaque);
+
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+/*
+this function opens every file the hls muxer writes on a ring of its own
+a file that can not get a ring is opened the POSIX way instead
+*/
+static int uring_io_open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options) {
+
+    UringOutput *output = (UringOutput*)s->opaque;
+
+    if (flags & AVIO_FLAG_WRITE) {
+        report_hls_open(output->report, url);
+    }
+
+    const char *path = url;
+    av_strstart(url, "file:", &path);
+
+    UringFile *file = flags & AVIO_FLAG_WRITE ? open_file(path, O_WRONLY | O_CREAT | O_TRUNC) : NULL;
+    {
+        if (file == NULL) {
+            return avio_open2(pb, url, flags, &s->interrupt_callback, options);
+        }
+    }
+
+    // the muxer's writes are flushed one registered buffer at a time
+    uint8_t *io_buffer = av_malloc(URING_BUFFER_SIZE);
+    {
+        if (io_buffer == NULL) {
+            close_file(file);
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    *pb = avio_alloc_context(io_buffer, URING_BUFFER_SIZE, 1, file, NULL, uring_write, uring_seek);
+    {
+        if (*pb == NULL) {
+            av_free(io_buffer);
+            close_file(file);
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    return 0;
+}
+
+/*
+this function waits for the writes of the file and closes it, a failed
+write marks the output failed since the muxer does not check io_close2
+*/
+static int uring_io_close2(AVFormatContext *s, AVIOContext *pb) {
+
+    UringOutput *output = (UringOutput*)s->opaque;
+
+    if (pb == NULL) {
+        return 0;
+    }
+
+    if (pb->write_packet != uring_write) {
+
+        if (pb->write_flag) {
+            avio_flush(pb);
+            report_output(output->report, pb->bytes_written, 0);
+        }
+
+        return avio_close(pb);
+    }
+
+    avio_flush(pb);
+
+    UringFile *file = (UringFile*)pb->opaque;
+    report_output(output->report, file->size, 0);
+
+    int result = close_file(file);
+    {
+        result = pb->error < 0 ? pb->error : result;
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not write output file: %s\n", av_err2str(result));
+            output->failed = 1;
+        }
+    }
+
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+
+    return result;
+}
+
+/*
+this function writes every file of an hls output through io_uring, it has
+to be called before avformat_write_header and only when uring_available()
+the segments and bytes are counted into report like watch_hls_output()
+does for the POSIX files
+*/
+void uring_hls_output(AVFormatContext *output_ctx, UringOutput *output, JobReport *report) {
+
+    output->report = report;
+    output->failed = 0;
+
+    output_ctx->opaque = output;
+    output_ctx->io_open = uring_io_open;
+    output_ctx->io_close2 = uring_io_close2;
+}
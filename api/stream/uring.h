@@ -0,0 +1,38 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+#include "../../core/report.h"
+
+// writes, or reads ahead, in flight per file
+#define URING_QUEUE_DEPTH 8
+
+// one registered buffer, a ring registers URING_QUEUE_DEPTH of them
+#define URING_BUFFER_SIZE (128 * 1024)
+
+// idle rings kept for the next files, the ones past it are closed
+#define URING_POOL_MAX 64
+
+// How a job reads its input file and writes its hls files
+typedef enum {
+    IO_BACKEND_POSIX = 0, // read() and write() through libavformat's file protocol
+    IO_BACKEND_URING = 1, // io_uring, see uring.c; POSIX where the kernel has no io_uring
+    IO_BACKEND_MMAP = 2,  // input mapped into memory, see core/mapped.c; outputs are written like POSIX
+} IoBackend;
+
+// io_uring output of a job, owned by the caller like an HlsSink
+typedef struct {
+    JobReport *report; // set by uring_hls_output()
+    int failed;        // set when a write completed with an error
+} UringOutput;
+
+int uring_available(void);
+
+AVIOContext* uring_open_read(const char *path);
+void uring_close_read(AVIOContext **pb);
+
+void uring_hls_output(AVFormatContext *output_ctx, UringOutput *output, JobReport *report);
+
+#endif
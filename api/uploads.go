@@ -0,0 +1,351 @@
+package api
+
+import (
+	"fmt"
+	"io"
+	"net/http"
+	"os"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/labstack/echo/v4"
+)
+
+// tusVersion is the version of the tus resumable upload protocol /uploads speaks
+const tusVersion = "1.0.0"
+
+// uploadIdleTimeout aborts a resumable upload that received no chunk for
+// that long, its conversion fails instead of waiting for the rest forever
+const uploadIdleTimeout = 10 * time.Minute
+
+// Upload is a resumable upload whose chunks are appended, in order, to the
+// pipe its conversion demuxes from, so segments are written while the
+// rest of the file is still on its way
+type Upload struct {
+	ID     string
+	Length int64
+	w      *os.File // write end of the pipe
+
+	offset  atomic.Int64 // bytes written into the pipe so far
+	writing sync.Mutex   // held by the PATCH whose chunk is being written
+
+	mu      sync.Mutex
+	idle    *time.Timer
+	ended   bool // no more chunks are accepted, w is closed
+	aborted bool // ended before its last byte
+}
+
+// Offset returns the number of bytes received so far
+func (u *Upload) Offset() int64 {
+	return u.offset.Load()
+}
+
+// Write appends to the pipe, counting what went through even when a chunk
+// is cut off half way
+func (u *Upload) Write(p []byte) (int, error) {
+	n, err := u.w.Write(p)
+	u.offset.Add(int64(n))
+	return n, err
+}
+
+// close closes the write end of the pipe, the demuxer sees the end of the input
+func (u *Upload) close(aborted bool) {
+	u.mu.Lock()
+	defer u.mu.Unlock()
+
+	if u.ended {
+		return
+	}
+
+	u.w.Close()
+	u.ended = true
+	u.aborted = aborted
+	u.idle.Stop()
+}
+
+// abort ends the input early, the conversion fails through incomplete
+func (u *Upload) abort() {
+	u.close(true)
+}
+
+// closed tells whether no more chunks are accepted
+func (u *Upload) closed() bool {
+	u.mu.Lock()
+	defer u.mu.Unlock()
+
+	return u.ended
+}
+
+// incomplete is handed to conversion.start, it fails the job when the
+// upload was aborted before its last byte
+func (u *Upload) incomplete() error {
+	u.mu.Lock()
+	defer u.mu.Unlock()
+
+	if u.aborted {
+		return fmt.Errorf("Upload aborted after %d of %d bytes", u.Offset(), u.Length)
+	}
+	return nil
+}
+
+// UploadRegistry holds the resumable uploads
+type UploadRegistry struct {
+	mu      sync.Mutex
+	uploads map[string]*Upload
+}
+
+// NewUploadRegistry returns an empty registry
+func NewUploadRegistry() *UploadRegistry {
+	return &UploadRegistry{
+		uploads: make(map[string]*Upload),
+	}
+}
+
+// uploads are the resumable uploads started by POST /uploads
+var uploads = NewUploadRegistry()
+
+// Add registers an upload, uploads whose job is gone from jobs are forgotten
+func (r *UploadRegistry) Add(upload *Upload) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	for id := range r.uploads {
+		if _, ok := jobs.Get(id); !ok {
+			delete(r.uploads, id)
+		}
+	}
+
+	r.uploads[upload.ID] = upload
+}
+
+// Get returns the upload id
+func (r *UploadRegistry) Get(id string) (*Upload, bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	upload, ok := r.uploads[id]
+	return upload, ok
+}
+
+// tusHeaders sets the headers every /uploads response carries
+func tusHeaders(c echo.Context) {
+	c.Response().Header().Set("Tus-Resumable", tusVersion)
+	c.Response().Header().Set("Cache-Control", "no-store")
+}
+
+// uploadParam returns the upload of the :id path parameter
+func uploadParam(c echo.Context) (*Upload, error) {
+	upload, ok := uploads.Get(c.Param("id"))
+	if !ok {
+		return nil, c.JSON(http.StatusNotFound, map[string]string{
+			"error": "No such upload",
+		})
+	}
+	return upload, nil
+}
+
+// handleUploadOptions tells tus clients what the server supports
+// @Summary Resumable upload capabilities
+// @Description tus discovery: supported versions and extensions
+// @Success 204 "Capabilities in the Tus-Version and Tus-Extension headers"
+// @Router /uploads [options]
+func handleUploadOptions(c echo.Context) error {
+	tusHeaders(c)
+	c.Response().Header().Set("Tus-Version", tusVersion)
+	c.Response().Header().Set("Tus-Extension", "creation,termination")
+
+	return c.NoContent(http.StatusNoContent)
+}
+
+// handleCreateUpload creates a resumable upload and queues its conversion
+// @Summary Create a resumable upload
+// @Description tus creation: announces an upload of Upload-Length bytes and queues its HLS conversion right away. The chunks sent with PATCH /uploads/{id} are demuxed as they arrive, so the conversion ends shortly after the last one. Takes the query parameters of /upload except wait
+// @Produce json
+// @Param Upload-Length header int true "Size of the whole file in bytes"
+// @Param mode query string false "Conversion mode, see /upload"
+// @Param ingest query string false "Ingest mode, see /upload"
+// @Param segments query string false "Segment container, see /upload"
+// @Param probesize query int false "Bytes read while probing the input, FFmpeg default when missing"
+// @Param analyzeduration query int false "Microseconds of media analyzed while probing, FFmpeg default when missing"
+// @Param output query string false "Output, see /upload"
+// @Param io query string false "I/O backend, see /upload"
+// @Param thumbnails query int false "Seconds between scrub thumbnails, see /upload"
+// @Success 201 {object} map[string]string "Upload created and conversion queued, Location is the upload url"
+// @Failure 400 {object} map[string]string "Bad request"
+// @Failure 500 {object} map[string]string "Internal server error"
+// @Failure 503 {object} map[string]string "Conversion queue is full"
+// @Router /uploads [post]
+func handleCreateUpload(c echo.Context) error {
+
+	tusHeaders(c)
+
+	length, err := strconv.ParseInt(c.Request().Header.Get("Upload-Length"), 10, 64)
+	{
+		if err != nil || length <= 0 {
+			return c.JSON(http.StatusBadRequest, map[string]string{
+				"error": "Missing or invalid Upload-Length",
+			})
+		}
+	}
+
+	cv, invalid := parseConversion(c)
+	{
+		if invalid != "" {
+			return c.JSON(http.StatusBadRequest, map[string]string{
+				"error": invalid,
+			})
+		}
+	}
+
+	jobID, err := newJobID()
+	{
+		if err != nil {
+			return c.JSON(http.StatusInternalServerError, map[string]string{
+				"error": "Failed to create job",
+			})
+		}
+	}
+
+	// the chunks go into wPipe, the demuxer blocks on rPipe until they do
+	rPipe, wPipe, err := os.Pipe()
+	{
+		if err != nil {
+			return c.JSON(http.StatusInternalServerError, map[string]string{
+				"error": "Failed to create pipe",
+			})
+		}
+	}
+
+	upload := &Upload{ID: jobID, Length: length, w: wPipe}
+	upload.idle = time.AfterFunc(uploadIdleTimeout, upload.abort)
+
+	if err := cv.start(jobs.Add(jobID, cv.mode), rPipe, upload.incomplete); err != nil {
+		upload.abort()
+		return queueFull(c)
+	}
+
+	uploads.Add(upload)
+
+	c.Response().Header().Set("Location", "/uploads/"+jobID)
+	c.Response().Header().Set("Upload-Offset", "0")
+
+	return c.JSON(http.StatusCreated, queuedResponse(jobID))
+}
+
+// handleUploadOffset tells a client where to resume
+// @Summary Resumable upload offset
+// @Description tus: the number of bytes received so far in Upload-Offset
+// @Param id path string true "Upload ID, the job id returned by POST /uploads"
+// @Success 200 "Offset in the Upload-Offset header"
+// @Failure 404 {object} map[string]string "No such upload"
+// @Router /uploads/{id} [head]
+func handleUploadOffset(c echo.Context) error {
+
+	tusHeaders(c)
+
+	upload, err := uploadParam(c)
+	if upload == nil {
+		return err
+	}
+
+	c.Response().Header().Set("Upload-Offset", strconv.FormatInt(upload.Offset(), 10))
+	c.Response().Header().Set("Upload-Length", strconv.FormatInt(upload.Length, 10))
+
+	return c.NoContent(http.StatusOK)
+}
+
+// handleUploadChunk appends a chunk to a resumable upload
+// @Summary Append a chunk
+// @Description tus: writes the body at Upload-Offset, which has to be the offset received so far. A chunk cut off by a dropped connection keeps what arrived, HEAD tells where to resume. The request returns once the demuxer took the chunk
+// @Accept application/offset+octet-stream
+// @Param id path string true "Upload ID, the job id returned by POST /uploads"
+// @Param Upload-Offset header int true "Offset the chunk starts at"
+// @Success 204 "Chunk written, the new offset is in Upload-Offset"
+// @Failure 404 {object} map[string]string "No such upload"
+// @Failure 409 {object} map[string]string "Upload-Offset does not match"
+// @Failure 410 {object} map[string]string "Upload finished, aborted or its conversion stopped reading"
+// @Failure 415 {object} map[string]string "Wrong Content-Type"
+// @Failure 423 {object} map[string]string "Another chunk is being written"
+// @Router /uploads/{id} [patch]
+func handleUploadChunk(c echo.Context) error {
+
+	tusHeaders(c)
+
+	upload, err := uploadParam(c)
+	if upload == nil {
+		return err
+	}
+
+	if c.Request().Header.Get("Content-Type") != "application/offset+octet-stream" {
+		return c.JSON(http.StatusUnsupportedMediaType, map[string]string{
+			"error": "Content-Type must be application/offset+octet-stream",
+		})
+	}
+
+	if !upload.writing.TryLock() {
+		return c.JSON(http.StatusLocked, map[string]string{
+			"error": "Another chunk is being written",
+		})
+	}
+	defer upload.writing.Unlock()
+
+	offset, err := strconv.ParseInt(c.Request().Header.Get("Upload-Offset"), 10, 64)
+	{
+		if err != nil || offset != upload.Offset() {
+			return c.JSON(http.StatusConflict, map[string]string{
+				"error": "Upload-Offset does not match, resume at " + strconv.FormatInt(upload.Offset(), 10),
+			})
+		}
+	}
+
+	// no idle abort while a chunk is arriving, however slowly
+	if !upload.idle.Stop() || upload.closed() {
+		return c.JSON(http.StatusGone, map[string]string{
+			"error": "Upload is finished or was aborted",
+		})
+	}
+
+	// a write error means the conversion failed and closed its end of the pipe
+	_, err = io.Copy(upload, io.LimitReader(c.Request().Body, upload.Length-offset))
+	{
+		if pipeErr, ok := err.(*os.PathError); ok {
+			upload.abort()
+			return c.JSON(http.StatusGone, map[string]string{
+				"error": "Conversion stopped reading: " + pipeErr.Err.Error(),
+			})
+		}
+	}
+
+	if upload.Offset() == upload.Length {
+		upload.close(false)
+	} else {
+		upload.idle.Reset(uploadIdleTimeout)
+	}
+
+	c.Response().Header().Set("Upload-Offset", strconv.FormatInt(upload.Offset(), 10))
+
+	return c.NoContent(http.StatusNoContent)
+}
+
+// handleDeleteUpload aborts a resumable upload
+// @Summary Abort a resumable upload
+// @Description tus termination: no more chunks are accepted and the conversion fails unless the upload was complete
+// @Param id path string true "Upload ID, the job id returned by POST /uploads"
+// @Success 204 "Upload aborted"
+// @Failure 404 {object} map[string]string "No such upload"
+// @Router /uploads/{id} [delete]
+func handleDeleteUpload(c echo.Context) error {
+
+	tusHeaders(c)
+
+	upload, err := uploadParam(c)
+	if upload == nil {
+		return err
+	}
+
+	upload.abort()
+
+	return c.NoContent(http.StatusNoContent)
+}
@@ -0,0 +1,329 @@
+/*
+alloc_bench counts the heap allocations of the remux loop once it reached
+steady state, after ALLOC_WARMUP_PACKETS (the plan opened its filters, the
+muxer its first segments), and tells apart who made them. the call stack
+of every allocation is walked up to the first frame of this program and
+charged by the library function that frame called, see owner_of(): the
+project's own code (remux_packet(), the plan, the io callbacks of
+report.c) calling malloc, libavutil or the packet and frame API of
+libavcodec makes it the project's, any other FFmpeg call makes it
+FFmpeg's. the project's loop has to allocate nothing, any allocation fails
+the run; FFmpeg's are printed per library and per packet (the demuxer's
+packet buffers, the muxer's interleaving queue and the segment and
+playlist files it opens), they are not ours to budget
+
+the counting allocator replaces malloc, calloc, realloc, free and the
+aligned allocations of the whole process, av_malloc() ends up in
+posix_memalign() and is counted too. glibc only, it forwards to
+__libc_malloc() and friends. FFmpeg has to be linked as shared libraries,
+pkg-config's default, or its frames can not be told from ours
+
+build from the repository root:
+    gcc -O2 bench/alloc_bench.c -o alloc_bench $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm -ldl
+
+usage:
+    ./alloc_bench input.mp4 [output_dir]
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#include "../core/report.c"
+#include "../core/probe.c"
+#include "../core/mapped.c"
+#include "../api/stream/read_pipe.c"
+#include "../api/stream/ingest.c"
+#include "../api/stream/sink.c"
+#include "../api/stream/uring.c"
+#include "../api/stream/cgompeg.c"
+#include "../api/stream/plan.c"
+#include "../api/stream/thumbs.c"
+#include "../api/stream/abr.c"
+#include "../api/stream/gop.c"
+#include "../api/stream/llhls.c"
+#include "../api/stream/live.c"
+
+#define ALLOC_WARMUP_PACKETS 200
+#define ALLOC_MAX_FRAMES 64
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+// who made an allocation, see owner_of()
+typedef enum {
+    OWNER_PROJECT   = 0,
+    OWNER_AVFORMAT  = 1,
+    OWNER_AVCODEC   = 2,
+    OWNER_FFMPEG    = 3, // the other FFmpeg libraries, and stacks that end in libavutil
+    NB_OWNERS       = 4,
+} AllocOwner;
+
+static const char *owner_names[NB_OWNERS] = { "project", "libavformat", "libavcodec", "other ffmpeg" };
+
+static int counting;
+static int64_t allocs[NB_OWNERS];
+static void *program_base; // where this program is loaded, its frames are the project's
+
+// set while an allocation is attributed, backtrace() and dladdr() may allocate themselves
+static __thread int attributing;
+
+// 1 when the shared object of info starts with name
+static int object_is(const Dl_info *info, const char *name) {
+    return info->dli_fname && strncmp(av_basename(info->dli_fname), name, strlen(name)) == 0;
+}
+
+// the packet and frame API, what it allocates the caller asked for
+static int is_data_api(const Dl_info *info) {
+
+    static const char *prefixes[] = { "av_packet_", "av_new_packet", "av_grow_packet", "av_frame_", "av_buffer_" };
+
+    for (int i = 0; info->dli_sname && i < (int)(sizeof(prefixes) / sizeof(prefixes[0])); i++) {
+        if (strncmp(info->dli_sname, prefixes[i], strlen(prefixes[i])) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// the owner of an allocation made inside the library function of info
+static AllocOwner library_owner(const Dl_info *info) {
+
+    if (object_is(info, "libavformat")) {
+        return OWNER_AVFORMAT;
+    }
+
+    if (object_is(info, "libavcodec")) {
+        return OWNER_AVCODEC;
+    }
+
+    return OWNER_FFMPEG;
+}
+
+/*
+this function walks the stack of an allocation from caller, the return
+address of the allocator, to the first frame of this program and charges
+the allocation by the library function that frame called (entry):
+ - none, libc or libavutil (malloc, strdup, av_malloc, av_dict_set): the
+   program allocated, the project's
+ - the packet and frame API of libavcodec (av_packet_alloc, av_packet_ref,
+   av_packet_make_writable, av_frame_alloc...): allocated because the
+   program asked for it, the project's too
+ - anything else (av_read_frame, av_interleaved_write_frame, the default
+   io_open a report.c callback forwards to): the library's own
+stacks without a frame of the program (threads of FFmpeg) go to the first
+library frame outside libc and libavutil
+*/
+static AllocOwner owner_of(void *caller) {
+
+    void *frames[ALLOC_MAX_FRAMES];
+    int nb_frames = backtrace(frames, ALLOC_MAX_FRAMES);
+
+    // the frames of the interposer itself come first
+    int first = 0;
+    while (first < nb_frames && frames[first] != caller) {
+        first++;
+    }
+
+    if (first == nb_frames) {
+        frames[0] = caller;
+        first = 0;
+        nb_frames = 1;
+    }
+
+    Dl_info entry = { 0 };
+    int has_entry = 0;
+    int innermost = -1; // the first library frame outside libc and libavutil
+
+    for (int i = first; i < nb_frames; i++) {
+
+        Dl_info info;
+        if (dladdr(frames[i], &info) == 0) {
+            continue;
+        }
+
+        if (info.dli_fbase == program_base) {
+
+            if (!has_entry || object_is(&entry, "libc.") || object_is(&entry, "libc-") || object_is(&entry, "libavutil") || is_data_api(&entry)) {
+                return OWNER_PROJECT;
+            }
+
+            return library_owner(&entry);
+        }
+
+        entry = info;
+        has_entry = 1;
+
+        if (innermost < 0 && !object_is(&info, "libc.") && !object_is(&info, "libc-") && !object_is(&info, "libavutil")) {
+            innermost = i;
+        }
+    }
+
+    Dl_info info;
+    if (innermost >= 0 && dladdr(frames[innermost], &info) != 0) {
+        return library_owner(&info);
+    }
+
+    return OWNER_FFMPEG;
+}
+
+static __attribute__((noinline)) void count_alloc(void *caller) {
+
+    if (!__atomic_load_n(&counting, __ATOMIC_RELAXED) || attributing) {
+        return;
+    }
+
+    attributing = 1;
+    __atomic_fetch_add(&allocs[owner_of(caller)], 1, __ATOMIC_RELAXED);
+    attributing = 0;
+}
+
+void *malloc(size_t size) {
+    count_alloc(__builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    count_alloc(__builtin_return_address(0));
+    return __libc_calloc(count, size);
+}
+
+// a realloc may move the block, for the loop it is an allocation either way
+void *realloc(void *ptr, size_t size) {
+    count_alloc(__builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count_alloc(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    count_alloc(__builtin_return_address(0));
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+typedef struct {
+    int64_t packets;
+    int64_t segments;
+    int64_t allocs[NB_OWNERS];
+} AllocCount;
+
+static void start_counting(void) {
+    memset(allocs, 0, sizeof(allocs));
+    __atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+}
+
+static void stop_counting(AllocCount *count, int64_t packets) {
+    __atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+
+    count->packets = packets;
+    memcpy(count->allocs, allocs, sizeof(allocs));
+}
+
+// the remux loop of copy_packets(), counted after the warmup
+static int count_remux(const char *input, const char *output_dir, AllocCount *count) {
+
+    AVFormatContext *input_ctx = open_input_file(input);
+    RemuxPlan plan;
+    JobReport report = { 0 };
+    job_report_init(&report);
+
+    AVFormatContext *output_ctx = input_ctx ? setup_hls_output(output_dir, "output.m3u8", input_ctx, SEGMENT_TS, 0, &plan, NULL, NULL, &report) : NULL;
+    {
+        if (output_ctx == NULL) {
+            avformat_close_input(&input_ctx);
+            return -1;
+        }
+    }
+
+    int64_t packets = 0;
+    int64_t segments = 0;
+    int result;
+
+    while ((result = remux_packet(input_ctx, output_ctx, &plan, &report)) > 0) {
+
+        if (++packets == ALLOC_WARMUP_PACKETS) {
+            segments = report.Segments;
+            start_counting();
+        }
+    }
+
+    stop_counting(count, packets - ALLOC_WARMUP_PACKETS);
+    count->segments = report.Segments - segments;
+
+    if (result == 0) {
+        result = plan_flush(&plan, output_ctx);
+    }
+    if (result >= 0) {
+        result = av_write_trailer(output_ctx);
+    }
+
+    free_plan(&plan);
+    avformat_free_context(output_ctx);
+    avformat_close_input(&input_ctx);
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s input.mp4 [output_dir]\n", argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    Dl_info program, avformat;
+    {
+        if (dladdr((void*)main, &program) == 0 || dladdr((void*)av_read_frame, &avformat) == 0 || program.dli_fbase == avformat.dli_fbase) {
+            fprintf(stderr, "Error: FFmpeg is linked statically, its allocations can not be told from the project's.\n");
+            return 1;
+        }
+
+        program_base = program.dli_fbase;
+    }
+
+    // the first backtrace() loads the unwinder, not while counting
+    void *frames[1];
+    backtrace(frames, 1);
+
+    AllocCount remux = { 0 };
+
+    if (count_remux(argv[1], argc > 2 ? argv[2] : "alloc", &remux) < 0) {
+        fprintf(stderr, "Error: Could not remux '%s'.\n", argv[1]);
+        return 1;
+    }
+
+    if (remux.packets <= 0) {
+        fprintf(stderr, "Error: '%s' has too few packets past the %d packet warmup.\n", argv[1], ALLOC_WARMUP_PACKETS);
+        return 1;
+    }
+
+    printf("%s, %" PRId64 " packets and %" PRId64 " segments after a %d packet warmup\n", av_basename(argv[1]), remux.packets, remux.segments, ALLOC_WARMUP_PACKETS);
+
+    for (int owner = 0; owner < NB_OWNERS; owner++) {
+        printf("%-12s %8" PRId64 " allocations, %.2f per packet%s\n", owner_names[owner], remux.allocs[owner], (double)remux.allocs[owner] / remux.packets, owner == OWNER_PROJECT ? " (has to be 0)" : "");
+    }
+
+    return remux.allocs[OWNER_PROJECT] != 0;
+}
@@ -0,0 +1,166 @@
+/*
+box_bench times the box downscale of image_convertor/downscale.c against
+swscale for the 2x to 5x shrinks and checks its output: the luma has to
+stay above BOX_MIN_PSNR against the swscale area average (chroma is left
+out, swscale places 4:2:0 chroma samples differently). exits 1 otherwise.
+that the simd kernels match the scalar one is tests/box_test.c
+
+build from the repository root:
+    gcc -O2 bench/box_bench.c -o box_bench $(pkg-config --cflags --libs libavformat libavcodec libswscale libavutil) -pthread -lm
+
+usage:
+    ./box_bench input.jpg [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../image_convertor/image.c"
+
+#include "libavutil/cpu.h"
+
+#define BOX_MIN_PSNR 35.0
+
+static double now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double luma_psnr(const AVFrame *a, const AVFrame *b) {
+
+    double error = 0;
+
+    for (int y = 0; y < a->height; y++) {
+        for (int x = 0; x < a->width; x++) {
+            int d = a->data[0][y * a->linesize[0] + x] - b->data[0][y * b->linesize[0] + x];
+            error += d * d;
+        }
+    }
+
+    if (error == 0) {
+        return INFINITY;
+    }
+
+    return 10 * log10(255.0 * 255.0 * a->width * a->height / error);
+}
+
+static double time_sws(struct SwsContext *sws_ctx, const AVFrame *src, AVFrame *dst, int iterations) {
+
+    double start = now_ms();
+
+    for (int i = 0; i < iterations; i++) {
+        sws_scale(sws_ctx, (const uint8_t* const*)src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+    }
+
+    return (now_ms() - start) / iterations;
+}
+
+static double time_box(const AVFrame *src, AVFrame *dst, int factor, uint16_t *scratch, int iterations) {
+
+    double start = now_ms();
+
+    for (int i = 0; i < iterations; i++) {
+        box_downscale(src, dst, factor, scratch);
+    }
+
+    return (now_ms() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s input.jpg [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    int iterations = argc > 2 ? FFMAX(atoi(argv[2]), 1) : 20;
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    AVCodecContext *decoder_ctx = NULL;
+    AVFrame *decoded = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    int src_width, src_height;
+
+    // no targets, so the picture is decoded at full size
+    if (decoded == NULL || pkt == NULL || decode_image(argv[1], &decoder_ctx, decoded, pkt, NULL, 0, &src_width, &src_height) < 0) {
+        fprintf(stderr, "Error: Could not decode '%s'.\n", argv[1]);
+        return 1;
+    }
+
+    // pngs and 4:4:4 jpegs are brought to what the box kernel takes first
+    AVFrame *src = alloc_scaled_frame(decoded->width, decoded->height);
+    {
+        struct SwsContext *convert = sws_getContext(decoded->width, decoded->height, decoded->format,
+            src->width, src->height, AV_PIX_FMT_YUVJ420P, SWS_POINT, NULL, NULL, NULL);
+
+        if (convert == NULL) {
+            fprintf(stderr, "Error: Could not convert the input.\n");
+            return 1;
+        }
+
+        sws_scale(convert, (const uint8_t* const*)decoded->data, decoded->linesize, 0, decoded->height, src->data, src->linesize);
+        sws_freeContext(convert);
+    }
+
+    uint16_t *scratch = av_malloc_array(box_scratch_size(src->width), sizeof(uint16_t));
+    int failed = 0;
+
+    printf("%s %dx%d, %d iterations, ms per picture\n", av_basename(argv[1]), src->width, src->height, iterations);
+    printf("factor  bicubic     area   box c  box simd  speedup  luma psnr vs area\n");
+
+    for (int factor = 2; factor <= 5; factor++) {
+
+        int width = src->width / factor;
+        int height = src->height / factor;
+
+        AVFrame *bicubic = alloc_scaled_frame(width, height);
+        AVFrame *area = alloc_scaled_frame(width, height);
+        AVFrame *box_c = alloc_scaled_frame(width, height);
+        AVFrame *box_simd = alloc_scaled_frame(width, height);
+
+        struct SwsContext *bicubic_ctx = sws_getContext(src->width, src->height, src->format, width, height, AV_PIX_FMT_YUVJ420P, SWS_BICUBIC, NULL, NULL, NULL);
+        struct SwsContext *area_ctx = sws_getContext(src->width, src->height, src->format, width, height, AV_PIX_FMT_YUVJ420P, SWS_AREA, NULL, NULL, NULL);
+
+        if (!bicubic || !area || !box_c || !box_simd || !bicubic_ctx || !area_ctx || !box_factor(src, width, height)) {
+            fprintf(stderr, "Error: Could not set up factor %d.\n", factor);
+            return 1;
+        }
+
+        double bicubic_ms = time_sws(bicubic_ctx, src, bicubic, iterations);
+        double area_ms = time_sws(area_ctx, src, area, iterations);
+
+        av_force_cpu_flags(0);
+        double c_ms = time_box(src, box_c, factor, scratch, iterations);
+
+        av_force_cpu_flags(-1);
+        double simd_ms = time_box(src, box_simd, factor, scratch, iterations);
+
+        double quality = luma_psnr(box_simd, area);
+
+        printf("%6d %8.3f %8.3f %7.3f %9.3f %7.1fx %10.2f dB%s\n", factor, bicubic_ms, area_ms, c_ms, simd_ms, bicubic_ms / simd_ms, quality,
+            quality < BOX_MIN_PSNR ? "  below bound" : "");
+
+        failed |= quality < BOX_MIN_PSNR;
+
+        sws_freeContext(bicubic_ctx);
+        sws_freeContext(area_ctx);
+        av_frame_free(&bicubic);
+        av_frame_free(&area);
+        av_frame_free(&box_c);
+        av_frame_free(&box_simd);
+    }
+
+    av_free(scratch);
+    av_frame_free(&src);
+    av_frame_free(&decoded);
+    av_packet_free(&pkt);
+    avcodec_free_context(&decoder_ctx);
+
+    return failed;
+}
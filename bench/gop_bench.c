@@ -0,0 +1,124 @@
+/*
+gop_bench compares the serial transcode, one decoder and one encoder with
+their own frame/slice threads, against the gop-parallel one with single
+threaded codecs on the same input. the process is pinned to the first
+workers cores for both runs, so both get the same core count
+
+build from the repository root:
+    gcc -O2 bench/gop_bench.c -o gop_bench $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread
+
+usage:
+    ./gop_bench input.mp4 [workers]
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../api/stream/cgompeg.h"
+#include "../core/report.c"
+#include "../core/probe.c"
+#include "../core/mapped.c"
+#include "../api/stream/read_pipe.c"
+#include "../api/stream/ingest.c"
+#include "../api/stream/sink.c"
+#include "../api/stream/uring.c"
+#include "../api/stream/cgompeg.c"
+#include "../api/stream/plan.c"
+#include "../api/stream/thumbs.c"
+#include "../api/stream/abr.c"
+#include "../api/stream/gop.c"
+#include "../api/stream/llhls.c"
+#include "../api/stream/live.c"
+
+#include "libavutil/cpu.h"
+
+static double now_seconds(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+this function restricts the process to the first cores cpus it may run on,
+av_cpu_count() and with it the codecs' auto thread count follow the mask
+*/
+static int pin_cores(int cores) {
+
+    cpu_set_t allowed, pinned;
+    {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return -1;
+        }
+
+        CPU_ZERO(&pinned);
+    }
+
+    for (int cpu = 0, n = 0; cpu < CPU_SETSIZE && n < cores; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            CPU_SET(cpu, &pinned);
+            n++;
+        }
+    }
+
+    return sched_setaffinity(0, sizeof(pinned), &pinned);
+}
+
+static double run(const char *input_file, const char *output_dir, int workers) {
+
+    if (make_dirs(output_dir) < 0) {
+        return -1;
+    }
+
+    double start = now_seconds();
+
+    if (gop_transcode(input_file, output_dir, "output.m3u8", workers, SEGMENT_TS, IO_BACKEND_MMAP, NULL, NULL) != 0) {
+        return -1;
+    }
+
+    return now_seconds() - start;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s input.mp4 [workers]\n", argv[0]);
+        return 1;
+    }
+
+    int workers = argc > 2 ? atoi(argv[2]) : av_cpu_count();
+    {
+        if (workers < 1 || pin_cores(workers) != 0) {
+            fprintf(stderr, "Error: Could not pin the benchmark to %d cores.\n", workers);
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    double serial = run(argv[1], "bench_out/serial", 1);
+    {
+        if (serial < 0) {
+            fprintf(stderr, "Error: serial transcode failed.\n");
+            return 1;
+        }
+    }
+
+    double parallel = run(argv[1], "bench_out/parallel", workers);
+    {
+        if (parallel < 0) {
+            fprintf(stderr, "Error: parallel transcode failed.\n");
+            return 1;
+        }
+    }
+
+    printf("cores:    %d\n", av_cpu_count());
+    printf("serial:   1 worker, threaded codecs  %8.2f s\n", serial);
+    printf("parallel: %d workers, 1 thread each  %8.2f s\n", workers, parallel);
+    printf("speedup over the threaded encoder: %.2fx\n", serial / parallel);
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+pipe_bench times how fast an upload is drained from its pipe into the spool
+file, the way read_pipe() spools TEMP_FILE and spill_input() the rest of a
+big upload. a writer thread pushes megabytes of data into a pipe in
+PIPE_BENCH_CHUNK writes (the Go side writes the multipart file the same
+way) and the reader drains it with:
+    read_1k  the former loop, 1 KB read() plus fwrite()
+    copy     copy_pipe(), the PIPE_COPY_BUFFER_SIZE read()/write() fallback
+    splice   drain_pipe(), splice() from the pipe into the file
+the best of PIPE_BENCH_RUNS runs is printed in GB/s. every spooled file is
+read back and exits 1 when it differs from what was written
+
+build from the repository root:
+    gcc -O2 bench/pipe_bench.c -o pipe_bench -pthread
+
+usage:
+    ./pipe_bench [megabytes] [spool_file]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../api/stream/read_pipe.c"
+
+#define PIPE_BENCH_RUNS 3
+#define PIPE_BENCH_CHUNK (256 * 1024)
+
+typedef enum {
+    DRAIN_READ_1K = 0,
+    DRAIN_COPY    = 1,
+    DRAIN_SPLICE  = 2,
+} DrainKind;
+
+static const char *drain_names[] = { "read_1k", "copy", "splice" };
+
+typedef struct {
+    int fd;
+    int64_t size;
+} PipeFeed;
+
+static double now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// byte i of the upload, so the spooled file can be checked without keeping
+// a copy: a fixed pattern, except for the first 8 bytes of every chunk that
+// hold the chunk's offset, so chunks out of order or lost are seen too
+static uint8_t feed_byte(int64_t i) {
+
+    int64_t in_chunk = i % PIPE_BENCH_CHUNK;
+
+    if (in_chunk < 8) {
+        return (uint8_t)((i - in_chunk) >> (in_chunk * 8));
+    }
+
+    return (uint8_t)(in_chunk * 31 + (in_chunk >> 12));
+}
+
+static void *write_feed(void *arg) {
+
+    PipeFeed *feed = arg;
+    uint8_t *chunk = malloc(PIPE_BENCH_CHUNK);
+
+    for (int i = 0; chunk && i < PIPE_BENCH_CHUNK; i++) {
+        chunk[i] = feed_byte(i);
+    }
+
+    for (int64_t offset = 0; chunk && offset < feed->size; offset += PIPE_BENCH_CHUNK) {
+
+        size_t size = feed->size - offset < PIPE_BENCH_CHUNK ? feed->size - offset : PIPE_BENCH_CHUNK;
+
+        for (int i = 0; i < 8; i++) {
+            chunk[i] = feed_byte(offset + i);
+        }
+
+        if (write_full(feed->fd, chunk, size) < 0) {
+            break;
+        }
+    }
+
+    free(chunk);
+    close(feed->fd);
+
+    return NULL;
+}
+
+// the spool loop read_pipe() had before drain_pipe()
+static int64_t drain_read_1k(int fd, int out_fd) {
+
+    FILE *file = fdopen(dup(out_fd), "wb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+    }
+
+    char buffer[1024];
+    ssize_t bytes_read;
+    int64_t total = 0;
+
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, bytes_read, file);
+        total += bytes_read;
+    }
+
+    fclose(file);
+
+    return bytes_read < 0 ? -1 : total;
+}
+
+static int same_feed(const char *path, int64_t size) {
+
+    FILE *file = fopen(path, "rb");
+    {
+        if (file == NULL) {
+            return 0;
+        }
+    }
+
+    uint8_t buffer[64 * 1024];
+    int64_t offset = 0;
+    size_t bytes_read;
+
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < bytes_read; i++) {
+            if (buffer[i] != feed_byte(offset + i)) {
+                fclose(file);
+                return 0;
+            }
+        }
+        offset += bytes_read;
+    }
+
+    fclose(file);
+
+    return offset == size;
+}
+
+// drains one upload of size bytes into path, returns the elapsed ms or -1
+static double run_drain(DrainKind kind, const char *path, int64_t size) {
+
+    int fds[2];
+    {
+        if (pipe(fds) != 0) {
+            return -1;
+        }
+    }
+
+    int out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    {
+        if (out_fd < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+    }
+
+    PipeFeed feed = { .fd = fds[1], .size = size };
+    pthread_t writer;
+
+    double start = now_ms();
+
+    pthread_create(&writer, NULL, write_feed, &feed);
+
+    int64_t drained;
+    {
+        switch (kind) {
+        case DRAIN_READ_1K: drained = drain_read_1k(fds[0], out_fd); break;
+        case DRAIN_COPY:    drained = copy_pipe(fds[0], out_fd); break;
+        default:            drained = drain_pipe(fds[0], out_fd); break;
+        }
+    }
+
+    close(out_fd);
+
+    double elapsed = now_ms() - start;
+
+    pthread_join(writer, NULL);
+    close(fds[0]);
+
+    if (drained != size || !same_feed(path, size)) {
+        return -1;
+    }
+
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+
+    int64_t megabytes = argc > 1 ? atoll(argv[1]) : 1024;
+    const char *path = argc > 2 ? argv[2] : "pipe_bench.bin";
+
+    if (megabytes <= 0) {
+        fprintf(stderr, "usage: %s [megabytes] [spool_file]\n", argv[0]);
+        return 1;
+    }
+
+    int64_t size = megabytes * 1024 * 1024;
+    int failed = 0;
+
+    for (DrainKind kind = DRAIN_READ_1K; kind <= DRAIN_SPLICE; kind++) {
+
+        double best = -1;
+
+        for (int run = 0; run < PIPE_BENCH_RUNS; run++) {
+
+            double elapsed = run_drain(kind, path, size);
+            {
+                if (elapsed < 0) {
+                    best = -1;
+                    break;
+                }
+            }
+
+            if (best < 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        if (best < 0) {
+            fprintf(stderr, "Error: %s spooled a different file.\n", drain_names[kind]);
+            failed = 1;
+            continue;
+        }
+
+        printf("%-8s %" PRId64 " MB in %8.1f ms, %6.2f GB/s\n", drain_names[kind], megabytes, best, size / (best / 1e3) / 1e9);
+    }
+
+    remove(path);
+
+    return failed;
+}
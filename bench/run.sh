@@ -0,0 +1,83 @@
+#!/bin/bash
+# Generates synthetic inputs with lavfi (testsrc2 + sine, no external media),
+# builds bench/suite.c and writes the results to bench_out/results.json, then
+# checks and times the box downscale kernel with bench/box_bench.c, counts
+# the allocations of the remux loop with bench/alloc_bench.c, times the
+# upload spooling with bench/pipe_bench.c and compares POSIX, io_uring and
+# mmap I/O under concurrent jobs with bench/uring_bench.c.
+#
+#   ITERATIONS=20 DURATIONS="10 60" bench/run.sh
+#
+# Inputs are only generated when missing, so repeated runs compare the same files.
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+ITERATIONS=${ITERATIONS:-10}
+RESOLUTIONS=${RESOLUTIONS:-"640x360 1280x720 1920x1080"}
+CODECS=${CODECS:-"libx264 mpeg4"}
+DURATIONS=${DURATIONS:-"10 60"}
+IMAGE_SIZES=${IMAGE_SIZES:-"828x177 1920x1080 4000x3000"}
+OUT=${OUT:-bench_out}
+
+mkdir -p "$OUT/inputs"
+
+videos=()
+for codec in $CODECS; do
+    for size in $RESOLUTIONS; do
+        for duration in $DURATIONS; do
+            file="$OUT/inputs/${codec}_${size}_${duration}s.mp4"
+            if [ ! -f "$file" ]; then
+                ffmpeg -v error -y \
+                    -f lavfi -i "testsrc2=size=${size}:rate=30:duration=${duration}" \
+                    -f lavfi -i "sine=frequency=440:sample_rate=48000:duration=${duration}" \
+                    -c:v "$codec" -g 60 -threads 1 -pix_fmt yuv420p -b:v 4M \
+                    -c:a aac -b:a 128k \
+                    -fflags +bitexact -flags:v +bitexact -flags:a +bitexact \
+                    "$file"
+            fi
+            videos+=("$file")
+        done
+    done
+done
+
+images=()
+for size in $IMAGE_SIZES; do
+    for ext in png jpg; do
+        file="$OUT/inputs/image_${size}.${ext}"
+        if [ ! -f "$file" ]; then
+            ffmpeg -v error -y -f lavfi -i "testsrc2=size=${size}" -frames:v 1 -pix_fmt "$([ "$ext" = jpg ] && echo yuvj420p || echo rgb24)" -fflags +bitexact "$file"
+        fi
+        images+=("$file")
+    done
+done
+
+gcc -O2 bench/suite.c -o "$OUT/suite" $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+
+"$OUT/suite" -n "$ITERATIONS" -w "$OUT/work" -o "$OUT/results.json" "${videos[@]}" -i "${images[@]}"
+
+# the box downscale kernel against swscale, fails when its luma drifts
+gcc -O2 bench/box_bench.c -o "$OUT/box_bench" $(pkg-config --cflags --libs libavformat libavcodec libswscale libavutil) -pthread -lm
+
+for size in $IMAGE_SIZES; do
+    "$OUT/box_bench" "$OUT/inputs/image_${size}.jpg" "$ITERATIONS"
+done
+
+# allocations per packet of the remux loop by owner, fails when the project's own code allocates
+gcc -O2 bench/alloc_bench.c -o "$OUT/alloc_bench" $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm -ldl
+
+for file in "${videos[@]}"; do
+    "$OUT/alloc_bench" "$file" "$OUT/work/alloc"
+done
+
+# GB/s of draining an upload pipe into the spool file, fails when a file differs
+gcc -O2 bench/pipe_bench.c -o "$OUT/pipe_bench" -pthread
+
+"$OUT/pipe_bench" "${PIPE_MB:-1024}" "$OUT/work/pipe_bench.bin"
+
+# URING_JOBS copy mode jobs at once with POSIX, io_uring then mmap I/O, fails when their outputs differ
+gcc -O2 bench/uring_bench.c -o "$OUT/uring_bench" $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+
+"$OUT/uring_bench" -j "${URING_JOBS:-32}" -n 3 -w "$OUT/work/uring" "${videos[@]}"
+
+echo "results: $OUT/results.json"
@@ -0,0 +1,516 @@
+/*
+suite runs the remux, ingest and image paths repeatedly on the given
+inputs and writes the results as json. every (path, input) pair runs in
+its own child process, so peak RSS is measured per case
+
+bench/run.sh generates the synthetic inputs with lavfi, builds this file
+and runs it. to run it by hand, from the repository root:
+    gcc -O2 bench/suite.c -o suite $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+    ./suite [-n iterations] [-o results.json] [-w workdir] video.mp4... [-i image.png...]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../core/report.c"
+#include "../core/probe.c"
+#include "../core/mapped.c"
+#include "../api/stream/read_pipe.c"
+#include "../api/stream/ingest.c"
+#include "../api/stream/sink.c"
+#include "../api/stream/uring.c"
+#include "../api/stream/cgompeg.c"
+#include "../api/stream/plan.c"
+#include "../api/stream/thumbs.c"
+#include "../api/stream/abr.c"
+#include "../api/stream/gop.c"
+#include "../api/stream/llhls.c"
+#include "../api/stream/live.c"
+#include "../image_convertor/image.c"
+
+#include "libavutil/avutil.h"
+#include "libavutil/avstring.h"
+
+#define BENCH_MAX_ITERATIONS 1000
+
+typedef enum {
+    BENCH_CMD,
+    BENCH_COPY_PACKETS,
+    BENCH_READ_PIPE,
+    BENCH_STREAM_PIPE,
+    BENCH_PROCESS_IMAGE,
+    BENCH_IMAGE_SESSION,
+    BENCH_THUMBNAILS_SERIAL,
+    BENCH_THUMBNAILS,
+} BenchPath;
+
+static const char *path_names[] = { "cmd", "copy_packets", "read_pipe", "stream_pipe", "process_image", "image_session", "thumbnails_serial", "thumbnails" };
+
+// the thumbnail set of image_convertor/main.c, once per process_image() and once decoded once
+static const ImageTarget thumbnails[] = {
+    { "thumb_2.jpg", 0, 0, 10, 2, '<' },
+    { "thumb_3.jpg", 0, 0, 10, 3, '<' },
+    { "thumb_4.jpg", 0, 0, 10, 4, '<' },
+    { "thumb_5.jpg", 0, 0, 10, 5, '<' },
+};
+
+#define BENCH_THUMBNAILS_SIZE (int)(sizeof(thumbnails) / sizeof(thumbnails[0]))
+
+// kept for the whole case, the untimed warm up fills its caches
+static ImageSession *image_session;
+
+// what a single pass over the input has to move, measured once up front
+typedef struct {
+    char path[1024];
+    char codec[32];
+    int width;
+    int height;
+    double duration;
+    int64_t bytes;
+    int64_t packets;
+    int64_t frames;
+} BenchInput;
+
+typedef struct {
+    uint8_t *data;
+    int64_t size;
+    int fd;
+} PipeFeed;
+
+static double now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int scan_input(const char *path, BenchInput *input) {
+
+    memset(input, 0, sizeof(*input));
+
+    if (realpath(path, input->path) == NULL) {
+        fprintf(stderr, "Error: Could not find input '%s'.\n", path);
+        return -1;
+    }
+
+    AVFormatContext *input_ctx = open_input_file(input->path);
+    {
+        if (input_ctx == NULL) {
+            return -1;
+        }
+    }
+
+    int video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    {
+        if (video_index >= 0) {
+            AVCodecParameters *par = input_ctx->streams[video_index]->codecpar;
+
+            snprintf(input->codec, sizeof(input->codec), "%s", avcodec_get_name(par->codec_id));
+            input->width = par->width;
+            input->height = par->height;
+        }
+
+        input->duration = input_ctx->duration != AV_NOPTS_VALUE ? input_ctx->duration / (double)AV_TIME_BASE : 0;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+
+    while (packet && av_read_frame(input_ctx, packet) >= 0) {
+
+        input->packets++;
+
+        if (packet->stream_index == video_index) {
+            input->frames++;
+        }
+
+        av_packet_unref(packet);
+    }
+
+    av_packet_free(&packet);
+    avformat_close_input(&input_ctx);
+
+    FILE *file = fopen(input->path, "rb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+
+        fseeko(file, 0, SEEK_END);
+        input->bytes = ftello(file);
+        fclose(file);
+    }
+
+    return 0;
+}
+
+static void* feed_pipe(void *arg) {
+
+    PipeFeed *feed = (PipeFeed*)arg;
+
+    for (int64_t written = 0; written < feed->size; ) {
+
+        ssize_t n = write(feed->fd, feed->data + written, feed->size - written);
+        if (n <= 0) {
+            break;
+        }
+
+        written += n;
+    }
+
+    close(feed->fd);
+
+    return NULL;
+}
+
+/*
+this function runs one iteration of path on input and returns its time
+in milliseconds, only the path itself is timed: opening the hls output
+for copy_packets and loading the upload into memory for the pipe paths
+happen before the clock starts
+*/
+static double run_once(BenchPath path, const BenchInput *input, const PipeFeed *upload) {
+
+    switch (path) {
+
+    case BENCH_CMD: {
+        double start = now_ms();
+        int result = cmd(input->path, "output.m3u8");
+        return result == 0 ? now_ms() - start : -1;
+    }
+
+    case BENCH_COPY_PACKETS: {
+        AVFormatContext *input_ctx = open_input_file(input->path);
+        RemuxPlan plan;
+        AVFormatContext *output_ctx = input_ctx ? setup_hls_output("copy", "output.m3u8", input_ctx, SEGMENT_TS, 0, &plan, NULL, NULL, NULL) : NULL;
+
+        double elapsed = -1;
+
+        if (output_ctx) {
+            double start = now_ms();
+            elapsed = copy_packets(input_ctx, output_ctx, &plan, NULL) == 0 ? now_ms() - start : -1;
+            free_plan(&plan);
+            avformat_free_context(output_ctx);
+        }
+
+        avformat_close_input(&input_ctx);
+
+        return elapsed;
+    }
+
+    case BENCH_READ_PIPE:
+    case BENCH_STREAM_PIPE: {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return -1;
+        }
+
+        JobConfig job = { .JobID = "bench", .WorkDir = "tmp/bench", .OutputDir = "outputs/bench" };
+        MetaData metadata = { .FileSize = input->bytes };
+
+        PipeFeed feed = *upload;
+        feed.fd = fds[1];
+
+        double start = now_ms();
+
+        pthread_t writer;
+        pthread_create(&writer, NULL, feed_pipe, &feed);
+
+        int result = path == BENCH_READ_PIPE ? read_pipe(fds[0], &metadata, &job) : stream_pipe(fds[0], &metadata, &job);
+
+        // drain whatever the job did not read so the writer can finish
+        char sink[4096];
+        while (read(fds[0], sink, sizeof(sink)) > 0) {
+        }
+
+        pthread_join(writer, NULL);
+        double elapsed = now_ms() - start;
+
+        close(fds[0]);
+
+        return result == 0 ? elapsed : -1;
+    }
+
+    case BENCH_PROCESS_IMAGE: {
+        double start = now_ms();
+        process_image(input->path, "output.jpg", input->width / 2, input->height / 2, 10, 2, '<');
+        return now_ms() - start;
+    }
+
+    case BENCH_IMAGE_SESSION: {
+
+        if (image_session == NULL && (image_session = image_session_alloc()) == NULL) {
+            return -1;
+        }
+
+        ImageTarget target = { "output.jpg", input->width / 2, input->height / 2, 10, 2, '<' };
+
+        double start = now_ms();
+        int result = image_session_process(image_session, input->path, &target, 1);
+        return result == 0 ? now_ms() - start : -1;
+    }
+
+    case BENCH_THUMBNAILS_SERIAL: {
+        double start = now_ms();
+
+        for (int i = 0; i < BENCH_THUMBNAILS_SIZE; i++) {
+            const ImageTarget *t = &thumbnails[i];
+            process_image(input->path, t->output_file, t->width, t->height, t->quality, t->d, t->mode);
+        }
+
+        return now_ms() - start;
+    }
+
+    case BENCH_THUMBNAILS: {
+        double start = now_ms();
+        int result = process_image_targets(input->path, thumbnails, BENCH_THUMBNAILS_SIZE);
+        return result == 0 ? now_ms() - start : -1;
+    }
+    }
+
+    return -1;
+}
+
+static int load_upload(const BenchInput *input, PipeFeed *upload) {
+
+    memset(upload, 0, sizeof(*upload));
+
+    FILE *file = fopen(input->path, "rb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+    }
+
+    upload->size = input->bytes;
+    upload->data = malloc(upload->size > 0 ? upload->size : 1);
+
+    int ok = upload->data && fread(upload->data, 1, upload->size, file) == (size_t)upload->size;
+    fclose(file);
+
+    return ok ? 0 : -1;
+}
+
+/*
+this function runs in the child process: one untimed warm up, then
+iterations timed runs whose times are written to fd
+*/
+static void run_case(BenchPath path, const BenchInput *input, int iterations, const char *workdir, int fd) {
+
+    // the paths log to stdout/stderr, keep the json output clean
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
+
+    if (chdir(workdir) != 0) {
+        _exit(1);
+    }
+
+    PipeFeed upload = {0};
+    if ((path == BENCH_READ_PIPE || path == BENCH_STREAM_PIPE) && load_upload(input, &upload) < 0) {
+        _exit(1);
+    }
+
+    for (int i = -1; i < iterations; i++) {
+
+        double elapsed = run_once(path, input, &upload);
+        {
+            if (elapsed < 0) {
+                _exit(1);
+            }
+        }
+
+        if (i >= 0 && write(fd, &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+            _exit(1);
+        }
+    }
+
+    _exit(0);
+}
+
+static int compare_double(const void *a, const void *b) {
+
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples
+static double percentile(const double *samples, int n, double p) {
+
+    int rank = (int)ceil(p / 100.0 * n);
+
+    return samples[FFMIN(FFMAX(rank, 1), n) - 1];
+}
+
+/*
+this function forks a child for the case, collects its samples and
+appends the json result. returns 0 when the case ran
+*/
+static int bench_case(FILE *out, int *first, BenchPath path, const BenchInput *input, int iterations, const char *workdir) {
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    fflush(NULL);
+
+    pid_t pid = fork();
+    {
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+
+        if (pid == 0) {
+            close(fds[0]);
+            run_case(path, input, iterations, workdir, fds[1]);
+        }
+    }
+
+    close(fds[1]);
+
+    double samples[BENCH_MAX_ITERATIONS];
+    int n = 0;
+
+    while (n < iterations && read(fds[0], &samples[n], sizeof(double)) == sizeof(double)) {
+        n++;
+    }
+
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || n == 0) {
+        fprintf(stderr, "%-14s %s: failed\n", path_names[path], input->path);
+        return -1;
+    }
+
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += samples[i];
+    }
+
+    qsort(samples, n, sizeof(double), compare_double);
+
+    double seconds = total / 1e3;
+
+    #ifdef __APPLE__
+        long peak_rss_kb = usage.ru_maxrss / 1024;
+    #else
+        long peak_rss_kb = usage.ru_maxrss;
+    #endif
+
+    fprintf(out, "%s\n    {\"path\": \"%s\", \"input\": \"%s\", \"codec\": \"%s\", \"width\": %d, \"height\": %d, \"duration_s\": %.3f, "
+        "\"bytes\": %" PRId64 ", \"packets\": %" PRId64 ", \"frames\": %" PRId64 ", \"iterations\": %d,\n",
+        *first ? "" : ",", path_names[path], av_basename(input->path), input->codec, input->width, input->height, input->duration,
+        input->bytes, input->packets, input->frames, n);
+
+    fprintf(out, "     \"latency_ms\": {\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f},\n",
+        samples[0], percentile(samples, n, 50), percentile(samples, n, 90), percentile(samples, n, 99), samples[n - 1], total / n);
+
+    fprintf(out, "     \"throughput\": {\"packets_per_s\": %.1f, \"mb_per_s\": %.2f, \"frames_per_s\": %.1f},\n",
+        input->packets * n / seconds, input->bytes * n / seconds / (1024 * 1024), input->frames * n / seconds);
+
+    fprintf(out, "     \"peak_rss_kb\": %ld}", peak_rss_kb);
+
+    fprintf(stderr, "%-14s %-32s p50 %9.3f ms  p99 %9.3f ms  rss %7ld KB\n",
+        path_names[path], av_basename(input->path), percentile(samples, n, 50), percentile(samples, n, 99), peak_rss_kb);
+
+    *first = 0;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    int iterations = 10;
+    const char *output = NULL;
+    const char *workdir = "bench_out";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:o:w:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = FFMIN(FFMAX(atoi(optarg), 1), BENCH_MAX_ITERATIONS); break;
+        case 'o': output = optarg; break;
+        case 'w': workdir = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-o results.json] [-w workdir] video... [-i image...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    if (make_dirs(workdir) < 0) {
+        fprintf(stderr, "Error: Could not create work directory '%s'.\n", workdir);
+        return 1;
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    {
+        if (out == NULL) {
+            fprintf(stderr, "Error: Could not open '%s'.\n", output);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n  \"ffmpeg\": \"%s\", \"iterations\": %d,\n  \"results\": [", av_version_info(), iterations);
+
+    int first = 1;
+    int failed = 0;
+    int images = 0;
+
+    for (int i = optind; i < argc; i++) {
+
+        if (strcmp(argv[i], "-i") == 0) {
+            images = 1;
+            continue;
+        }
+
+        BenchInput input;
+        if (scan_input(argv[i], &input) < 0) {
+            failed = 1;
+            continue;
+        }
+
+        if (images) {
+
+            BenchPath paths[] = { BENCH_PROCESS_IMAGE, BENCH_IMAGE_SESSION, BENCH_THUMBNAILS_SERIAL, BENCH_THUMBNAILS };
+
+            for (int p = 0; p < (int)(sizeof(paths) / sizeof(paths[0])); p++) {
+                failed |= bench_case(out, &first, paths[p], &input, iterations, workdir) < 0;
+            }
+            continue;
+        }
+
+        BenchPath paths[] = { BENCH_CMD, BENCH_COPY_PACKETS, BENCH_READ_PIPE, BENCH_STREAM_PIPE };
+
+        for (int p = 0; p < (int)(sizeof(paths) / sizeof(paths[0])); p++) {
+            failed |= bench_case(out, &first, paths[p], &input, iterations, workdir) < 0;
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return failed;
+}
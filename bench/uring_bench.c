@@ -0,0 +1,259 @@
+/*
+uring_bench runs many copy mode conversions at once, the way a busy server
+converts spooled uploads, once per IoBackend (posix, uring and mmap):
+every job reads its input file and writes its playlist and segments into
+a directory of its own. the best of the rounds is printed per backend
+(wall time, jobs/s, input MB/s and job latency), then the outputs of the
+uring and mmap jobs are compared file by file with the posix ones. exits 1
+when a job fails or when a backend wrote different files
+
+build from the repository root:
+    gcc -O2 bench/uring_bench.c -o uring_bench $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+
+usage:
+    ./uring_bench [-j jobs] [-n rounds] [-w workdir] input.mp4...
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "../core/report.c"
+#include "../core/probe.c"
+#include "../core/mapped.c"
+#include "../api/stream/read_pipe.c"
+#include "../api/stream/ingest.c"
+#include "../api/stream/sink.c"
+#include "../api/stream/uring.c"
+#include "../api/stream/cgompeg.c"
+#include "../api/stream/plan.c"
+#include "../api/stream/thumbs.c"
+#include "../api/stream/abr.c"
+#include "../api/stream/gop.c"
+#include "../api/stream/llhls.c"
+#include "../api/stream/live.c"
+
+#define URING_BENCH_MAX_JOBS 256
+
+static const char *backend_names[] = { "posix", "uring", "mmap" };
+
+typedef struct {
+    const char *input;
+    char output_dir[512];
+    IoBackend io;
+    double latency;
+    int result;
+} BenchJob;
+
+static double now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// convert_file() of one job, without the probe cache and the printf
+static void *run_job(void *arg) {
+
+    BenchJob *job = arg;
+    double start = now_ms();
+
+    ProbeOptions probe = { 0 };
+
+    MappedInput mapped;
+    AVIOContext *pb = open_input_io(job->input, job->io, &mapped);
+    AVFormatContext *input_ctx = open_input_probed_io(job->input, pb, &probe, NULL);
+
+    job->result = input_ctx ? remux_to_hls(input_ctx, job->output_dir, "output.m3u8", SEGMENT_TS, NULL, job->io, 0, NULL) : 1;
+
+    avformat_close_input(&input_ctx);
+    close_input_io(&pb, job->io, &mapped);
+
+    job->latency = now_ms() - start;
+
+    return NULL;
+}
+
+static int same_file(const char *a, const char *b) {
+
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+
+    int same = fa && fb;
+
+    while (same) {
+
+        uint8_t ba[65536], bb[65536];
+        size_t na = fread(ba, 1, sizeof(ba), fa);
+        size_t nb = fread(bb, 1, sizeof(bb), fb);
+
+        same = na == nb && memcmp(ba, bb, na) == 0;
+
+        if (na == 0) {
+            break;
+        }
+    }
+
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+
+    return same;
+}
+
+// every file of dir a is in dir b with the same bytes, and b has no others
+static int same_dir(const char *a, const char *b) {
+
+    DIR *dir = opendir(a);
+    {
+        if (dir == NULL) {
+            return 0;
+        }
+    }
+
+    int same = 1;
+    int files = 0;
+
+    struct dirent *entry;
+    while (same && (entry = readdir(dir))) {
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        char path_a[1024], path_b[1024];
+        snprintf(path_a, sizeof(path_a), "%s/%s", a, entry->d_name);
+        snprintf(path_b, sizeof(path_b), "%s/%s", b, entry->d_name);
+
+        same = same_file(path_a, path_b);
+        files++;
+    }
+
+    closedir(dir);
+
+    dir = opendir(b);
+    {
+        while (same && dir && (entry = readdir(dir))) {
+            files -= entry->d_name[0] != '.';
+        }
+
+        if (dir) {
+            closedir(dir);
+        }
+    }
+
+    return same && files == 0;
+}
+
+int main(int argc, char **argv) {
+
+    int jobs = 32;
+    int rounds = 3;
+    const char *workdir = "uring_bench";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:n:w:")) != -1) {
+        switch (opt) {
+        case 'j': jobs = FFMIN(FFMAX(atoi(optarg), 1), URING_BENCH_MAX_JOBS); break;
+        case 'n': rounds = FFMAX(atoi(optarg), 1); break;
+        case 'w': workdir = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-j jobs] [-n rounds] [-w workdir] input.mp4...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int inputs = argc - optind;
+    {
+        if (inputs <= 0) {
+            fprintf(stderr, "usage: %s [-j jobs] [-n rounds] [-w workdir] input.mp4...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    if (!uring_available()) {
+        fprintf(stderr, "io_uring is not available here, the uring jobs run with POSIX I/O.\n");
+    }
+
+    static BenchJob bench_jobs[3][URING_BENCH_MAX_JOBS];
+    int failed = 0;
+
+    for (IoBackend io = IO_BACKEND_POSIX; io <= IO_BACKEND_MMAP; io++) {
+
+        double best_wall = -1;
+        double latencies[URING_BENCH_MAX_JOBS];
+        int64_t bytes_in = 0;
+
+        for (int round = 0; round < rounds; round++) {
+
+            pthread_t threads[URING_BENCH_MAX_JOBS];
+            bytes_in = 0;
+
+            double start = now_ms();
+
+            for (int i = 0; i < jobs; i++) {
+
+                BenchJob *job = &bench_jobs[io][i];
+                {
+                    job->input = argv[optind + i % inputs];
+                    job->io = io;
+                    snprintf(job->output_dir, sizeof(job->output_dir), "%s/%s/%d", workdir, backend_names[io], i);
+                }
+
+                struct stat st;
+                bytes_in += stat(job->input, &st) == 0 ? st.st_size : 0;
+
+                pthread_create(&threads[i], NULL, run_job, job);
+            }
+
+            for (int i = 0; i < jobs; i++) {
+                pthread_join(threads[i], NULL);
+            }
+
+            double wall = now_ms() - start;
+
+            for (int i = 0; i < jobs; i++) {
+                if (bench_jobs[io][i].result != 0) {
+                    fprintf(stderr, "Error: %s job %d failed on '%s'.\n", backend_names[io], i, bench_jobs[io][i].input);
+                    failed = 1;
+                }
+            }
+
+            if (best_wall < 0 || wall < best_wall) {
+
+                best_wall = wall;
+
+                for (int i = 0; i < jobs; i++) {
+                    latencies[i] = bench_jobs[io][i].latency;
+                }
+            }
+        }
+
+        qsort(latencies, jobs, sizeof(double), compare_double);
+
+        printf("%s: %d jobs in %.1f ms, %.1f jobs/s, %.1f MB/s in, job latency p50 %.1f ms p99 %.1f ms\n",
+            backend_names[io], jobs, best_wall, jobs / (best_wall / 1e3), bytes_in / (best_wall / 1e3) / 1e6,
+            latencies[jobs / 2], latencies[FFMIN(jobs - 1, jobs * 99 / 100)]);
+    }
+
+    for (IoBackend io = IO_BACKEND_URING; io <= IO_BACKEND_MMAP; io++) {
+        for (int i = 0; i < jobs; i++) {
+            if (!same_dir(bench_jobs[IO_BACKEND_POSIX][i].output_dir, bench_jobs[io][i].output_dir)) {
+                fprintf(stderr, "Error: job %d wrote different files with posix and %s.\n", i, backend_names[io]);
+                failed = 1;
+            }
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,39 @@
+package cmd
+
+/*
+#include <stdint.h>
+*/
+import "C"
+import (
+	"io"
+	"runtime/cgo"
+	"unsafe"
+)
+
+// LogFunc receives the FFmpeg messages of a Job, level is an AV_LOG_* value
+type LogFunc func(level int, line string)
+
+// goCmdLog is the C LogFunc of every Job with Options.Log, handle is the
+// cgo.Handle of that LogFunc
+//
+//export goCmdLog
+func goCmdLog(handle C.uintptr_t, level C.int, line *C.char) {
+	log := cgo.Handle(handle).Value().(LogFunc)
+
+	log(int(level), C.GoString(line))
+}
+
+// goCmdRead is the C ReadFunc of every Job with Options.Input, handle is
+// the cgo.Handle of that io.Reader
+//
+//export goCmdRead
+func goCmdRead(handle C.uintptr_t, buf *C.uint8_t, size C.int) C.int {
+	input := cgo.Handle(handle).Value().(io.Reader)
+
+	n, err := io.ReadFull(input, unsafe.Slice((*byte)(unsafe.Pointer(buf)), int(size)))
+	if n == 0 && err != nil && err != io.EOF && err != io.ErrUnexpectedEOF {
+		return -1
+	}
+
+	return C.int(n)
+}
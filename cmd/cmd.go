@@ -3,20 +3,233 @@ package cmd
 /*
 #cgo LDFLAGS: -lavformat -lavcodec -lswscale -lavutil
 #include "./../core/cgompeg.h"
+#include "./../core/report.c"
+#include "./../core/probe.c"
+#include "./../core/mapped.c"
+#include "./../core/executor.c"
 #include "./../core/cgompeg.c"
+
+extern void goCmdLog(uintptr_t handle, int level, char *line);
+extern int goCmdRead(uintptr_t handle, uint8_t *buf, int size);
 */
 import "C"
 import (
+	"errors"
+	"io"
+	"runtime/cgo"
+	"time"
 	"unsafe"
 )
 
+// ProbeOptions is the probe budget of a conversion, zero values keep the
+// FFmpeg defaults
+type ProbeOptions struct {
+	ProbeSize       int64         // bytes read while probing
+	AnalyzeDuration time.Duration // media analyzed while probing
+	CacheDir        string        // probe cache directory, empty disables the cache, not used with Options.Input
+}
+
+// StageTime is the time a conversion spent in one stage
+type StageTime struct {
+	Wall time.Duration
+	CPU  time.Duration // conversion thread only, the codec's own worker threads are not included
+}
+
+// JobReport tells where the time of a conversion went and how much it moved
+type JobReport struct {
+	CacheHit     bool          // stream info came from the probe cache
+	Probe        time.Duration // opening and probing the input
+	FirstSegment time.Duration // until the first segment was written, 0 if none
+
+	Header  StageTime // writing the hls header
+	Remux   StageTime // remuxing the packets
+	Trailer StageTime // writing the trailer and the final playlist
+
+	BytesIn  int64 // packet payload read from the input
+	BytesOut int64 // bytes written, playlists included
+	Packets  int64 // packets read from the input
+	Segments int64 // segments written
+}
+
+// Segment containers of Options.SegmentType
+const (
+	SegmentTS   = "ts"
+	SegmentFMP4 = "fmp4"
+)
+
+// Options of a Job, zero values keep what Cmd does
+type Options struct {
+	OutputDir       string        // playlist and segments, ../outputs when empty
+	SegmentDuration time.Duration // target segment duration, 1s when zero
+	SegmentType     string        // SegmentTS (default) or SegmentFMP4
+	Probe           ProbeOptions
+
+	Log      LogFunc // FFmpeg messages of the job, dropped when nil
+	LogLevel int     // most verbose AV_LOG_* level passed to Log, AV_LOG_ERROR (16) when zero
+
+	Input io.Reader // read instead of the input file when set, the input must not need seeking
+}
+
+// Job converts files to HLS with the same options, it keeps its packet
+// and options between runs. Jobs share no state, so separate Jobs may run
+// on any number of goroutines at once; one Job runs one conversion at a time
+type Job struct {
+	job     *C.HlsJob
+	handles []cgo.Handle // of the log and input callbacks, deleted by Close
+}
+
+// NewJob returns a Job with opts, Close frees it
+func NewJob(opts Options) (*Job, error) {
+
+	var options C.HlsJobOptions
+	{
+		copyCString(options.OutputDir[:], opts.OutputDir)
+		copyCString(options.Probe.CacheDir[:], opts.Probe.CacheDir)
+
+		options.SegmentSeconds = C.double(opts.SegmentDuration.Seconds())
+		options.Probe.ProbeSize = C.int64_t(opts.Probe.ProbeSize)
+		options.Probe.AnalyzeDuration = C.int64_t(opts.Probe.AnalyzeDuration.Microseconds())
+	}
+
+	switch opts.SegmentType {
+	case "", SegmentTS:
+		options.SegmentType = C.HLS_SEGMENT_TS
+	case SegmentFMP4:
+		options.SegmentType = C.HLS_SEGMENT_FMP4
+	default:
+		return nil, errors.New("unknown segment type " + opts.SegmentType)
+	}
+
+	j := &Job{}
+
+	if opts.Log != nil {
+		handle := cgo.NewHandle(opts.Log)
+		j.handles = append(j.handles, handle)
+
+		options.Log.Func = C.LogFunc(C.goCmdLog)
+		options.Log.Handle = C.uintptr_t(handle)
+		options.Log.Level = C.int(opts.LogLevel)
+	}
+
+	if opts.Input != nil {
+		handle := cgo.NewHandle(opts.Input)
+		j.handles = append(j.handles, handle)
+
+		options.Read = C.ReadFunc(C.goCmdRead)
+		options.ReadHandle = C.uintptr_t(handle)
+	}
+
+	j.job = C.hls_job_open(&options)
+	{
+		if j.job == nil {
+			j.Close()
+			return nil, errors.New("could not allocate the job")
+		}
+	}
+
+	return j, nil
+}
+
+// Run converts inputFile into outputFile under the job's OutputDir, with
+// Options.Input inputFile only names the input. the conversion runs on
+// one of the executor threads while the calling goroutine waits
+func (j *Job) Run(inputFile, outputFile string) (JobReport, error) {
+
+	task := (*C.HlsJobTask)(C.calloc(1, C.sizeof_HlsJobTask))
+	{
+		task.Task.Func = C.TaskFunc(C.hls_job_task)
+		task.Job = j.job
+		task.InputFile = C.CString(inputFile)
+		task.OutputFile = C.CString(outputFile)
+	}
+
+	defer C.free(unsafe.Pointer(task))
+	defer C.free(unsafe.Pointer(task.InputFile))
+	defer C.free(unsafe.Pointer(task.OutputFile))
+
+	result, err := runTask(unsafe.Pointer(task))
+	if err != nil {
+		return JobReport{}, err
+	}
+
+	report := newJobReport(*C.hls_job_report(j.job))
+
+	if result != 0 {
+		return report, errors.New("HLS conversion failed")
+	}
+
+	return report, nil
+}
+
+// Close frees the job, it must not be running
+func (j *Job) Close() {
+
+	C.hls_job_close(&j.job)
+
+	for _, handle := range j.handles {
+		handle.Delete()
+	}
+
+	j.handles = nil
+}
+
+// copyCString copies s into a fixed size C char array, always NUL terminating it
+func copyCString(dst []C.char, s string) {
+	n := copy(unsafe.Slice((*byte)(unsafe.Pointer(&dst[0])), len(dst)-1), s)
+	dst[n] = 0
+}
+
 func Cmd(inputFile, outputFile string) int {
 
-	cInputFile := C.CString(inputFile)
-	cOutputFile := C.CString(outputFile)
+	_, result := CmdWithOptions(inputFile, outputFile, ProbeOptions{})
+
+	return result
+}
+
+// CmdWithOptions is Cmd with a probe budget and probe cache, it also
+// reports the time spent in each stage and the time to first segment
+func CmdWithOptions(inputFile, outputFile string, opts ProbeOptions) (JobReport, int) {
+
+	job, err := NewJob(Options{Probe: opts})
+	if err != nil {
+		return JobReport{}, 1
+	}
+
+	defer job.Close()
+
+	report, err := job.Run(inputFile, outputFile)
+	if err != nil {
+		return report, 1
+	}
+
+	return report, 0
+}
+
+func newStageTime(stage C.StageTime) StageTime {
+	return StageTime{
+		Wall: time.Duration(stage.WallMicros) * time.Microsecond,
+		CPU:  time.Duration(stage.CpuMicros) * time.Microsecond,
+	}
+}
+
+func newJobReport(report C.JobReport) JobReport {
+	r := JobReport{
+		CacheHit: report.CacheHit != 0,
+		Probe:    time.Duration(report.Stages[C.JOB_STAGE_PROBE].WallMicros) * time.Microsecond,
+
+		Header:  newStageTime(report.Stages[C.JOB_STAGE_HEADER]),
+		Remux:   newStageTime(report.Stages[C.JOB_STAGE_PACKETS]),
+		Trailer: newStageTime(report.Stages[C.JOB_STAGE_TRAILER]),
+
+		BytesIn:  int64(report.BytesIn),
+		BytesOut: int64(report.BytesOut),
+		Packets:  int64(report.Packets),
+		Segments: int64(report.Segments),
+	}
 
-	defer C.free(unsafe.Pointer(cInputFile))
-	defer C.free(unsafe.Pointer(cOutputFile))
+	if report.FirstSegmentMicros >= 0 {
+		r.FirstSegment = time.Duration(report.FirstSegmentMicros) * time.Microsecond
+	}
 
-	return int(C.cmd(cInputFile, cOutputFile))
+	return r
 }
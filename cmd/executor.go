@@ -0,0 +1,107 @@
+package cmd
+
+/*
+#include "./../core/executor.h"
+*/
+import "C"
+import (
+	"os"
+	"runtime"
+	"runtime/cgo"
+	"sync"
+	"syscall"
+	"unsafe"
+)
+
+// executor runs the conversions of every Job on runtime.NumCPU() native
+// threads (core/executor.c). a goroutine in Run waits on a channel instead
+// of holding a Go OS thread in a cgo call, so any number of concurrent
+// Runs keep the thread count bounded; the ones past the threads queue up
+var executor struct {
+	once   sync.Once
+	pool   *C.Executor
+	events *os.File
+	err    error
+}
+
+// startExecutor starts the threads and the goroutine polling their events on first use
+func startExecutor() error {
+	executor.once.Do(func() {
+		pool := C.executor_open(C.int(runtime.NumCPU()), 0)
+		if pool == nil {
+			executor.err = syscall.EAGAIN
+			return
+		}
+
+		// the executor closes its descriptor, the os.File closes this one
+		fd, err := syscall.Dup(int(C.executor_fd(pool)))
+		if err != nil {
+			C.executor_close(&pool)
+			executor.err = err
+			return
+		}
+
+		syscall.CloseOnExec(fd)
+
+		executor.pool = pool
+		executor.events = os.NewFile(uintptr(fd), "executor")
+
+		go pollExecutor()
+	})
+
+	return executor.err
+}
+
+// pollExecutor waits on the event descriptor in the netpoller and sends
+// the result of every finished task to its Run
+func pollExecutor() {
+	conn, err := executor.events.SyscallConn()
+	if err != nil {
+		panic(err)
+	}
+
+	events := make([]C.TaskEvent, C.EXECUTOR_POLL_MAX)
+
+	for {
+		n := 0
+
+		// called again each time the descriptor becomes readable while it returns false
+		err := conn.Read(func(uintptr) bool {
+			n = int(C.executor_poll(executor.pool, &events[0], C.int(len(events))))
+			return n > 0
+		})
+		if err != nil {
+			return
+		}
+
+		for _, event := range events[:n] {
+			if event.State != C.TASK_DONE {
+				continue
+			}
+
+			handle := cgo.Handle(event.Task.Handle)
+
+			handle.Value().(chan int) <- int(event.Task.Result)
+			handle.Delete()
+		}
+	}
+}
+
+// runTask runs task, C memory, on the executor and waits for its result
+func runTask(task unsafe.Pointer) (int, error) {
+	if err := startExecutor(); err != nil {
+		return 0, err
+	}
+
+	done := make(chan int, 1)
+	handle := cgo.NewHandle(done)
+
+	(*C.Task)(task).Handle = C.uintptr_t(handle)
+
+	if result := C.executor_submit(executor.pool, (*C.Task)(task)); result < 0 {
+		handle.Delete()
+		return 0, syscall.Errno(-result)
+	}
+
+	return <-done, nil
+}
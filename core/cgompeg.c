@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 
+#include "cgompeg.h"
+#include "probe.h"
+#include "mapped.h"
+
 #include "libavformat/avformat.h"
 #include "libavcodec/avcodec.h"
 #include "libavutil/opt.h"
@@ -12,25 +16,28 @@
     #include <direct.h>  // For _mkdir on Windows
 #endif
 
-static int custom_read(void *opaque, uint8_t *buf, int buf_size) {
-    
-    FILE *file = (FILE*)opaque;
-    
-    size_t bytes_read = fread(buf, 1, buf_size, file);
+// the HlsJob handle, the options are copied so the caller's may go away
+struct HlsJob {
+    HlsJobOptions options;
+    AVPacket *packet; // reused by every copy_packets() of the job
+    JobReport report;
+};
+
+// the AVIOContext read callback over HlsJobOptions.Read
+static int job_read(void *opaque, uint8_t *buf, int buf_size) {
+
+    const HlsJobOptions *options = (const HlsJobOptions*)opaque;
+
+    int bytes_read = options->Read(options->ReadHandle, buf, buf_size);
     {
         if (bytes_read == 0) {
             return AVERROR_EOF;
         }
     }
 
-    return bytes_read;
+    return bytes_read < 0 ? AVERROR(EIO) : bytes_read;
 }
 
-// int custom_read(void *opaque, uint8_t *buf, int buf_size) {
-//     FILE *file = (FILE*)opaque;
-//     return fread(buf, 1, buf_size, file);
-// }
-
 /* 
 this function opens the input file and returns the context
 it also finds the stream info and returns the context
@@ -67,12 +74,12 @@ AVFormatContext* open_input_file(const char *input_file) {
 /*
 this function sets up the output file for hls
 it also copies the streams from the input to the output
-it also sets the hls options
+it also sets the hls options of the job
 */
-AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *input_ctx) {
+AVFormatContext* setup_hls_output(const HlsJobOptions *job_options, const char *output_file, AVFormatContext *input_ctx, JobReport *report) {
     
     char m3u8_path[1024];
-    char output_dir[] = "../outputs";
+    const char *output_dir = job_options->OutputDir[0] ? job_options->OutputDir : HLS_DEFAULT_OUTPUT_DIR;
     {   
         #ifdef _WIN32
             _mkdir(output_dir);
@@ -137,20 +144,37 @@ AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *inpu
     hls_time: the duration of each segment in seconds
     hls_list_size: the number of segments to keep in the playlist
     hls_segment_filename: the filename format for the segments
+    hls_segment_type: mpegts or fmp4, fmp4 also writes an init.mp4
     */
+    int fmp4 = job_options->SegmentType == HLS_SEGMENT_FMP4;
+    double segment_seconds = job_options->SegmentSeconds > 0 ? job_options->SegmentSeconds : HLS_DEFAULT_SEGMENT_SECONDS;
+
     char segment_path[1024];
-    snprintf(segment_path, sizeof(segment_path), "%s/segment%%03d.ts", output_dir);
+    snprintf(segment_path, sizeof(segment_path), fmp4 ? "%s/segment%%03d.m4s" : "%s/segment%%03d.ts", output_dir);
+
+    char segment_time[32];
+    snprintf(segment_time, sizeof(segment_time), "%g", segment_seconds);
    
     AVDictionary *options = NULL;
     { 
-        av_dict_set(&options, "hls_time", "1", 0); // Segment duration
+        av_dict_set(&options, "hls_time", segment_time, 0); // Segment duration
         av_dict_set(&options, "hls_list_size", "0", 0); // Unlimited playlist size
         av_dict_set(&options, "hls_segment_filename", segment_path, 0);
+
+        if (fmp4) {
+            av_dict_set(&options, "hls_segment_type", "fmp4", 0);
+            av_dict_set(&options, "hls_fmp4_init_filename", "init.mp4", 0);
+        }
         // av_dict_set(&options, "video_bitrate", "1000000", 0);
         // av_dict_set(&options, "audio_bitrate", "128000", 0);
         // av_dict_set(&options, "hls_flags", "delete_segments", 0);
     }
     
+    StageClock clock;
+    stage_begin(&clock);
+
+    watch_hls_output(output_ctx, report);
+
     if (!(output_ctx->oformat->flags & AVFMT_NOFILE)) {
 
         int result = avio_open(&output_ctx->pb, output_file, AVIO_FLAG_WRITE);
@@ -175,6 +199,8 @@ AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *inpu
     }
 
     av_dict_free(&options);
+
+    stage_end(report, JOB_STAGE_HEADER, &clock);
     
     return output_ctx;
 }
@@ -183,39 +209,48 @@ AVFormatContext* setup_hls_output(const char *output_file, AVFormatContext *inpu
 this function copies the packets from the input to the output
 it also sets the pts, dts, duration, and pos for the output packet
 it also unreferences the input packet
+pkt is the packet of the job, reused for every read
 */
-int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx) {
-    
-    AVPacket pkt;
+int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx, AVPacket *pkt, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
     
     /*
     this block reads the packets from the input
     it also sets the pts, dts, duration, and pos for the output packet
     it also unreferences the input packet
     */
-    while (av_read_frame(input_ctx, &pkt) >= 0) {
+    while (av_read_frame(input_ctx, pkt) >= 0) {
+
+        report_packet(report, pkt);
         
-        AVStream *in_stream = input_ctx->streams[pkt.stream_index];
-        AVStream *out_stream = output_ctx->streams[pkt.stream_index];
+        AVStream *in_stream = input_ctx->streams[pkt->stream_index];
+        AVStream *out_stream = output_ctx->streams[pkt->stream_index];
         {
-            pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.dts = av_rescale_q_rnd(pkt.dts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.duration = av_rescale_q(pkt.duration, in_stream->time_base, out_stream->time_base);
-            pkt.pos = -1;
+            pkt->pts = av_rescale_q_rnd(pkt->pts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+            pkt->dts = av_rescale_q_rnd(pkt->dts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+            pkt->duration = av_rescale_q(pkt->duration, in_stream->time_base, out_stream->time_base);
+            pkt->pos = -1;
         }
 
-        int result = av_interleaved_write_frame(output_ctx, &pkt);
+        report_progress(report, pkt->dts, out_stream->time_base);
+
+        int result = av_interleaved_write_frame(output_ctx, pkt);
         {
             if (result < 0) {
                 fprintf(stderr, "Error: Failed to write frame to output file.\n");
-                av_packet_unref(&pkt);
+                av_packet_unref(pkt);
                 return -1;
             }
         }
 
-        av_packet_unref(&pkt);
+        av_packet_unref(pkt);
     }
 
+    stage_end(report, JOB_STAGE_PACKETS, &clock);
+    stage_begin(&clock);
+
     int result = av_write_trailer(output_ctx);
     {
         if (result < 0) {
@@ -224,36 +259,122 @@ int copy_packets(AVFormatContext *input_ctx, AVFormatContext *output_ctx) {
         }
     }
 
+    stage_end(report, JOB_STAGE_TRAILER, &clock);
+
     return 0;
 }
 
-int cmd(const char *input_file, const char *output_file) {
-    
-    av_log_set_level(AV_LOG_QUIET);
+/*
+this function returns a job with a copy of options, NULL options keep
+the defaults of cmd(). the job is run any number of times with
+hls_job_run() and freed with hls_job_close()
+*/
+HlsJob* hls_job_open(const HlsJobOptions *options) {
+
+    HlsJob *job = av_mallocz(sizeof(*job));
+    {
+        if (job == NULL) {
+            return NULL;
+        }
+
+        if (options) {
+            job->options = *options;
+        }
+    }
+
+    job->packet = av_packet_alloc();
+    {
+        if (job->packet == NULL) {
+            av_free(job);
+            return NULL;
+        }
+    }
+
+    return job;
+}
+
+// the input reader of a run: options->Read when set, a mapping of input_file otherwise
+static AVIOContext* open_job_input(HlsJob *job, const char *input_file, MappedInput *mapped) {
+
+    mapped->data = NULL;
+    mapped->size = 0;
+
+    if (job->options.Read == NULL) {
+        map_input(mapped, input_file, 1);
+        return mapped_io(mapped);
+    }
+
+    uint8_t *io_buffer = av_malloc(HLS_READ_BUFFER_SIZE);
+    {
+        if (io_buffer == NULL) {
+            return NULL;
+        }
+    }
+
+    AVIOContext *pb = avio_alloc_context(io_buffer, HLS_READ_BUFFER_SIZE, 0, &job->options, job_read, NULL, NULL);
+    {
+        if (pb == NULL) {
+            av_free(io_buffer);
+        }
+    }
+
+    return pb;
+}
+
+static void close_job_input(AVIOContext **pb, MappedInput *mapped) {
 
-    AVFormatContext *input_ctx = open_input_file(input_file);
+    if (mapped->data) {
+        free_mapped_io(pb);
+        unmap_input(mapped);
+    } else if (*pb) {
+        av_freep(&(*pb)->buffer);
+        avio_context_free(pb);
+    }
+}
+
+static int run_job(HlsJob *job, const char *input_file, const char *output_file) {
+
+    // the input is read through a mapping where it can be, see mapped.c
+    MappedInput mapped;
+    AVIOContext *pb = open_job_input(job, input_file, &mapped);
+    {
+        if (job->options.Read && pb == NULL) {
+            return 1;
+        }
+    }
+
+    // the probe cache hashes the file at input_file, a Read input is only named by it
+    ProbeOptions probe = job->options.Probe;
+    if (job->options.Read) {
+        probe.CacheDir[0] = '\0';
+    }
+
+    AVFormatContext *input_ctx = open_input_probed_io(input_file, pb, &probe, &job->report);
     { 
         if (input_ctx == NULL) { 
             fprintf(stderr, "Error: Could not open input file.\n");
+            close_job_input(&pb, &mapped);
             return 1;
         };
     }
 
-    AVFormatContext *output_ctx = setup_hls_output(output_file, input_ctx);
+    AVFormatContext *output_ctx = setup_hls_output(&job->options, output_file, input_ctx, &job->report);
     {
         if (output_ctx == NULL) {
             fprintf(stderr, "Error: Could not setup HLS output.\n");
             avformat_close_input(&input_ctx);
             avformat_free_context(output_ctx);
+            close_job_input(&pb, &mapped);
             return 1;
         }
     }
 
-    int result = copy_packets(input_ctx, output_ctx);
+    int result = copy_packets(input_ctx, output_ctx, job->packet, &job->report);
     {   
         if (result < 0) {
             avformat_close_input(&input_ctx);
             avformat_free_context(output_ctx);
+            close_job_input(&pb, &mapped);
             return 1;
         }
     }
@@ -261,9 +382,89 @@ int cmd(const char *input_file, const char *output_file) {
     {
         avformat_close_input(&input_ctx);
         avformat_free_context(output_ctx);
+        close_job_input(&pb, &mapped);
     }
 
     printf("HLS conversion completed successfully.\n");
    
     return 0;
 }
+
+/*
+this function converts input_file into output_file under the job's
+OutputDir and restarts the job report, the FFmpeg messages of the run go
+to the job's Log. with options.Read set input_file only names the input
+*/
+int hls_job_run(HlsJob *job, const char *input_file, const char *output_file) {
+
+    job_report_init(&job->report);
+    job_log_attach(&job->options.Log);
+
+    int result = run_job(job, input_file, output_file);
+
+    job_log_attach(NULL);
+
+    return result;
+}
+
+// the TaskFunc of an HlsJobTask
+int hls_job_task(Task *task) {
+
+    HlsJobTask *run = (HlsJobTask*)task;
+
+    return hls_job_run(run->Job, run->InputFile, run->OutputFile);
+}
+
+// the report of the last run, Progress may be set before a run
+JobReport* hls_job_report(HlsJob *job) {
+    return &job->report;
+}
+
+void hls_job_close(HlsJob **job) {
+
+    if (*job == NULL) {
+        return;
+    }
+
+    av_packet_free(&(*job)->packet);
+    av_freep(job);
+}
+
+/*
+this function is cmd() with a probe budget, a probe cache and a job
+report, probe and report may be NULL
+*/
+int cmd_probe(const char *input_file, const char *output_file, const ProbeOptions *probe, JobReport *report) {
+
+    HlsJobOptions options = { 0 };
+    {
+        if (probe) {
+            options.Probe = *probe;
+        }
+    }
+
+    HlsJob *job = hls_job_open(&options);
+    {
+        if (job == NULL) {
+            return 1;
+        }
+
+        if (report) {
+            job->report = *report;
+        }
+    }
+
+    int result = hls_job_run(job, input_file, output_file);
+
+    if (report) {
+        *report = job->report;
+    }
+
+    hls_job_close(&job);
+
+    return result;
+}
+
+int cmd(const char *input_file, const char *output_file) {
+    return cmd_probe(input_file, output_file, NULL, NULL);
+}
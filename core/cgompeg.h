@@ -1,6 +1,63 @@
 #ifndef CGOMPEG_H
 #define CGOMPEG_H
 
+#include <stdint.h>
+
+#include "probe.h"
+#include "executor.h"
+
+// playlist and segments of a job without HlsJobOptions.OutputDir, the old fixed layout
+#define HLS_DEFAULT_OUTPUT_DIR "../outputs"
+
+// segment duration of a job without HlsJobOptions.SegmentSeconds
+#define HLS_DEFAULT_SEGMENT_SECONDS 1.0
+
+// buffer of the AVIOContext over HlsJobOptions.Read
+#define HLS_READ_BUFFER_SIZE 65536
+
+// Container of the media segments, hls_segment_type of the muxer
+typedef enum {
+    HLS_SEGMENT_TS   = 0, // mpeg-ts segments
+    HLS_SEGMENT_FMP4 = 1, // fragmented mp4 segments with an init.mp4
+} HlsSegmentType;
+
+// called on the job thread for the input bytes of a job that has no input
+// file, returns the bytes written to buf, 0 at the end, < 0 on errors
+typedef int (*ReadFunc)(uintptr_t handle, uint8_t *buf, int size);
+
+// Options of an HlsJob, zero values keep what cmd() does
+typedef struct {
+    char OutputDir[512];   // playlist and segments, HLS_DEFAULT_OUTPUT_DIR when empty
+    double SegmentSeconds; // target segment duration, HLS_DEFAULT_SEGMENT_SECONDS when zero
+    int SegmentType;       // HlsSegmentType, HLS_SEGMENT_TS when zero
+    ProbeOptions Probe;    // probe budget and probe cache
+    JobLog Log;            // FFmpeg messages of the job, dropped when Log.Func is NULL
+
+    ReadFunc Read;         // reads the input instead of the input file when set, no seeking
+    uintptr_t ReadHandle;  // passed back to Read, a cgo.Handle from Go
+} HlsJobOptions;
+
+// A job handle: its options plus the state it keeps between runs. jobs
+// share nothing, so any number of them may run at once on separate threads;
+// one job runs one conversion at a time
+typedef struct HlsJob HlsJob;
+
+// An hls_job_run() for an Executor, the strings belong to the caller and
+// have to stay valid until the task is done
+typedef struct {
+    Task Task; // first, hls_job_task() is its Func
+    HlsJob *Job;
+    const char *InputFile;
+    const char *OutputFile;
+} HlsJobTask;
+
+HlsJob* hls_job_open(const HlsJobOptions *options);
+int hls_job_run(HlsJob *job, const char *input_file, const char *output_file);
+int hls_job_task(Task *task);
+JobReport* hls_job_report(HlsJob *job);
+void hls_job_close(HlsJob **job);
+
 int cmd(const char *input_file, const char *output_file);
+int cmd_probe(const char *input_file, const char *output_file, const ProbeOptions *probe, JobReport *report);
 
-#endif
\ No newline at end of file
+#endif
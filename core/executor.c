@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "executor.h"
+
+#include "libavutil/mem.h"
+#include "libavutil/error.h"
+#include "libavutil/common.h"
+
+#ifdef __linux__
+    #include <sys/eventfd.h>
+    #define EXECUTOR_HAVE_EVENTFD 1
+#endif
+
+struct Executor {
+    pthread_t threads[EXECUTOR_MAX_WORKERS];
+    int nb_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stopping;
+
+    Task *head; // submitted, not picked up yet
+    Task *tail;
+    int queued;
+    int queue_size; // bound of queued, unbounded when <= 0
+
+    TaskEvent *events; // not polled yet
+    int nb_events;
+    int events_capacity;
+
+    int read_fd;  // readable while events are waiting
+    int write_fd; // the same eventfd, or the write end of a pipe
+};
+
+/*
+this function queues the event of task and wakes the poller. the counter of
+the eventfd (or the bytes in the pipe) only tells that there is something
+to poll, the events themselves stay in executor->events
+*/
+static void push_event(Executor *executor, Task *task, TaskState state) {
+
+    pthread_mutex_lock(&executor->lock);
+
+    if (executor->nb_events == executor->events_capacity) {
+
+        int capacity = FFMAX(EXECUTOR_POLL_MAX, executor->events_capacity * 2);
+        TaskEvent *events = av_realloc_array(executor->events, capacity, sizeof(TaskEvent));
+
+        // the poller would never hear of the task, so this is fatal
+        if (events == NULL) {
+            fprintf(stderr, "Error: Could not queue a task event.\n");
+            abort();
+        }
+
+        executor->events = events;
+        executor->events_capacity = capacity;
+    }
+
+    executor->events[executor->nb_events++] = (TaskEvent){ .Task = task, .State = state };
+
+    pthread_mutex_unlock(&executor->lock);
+
+    uint64_t one = 1;
+    ssize_t written;
+
+    do {
+        written = write(executor->write_fd, &one, sizeof(one));
+    } while (written < 0 && errno == EINTR);
+}
+
+static void* executor_worker(void *arg) {
+
+    Executor *executor = (Executor*)arg;
+
+    for (;;) {
+
+        pthread_mutex_lock(&executor->lock);
+
+        while (executor->head == NULL && !executor->stopping) {
+            pthread_cond_wait(&executor->cond, &executor->lock);
+        }
+
+        Task *task = executor->head;
+        {
+            if (task == NULL) {
+                pthread_mutex_unlock(&executor->lock);
+                return NULL;
+            }
+
+            executor->head = task->next;
+            executor->queued--;
+
+            if (executor->head == NULL) {
+                executor->tail = NULL;
+            }
+        }
+
+        pthread_mutex_unlock(&executor->lock);
+
+        push_event(executor, task, TASK_STARTED);
+
+        task->Result = task->Func(task);
+
+        push_event(executor, task, TASK_DONE);
+    }
+}
+
+static int open_event_fd(Executor *executor) {
+
+#ifdef EXECUTOR_HAVE_EVENTFD
+    executor->read_fd = executor->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return executor->read_fd < 0 ? AVERROR(errno) : 0;
+#else
+    int fds[2];
+    {
+        if (pipe(fds) != 0) {
+            return AVERROR(errno);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    executor->read_fd = fds[0];
+    executor->write_fd = fds[1];
+
+    return 0;
+#endif
+}
+
+/*
+this function starts workers native threads, clamped to
+EXECUTOR_MAX_WORKERS. queue_size bounds the tasks waiting for a worker,
+executor_submit() fails past it; <= 0 queues without bound
+*/
+Executor* executor_open(int workers, int queue_size) {
+
+    Executor *executor = av_mallocz(sizeof(*executor));
+    {
+        if (executor == NULL) {
+            return NULL;
+        }
+
+        executor->queue_size = queue_size;
+        executor->read_fd = executor->write_fd = -1;
+
+        pthread_mutex_init(&executor->lock, NULL);
+        pthread_cond_init(&executor->cond, NULL);
+    }
+
+    if (open_event_fd(executor) < 0) {
+        fprintf(stderr, "Error: Could not create the executor event descriptor.\n");
+        executor_close(&executor);
+        return NULL;
+    }
+
+    workers = FFMAX(1, FFMIN(workers, EXECUTOR_MAX_WORKERS));
+
+    for (int i = 0; i < workers; i++) {
+
+        if (pthread_create(&executor->threads[i], NULL, executor_worker, executor) != 0) {
+            fprintf(stderr, "Error: Could not start executor thread.\n");
+            executor_close(&executor);
+            return NULL;
+        }
+
+        executor->nb_threads++;
+    }
+
+    return executor;
+}
+
+// non blocking, readable while executor_poll() has events to return; owned
+// by the executor, dup() it to keep it elsewhere
+int executor_fd(const Executor *executor) {
+    return executor->read_fd;
+}
+
+/*
+this function queues task for the next free worker without blocking,
+AVERROR(EAGAIN) when queue_size tasks are already waiting
+*/
+int executor_submit(Executor *executor, Task *task) {
+
+    task->next = NULL;
+    task->Result = 0;
+
+    pthread_mutex_lock(&executor->lock);
+
+    if (executor->stopping || (executor->queue_size > 0 && executor->queued >= executor->queue_size)) {
+        pthread_mutex_unlock(&executor->lock);
+        return AVERROR(EAGAIN);
+    }
+
+    if (executor->tail) {
+        executor->tail->next = task;
+    } else {
+        executor->head = task;
+    }
+
+    executor->tail = task;
+    executor->queued++;
+
+    pthread_cond_signal(&executor->cond);
+    pthread_mutex_unlock(&executor->lock);
+
+    return 0;
+}
+
+/*
+this function moves up to max waiting events into events, oldest first,
+and returns how many. the descriptor is drained first, so an event pushed
+while this runs makes it readable again
+*/
+int executor_poll(Executor *executor, TaskEvent *events, int max) {
+
+    uint64_t counter[8];
+    while (read(executor->read_fd, counter, sizeof(counter)) > 0) {
+    }
+
+    pthread_mutex_lock(&executor->lock);
+
+    int count = FFMIN(max, executor->nb_events);
+    {
+        memcpy(events, executor->events, count * sizeof(TaskEvent));
+        memmove(executor->events, executor->events + count, (executor->nb_events - count) * sizeof(TaskEvent));
+
+        executor->nb_events -= count;
+    }
+
+    int left = executor->nb_events;
+
+    pthread_mutex_unlock(&executor->lock);
+
+    // what was left over still needs a wakeup
+    if (left > 0) {
+
+        uint64_t one = 1;
+        ssize_t written = write(executor->write_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    return count;
+}
+
+/*
+this function stops accepting tasks, lets the workers run the ones still
+queued and joins them. the events of those tasks can still be polled
+*/
+void executor_stop(Executor *executor) {
+
+    pthread_mutex_lock(&executor->lock);
+    executor->stopping = 1;
+    pthread_cond_broadcast(&executor->cond);
+    pthread_mutex_unlock(&executor->lock);
+
+    for (int i = 0; i < executor->nb_threads; i++) {
+        pthread_join(executor->threads[i], NULL);
+    }
+
+    executor->nb_threads = 0;
+}
+
+// executor_stop() and frees the executor, events nobody polled are dropped
+void executor_close(Executor **executor) {
+
+    Executor *e = *executor;
+    {
+        if (e == NULL) {
+            return;
+        }
+    }
+
+    executor_stop(e);
+
+    if (e->read_fd >= 0) {
+        close(e->read_fd);
+    }
+
+    if (e->write_fd >= 0 && e->write_fd != e->read_fd) {
+        close(e->write_fd);
+    }
+
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->cond);
+
+    av_freep(&e->events);
+    av_freep(executor);
+}
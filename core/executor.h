@@ -0,0 +1,50 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdint.h>
+
+// native threads an Executor may start
+#define EXECUTOR_MAX_WORKERS 256
+
+// events handed back by one executor_poll() call at most
+#define EXECUTOR_POLL_MAX 64
+
+struct Task;
+
+// runs a task on an executor thread, the result ends up in Task.Result
+typedef int (*TaskFunc)(struct Task *task);
+
+// What happened to a task, in the order executor_poll() reports it
+typedef enum {
+    TASK_STARTED = 1, // a worker picked the task up
+    TASK_DONE    = 2, // Func returned, Result is set
+} TaskState;
+
+// A unit of work owned by the caller, usually the first member of a larger
+// struct that carries the arguments of Func. it has to stay valid until its
+// TASK_DONE event was polled
+typedef struct Task {
+    TaskFunc Func;
+    uintptr_t Handle;  // passed back in the events, a cgo.Handle from Go
+    int Result;        // of Func, set before TASK_DONE
+    struct Task *next; // queue link, owned by the executor
+} Task;
+
+typedef struct {
+    Task *Task;
+    int State; // TaskState
+} TaskEvent;
+
+// A fixed pool of native worker threads fed by a submission queue. the
+// events of the tasks are collected for executor_poll() and announced on
+// a file descriptor, so the submitter waits without a thread of its own
+typedef struct Executor Executor;
+
+Executor* executor_open(int workers, int queue_size);
+int executor_fd(const Executor *executor);
+int executor_submit(Executor *executor, Task *task);
+int executor_poll(Executor *executor, TaskEvent *events, int max);
+void executor_stop(Executor *executor);
+void executor_close(Executor **executor);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "mapped.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// one reader of a mapped input, the opaque of its AVIOContext
+typedef struct {
+    const MappedInput *input;
+    int64_t pos;
+} MappedReader;
+
+/*
+this function maps path read only for readers readers at once. a single
+demuxer reads front to back, so the kernel is told to read ahead
+aggressively and to drop pages behind; several readers (the chunk workers
+and the audio reader of gop.c) are at different places of the file and
+read pages another one already passed, there the default readahead is
+kept. where the filesystem supports it the mapping also asks for huge
+pages, fewer tlb misses on multi-GB sources. returns < 0 (and input->data
+NULL) when the file can not be mapped, empty files and windows included,
+the caller then opens it the usual way
+*/
+int map_input(MappedInput *input, const char *path, int readers) {
+
+    input->data = NULL;
+    input->size = 0;
+
+#ifdef _WIN32
+    return AVERROR(ENOSYS);
+#else
+    int fd = open(path, O_RDONLY);
+    {
+        if (fd < 0) {
+            return AVERROR(errno);
+        }
+    }
+
+    struct stat st;
+    {
+        if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX) {
+            close(fd);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    // the mapping keeps the file open, the descriptor is not needed past here
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    {
+        if (data == MAP_FAILED) {
+            return AVERROR(errno);
+        }
+    }
+
+    madvise(data, st.st_size, readers > 1 ? MADV_NORMAL : MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(data, st.st_size, MADV_HUGEPAGE);
+#endif
+
+    input->data = data;
+    input->size = st.st_size;
+
+    return 0;
+#endif
+}
+
+// the readers of the input have to be freed first
+void unmap_input(MappedInput *input) {
+
+#ifndef _WIN32
+    if (input->data) {
+        munmap((void*)input->data, input->size);
+    }
+#endif
+
+    input->data = NULL;
+    input->size = 0;
+}
+
+static int mapped_read(void *opaque, uint8_t *buf, int buf_size) {
+
+    MappedReader *reader = (MappedReader*)opaque;
+
+    int64_t left = reader->input->size - reader->pos;
+    {
+        if (left <= 0) {
+            return AVERROR_EOF;
+        }
+    }
+
+    int size = FFMIN(buf_size, left);
+
+    memcpy(buf, reader->input->data + reader->pos, size);
+    reader->pos += size;
+
+    return size;
+}
+
+static int64_t mapped_seek(void *opaque, int64_t offset, int whence) {
+
+    MappedReader *reader = (MappedReader*)opaque;
+
+    if (whence & AVSEEK_SIZE) {
+        return reader->input->size;
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: position = offset; break;
+        case SEEK_CUR: position = reader->pos + offset; break;
+        case SEEK_END: position = reader->input->size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    reader->pos = position;
+
+    return position;
+}
+
+/*
+this function returns a reader of the mapped input with a position of its
+own, it goes to the input context before avformat_open_input and is freed
+with free_mapped_io() after avformat_close_input. NULL when input is not
+mapped, the caller then opens the file by path
+*/
+AVIOContext* mapped_io(const MappedInput *input) {
+
+    if (input->data == NULL) {
+        return NULL;
+    }
+
+    MappedReader *reader = av_mallocz(sizeof(*reader));
+    uint8_t *io_buffer = av_malloc(MAPPED_IO_BUFFER_SIZE);
+    {
+        if (reader == NULL || io_buffer == NULL) {
+            av_free(reader);
+            av_free(io_buffer);
+            return NULL;
+        }
+
+        reader->input = input;
+    }
+
+    AVIOContext *pb = avio_alloc_context(io_buffer, MAPPED_IO_BUFFER_SIZE, 0, reader, mapped_read, NULL, mapped_seek);
+    {
+        if (pb == NULL) {
+            av_free(reader);
+            av_free(io_buffer);
+            return NULL;
+        }
+    }
+
+    return pb;
+}
+
+void free_mapped_io(AVIOContext **pb) {
+
+    if (*pb == NULL) {
+        return;
+    }
+
+    av_free((*pb)->opaque);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
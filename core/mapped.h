@@ -0,0 +1,25 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+
+// AVIOContext buffer of a mapped input, refilling it is a memcpy from the mapping
+#define MAPPED_IO_BUFFER_SIZE 65536
+
+// A local input file mapped into memory, owned by the caller. any number of
+// readers made by mapped_io() share the one mapping, and every job mapping
+// the same file shares its pages in the page cache
+typedef struct {
+    const uint8_t *data; // NULL when the file could not be mapped
+    int64_t size;
+} MappedInput;
+
+int map_input(MappedInput *input, const char *path, int readers);
+void unmap_input(MappedInput *input);
+
+AVIOContext* mapped_io(const MappedInput *input);
+void free_mapped_io(AVIOContext **pb);
+
+#endif
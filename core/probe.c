@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "probe.h"
+
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libavutil/hash.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/error.h"
+
+#ifdef _WIN32
+    #include <direct.h>  // For _mkdir on Windows
+#endif
+
+#define PROBE_CACHE_MAGIC   0x43475043 // "CGPC"
+#define PROBE_CACHE_VERSION 2
+
+/*
+the file the keyframe index of an entry was scanned from. the cache key
+only samples the head and the tail of the input, the keyframes depend on
+all of it, so they are served for the very same file only
+*/
+typedef struct {
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t ino;
+    uint64_t dev;
+} ProbeFileStamp;
+
+/*
+the cache entry is written as a ProbeCacheHeader, then nb_streams times a
+ProbeCacheStream followed by its extradata, then the keyframe pts of the
+video stream. the entries are only ever read back on the machine that
+wrote them, so the structs are written as they are laid out in memory
+*/
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t stream_size;
+    int32_t nb_streams;
+    int32_t video_index;
+    int32_t nb_keyframes;
+    int64_t duration;
+    int64_t start_time;
+    int64_t bit_rate;
+    ProbeFileStamp keyframes_file; // set with nb_keyframes
+} ProbeCacheHeader;
+
+typedef struct {
+    AVRational time_base;
+    AVRational avg_frame_rate;
+    AVRational r_frame_rate;
+    int64_t duration;
+    int64_t start_time;
+
+    int32_t codec_type;
+    int32_t codec_id;
+    uint32_t codec_tag;
+    int32_t format;
+    int64_t bit_rate;
+    int32_t bits_per_coded_sample;
+    int32_t bits_per_raw_sample;
+    int32_t profile;
+    int32_t level;
+
+    int32_t width;
+    int32_t height;
+    AVRational sample_aspect_ratio;
+    int32_t field_order;
+    int32_t color_range;
+    int32_t color_primaries;
+    int32_t color_trc;
+    int32_t color_space;
+    int32_t chroma_location;
+    int32_t video_delay;
+
+    int32_t channel_order;
+    int32_t nb_channels;
+    uint64_t channel_mask;
+    int32_t sample_rate;
+    int32_t block_align;
+    int32_t frame_size;
+    int32_t initial_padding;
+    int32_t trailing_padding;
+    int32_t seek_preroll;
+
+    int32_t extradata_size;
+} ProbeCacheStream;
+
+typedef struct {
+    ProbeCacheHeader header;
+    ProbeCacheStream *streams;
+    uint8_t **extradata;
+    int64_t *keyframes;
+} ProbeCacheEntry;
+
+/*
+this function sets probesize and analyzeduration for avformat_open_input
+*/
+void apply_probe_budget(AVDictionary **format_options, const ProbeOptions *options) {
+
+    if (options == NULL) {
+        return;
+    }
+
+    if (options->ProbeSize > 0) {
+        av_dict_set_int(format_options, "probesize", FFMAX(options->ProbeSize, 32), 0);
+    }
+
+    if (options->AnalyzeDuration > 0) {
+        av_dict_set_int(format_options, "analyzeduration", options->AnalyzeDuration, 0);
+    }
+}
+
+static int make_cache_dir(const char *path) {
+
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    for (char *p = dir + 1; ; p++) {
+
+        if (*p != '/' && *p != '\0') {
+            continue;
+        }
+
+        char c = *p;
+        *p = '\0';
+
+        #ifdef _WIN32
+            int result = _mkdir(dir);
+        #else
+            int result = mkdir(dir, 0777);
+        #endif
+
+        if (result < 0 && errno != EEXIST) {
+            return -1;
+        }
+
+        *p = c;
+
+        if (c == '\0') {
+            return 0;
+        }
+    }
+}
+
+// this function reads the size, mtime and inode of input_file into stamp
+static int file_stamp(const char *input_file, ProbeFileStamp *stamp) {
+
+    struct stat st;
+    {
+        if (stat(input_file, &st) != 0) {
+            return -1;
+        }
+    }
+
+    memset(stamp, 0, sizeof(*stamp));
+
+    stamp->size = st.st_size;
+    stamp->mtime_sec = st.st_mtime;
+    stamp->ino = st.st_ino;
+    stamp->dev = st.st_dev;
+
+#if defined(__APPLE__)
+    stamp->mtime_nsec = st.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+    return 0;
+}
+
+/*
+this function builds the cache key of the input
+hashing a whole multi gigabyte upload would cost more than the probe it
+saves, so the key is the sha256 of the file size plus its first and last
+PROBE_CACHE_SAMPLE_SIZE bytes; containers keep their headers and indexes
+there, which is exactly what the cached stream info is derived from.
+the keyframe index is not, it is only served with a matching file stamp
+*/
+static int probe_cache_path(const ProbeOptions *options, const char *input_file, char *path, int path_size) {
+
+    if (options == NULL || options->CacheDir[0] == '\0' || input_file == NULL) {
+        return -1;
+    }
+
+    FILE *file = fopen(input_file, "rb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+    }
+
+    struct AVHashContext *hash = NULL;
+    uint8_t *sample = av_malloc(PROBE_CACHE_SAMPLE_SIZE);
+
+    if (sample == NULL || av_hash_alloc(&hash, "SHA256") < 0) {
+        av_free(sample);
+        fclose(file);
+        return -1;
+    }
+
+    av_hash_init(hash);
+
+    fseeko(file, 0, SEEK_END);
+    int64_t size = ftello(file);
+    av_hash_update(hash, (const uint8_t*)&size, sizeof(size));
+
+    // the head, then the tail unless the head already covered the whole file
+    fseeko(file, 0, SEEK_SET);
+    size_t n = fread(sample, 1, PROBE_CACHE_SAMPLE_SIZE, file);
+    av_hash_update(hash, sample, n);
+
+    if (size > PROBE_CACHE_SAMPLE_SIZE) {
+        fseeko(file, FFMAX(size - PROBE_CACHE_SAMPLE_SIZE, PROBE_CACHE_SAMPLE_SIZE), SEEK_SET);
+        n = fread(sample, 1, PROBE_CACHE_SAMPLE_SIZE, file);
+        av_hash_update(hash, sample, n);
+    }
+
+    uint8_t key[AV_HASH_MAX_SIZE * 2 + 1];
+    av_hash_final_hex(hash, key, sizeof(key));
+
+    av_hash_freep(&hash);
+    av_free(sample);
+    fclose(file);
+
+    snprintf(path, path_size, "%s/%s.probe", options->CacheDir, (const char*)key);
+
+    return 0;
+}
+
+static void free_cache_entry(ProbeCacheEntry *entry) {
+
+    for (int i = 0; entry->extradata && i < entry->header.nb_streams; i++) {
+        av_freep(&entry->extradata[i]);
+    }
+
+    av_freep(&entry->extradata);
+    av_freep(&entry->streams);
+    av_freep(&entry->keyframes);
+}
+
+static int read_cache_entry(const char *path, ProbeCacheEntry *entry) {
+
+    memset(entry, 0, sizeof(*entry));
+
+    FILE *file = fopen(path, "rb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+    }
+
+    ProbeCacheHeader *header = &entry->header;
+
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        header->magic != PROBE_CACHE_MAGIC ||
+        header->version != PROBE_CACHE_VERSION ||
+        header->header_size != sizeof(ProbeCacheHeader) ||
+        header->stream_size != sizeof(ProbeCacheStream) ||
+        header->nb_streams <= 0 || header->nb_keyframes < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    entry->streams = av_calloc(header->nb_streams, sizeof(*entry->streams));
+    entry->extradata = av_calloc(header->nb_streams, sizeof(*entry->extradata));
+    {
+        if (entry->streams == NULL || entry->extradata == NULL) {
+            free_cache_entry(entry);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < header->nb_streams; i++) {
+
+        ProbeCacheStream *stream = &entry->streams[i];
+
+        if (fread(stream, sizeof(*stream), 1, file) != 1 || stream->extradata_size < 0) {
+            free_cache_entry(entry);
+            fclose(file);
+            return -1;
+        }
+
+        if (stream->extradata_size > 0) {
+
+            entry->extradata[i] = av_mallocz(stream->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+            if (entry->extradata[i] == NULL || fread(entry->extradata[i], stream->extradata_size, 1, file) != 1) {
+                free_cache_entry(entry);
+                fclose(file);
+                return -1;
+            }
+        }
+    }
+
+    if (header->nb_keyframes > 0) {
+
+        entry->keyframes = av_malloc_array(header->nb_keyframes, sizeof(int64_t));
+
+        if (entry->keyframes == NULL || fread(entry->keyframes, sizeof(int64_t), header->nb_keyframes, file) != (size_t)header->nb_keyframes) {
+            free_cache_entry(entry);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/*
+this function writes the entry to a temporary file and renames it over the
+cache file, so concurrent jobs on the same input never read a partial entry
+*/
+static int write_cache_entry(const ProbeOptions *options, const char *path, const ProbeCacheEntry *entry) {
+
+    static int counter;
+
+    if (make_cache_dir(options->CacheDir) < 0) {
+        return -1;
+    }
+
+    char temp_path[1100];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.%d.tmp", path, (int)getpid(), __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+
+    FILE *file = fopen(temp_path, "wb");
+    {
+        if (file == NULL) {
+            return -1;
+        }
+    }
+
+    int ok = fwrite(&entry->header, sizeof(entry->header), 1, file) == 1;
+
+    for (int i = 0; ok && i < entry->header.nb_streams; i++) {
+
+        ok = fwrite(&entry->streams[i], sizeof(ProbeCacheStream), 1, file) == 1;
+
+        if (ok && entry->streams[i].extradata_size > 0) {
+            ok = fwrite(entry->extradata[i], entry->streams[i].extradata_size, 1, file) == 1;
+        }
+    }
+
+    if (ok && entry->header.nb_keyframes > 0) {
+        ok = fwrite(entry->keyframes, sizeof(int64_t), entry->header.nb_keyframes, file) == (size_t)entry->header.nb_keyframes;
+    }
+
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+
+    if (!ok || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+this function stores the probed stream layout and codec parameters
+the extradata pointers are borrowed from input_ctx
+*/
+static void store_stream_info(const ProbeOptions *options, const char *path, AVFormatContext *input_ctx) {
+
+    ProbeCacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    entry.header.magic = PROBE_CACHE_MAGIC;
+    entry.header.version = PROBE_CACHE_VERSION;
+    entry.header.header_size = sizeof(ProbeCacheHeader);
+    entry.header.stream_size = sizeof(ProbeCacheStream);
+    entry.header.nb_streams = input_ctx->nb_streams;
+    entry.header.video_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    entry.header.duration = input_ctx->duration;
+    entry.header.start_time = input_ctx->start_time;
+    entry.header.bit_rate = input_ctx->bit_rate;
+
+    entry.streams = av_calloc(input_ctx->nb_streams, sizeof(*entry.streams));
+    entry.extradata = av_calloc(input_ctx->nb_streams, sizeof(*entry.extradata));
+    {
+        if (entry.streams == NULL || entry.extradata == NULL || input_ctx->nb_streams == 0) {
+            av_freep(&entry.streams);
+            av_freep(&entry.extradata);
+            return;
+        }
+    }
+
+    for (unsigned int i = 0; i < input_ctx->nb_streams; i++) {
+
+        AVStream *in_stream = input_ctx->streams[i];
+        AVCodecParameters *par = in_stream->codecpar;
+        ProbeCacheStream *stream = &entry.streams[i];
+
+        stream->time_base = in_stream->time_base;
+        stream->avg_frame_rate = in_stream->avg_frame_rate;
+        stream->r_frame_rate = in_stream->r_frame_rate;
+        stream->duration = in_stream->duration;
+        stream->start_time = in_stream->start_time;
+
+        stream->codec_type = par->codec_type;
+        stream->codec_id = par->codec_id;
+        stream->codec_tag = par->codec_tag;
+        stream->format = par->format;
+        stream->bit_rate = par->bit_rate;
+        stream->bits_per_coded_sample = par->bits_per_coded_sample;
+        stream->bits_per_raw_sample = par->bits_per_raw_sample;
+        stream->profile = par->profile;
+        stream->level = par->level;
+
+        stream->width = par->width;
+        stream->height = par->height;
+        stream->sample_aspect_ratio = par->sample_aspect_ratio;
+        stream->field_order = par->field_order;
+        stream->color_range = par->color_range;
+        stream->color_primaries = par->color_primaries;
+        stream->color_trc = par->color_trc;
+        stream->color_space = par->color_space;
+        stream->chroma_location = par->chroma_location;
+        stream->video_delay = par->video_delay;
+
+        stream->channel_order = par->ch_layout.order;
+        stream->nb_channels = par->ch_layout.nb_channels;
+        stream->channel_mask = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+        stream->sample_rate = par->sample_rate;
+        stream->block_align = par->block_align;
+        stream->frame_size = par->frame_size;
+        stream->initial_padding = par->initial_padding;
+        stream->trailing_padding = par->trailing_padding;
+        stream->seek_preroll = par->seek_preroll;
+
+        stream->extradata_size = par->extradata_size;
+        entry.extradata[i] = par->extradata;
+    }
+
+    write_cache_entry(options, path, &entry);
+
+    av_freep(&entry.streams);
+    av_freep(&entry.extradata);
+}
+
+/*
+this function fills the streams created by avformat_open_input from a
+cache entry instead of running avformat_find_stream_info
+it fails when the demuxer did not create the same streams, the caller
+then probes as usual
+*/
+static int apply_stream_info(AVFormatContext *input_ctx, const ProbeCacheEntry *entry) {
+
+    if ((int)input_ctx->nb_streams != entry->header.nb_streams) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < input_ctx->nb_streams; i++) {
+
+        AVCodecParameters *par = input_ctx->streams[i]->codecpar;
+        const ProbeCacheStream *stream = &entry->streams[i];
+
+        if (par->codec_type != stream->codec_type || (par->codec_id != AV_CODEC_ID_NONE && (int32_t)par->codec_id != stream->codec_id)) {
+            return -1;
+        }
+    }
+
+    for (unsigned int i = 0; i < input_ctx->nb_streams; i++) {
+
+        AVStream *in_stream = input_ctx->streams[i];
+        AVCodecParameters *par = in_stream->codecpar;
+        const ProbeCacheStream *stream = &entry->streams[i];
+
+        in_stream->avg_frame_rate = stream->avg_frame_rate;
+        in_stream->r_frame_rate = stream->r_frame_rate;
+
+        if (in_stream->duration == AV_NOPTS_VALUE) {
+            in_stream->duration = stream->duration;
+        }
+
+        if (in_stream->start_time == AV_NOPTS_VALUE) {
+            in_stream->start_time = stream->start_time;
+        }
+
+        par->codec_id = stream->codec_id;
+        par->codec_tag = stream->codec_tag;
+        par->format = stream->format;
+        par->bit_rate = stream->bit_rate;
+        par->bits_per_coded_sample = stream->bits_per_coded_sample;
+        par->bits_per_raw_sample = stream->bits_per_raw_sample;
+        par->profile = stream->profile;
+        par->level = stream->level;
+
+        par->width = stream->width;
+        par->height = stream->height;
+        par->sample_aspect_ratio = stream->sample_aspect_ratio;
+        par->field_order = stream->field_order;
+        par->color_range = stream->color_range;
+        par->color_primaries = stream->color_primaries;
+        par->color_trc = stream->color_trc;
+        par->color_space = stream->color_space;
+        par->chroma_location = stream->chroma_location;
+        par->video_delay = stream->video_delay;
+
+        if (stream->nb_channels > 0) {
+
+            av_channel_layout_uninit(&par->ch_layout);
+
+            if (stream->channel_order == AV_CHANNEL_ORDER_NATIVE) {
+                av_channel_layout_from_mask(&par->ch_layout, stream->channel_mask);
+            } else {
+                av_channel_layout_default(&par->ch_layout, stream->nb_channels);
+            }
+        }
+
+        par->sample_rate = stream->sample_rate;
+        par->block_align = stream->block_align;
+        par->frame_size = stream->frame_size;
+        par->initial_padding = stream->initial_padding;
+        par->trailing_padding = stream->trailing_padding;
+        par->seek_preroll = stream->seek_preroll;
+
+        // headers like avcC come from the container, only fill in what the parsers would have found
+        if (par->extradata_size == 0 && stream->extradata_size > 0) {
+
+            par->extradata = av_mallocz(stream->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            {
+                if (par->extradata == NULL) {
+                    return AVERROR(ENOMEM);
+                }
+            }
+
+            memcpy(par->extradata, entry->extradata[i], stream->extradata_size);
+            par->extradata_size = stream->extradata_size;
+        }
+    }
+
+    if (input_ctx->duration == AV_NOPTS_VALUE) {
+        input_ctx->duration = entry->header.duration;
+    }
+
+    if (input_ctx->start_time == AV_NOPTS_VALUE) {
+        input_ctx->start_time = entry->header.start_time;
+    }
+
+    if (input_ctx->bit_rate <= 0) {
+        input_ctx->bit_rate = entry->header.bit_rate;
+    }
+
+    return 0;
+}
+
+/*
+this function opens the input file like open_input_file() but with the
+probe budget of the job. when the probe cache has an entry for the same
+content avformat_find_stream_info is skipped, otherwise the probed stream
+info is stored for the next job on the same source
+*/
+AVFormatContext* open_input_probed(const char *input_file, const ProbeOptions *options, JobReport *report) {
+    return open_input_probed_io(input_file, NULL, options, report);
+}
+
+/*
+this function is open_input_probed() reading the input through pb when it
+is set, the caller frees pb after avformat_close_input, also when the
+input could not be opened
+*/
+AVFormatContext* open_input_probed_io(const char *input_file, AVIOContext *pb, const ProbeOptions *options, JobReport *report) {
+
+    StageClock clock;
+    stage_begin(&clock);
+
+    char cache_path[1024];
+    int cached = probe_cache_path(options, input_file, cache_path, sizeof(cache_path)) == 0;
+
+    AVDictionary *format_options = NULL;
+    apply_probe_budget(&format_options, options);
+
+    AVFormatContext *input_ctx = NULL;
+
+    if (pb) {
+
+        input_ctx = avformat_alloc_context();
+        {
+            if (input_ctx == NULL) {
+                av_dict_free(&format_options);
+                return NULL;
+            }
+        }
+
+        input_ctx->pb = pb;
+        input_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    int result = avformat_open_input(&input_ctx, input_file, NULL, &format_options);
+    {
+        av_dict_free(&format_options);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: Could not open input file '%s'.\n", input_file);
+            return NULL;
+        }
+    }
+
+    ProbeCacheEntry entry;
+    int hit = cached && read_cache_entry(cache_path, &entry) == 0;
+    {
+        if (hit) {
+            hit = apply_stream_info(input_ctx, &entry) == 0;
+            free_cache_entry(&entry);
+        }
+    }
+
+    if (!hit) {
+
+        result = avformat_find_stream_info(input_ctx, NULL);
+        {
+            if (result < 0) {
+                fprintf(stderr, "Error: Could not find stream info in input file.\n");
+                avformat_close_input(&input_ctx);
+                return NULL;
+            }
+        }
+
+        if (cached) {
+            store_stream_info(options, cache_path, input_ctx);
+        }
+    }
+
+    if (report) {
+        report->CacheHit = hit;
+    }
+
+    report_input(report, input_ctx);
+    stage_end(report, JOB_STAGE_PROBE, &clock);
+
+    return input_ctx;
+}
+
+/*
+this function returns the keyframe index cached for the input
+returns -1 when the cache has no keyframes for it, or when they were
+scanned from another file that only shares the sampled head and tail
+*/
+int probe_cache_keyframes(const ProbeOptions *options, const char *input_file, int64_t **keyframes, int *nb_keyframes) {
+
+    char cache_path[1024];
+    ProbeCacheEntry entry;
+
+    if (probe_cache_path(options, input_file, cache_path, sizeof(cache_path)) < 0 || read_cache_entry(cache_path, &entry) < 0) {
+        return -1;
+    }
+
+    ProbeFileStamp stamp;
+
+    if (entry.header.nb_keyframes == 0 || file_stamp(input_file, &stamp) < 0 || memcmp(&stamp, &entry.header.keyframes_file, sizeof(stamp)) != 0) {
+        free_cache_entry(&entry);
+        return -1;
+    }
+
+    *keyframes = entry.keyframes;
+    *nb_keyframes = entry.header.nb_keyframes;
+    entry.keyframes = NULL;
+
+    free_cache_entry(&entry);
+
+    return 0;
+}
+
+/*
+this function adds the keyframe index to the cache entry of the input,
+stamped with the file it was scanned from
+the entry must already exist, open_input_probed() creates it
+*/
+int probe_cache_store_keyframes(const ProbeOptions *options, const char *input_file, const int64_t *keyframes, int nb_keyframes) {
+
+    char cache_path[1024];
+    ProbeCacheEntry entry;
+
+    if (probe_cache_path(options, input_file, cache_path, sizeof(cache_path)) < 0 || read_cache_entry(cache_path, &entry) < 0) {
+        return -1;
+    }
+
+    if (file_stamp(input_file, &entry.header.keyframes_file) < 0) {
+        free_cache_entry(&entry);
+        return -1;
+    }
+
+    av_freep(&entry.keyframes);
+    entry.keyframes = (int64_t*)keyframes;
+    entry.header.nb_keyframes = nb_keyframes;
+
+    int result = write_cache_entry(options, cache_path, &entry);
+
+    entry.keyframes = NULL;
+    free_cache_entry(&entry);
+
+    return result;
+}
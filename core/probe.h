@@ -0,0 +1,26 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+#include "report.h"
+
+// bytes hashed from the start and from the end of the input for the cache key
+#define PROBE_CACHE_SAMPLE_SIZE (1 << 20)
+
+// Per-job probe budget, zero values keep the FFmpeg defaults
+typedef struct {
+    int64_t ProbeSize;       // bytes read while probing (FFmpeg default 5MB)
+    int64_t AnalyzeDuration; // microseconds of media analyzed (FFmpeg default 5s)
+    char CacheDir[512];      // probe cache directory, empty disables the cache
+} ProbeOptions;
+
+AVFormatContext* open_input_probed(const char *input_file, const ProbeOptions *options, JobReport *report);
+AVFormatContext* open_input_probed_io(const char *input_file, AVIOContext *pb, const ProbeOptions *options, JobReport *report);
+void apply_probe_budget(AVDictionary **format_options, const ProbeOptions *options);
+
+int probe_cache_keyframes(const ProbeOptions *options, const char *input_file, int64_t **keyframes, int *nb_keyframes);
+int probe_cache_store_keyframes(const ProbeOptions *options, const char *input_file, const int64_t *keyframes, int nb_keyframes);
+
+#endif
@@ -0,0 +1,272 @@
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "report.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+
+/*
+the counters of a report are shared by the branches of an abr ladder and by
+the chunk workers of a gop transcode, so every update is an atomic add
+*/
+#define REPORT_ADD(field, value) __atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+
+// microseconds between two calls of JobReport.Progress
+#define REPORT_PROGRESS_INTERVAL 250000
+
+void job_report_init(JobReport *report) {
+
+    ProgressFunc progress = report->Progress;
+    LatencyFunc latency = report->Latency;
+    uintptr_t progress_handle = report->ProgressHandle;
+
+    memset(report, 0, sizeof(*report));
+    report->StartedAt = av_gettime_relative();
+    report->FirstSegmentMicros = -1;
+    report->DurationMicros = -1;
+    report->LatencyMicros = -1;
+
+    report->Progress = progress;
+    report->Latency = latency;
+    report->ProgressHandle = progress_handle;
+}
+
+/*
+this function returns the cpu time used by the calling thread so far
+*/
+int64_t thread_cpu_micros(void) {
+
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void stage_begin(StageClock *clock) {
+
+    clock->wall = av_gettime_relative();
+    clock->cpu = thread_cpu_micros();
+}
+
+/*
+this function adds the time since stage_begin() to the stage, the cpu time
+only covers the calling thread, worker threads report theirs with
+stage_add_cpu()
+*/
+void stage_end(JobReport *report, JobStage stage, const StageClock *clock) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    REPORT_ADD(report->Stages[stage].WallMicros, av_gettime_relative() - clock->wall);
+    REPORT_ADD(report->Stages[stage].CpuMicros, thread_cpu_micros() - clock->cpu);
+}
+
+void stage_add_cpu(JobReport *report, JobStage stage, int64_t cpu_micros) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    REPORT_ADD(report->Stages[stage].CpuMicros, cpu_micros);
+}
+
+void report_packet(JobReport *report, const AVPacket *packet) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    REPORT_ADD(report->Packets, 1);
+    REPORT_ADD(report->BytesIn, packet->size);
+
+    // the clock is only read for the first packet after a publish
+    if (report->Latency && __atomic_load_n(&report->PendingSince, __ATOMIC_RELAXED) == 0) {
+        int64_t none = 0;
+        __atomic_compare_exchange_n(&report->PendingSince, &none, av_gettime_relative(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+void report_output(JobReport *report, int64_t bytes, int segments) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    REPORT_ADD(report->BytesOut, bytes);
+    REPORT_ADD(report->Segments, segments);
+}
+
+/*
+this function records the duration and start time of the probed input,
+the progress of the job is measured against them
+*/
+void report_input(JobReport *report, const AVFormatContext *input_ctx) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    report->DurationMicros = input_ctx->duration != AV_NOPTS_VALUE ? input_ctx->duration : -1;
+    report->InputStart = input_ctx->start_time != AV_NOPTS_VALUE ? input_ctx->start_time : 0;
+}
+
+/*
+this function moves the progress to the dts of a packet that is written
+and calls Progress when REPORT_PROGRESS_INTERVAL passed since the last call
+only the thread that writes the packets in order calls it
+*/
+void report_progress(JobReport *report, int64_t dts, AVRational time_base) {
+
+    if (report == NULL || dts == AV_NOPTS_VALUE) {
+        return;
+    }
+
+    int64_t position = av_rescale_q(dts, time_base, AV_TIME_BASE_Q) - report->InputStart;
+
+    report->PositionMicros = FFMAX(report->PositionMicros, position);
+
+    int64_t now = av_gettime_relative();
+
+    if (report->Progress && now - report->ProgressAt >= REPORT_PROGRESS_INTERVAL) {
+        report->ProgressAt = now;
+        report->Progress(report->ProgressHandle, report->PositionMicros, report->DurationMicros);
+    }
+}
+
+/*
+this function records a file the hls muxer opens for writing
+the muxer rewrites the playlist every time a segment is finished, so the
+first time a playlist is opened the first segment is written, and every
+time the packets read since the last rewrite are published
+*/
+void report_hls_open(JobReport *report, const char *url) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    if (strstr(url, ".m3u8")) {
+
+        int64_t none = -1;
+        int64_t elapsed = av_gettime_relative() - report->StartedAt;
+
+        // renditions of an abr ladder share the report, the first one wins
+        __atomic_compare_exchange_n(&report->FirstSegmentMicros, &none, elapsed, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+        int64_t since = __atomic_exchange_n(&report->PendingSince, 0, __ATOMIC_RELAXED);
+
+        if (report->Latency && since > 0) {
+            report->LatencyMicros = av_gettime_relative() - since;
+            report->Latency(report->ProgressHandle, report->LatencyMicros);
+        }
+
+    } else if (av_match_ext(url, "ts,m4s")) {
+        report_output(report, 0, 1);
+    }
+}
+
+static int hls_io_open(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options) {
+
+    JobReport *report = (JobReport*)s->opaque;
+
+    if (flags & AVIO_FLAG_WRITE) {
+        report_hls_open(report, url);
+    }
+
+    return __atomic_load_n(&report->IoOpen, __ATOMIC_RELAXED)(s, pb, url, flags, options);
+}
+
+static int hls_io_close2(AVFormatContext *s, AVIOContext *pb) {
+
+    JobReport *report = (JobReport*)s->opaque;
+
+    if (pb && pb->write_flag) {
+        avio_flush(pb);
+        report_output(report, pb->bytes_written, 0);
+    }
+
+    return __atomic_load_n(&report->IoClose2, __ATOMIC_RELAXED)(s, pb);
+}
+
+/*
+this function records the time to first segment, the segments and the
+bytes written by an hls output into report, it has to be called before
+avformat_write_header
+the callbacks it wraps are kept in the report, not in globals: the outputs
+of concurrent jobs are set up on different threads. the branches of an abr
+ladder share a report, but every fresh output starts with the same
+libavformat defaults, so they all store the same pointers
+*/
+void watch_hls_output(AVFormatContext *output_ctx, JobReport *report) {
+
+    if (report == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&report->IoOpen, output_ctx->io_open, __ATOMIC_RELAXED);
+    __atomic_store_n(&report->IoClose2, output_ctx->io_close2, __ATOMIC_RELAXED);
+
+    output_ctx->opaque = report;
+    output_ctx->io_open = hls_io_open;
+    output_ctx->io_close2 = hls_io_close2;
+}
+
+/*
+libavutil has one log callback and one log level for the whole process, so
+jobs never set them. job_log_callback() is installed once instead and hands
+every message to the JobLog of the thread that logged it: the job thread
+and the worker threads a job starts attach their JobLog, messages of other
+threads (the codec's own worker threads included) are dropped
+*/
+static __thread const JobLog *thread_log;
+static __thread int thread_log_prefix = 1;
+
+static pthread_once_t job_log_once = PTHREAD_ONCE_INIT;
+
+static void job_log_callback(void *avcl, int level, const char *fmt, va_list vl) {
+
+    const JobLog *log = thread_log;
+    {
+        if (log == NULL || log->Func == NULL) {
+            return;
+        }
+
+        if ((level & 0xff) > (log->Level ? log->Level : AV_LOG_ERROR)) {
+            return;
+        }
+    }
+
+    char line[1024];
+    av_log_format_line2(avcl, level, fmt, vl, line, sizeof(line), &thread_log_prefix);
+
+    log->Func(log->Handle, level & 0xff, line);
+}
+
+static void install_job_log(void) {
+    av_log_set_callback(job_log_callback);
+}
+
+/*
+this function routes the FFmpeg messages of the calling thread to log until
+the next call, NULL drops them. log has to outlive the attachment, so a job
+detaches before it returns
+*/
+void job_log_attach(const JobLog *log) {
+
+    pthread_once(&job_log_once, install_job_log);
+
+    thread_log = log;
+    thread_log_prefix = 1;
+}
+
+// the JobLog of the calling thread, for the worker threads a job starts
+const JobLog* job_log_current(void) {
+    return thread_log;
+}
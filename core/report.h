@@ -0,0 +1,102 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+
+#include "libavformat/avformat.h"
+
+// Stages of a job, each one is timed separately in JobReport.Stages
+typedef enum {
+    JOB_STAGE_SPOOL   = 0, // copying the upload into the work dir
+    JOB_STAGE_PROBE   = 1, // opening and probing the input
+    JOB_STAGE_HEADER  = 2, // writing the output headers
+    JOB_STAGE_PACKETS = 3, // demuxing, transcoding and muxing the packets
+    JOB_STAGE_TRAILER = 4, // flushing the encoders and writing the trailers
+    JOB_STAGE_COUNT,
+} JobStage;
+
+// called on the job thread while the packets are written, at most every
+// REPORT_PROGRESS_INTERVAL. position and duration are microseconds of
+// media, duration is -1 when the input does not tell
+typedef void (*ProgressFunc)(uintptr_t handle, int64_t position, int64_t duration);
+
+// called by the thread that writes the playlist every time it publishes a
+// new segment, latency is the time in microseconds since about the oldest
+// packet in that segment was read from the input
+typedef void (*LatencyFunc)(uintptr_t handle, int64_t latency);
+
+// called on a job thread for every FFmpeg message of that job up to its
+// JobLog.Level, line is the formatted message with its [context] prefix
+typedef void (*LogFunc)(uintptr_t handle, int level, const char *line);
+
+// Where the FFmpeg messages of a job go, they are dropped when Func is NULL
+typedef struct {
+    LogFunc Func;
+    uintptr_t Handle; // passed back to Func, a cgo.Handle from Go
+    int Level;        // most verbose AV_LOG_* level passed to Func, AV_LOG_ERROR when zero
+} JobLog;
+
+// io callbacks of an output AVFormatContext, wrapped by watch_hls_output()
+typedef int (*IoOpenFunc)(AVFormatContext *s, AVIOContext **pb, const char *url, int flags, AVDictionary **options);
+typedef int (*IoCloseFunc)(AVFormatContext *s, AVIOContext *pb);
+
+typedef struct {
+    int64_t WallMicros; // elapsed time of the stage
+    int64_t CpuMicros;  // cpu time of the job threads, the codec's own worker threads are not included
+} StageTime;
+
+// Filled in by the job so its cost can be measured, read by Go once the job returned
+typedef struct {
+    int64_t StartedAt;          // av_gettime_relative() when the job started
+    int64_t FirstSegmentMicros; // job start until the first segment was finished, -1 if none
+    int CacheHit;               // 1 when the stream info came from the probe cache
+
+    StageTime Stages[JOB_STAGE_COUNT];
+
+    int64_t BytesIn;  // packet payload read from the input
+    int64_t BytesOut; // bytes written to the outputs, playlists included
+    int64_t Packets;  // packets read from the input
+    int64_t Segments; // media segments written
+
+    ProgressFunc Progress;    // set by the caller, kept by job_report_init()
+    uintptr_t ProgressHandle; // passed back to Progress, a cgo.Handle from Go
+    int64_t DurationMicros;   // duration of the input, -1 when unknown
+    int64_t PositionMicros;   // media written so far, from the start of the input
+    int64_t InputStart;       // start time of the input in AV_TIME_BASE
+    int64_t ProgressAt;       // av_gettime_relative() of the last Progress call
+
+    LatencyFunc Latency;      // set by the caller, kept by job_report_init(), called with ProgressHandle
+    int64_t PendingSince;     // av_gettime_relative() when the oldest packet not yet published was read, 0 when none
+    int64_t LatencyMicros;    // latency of the last published segment, -1 before the first
+
+    IoOpenFunc IoOpen;        // the io callbacks watch_hls_output() wrapped, the libavformat
+    IoCloseFunc IoClose2;     // defaults every output of the job starts with
+} JobReport;
+
+// Start of a stage, taken on the thread that runs it
+typedef struct {
+    int64_t wall;
+    int64_t cpu;
+} StageClock;
+
+void job_report_init(JobReport *report);
+
+int64_t thread_cpu_micros(void);
+
+void stage_begin(StageClock *clock);
+void stage_end(JobReport *report, JobStage stage, const StageClock *clock);
+void stage_add_cpu(JobReport *report, JobStage stage, int64_t cpu_micros);
+
+void report_packet(JobReport *report, const AVPacket *packet);
+void report_output(JobReport *report, int64_t bytes, int segments);
+void report_hls_open(JobReport *report, const char *url);
+
+void report_input(JobReport *report, const AVFormatContext *input_ctx);
+void report_progress(JobReport *report, int64_t dts, AVRational time_base);
+
+void watch_hls_output(AVFormatContext *output_ctx, JobReport *report);
+
+void job_log_attach(const JobLog *log);
+const JobLog* job_log_current(void);
+
+#endif
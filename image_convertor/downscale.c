@@ -0,0 +1,329 @@
+#include <stdint.h>
+#include <libavutil/frame.h>
+#include <libavutil/cpu.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/common.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define BOX_HAVE_AVX2 1
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
+    #define BOX_HAVE_NEON 1
+#endif
+
+/*
+Integer factor box downscale of yuvj420p pictures, the '<' shrink path of
+image.c for exact divisors. Every output pixel is the rounded mean of the
+factor x factor source pixels it covers. Rows are summed vertically into
+16 bit column sums, the column sums are then reduced horizontally.
+The avx2 and neon versions give the same bytes as the scalar one.
+*/
+
+// larger factors are left to swscale, the column sums must fit 16 bits
+#define BOX_MAX_FACTOR 8
+
+// column sums are padded so the simd loops can run past the plane width
+#define BOX_PADDING 32
+
+typedef struct {
+    void (*sum_rows)(const uint8_t **rows, int nb_rows, int width, uint16_t *sums);
+    void (*add_pairs)(const uint16_t *sums, int width, uint16_t *pairs);
+    void (*normalize)(const uint16_t *sums, int width, int factor, uint8_t *dst);
+} BoxKernels;
+
+// (sum + half) * reciprocal >> BOX_SHIFT is (sum + half) / factor^2 for every
+// sum of up to BOX_MAX_FACTOR^2 pixels and fits 32 bits, on every path
+#define BOX_SHIFT 20
+
+static inline uint32_t box_reciprocal(int factor) {
+    return ((1u << BOX_SHIFT) + factor * factor - 1) / (factor * factor);
+}
+
+static void sum_rows_c(const uint8_t **rows, int nb_rows, int width, uint16_t *sums) {
+
+    for (int x = 0; x < width; x++) {
+        sums[x] = rows[0][x];
+    }
+
+    for (int r = 1; r < nb_rows; r++) {
+        for (int x = 0; x < width; x++) {
+            sums[x] += rows[r][x];
+        }
+    }
+}
+
+static void add_pairs_c(const uint16_t *sums, int width, uint16_t *pairs) {
+
+    for (int x = 0; x < width; x++) {
+        pairs[x] = sums[2 * x] + sums[2 * x + 1];
+    }
+}
+
+static void normalize_c(const uint16_t *sums, int width, int factor, uint8_t *dst) {
+
+    uint32_t reciprocal = box_reciprocal(factor);
+    uint32_t half = factor * factor / 2;
+
+    for (int x = 0; x < width; x++) {
+        dst[x] = (uint8_t)(((sums[x] + half) * reciprocal) >> BOX_SHIFT);
+    }
+}
+
+#ifdef BOX_HAVE_AVX2
+
+__attribute__((target("avx2")))
+static void sum_rows_avx2(const uint8_t **rows, int nb_rows, int width, uint16_t *sums) {
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i sum = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[0] + x)));
+
+        for (int r = 1; r < nb_rows; r++) {
+            sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[r] + x))));
+        }
+
+        _mm256_storeu_si256((__m256i*)(sums + x), sum);
+    }
+
+    const uint8_t *tail[BOX_MAX_FACTOR];
+    for (int r = 0; r < nb_rows; r++) {
+        tail[r] = rows[r] + x;
+    }
+
+    sum_rows_c(tail, nb_rows, width - x, sums + x);
+}
+
+__attribute__((target("avx2")))
+static void add_pairs_avx2(const uint16_t *sums, int width, uint16_t *pairs) {
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    int x = 0;
+
+    // madd adds neighbouring 16 bit lanes into 32 bits, packus brings them back in lane order
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i a = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(sums + 2 * x)), ones);
+        __m256i b = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(sums + 2 * x + 16)), ones);
+
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+
+        _mm256_storeu_si256((__m256i*)(pairs + x), packed);
+    }
+
+    add_pairs_c(sums + 2 * x, width - x, pairs + x);
+}
+
+__attribute__((target("avx2")))
+static void normalize_avx2(const uint16_t *sums, int width, int factor, uint8_t *dst) {
+
+    const __m256i reciprocal = _mm256_set1_epi32((int)box_reciprocal(factor));
+    const __m256i half = _mm256_set1_epi32(factor * factor / 2);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(sums + x)));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(sums + x + 8)));
+
+        lo = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_add_epi32(lo, half), reciprocal), BOX_SHIFT);
+        hi = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_add_epi32(hi, half), reciprocal), BOX_SHIFT);
+
+        // 32 -> 16 -> 8 bits, the permute undoes the per lane interleave of packus
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+
+        _mm_storeu_si128((__m128i*)(dst + x), bytes);
+    }
+
+    normalize_c(sums + x, width - x, factor, dst + x);
+}
+
+#endif
+
+#ifdef BOX_HAVE_NEON
+
+static void sum_rows_neon(const uint8_t **rows, int nb_rows, int width, uint16_t *sums) {
+
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+
+        uint8x16_t first = vld1q_u8(rows[0] + x);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(first));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(first));
+
+        for (int r = 1; r < nb_rows; r++) {
+            uint8x16_t row = vld1q_u8(rows[r] + x);
+            lo = vaddw_u8(lo, vget_low_u8(row));
+            hi = vaddw_u8(hi, vget_high_u8(row));
+        }
+
+        vst1q_u16(sums + x, lo);
+        vst1q_u16(sums + x + 8, hi);
+    }
+
+    const uint8_t *tail[BOX_MAX_FACTOR];
+    for (int r = 0; r < nb_rows; r++) {
+        tail[r] = rows[r] + x;
+    }
+
+    sum_rows_c(tail, nb_rows, width - x, sums + x);
+}
+
+static void add_pairs_neon(const uint16_t *sums, int width, uint16_t *pairs) {
+
+    int x = 0;
+
+    // vpaddq adds neighbouring lanes of a and then of b, which keeps them in order
+    for (; x + 8 <= width; x += 8) {
+        vst1q_u16(pairs + x, vpaddq_u16(vld1q_u16(sums + 2 * x), vld1q_u16(sums + 2 * x + 8)));
+    }
+
+    add_pairs_c(sums + 2 * x, width - x, pairs + x);
+}
+
+static void normalize_neon(const uint16_t *sums, int width, int factor, uint8_t *dst) {
+
+    const uint32x4_t reciprocal = vdupq_n_u32(box_reciprocal(factor));
+    const uint16x8_t half = vdupq_n_u16(factor * factor / 2);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        uint16x8_t sum = vaddq_u16(vld1q_u16(sums + x), half);
+
+        uint32x4_t lo = vmulq_u32(vmovl_u16(vget_low_u16(sum)), reciprocal);
+        uint32x4_t hi = vmulq_u32(vmovl_u16(vget_high_u16(sum)), reciprocal);
+
+        uint16x8_t words = vcombine_u16(vmovn_u32(vshrq_n_u32(lo, BOX_SHIFT)), vmovn_u32(vshrq_n_u32(hi, BOX_SHIFT)));
+
+        vst1_u8(dst + x, vmovn_u16(words));
+    }
+
+    normalize_c(sums + x, width - x, factor, dst + x);
+}
+
+#endif
+
+/*
+this function picks the kernels for the running cpu, av_force_cpu_flags(0)
+selects the scalar ones
+*/
+static BoxKernels box_kernels(void) {
+
+    BoxKernels kernels = { sum_rows_c, add_pairs_c, normalize_c };
+
+    int flags = av_get_cpu_flags();
+    (void)flags;
+
+    #ifdef BOX_HAVE_AVX2
+        if (flags & AV_CPU_FLAG_AVX2) {
+            kernels = (BoxKernels){ sum_rows_avx2, add_pairs_avx2, normalize_avx2 };
+        }
+    #endif
+
+    #ifdef BOX_HAVE_NEON
+        if (flags & AV_CPU_FLAG_NEON) {
+            kernels = (BoxKernels){ sum_rows_neon, add_pairs_neon, normalize_neon };
+        }
+    #endif
+
+    return kernels;
+}
+
+/*
+this function returns the factor when dst_width x dst_height is src
+divided by an integer the box kernel handles, 0 otherwise
+the output is full range yuvj420p, so is the source it takes
+*/
+int box_factor(const AVFrame *src, int dst_width, int dst_height) {
+
+    int full_range = src->format == AV_PIX_FMT_YUVJ420P || (src->format == AV_PIX_FMT_YUV420P && src->color_range == AVCOL_RANGE_JPEG);
+
+    if (!full_range || dst_width <= 0 || dst_height <= 0) {
+        return 0;
+    }
+
+    int factor = src->width / dst_width;
+
+    if (factor < 2 || factor > BOX_MAX_FACTOR || src->width / factor != dst_width || src->height / factor != dst_height) {
+        return 0;
+    }
+
+    return factor;
+}
+
+// number of uint16_t box_downscale() needs as scratch for a src_width wide picture
+int box_scratch_size(int src_width) {
+    return 2 * (src_width + BOX_MAX_FACTOR + BOX_PADDING);
+}
+
+static void box_plane(const BoxKernels *kernels, const uint8_t *src, int src_linesize, int src_width, int src_height,
+                      uint8_t *dst, int dst_linesize, int dst_width, int dst_height, int factor, uint16_t *scratch) {
+
+    uint16_t *sums = scratch;
+    uint16_t *reduced = scratch + src_width + BOX_MAX_FACTOR + BOX_PADDING;
+
+    // the chroma of an odd sized output can reach one column past the source
+    int covered = dst_width * factor;
+
+    for (int y = 0; y < dst_height; y++) {
+
+        const uint8_t *rows[BOX_MAX_FACTOR];
+        for (int r = 0; r < factor; r++) {
+            rows[r] = src + (intptr_t)FFMIN(y * factor + r, src_height - 1) * src_linesize;
+        }
+
+        kernels->sum_rows(rows, factor, FFMIN(covered, src_width), sums);
+
+        for (int x = src_width; x < covered; x++) {
+            sums[x] = sums[src_width - 1];
+        }
+
+        const uint16_t *row_sums = sums;
+
+        if (factor == 2 || factor == 4 || factor == 8) {
+            for (int width = covered / 2; width >= dst_width; width /= 2) {
+                kernels->add_pairs(row_sums, width, reduced);
+                row_sums = reduced;
+            }
+        } else {
+            for (int x = 0; x < dst_width; x++) {
+
+                uint16_t sum = 0;
+                for (int i = 0; i < factor; i++) {
+                    sum += sums[x * factor + i];
+                }
+
+                reduced[x] = sum;
+            }
+
+            row_sums = reduced;
+        }
+
+        kernels->normalize(row_sums, dst_width, factor, dst + (intptr_t)y * dst_linesize);
+    }
+}
+
+/*
+this function box downscales src into dst by factor, both yuvj420p with
+dst already allocated at src / factor. scratch holds box_scratch_size()
+uint16_t
+*/
+void box_downscale(const AVFrame *src, AVFrame *dst, int factor, uint16_t *scratch) {
+
+    BoxKernels kernels = box_kernels();
+
+    for (int plane = 0; plane < 3; plane++) {
+
+        int shift = plane == 0 ? 0 : 1;
+
+        box_plane(&kernels,
+            src->data[plane], src->linesize[plane], AV_CEIL_RSHIFT(src->width, shift), AV_CEIL_RSHIFT(src->height, shift),
+            dst->data[plane], dst->linesize[plane], AV_CEIL_RSHIFT(dst->width, shift), AV_CEIL_RSHIFT(dst->height, shift),
+            factor, scratch);
+    }
+}
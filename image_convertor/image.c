@@ -0,0 +1,754 @@
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "downscale.c"
+
+//#define AV_ERROR_EXIT(ret) if (ret < 0) { fprintf(stderr, "Error: %s\n", av_err2str(ret)); exit(1); }
+
+// scalers and encoders an ImageSession keeps open, the oldest one is replaced
+#define IMAGE_SESSION_SCALERS  8
+#define IMAGE_SESSION_ENCODERS 8
+
+// One output of process_image_targets()
+typedef struct {
+    const char *output_file;
+    int width;
+    int height;
+    int quality;
+    int d;  // with mode, derives the output size from the input size
+    char mode; // '<' divides the input size by d, '>' multiplies it, 0 keeps width x height
+} ImageTarget;
+
+// shared by the encoder threads, the decoded frame is only read
+typedef struct {
+    const AVFrame *frame;
+    int src_width;  // size of the input, the frame is smaller when it was decoded at lowres
+    int src_height;
+    const ImageTarget *targets;
+    int nb_targets;
+    int next_target;
+    int failed;
+} ImageJob;
+
+typedef struct {
+    int src_width;
+    int src_height;
+    int src_format;
+    int src_range;
+    int dst_width;
+    int dst_height;
+    int dst_format;
+
+    int box_factor;            // the box kernel of downscale.c scales instead of sws_ctx when set
+    uint16_t *box_scratch;
+    struct SwsContext *sws_ctx;
+    AVFrame *frame; // scaled picture, reused by every conversion with this key
+} ImageScaler;
+
+typedef struct {
+    int width;
+    int height;
+    int quality;
+
+    AVCodecContext *encoder_ctx;
+} ImageEncoder;
+
+/*
+Converter state kept across calls, so repeated conversions of same sized
+images only pay for the demux, the decode and the encode itself.
+A session is used by one thread at a time.
+*/
+typedef struct {
+    AVCodecContext *decoder_ctx; // reopened when the input codec changes
+    AVFrame *frame;              // decoded picture
+    AVPacket *packet;            // demuxed and encoded packets
+
+    ImageScaler scalers[IMAGE_SESSION_SCALERS];
+    int nb_scalers;
+    int next_scaler;
+
+    ImageEncoder encoders[IMAGE_SESSION_ENCODERS];
+    int nb_encoders;
+    int next_encoder;
+} ImageSession;
+
+// this function resolves the '<' and '>' modes of target against the input size
+static void target_size(const ImageTarget *target, int src_width, int src_height, int *width, int *height) {
+
+    *width = target->width;
+    *height = target->height;
+
+    if (target->mode == '<') {
+        *width = src_width / target->d;
+        *height = src_height / target->d;
+    } else if (target->mode == '>') {
+        *width = src_width * target->d;
+        *height = src_height * target->d;
+    }
+}
+
+/*
+this function tells whether every target is either the exact size of a
+decode at lowres or an integer shrink of it the box kernel takes, like
+box_factor() checks it on the decoded frame
+*/
+static int lowres_fits_box(int src_width, int src_height, int lowres, const ImageTarget *targets, int nb_targets) {
+
+    // the decoder rounds the lowres size up
+    int decoded_width = AV_CEIL_RSHIFT(src_width, lowres);
+    int decoded_height = AV_CEIL_RSHIFT(src_height, lowres);
+
+    for (int i = 0; i < nb_targets; i++) {
+
+        int width, height;
+        target_size(&targets[i], src_width, src_height, &width, &height);
+
+        if (width == decoded_width && height == decoded_height) {
+            continue;
+        }
+
+        int factor = width > 0 ? decoded_width / width : 0;
+
+        if (factor < 2 || factor > BOX_MAX_FACTOR || decoded_width / factor != width || decoded_height / factor != height) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+this function returns the largest lowres (decode at 1/2, 1/4 or 1/8 of
+the size) the decoder supports that still leaves every target at or
+below the decoded size, the scaler does the rest of the shrink
+a full range 4:2:0 source (box_source) gives up lowres steps while the
+shrink left over would be a fraction for swscale, down to the lowres that
+leaves an integer factor for the box kernel of downscale.c or lands on
+the target exactly. a 1/4 shrink of a 1001 pixel wide jpeg is decoded at
+1/2 and box halved, not decoded at 1/4 (251) and bicubic scaled to 250
+*/
+static int target_lowres(const AVCodec *decoder, int src_width, int src_height, int box_source, const ImageTarget *targets, int nb_targets) {
+
+    if (nb_targets == 0 || src_width <= 0 || src_height <= 0) {
+        return 0;
+    }
+
+    int lowres = FFMIN(decoder->max_lowres, 3);
+
+    for (int i = 0; i < nb_targets && lowres > 0; i++) {
+
+        int width, height;
+        target_size(&targets[i], src_width, src_height, &width, &height);
+
+        while (lowres > 0 && (width > src_width >> lowres || height > src_height >> lowres)) {
+            lowres--;
+        }
+    }
+
+    if (box_source) {
+        for (int box_lowres = lowres; box_lowres >= 0; box_lowres--) {
+            if (lowres_fits_box(src_width, src_height, box_lowres, targets, nb_targets)) {
+                return box_lowres;
+            }
+        }
+    }
+
+    // no lowres leaves whole factors, the scaler takes the smallest decode
+    return lowres;
+}
+
+/*
+this function opens input_file and decodes its first picture into frame
+decoders that can (mjpeg) decode at the smallest size all targets fit
+in, src_width x src_height is set to the full size of the input
+*decoder_ctx is opened on first use and kept for the next input of the
+same codec and lowres, the caller frees it
+*/
+static int decode_image(const char *input_file, AVCodecContext **decoder_ctx, AVFrame *frame, AVPacket *pkt,
+                        const ImageTarget *targets, int nb_targets, int *src_width, int *src_height) {
+
+    AVFormatContext *input_ctx = NULL;
+    int result = -1;
+
+    printf("Opening input file: %s\n", input_file);
+    {
+        int ret = avformat_open_input(&input_ctx, input_file, NULL, NULL);
+        {
+            if (ret < 0) {
+                fprintf(stderr, "Could not open input file\n");
+                return -1;
+            }
+        }
+
+        ret = avformat_find_stream_info(input_ctx, NULL);
+        {
+            if (ret < 0) {
+                fprintf(stderr, "Could not find stream info\n");
+                goto cleanup;
+            }
+        }
+    }
+
+    int video_stream_index = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    {
+        if (video_stream_index < 0) {
+            fprintf(stderr, "Could not find video stream\n");
+            goto cleanup;
+        }
+    }
+
+    AVStream *video_stream = input_ctx->streams[video_stream_index];
+
+    const AVCodec *decoder = avcodec_find_decoder(video_stream->codecpar->codec_id);
+    {
+        if (!decoder) {
+            fprintf(stderr, "Could not find video decoder\n");
+            goto cleanup;
+        }
+    }
+
+    AVCodecParameters *codecpar = video_stream->codecpar;
+
+    // what box_factor() takes: full range 4:2:0, most jpegs
+    int box_source = codecpar->format == AV_PIX_FMT_YUVJ420P || (codecpar->format == AV_PIX_FMT_YUV420P && codecpar->color_range == AVCOL_RANGE_JPEG);
+
+    int lowres = target_lowres(decoder, codecpar->width, codecpar->height, box_source, targets, nb_targets);
+
+    // image decoders read the geometry from every picture, so an open one is reused as is
+    if (*decoder_ctx && (*decoder_ctx)->codec_id == video_stream->codecpar->codec_id && (*decoder_ctx)->lowres == lowres) {
+        avcodec_flush_buffers(*decoder_ctx);
+    } else {
+
+        avcodec_free_context(decoder_ctx);
+
+        *decoder_ctx = avcodec_alloc_context3(decoder);
+        {
+            if (*decoder_ctx == NULL) {
+                fprintf(stderr, "Could not allocate decoder context\n");
+                goto cleanup;
+            }
+
+            int ret = avcodec_parameters_to_context(*decoder_ctx, video_stream->codecpar);
+            {
+                if (ret < 0) {
+                    fprintf(stderr, "Could not copy codec parameters to decoder context\n");
+                    avcodec_free_context(decoder_ctx);
+                    goto cleanup;
+                }
+            }
+
+            (*decoder_ctx)->lowres = lowres;
+
+            ret = avcodec_open2(*decoder_ctx, decoder, NULL);
+            {
+                if (ret != 0) {
+                    fprintf(stderr, "Could not open codec\n");
+                    avcodec_free_context(decoder_ctx);
+                    goto cleanup;
+                }
+            }
+        }
+    }
+
+    // an image is a single picture, stop at the first decoded frame
+    while (result < 0 && av_read_frame(input_ctx, pkt) >= 0) {
+
+        if (pkt->stream_index != video_stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        int ret = avcodec_send_packet(*decoder_ctx, pkt);
+        av_packet_unref(pkt);
+
+        if (ret != 0) {
+            fprintf(stderr, "Error sending packet to decoder\n");
+            goto cleanup;
+        }
+
+        if (avcodec_receive_frame(*decoder_ctx, frame) >= 0) {
+            result = 0;
+        }
+    }
+
+    // decoders with delay only hand the picture out when flushed
+    if (result < 0 && avcodec_send_packet(*decoder_ctx, NULL) >= 0 && avcodec_receive_frame(*decoder_ctx, frame) >= 0) {
+        result = 0;
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "Could not decode input file\n");
+    } else if (lowres > 0) {
+        *src_width = video_stream->codecpar->width;
+        *src_height = video_stream->codecpar->height;
+        printf("Decoded frame: %d x %d at 1/%d of %d x %d\n", frame->width, frame->height, 1 << lowres, *src_width, *src_height);
+    } else {
+        *src_width = frame->width;
+        *src_height = frame->height;
+        printf("Decoded frame: %d x %d\n", frame->width, frame->height);
+    }
+
+cleanup:
+
+    avformat_close_input(&input_ctx);
+
+    return result;
+}
+
+static AVCodecContext* open_jpeg_encoder(int width, int height, int quality) {
+
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    {
+        if (!encoder) {
+            fprintf(stderr, "Could not find MJPEG encoder\n");
+            return NULL;
+        }
+    }
+
+    AVCodecContext *encoder_ctx = avcodec_alloc_context3(encoder);
+    {
+        if (encoder_ctx == NULL) {
+            fprintf(stderr, "Could not allocate encoder context\n");
+            return NULL;
+        }
+
+        encoder_ctx->width = width;
+        encoder_ctx->height = height;
+        // encoder_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P; // Changed to YUVJ420P for MJPEG compatibility
+        encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+        encoder_ctx->global_quality = quality;
+        encoder_ctx->time_base = (AVRational){1, 1};
+        encoder_ctx->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL; // Allow non-full-range YUV
+        encoder_ctx->thread_count = 1; // the targets already run in parallel
+
+        int ret = avcodec_open2(encoder_ctx, encoder, NULL);
+        {
+            if (ret < 0) {
+                fprintf(stderr, "Could not open encoder\n");
+                avcodec_free_context(&encoder_ctx);
+                return NULL;
+            }
+        }
+    }
+
+    return encoder_ctx;
+}
+
+static AVFrame* alloc_scaled_frame(int width, int height) {
+
+    AVFrame *out_frame = av_frame_alloc();
+    {
+        if (out_frame == NULL) {
+            fprintf(stderr, "Could not allocate output frame\n");
+            return NULL;
+        }
+
+        out_frame->width = width;
+        out_frame->height = height;
+        out_frame->format = AV_PIX_FMT_YUVJ420P; // Changed to YUVJ420P for MJPEG compatibility
+        out_frame->color_range = AVCOL_RANGE_JPEG;
+
+        int ret = av_frame_get_buffer(out_frame, 0);
+        {
+            if (ret < 0) {
+                fprintf(stderr, "Could not allocate output frame buffer\n");
+                av_frame_free(&out_frame);
+                return NULL;
+            }
+        }
+    }
+
+    return out_frame;
+}
+
+/*
+this function encodes the scaled picture and writes it to output_file
+the encoder is never drained, mjpeg has no delay, so it stays usable for
+the next picture
+*/
+static int write_jpeg(AVCodecContext *encoder_ctx, AVPacket *encoded_pkt, const AVFrame *out_frame, const char *output_file) {
+
+    int result = -1;
+
+    int ret = avcodec_send_frame(encoder_ctx, out_frame);
+    {
+        if (ret < 0) {
+            fprintf(stderr, "Error sending frame to encoder\n");
+            return -1;
+        }
+    }
+
+    while (avcodec_receive_packet(encoder_ctx, encoded_pkt) >= 0) {
+
+        FILE *output_file_ptr = fopen(output_file, "wb");
+        {
+            if (!output_file_ptr) {
+                fprintf(stderr, "Could not open output file '%s'\n", output_file);
+                av_packet_unref(encoded_pkt);
+                return -1;
+            }
+        }
+
+        fwrite(encoded_pkt->data, 1, encoded_pkt->size, output_file_ptr);
+        fclose(output_file_ptr);
+        av_packet_unref(encoded_pkt);
+
+        result = 0;
+    }
+
+    return result;
+}
+
+/*
+this function sets up the scaling from frame to width x height: exact
+integer shrinks of full range 4:2:0 pictures get the box kernel and its
+scratch, everything else a bicubic SwsContext
+*/
+static int open_scaler(ImageScaler *scaler, const AVFrame *frame, int width, int height) {
+
+    scaler->box_factor = box_factor(frame, width, height);
+
+    if (scaler->box_factor) {
+        scaler->box_scratch = av_malloc_array(box_scratch_size(frame->width), sizeof(uint16_t));
+        return scaler->box_scratch ? 0 : -1;
+    }
+
+    scaler->sws_ctx = sws_getContext(frame->width, frame->height, frame->format, width, height, AV_PIX_FMT_YUVJ420P, SWS_BICUBIC, NULL, NULL, NULL);
+
+    return scaler->sws_ctx ? 0 : -1;
+}
+
+static void close_scaler(ImageScaler *scaler) {
+
+    sws_freeContext(scaler->sws_ctx);
+    av_freep(&scaler->box_scratch);
+    av_frame_free(&scaler->frame);
+
+    scaler->sws_ctx = NULL;
+}
+
+static void scale_picture(const ImageScaler *scaler, const AVFrame *frame, AVFrame *out_frame) {
+
+    if (scaler->box_factor) {
+        box_downscale(frame, out_frame, scaler->box_factor, scaler->box_scratch);
+    } else {
+        sws_scale(scaler->sws_ctx, (const uint8_t* const*)frame->data, frame->linesize, 0, frame->height, out_frame->data, out_frame->linesize);
+    }
+}
+
+/*
+this function scales frame to the size of target and writes it as jpeg
+every call has its own scaler and encoder, so targets can run in parallel
+*/
+static int encode_target(const AVFrame *frame, int src_width, int src_height, const ImageTarget *target) {
+
+    ImageScaler scaler = {0};
+    AVFrame *out_frame = NULL;
+    AVPacket *encoded_pkt = NULL;
+    int result = -1;
+
+    int width, height;
+    target_size(target, src_width, src_height, &width, &height);
+
+    AVCodecContext *encoder_ctx = open_jpeg_encoder(width, height, target->quality);
+    {
+        if (encoder_ctx == NULL) {
+            return -1;
+        }
+    }
+
+    if (open_scaler(&scaler, frame, width, height) < 0) {
+        fprintf(stderr, "Could not create scaling context\n");
+        goto cleanup;
+    }
+
+    out_frame = alloc_scaled_frame(width, height);
+    encoded_pkt = av_packet_alloc();
+    {
+        if (out_frame == NULL || encoded_pkt == NULL) {
+            goto cleanup;
+        }
+    }
+
+    scale_picture(&scaler, frame, out_frame);
+
+    result = write_jpeg(encoder_ctx, encoded_pkt, out_frame, target->output_file);
+
+cleanup:
+
+    av_packet_free(&encoded_pkt);
+    av_frame_free(&out_frame);
+    close_scaler(&scaler);
+    avcodec_free_context(&encoder_ctx);
+
+    return result;
+}
+
+static void* target_thread(void *arg) {
+
+    ImageJob *job = (ImageJob*)arg;
+
+    int index;
+    while ((index = __atomic_fetch_add(&job->next_target, 1, __ATOMIC_RELAXED)) < job->nb_targets) {
+
+        if (encode_target(job->frame, job->src_width, job->src_height, &job->targets[index]) < 0) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+this function decodes input_file once and writes every target from the
+same decoded frame. the targets are scaled and encoded on up to one
+thread per core, so a thumbnail set costs one decode plus the slowest
+encode. jpegs are decoded at lowres when the largest target allows it.
+returns -1 when the decode or any target failed
+*/
+int process_image_targets(const char *input_file, const ImageTarget *targets, int nb_targets) {
+
+    AVCodecContext *decoder_ctx = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    {
+        if (frame == NULL || pkt == NULL) {
+            fprintf(stderr, "Could not allocate frame\n");
+            av_frame_free(&frame);
+            av_packet_free(&pkt);
+            return -1;
+        }
+    }
+
+    int src_width, src_height;
+    int result = decode_image(input_file, &decoder_ctx, frame, pkt, targets, nb_targets, &src_width, &src_height);
+
+    avcodec_free_context(&decoder_ctx);
+    av_packet_free(&pkt);
+
+    if (result < 0) {
+        av_frame_free(&frame);
+        return -1;
+    }
+
+    ImageJob job = { frame, src_width, src_height, targets, nb_targets, 0, 0 };
+
+    int nb_threads = FFMAX(1, FFMIN(nb_targets, av_cpu_count()));
+    pthread_t threads[nb_threads];
+    int started = 0;
+
+    // the calling thread is one of the workers
+    for (; started < nb_threads - 1; started++) {
+        if (pthread_create(&threads[started], NULL, target_thread, &job) != 0) {
+            break;
+        }
+    }
+
+    target_thread(&job);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    av_frame_free(&frame);
+
+    return job.failed ? -1 : 0;
+}
+
+ImageSession* image_session_alloc(void) {
+
+    ImageSession *session = av_mallocz(sizeof(*session));
+    {
+        if (session == NULL) {
+            return NULL;
+        }
+    }
+
+    session->frame = av_frame_alloc();
+    session->packet = av_packet_alloc();
+    {
+        if (session->frame == NULL || session->packet == NULL) {
+            av_frame_free(&session->frame);
+            av_packet_free(&session->packet);
+            av_free(session);
+            return NULL;
+        }
+    }
+
+    return session;
+}
+
+void image_session_free(ImageSession **session) {
+
+    ImageSession *s = *session;
+    if (s == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < s->nb_scalers; i++) {
+        close_scaler(&s->scalers[i]);
+    }
+
+    for (int i = 0; i < s->nb_encoders; i++) {
+        avcodec_free_context(&s->encoders[i].encoder_ctx);
+    }
+
+    avcodec_free_context(&s->decoder_ctx);
+    av_frame_free(&s->frame);
+    av_packet_free(&s->packet);
+
+    av_freep(session);
+}
+
+/*
+this function returns the cached scaler from frame to width x height,
+creating it and its output frame on a miss
+*/
+static ImageScaler* session_scaler(ImageSession *session, const AVFrame *frame, int width, int height) {
+
+    for (int i = 0; i < session->nb_scalers; i++) {
+
+        ImageScaler *scaler = &session->scalers[i];
+
+        if (scaler->src_width == frame->width && scaler->src_height == frame->height &&
+            scaler->src_format == frame->format && scaler->src_range == frame->color_range &&
+            scaler->dst_width == width && scaler->dst_height == height && scaler->dst_format == AV_PIX_FMT_YUVJ420P) {
+            return scaler;
+        }
+    }
+
+    ImageScaler *scaler;
+    {
+        if (session->nb_scalers < IMAGE_SESSION_SCALERS) {
+            scaler = &session->scalers[session->nb_scalers++];
+        } else {
+            scaler = &session->scalers[session->next_scaler];
+            session->next_scaler = (session->next_scaler + 1) % IMAGE_SESSION_SCALERS;
+
+            close_scaler(scaler);
+        }
+
+        memset(scaler, 0, sizeof(*scaler));
+    }
+
+    int result = open_scaler(scaler, frame, width, height);
+    scaler->frame = alloc_scaled_frame(width, height);
+    {
+        if (result < 0 || scaler->frame == NULL) {
+            fprintf(stderr, "Could not create scaling context\n");
+            close_scaler(scaler);
+
+            // the slot stays empty, its key never matches
+            scaler->src_format = AV_PIX_FMT_NONE;
+            return NULL;
+        }
+    }
+
+    scaler->src_width = frame->width;
+    scaler->src_height = frame->height;
+    scaler->src_format = frame->format;
+    scaler->src_range = frame->color_range;
+    scaler->dst_width = width;
+    scaler->dst_height = height;
+    scaler->dst_format = AV_PIX_FMT_YUVJ420P;
+
+    return scaler;
+}
+
+static AVCodecContext* session_encoder(ImageSession *session, int width, int height, int quality) {
+
+    for (int i = 0; i < session->nb_encoders; i++) {
+
+        ImageEncoder *encoder = &session->encoders[i];
+
+        if (encoder->encoder_ctx && encoder->width == width && encoder->height == height && encoder->quality == quality) {
+            return encoder->encoder_ctx;
+        }
+    }
+
+    ImageEncoder *encoder;
+    {
+        if (session->nb_encoders < IMAGE_SESSION_ENCODERS) {
+            encoder = &session->encoders[session->nb_encoders++];
+        } else {
+            encoder = &session->encoders[session->next_encoder];
+            session->next_encoder = (session->next_encoder + 1) % IMAGE_SESSION_ENCODERS;
+
+            avcodec_free_context(&encoder->encoder_ctx);
+        }
+    }
+
+    encoder->width = width;
+    encoder->height = height;
+    encoder->quality = quality;
+    encoder->encoder_ctx = open_jpeg_encoder(width, height, quality);
+
+    return encoder->encoder_ctx;
+}
+
+/*
+this function is process_image_targets() on a session: the decoder, the
+scalers with their output frames and the encoders are looked up by
+geometry and kept for the next call, so a steady stream of same sized
+images allocates nothing here. the targets run one after another on the
+calling thread
+*/
+int image_session_process(ImageSession *session, const char *input_file, const ImageTarget *targets, int nb_targets) {
+
+    int src_width, src_height;
+    if (decode_image(input_file, &session->decoder_ctx, session->frame, session->packet, targets, nb_targets, &src_width, &src_height) < 0) {
+        return -1;
+    }
+
+    const AVFrame *frame = session->frame;
+    int result = 0;
+
+    for (int i = 0; i < nb_targets; i++) {
+
+        int width, height;
+        target_size(&targets[i], src_width, src_height, &width, &height);
+
+        ImageScaler *scaler = session_scaler(session, frame, width, height);
+        AVCodecContext *encoder_ctx = session_encoder(session, width, height, targets[i].quality);
+        {
+            if (scaler == NULL || encoder_ctx == NULL) {
+                result = -1;
+                continue;
+            }
+        }
+
+        // a no-op unless the encoder still holds a reference to the last picture
+        if (av_frame_make_writable(scaler->frame) < 0) {
+            result = -1;
+            continue;
+        }
+
+        scale_picture(scaler, frame, scaler->frame);
+
+        if (write_jpeg(encoder_ctx, session->packet, scaler->frame, targets[i].output_file) < 0) {
+            result = -1;
+        }
+    }
+
+    av_frame_unref(session->frame);
+
+    return result;
+}
+
+/*
+this function decodes input_file, scales it and writes output_file as jpeg
+it lives outside main.c so bench/suite.c can build it without main()
+i == '<' divides the input size by d, i == '>' multiplies it
+*/
+void process_image(const char *input_file, const char *output_file, int width, int height, int quality, int d, char i) {
+
+    ImageTarget target = { output_file, width, height, quality, d, i };
+
+    process_image_targets(input_file, &target, 1);
+}
@@ -1,6 +1,9 @@
 #include <unistd.h>
 #include <stdio.h>
 
+// read_file_from_pipe() drains the pipe with splice(), shared with the api
+#include "../../api/stream/read_pipe.c"
+
 void read_from_pipe(int fd) {
     char buffer[1024];
     ssize_t bytes_read;
@@ -14,32 +17,3 @@ void read_from_pipe(int fd) {
         perror("Error reading from pipe");
     }
 }
-
-int read_file_from_pipe(int fd) {
-
-
-    printf("C received: %d", fd);
-    
-    FILE *output = fopen("output.mp4", "w");
-    if (!output) {
-        perror("Failed to open output file");
-        return 1;
-    }
-
-    char buffer[1024];
-    ssize_t bytes_read;
-
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        fwrite(buffer, 1, bytes_read, output); // Write data to file
-        //printf("C received: %s", buffer);
-    }
-
-    if (bytes_read < 0) {
-        perror("Error reading from pipe");
-        return 1;
-    }
-
-    fclose(output);
-
-    return 0;
-}
\ No newline at end of file
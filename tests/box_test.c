@@ -0,0 +1,168 @@
+/*
+box_test checks that the AVX2/NEON kernels of image_convertor/downscale.c
+give the same bytes as the scalar one, for every factor from 2 to
+BOX_MAX_FACTOR on odd and even sizes, with random, black and white
+pictures (white is the largest column sum). exits 1 on the first mismatch
+
+build from the repository root:
+    gcc -O2 tests/box_test.c -o box_test $(pkg-config --cflags --libs libavutil)
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "../image_convertor/downscale.c"
+
+#include "libavutil/mem.h"
+
+typedef enum {
+    FILL_RANDOM = 0,
+    FILL_BLACK  = 1,
+    FILL_WHITE  = 2,
+} Fill;
+
+static const int sizes[][2] = {
+    { 16, 16 }, { 97, 61 }, { 333, 171 }, { 1023, 769 }, { 1920, 1080 },
+};
+
+static AVFrame* alloc_picture(int width, int height) {
+
+    AVFrame *frame = av_frame_alloc();
+    {
+        if (frame == NULL) {
+            return NULL;
+        }
+
+        frame->width = width;
+        frame->height = height;
+        frame->format = AV_PIX_FMT_YUVJ420P;
+        frame->color_range = AVCOL_RANGE_JPEG;
+
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            return NULL;
+        }
+    }
+
+    return frame;
+}
+
+// fixed seed, every run tests the same pictures
+static void fill_picture(AVFrame *frame, Fill fill, uint32_t *seed) {
+
+    for (int plane = 0; plane < 3; plane++) {
+
+        int shift = plane == 0 ? 0 : 1;
+
+        for (int y = 0; y < AV_CEIL_RSHIFT(frame->height, shift); y++) {
+
+            uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+
+            for (int x = 0; x < AV_CEIL_RSHIFT(frame->width, shift); x++) {
+
+                *seed ^= *seed << 13;
+                *seed ^= *seed >> 17;
+                *seed ^= *seed << 5;
+
+                row[x] = fill == FILL_BLACK ? 0 : fill == FILL_WHITE ? 255 : (uint8_t)*seed;
+            }
+        }
+    }
+}
+
+// the first differing byte as plane/x/y, 0 when the pictures are the same
+static int compare_pictures(const AVFrame *a, const AVFrame *b) {
+
+    for (int plane = 0; plane < 3; plane++) {
+
+        int shift = plane == 0 ? 0 : 1;
+
+        for (int y = 0; y < AV_CEIL_RSHIFT(a->height, shift); y++) {
+            for (int x = 0; x < AV_CEIL_RSHIFT(a->width, shift); x++) {
+
+                int pa = a->data[plane][y * a->linesize[plane] + x];
+                int pb = b->data[plane][y * b->linesize[plane] + x];
+
+                if (pa != pb) {
+                    fprintf(stderr, "plane %d at %d,%d: scalar %d, simd %d\n", plane, x, y, pa, pb);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(void) {
+
+    int flags = av_get_cpu_flags();
+    {
+        if (!(flags & (AV_CPU_FLAG_AVX2 | AV_CPU_FLAG_NEON))) {
+            printf("box_test: no avx2 or neon on this cpu, only the scalar kernel runs\n");
+        }
+    }
+
+    uint32_t seed = 0x2545f491;
+    int failed = 0;
+    int cases = 0;
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+
+        AVFrame *src = alloc_picture(width, height);
+        uint16_t *scratch = av_malloc_array(box_scratch_size(width), sizeof(uint16_t));
+        {
+            if (src == NULL || scratch == NULL) {
+                fprintf(stderr, "Error: Could not allocate a %dx%d picture.\n", width, height);
+                return 1;
+            }
+        }
+
+        for (int factor = 2; factor <= BOX_MAX_FACTOR; factor++) {
+
+            // box_factor() leaves sizes that do not divide back to swscale
+            if (box_factor(src, width / factor, height / factor) != factor) {
+                continue;
+            }
+
+            for (Fill fill = FILL_RANDOM; fill <= FILL_WHITE; fill++) {
+
+                fill_picture(src, fill, &seed);
+
+                AVFrame *scalar = alloc_picture(width / factor, height / factor);
+                AVFrame *simd = alloc_picture(width / factor, height / factor);
+                {
+                    if (scalar == NULL || simd == NULL) {
+                        fprintf(stderr, "Error: Could not allocate the outputs.\n");
+                        return 1;
+                    }
+                }
+
+                av_force_cpu_flags(0);
+                box_downscale(src, scalar, factor, scratch);
+
+                av_force_cpu_flags(-1);
+                box_downscale(src, simd, factor, scratch);
+
+                if (compare_pictures(scalar, simd) != 0) {
+                    fprintf(stderr, "FAIL %dx%d factor %d fill %d: simd differs from scalar\n", width, height, factor, fill);
+                    failed = 1;
+                }
+
+                cases++;
+
+                av_frame_free(&scalar);
+                av_frame_free(&simd);
+            }
+        }
+
+        av_free(scratch);
+        av_frame_free(&src);
+    }
+
+    printf("box_test: %d cases, %s\n", cases, failed ? "FAILED" : "ok");
+
+    return failed;
+}
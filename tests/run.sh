@@ -0,0 +1,25 @@
+#!/bin/bash
+# Builds and runs the tests in tests/, exits non-zero when one of them fails.
+# Unlike bench/run.sh it times nothing and needs no generated media, so it
+# is quick enough to run on every change.
+#
+#   tests/run.sh
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+OUT=${OUT:-tests_out}
+
+mkdir -p "$OUT"
+
+# the avx2/neon box downscale kernels against the scalar one, byte for byte
+gcc -O2 tests/box_test.c -o "$OUT/box_test" $(pkg-config --cflags --libs libavutil) -lm
+
+"$OUT/box_test"
+
+# an output=memory job, fetches its playlist from the sink
+gcc -O2 tests/sink_test.c -o "$OUT/sink_test" $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+
+"$OUT/sink_test" "$OUT"
+
+echo "tests passed"
@@ -0,0 +1,322 @@
+/*
+sink_test runs an output=memory job the way api.go does and fetches its
+playlist: remux_to_hls() with an HlsSink that keeps the last file handed
+over under each name, like OutputStore.Sink(). it fails when output.m3u8
+is missing, is not a finished playlist, names a segment the sink never
+got, or when a file was handed over under a temp name (output.m3u8.tmp)
+
+the input is a short mpeg4 + mpegts clip the test encodes itself into
+work_dir, no media files needed
+
+build from the repository root:
+    gcc -O2 tests/sink_test.c -o sink_test $(pkg-config --cflags --libs libavformat libavcodec libswscale libswresample libavutil) -pthread -lm
+
+usage:
+    ./sink_test [work_dir]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../core/report.c"
+#include "../core/probe.c"
+#include "../core/mapped.c"
+#include "../api/stream/read_pipe.c"
+#include "../api/stream/ingest.c"
+#include "../api/stream/sink.c"
+#include "../api/stream/uring.c"
+#include "../api/stream/cgompeg.c"
+#include "../api/stream/plan.c"
+#include "../api/stream/thumbs.c"
+#include "../api/stream/abr.c"
+#include "../api/stream/gop.c"
+#include "../api/stream/llhls.c"
+#include "../api/stream/live.c"
+
+#define TEST_WIDTH 160
+#define TEST_HEIGHT 120
+#define TEST_FPS 25
+#define TEST_FRAMES 100 // 4 seconds, hls_time is 1 so a few segments
+
+#define MAX_FILES 64
+
+// the files of the memory job, a name handed over again replaces its data
+typedef struct {
+    char name[1024];
+    uint8_t *data;
+    int size;
+    int handovers;
+} StoredFile;
+
+static StoredFile files[MAX_FILES];
+static int nb_files;
+static int temp_names;
+
+static int store_file(uintptr_t handle, char *name, uint8_t *data, int size) {
+
+    (void)handle;
+
+    if (strstr(name, ".tmp")) {
+        fprintf(stderr, "FAIL: '%s' was handed over under its temp name\n", name);
+        temp_names++;
+    }
+
+    StoredFile *file = NULL;
+
+    for (int i = 0; i < nb_files; i++) {
+        if (strcmp(files[i].name, name) == 0) {
+            file = &files[i];
+        }
+    }
+
+    if (file == NULL) {
+
+        if (nb_files == MAX_FILES) {
+            return -1;
+        }
+
+        file = &files[nb_files++];
+        av_strlcpy(file->name, name, sizeof(file->name));
+    }
+
+    uint8_t *copy = av_realloc(file->data, FFMAX(size, 1));
+    {
+        if (copy == NULL) {
+            return -1;
+        }
+    }
+
+    memcpy(copy, data, size);
+    file->data = copy;
+    file->size = size;
+    file->handovers++;
+
+    return 0;
+}
+
+static StoredFile* fetch_file(const char *name) {
+
+    for (int i = 0; i < nb_files; i++) {
+        if (strcmp(files[i].name, name) == 0) {
+            return &files[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+this function encodes TEST_FRAMES moving gray frames with the native
+mpeg4 encoder into an mpegts file at path
+*/
+static int write_input(const char *path) {
+
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    {
+        if (encoder == NULL) {
+            fprintf(stderr, "Error: No mpeg4 encoder.\n");
+            return -1;
+        }
+    }
+
+    AVFormatContext *output_ctx = NULL;
+    AVCodecContext *encoder_ctx = avcodec_alloc_context3(encoder);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    {
+        if (encoder_ctx == NULL || frame == NULL || packet == NULL || avformat_alloc_output_context2(&output_ctx, NULL, "mpegts", path) < 0) {
+            fprintf(stderr, "Error: Could not allocate the input writer.\n");
+            return -1;
+        }
+    }
+
+    encoder_ctx->width = TEST_WIDTH;
+    encoder_ctx->height = TEST_HEIGHT;
+    encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    encoder_ctx->time_base = (AVRational){ 1, TEST_FPS };
+    encoder_ctx->framerate = (AVRational){ TEST_FPS, 1 };
+    encoder_ctx->gop_size = TEST_FPS;
+    encoder_ctx->max_b_frames = 0;
+
+    AVStream *stream = avformat_new_stream(output_ctx, NULL);
+
+    int result = stream ? avcodec_open2(encoder_ctx, encoder, NULL) : -1;
+
+    if (result >= 0) {
+        stream->time_base = encoder_ctx->time_base;
+        result = avcodec_parameters_from_context(stream->codecpar, encoder_ctx);
+    }
+
+    if (result >= 0) {
+        result = avio_open(&output_ctx->pb, path, AVIO_FLAG_WRITE);
+    }
+
+    if (result >= 0) {
+        result = avformat_write_header(output_ctx, NULL);
+    }
+
+    frame->width = TEST_WIDTH;
+    frame->height = TEST_HEIGHT;
+    frame->format = AV_PIX_FMT_YUV420P;
+
+    if (result >= 0) {
+        result = av_frame_get_buffer(frame, 0);
+    }
+
+    for (int i = 0; i <= TEST_FRAMES && result >= 0; i++) {
+
+        // NULL flushes the encoder after the last frame
+        AVFrame *input = NULL;
+
+        if (i < TEST_FRAMES) {
+
+            result = av_frame_make_writable(frame);
+
+            for (int plane = 0; plane < 3 && result >= 0; plane++) {
+
+                int shift = plane == 0 ? 0 : 1;
+
+                for (int y = 0; y < TEST_HEIGHT >> shift; y++) {
+                    memset(frame->data[plane] + y * frame->linesize[plane], plane == 0 ? (i * 2 + y) & 0xff : 128, TEST_WIDTH >> shift);
+                }
+            }
+
+            frame->pts = i;
+            input = frame;
+        }
+
+        if (result >= 0) {
+            result = avcodec_send_frame(encoder_ctx, input);
+        }
+
+        while (result >= 0) {
+
+            result = avcodec_receive_packet(encoder_ctx, packet);
+
+            if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+                result = 0;
+                break;
+            }
+
+            if (result >= 0) {
+                av_packet_rescale_ts(packet, encoder_ctx->time_base, stream->time_base);
+                packet->stream_index = stream->index;
+                result = av_interleaved_write_frame(output_ctx, packet);
+            }
+        }
+    }
+
+    if (result >= 0) {
+        result = av_write_trailer(output_ctx);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "Error: Could not write the test input '%s'.\n", path);
+    }
+
+    avio_closep(&output_ctx->pb);
+    avformat_free_context(output_ctx);
+    avcodec_free_context(&encoder_ctx);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+
+    return result < 0 ? -1 : 0;
+}
+
+// 1 when every segment line of the playlist was handed over
+static int segments_stored(const StoredFile *playlist, int *segments) {
+
+    char *text = av_strndup((const char*)playlist->data, playlist->size);
+    {
+        if (text == NULL) {
+            return 0;
+        }
+    }
+
+    int ok = 1;
+    char *saveptr = NULL;
+    *segments = 0;
+
+    for (char *line = strtok_r(text, "\r\n", &saveptr); line; line = strtok_r(NULL, "\r\n", &saveptr)) {
+
+        if (line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+
+        (*segments)++;
+
+        if (fetch_file(line) == NULL) {
+            fprintf(stderr, "FAIL: the playlist names '%s', the sink never got it\n", line);
+            ok = 0;
+        }
+    }
+
+    av_free(text);
+
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+
+    const char *work_dir = argc > 1 ? argv[1] : ".";
+
+    char input_path[1024];
+    snprintf(input_path, sizeof(input_path), "%s/sink_input.ts", work_dir);
+
+    if (write_input(input_path) < 0) {
+        return 1;
+    }
+
+    AVFormatContext *input_ctx = open_input_file(input_path);
+    {
+        if (input_ctx == NULL) {
+            return 1;
+        }
+    }
+
+    // the output dir is only a name, a memory job creates nothing on disk
+    JobReport report = { 0 };
+    HlsSink sink = { .Func = store_file };
+
+    int result = remux_to_hls(input_ctx, "memory-job", PLAYLIST_FILE, SEGMENT_TS, &sink, IO_BACKEND_POSIX, 0, &report);
+
+    avformat_close_input(&input_ctx);
+    remove(input_path);
+
+    int failed = result != 0 || temp_names > 0;
+
+    if (result != 0) {
+        fprintf(stderr, "FAIL: the memory job failed with %d\n", result);
+    }
+
+    int segments = 0;
+    StoredFile *playlist = fetch_file(PLAYLIST_FILE);
+
+    if (playlist == NULL) {
+        fprintf(stderr, "FAIL: no '%s' among the %d files of the memory job\n", PLAYLIST_FILE, nb_files);
+        failed = 1;
+    } else {
+
+        if (playlist->size < 7 || memcmp(playlist->data, "#EXTM3U", 7) != 0) {
+            fprintf(stderr, "FAIL: '%s' does not start with #EXTM3U\n", PLAYLIST_FILE);
+            failed = 1;
+        }
+
+        if (av_strnstr((const char*)playlist->data, "#EXT-X-ENDLIST", playlist->size) == NULL) {
+            fprintf(stderr, "FAIL: '%s' has no #EXT-X-ENDLIST\n", PLAYLIST_FILE);
+            failed = 1;
+        }
+
+        if (!segments_stored(playlist, &segments) || segments == 0) {
+            failed = 1;
+        }
+    }
+
+    printf("sink_test: %d files, %d segments in the playlist, %s\n", nb_files, segments, failed ? "FAILED" : "ok");
+
+    for (int i = 0; i < nb_files; i++) {
+        av_free(files[i].data);
+    }
+
+    return failed;
+}